@@ -42,16 +42,19 @@ public:
 
   char operator[](int i) const { return p_[i]; }
 
+  void remove_prefix(int n) { p_ += n; len_ -= n; }
+  void remove_suffix(int n) { len_ -= n; }
+
   std::string as_string() const 
   { return std::string(data(), size()); }
 
-  bool operator==(const StringPiece& y)
+  bool operator==(const StringPiece& y) const
   {
     if(size() != y.size()) return false;
     if(memcmp(data(), y.data(), size()) == 0) return true;
     return false;
   }
-  bool operator!=(const StringPiece& y)
+  bool operator!=(const StringPiece& y) const
   {
     return !operator==(y);
   }
@@ -4,48 +4,417 @@
 // https://opensource.org/licenses/MIT
 
 #include "AsyncLogging.h"
+#include "threads/CurrentThread.h"
 
+#include <algorithm>
 #include <memory>
 
 namespace chtho
 {
+namespace
+{
+// see AsyncLogging::dropInsteadOfWait
+__thread bool t_noWait = false;
+
+// the default sink
+class FileSink : public LogSink
+{
+private:
+  LogFile file_;
+public:
+  FileSink(const std::string& name, off_t rollsz) : file_(name, rollsz, false) {}
+  LogFile& file() { return file_; }
+  void append(const char* data, int len) override { file_.append(data, len); }
+  void flush() override { file_.flush(); }
+};
+} // namespace
+
+// the bytes of complete lines between tail_ and head_, both only ever
+// grow. the producer owns head_, the consumer tail_, the padding
+// keeps them off each other's cache line.
+// a ring that overwrites (Overflow::DropOldest) lets the producer move
+// tail_ as well, past the oldest lines, so it also remembers where
+// its lines start
+class AsyncLogging::Ring : noncopyable
+{
+private:
+  std::unique_ptr<char[]> buf_;
+  const size_t mask_;
+  const bool overwrite_;
+  char pad0_[64];
+  std::atomic<size_t> head_;
+  size_t cachedTail_; // the producer's last look at tail_
+  std::atomic<size_t> droppedLines_;
+  std::atomic<size_t> droppedBytes_;
+  // the starts of the lines not known to be consumed, a ring of
+  // startMask_ + 1 between startTail_ and startHead_. overwriting
+  // rings only
+  std::unique_ptr<size_t[]> starts_;
+  const size_t startMask_;
+  size_t startHead_;
+  size_t startTail_;
+  char pad1_[64];
+  std::atomic<size_t> tail_;
+  std::string stage_; // what an overwriting ring is drained through
+  size_t reportedLines_; // drops the consumer has written about
+  size_t reportedBytes_;
+  std::atomic<bool> closed_; // the thread has exited
+  const pid_t tid_;
+
+  static void add(std::atomic<size_t>& n, size_t v)
+  {
+    n.store(n.load(std::memory_order_relaxed) + v, std::memory_order_relaxed);
+  }
+  void copy(size_t from, size_t n, char* to) const
+  {
+    size_t off = from & mask_;
+    size_t first = std::min(n, capacity() - off);
+    memcpy(to, buf_.get() + off, first);
+    memcpy(to + first, buf_.get(), n - first);
+  }
+  void write(size_t head, const char* line, size_t len)
+  {
+    size_t off = head & mask_;
+    size_t first = std::min(len, capacity() - off);
+    memcpy(buf_.get() + off, line, first);
+    memcpy(buf_.get(), line + first, len - first);
+  }
+  bool startsFull() const { return startHead_ - startTail_ > startMask_; }
+  // forgets the starts of the lines the consumer has taken
+  void forgetConsumed()
+  {
+    while(startTail_ != startHead_ && starts_[startTail_ & startMask_] < cachedTail_)
+      ++startTail_;
+  }
+public:
+  Ring(size_t size, bool overwrite)
+    : buf_(new char[size]),
+      mask_(size - 1),
+      overwrite_(overwrite),
+      head_(0),
+      cachedTail_(0),
+      droppedLines_(0),
+      droppedBytes_(0),
+      // room for lines of 32 bytes on average
+      starts_(overwrite ? new size_t[size / 32] : NULL),
+      startMask_(size / 32 - 1),
+      startHead_(0),
+      startTail_(0),
+      tail_(0),
+      reportedLines_(0),
+      reportedBytes_(0),
+      closed_(false),
+      tid_(CurrentThread::tid())
+  {}
+  size_t capacity() const { return mask_ + 1; }
+  size_t droppedLines() const { return droppedLines_.load(std::memory_order_relaxed); }
+  size_t droppedBytes() const { return droppedBytes_.load(std::memory_order_relaxed); }
+  // consumer. the bytes waiting, at least
+  size_t pending() const
+  {
+    return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_relaxed);
+  }
+
+  // producer. false if the ring would hold more than limit bytes with
+  // the line, *half is set if the ring just got half full
+  bool push(const char* line, size_t len, size_t limit, bool* half)
+  {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if(head - cachedTail_ + len > limit)
+    {
+      cachedTail_ = tail_.load(std::memory_order_acquire);
+      if(head - cachedTail_ + len > limit) return false;
+    }
+    if(overwrite_)
+    {
+      if(startsFull()) return false; // overwrite() looks again
+      starts_[startHead_++ & startMask_] = head;
+    }
+    write(head, line, len);
+    head_.store(head + len, std::memory_order_release);
+    size_t h = capacity() / 2;
+    *half = head - cachedTail_ < h && head + len - cachedTail_ >= h;
+    return true;
+  }
+
+  // producer, overwriting rings. makes room by moving tail_ past the
+  // oldest lines, the line must fit into the ring
+  void overwrite(const char* line, size_t len, bool* half)
+  {
+    size_t head = head_.load(std::memory_order_relaxed);
+    if(head - cachedTail_ + len > capacity() || startsFull())
+    {
+      cachedTail_ = tail_.load(std::memory_order_acquire);
+      forgetConsumed();
+      while(head - cachedTail_ + len > capacity() || startsFull())
+      {
+        // the new tail is the first line start that leaves room
+        size_t need = head + len - std::min(head + len, capacity());
+        size_t i = startTail_;
+        while(i != startHead_ && starts_[i & startMask_] < need) ++i;
+        if(i == startTail_) ++i; // only a start to spare
+        size_t tail = i == startHead_ ? head : starts_[i & startMask_];
+        size_t expected = cachedTail_;
+        if(tail_.compare_exchange_strong(expected, tail, std::memory_order_acq_rel))
+        {
+          add(droppedLines_, i - startTail_);
+          add(droppedBytes_, tail - cachedTail_);
+          startTail_ = i;
+          cachedTail_ = tail;
+          break;
+        }
+        // the consumer took some lines meanwhile
+        cachedTail_ = expected;
+        forgetConsumed();
+      }
+    }
+    write(head, line, len);
+    starts_[startHead_++ & startMask_] = head;
+    head_.store(head + len, std::memory_order_release);
+    size_t h = capacity() / 2;
+    *half = head - cachedTail_ < h && head + len - cachedTail_ >= h;
+  }
+
+  void drop(size_t len)
+  {
+    add(droppedLines_, 1);
+    add(droppedBytes_, len);
+  }
+
+  void close() { closed_.store(true, std::memory_order_release); }
+  bool closed() const { return closed_.load(std::memory_order_acquire); }
+
+  // consumer. writes out what has been committed, returns how much
+  size_t drain(LogSink* out)
+  {
+    size_t head = head_.load(std::memory_order_acquire);
+    size_t tail = tail_.load(std::memory_order_acquire);
+    size_t n = head - tail;
+    if(n == 0) return 0;
+    if(overwrite_) return drainOverwritten(out, head, tail);
+    size_t off = tail & mask_;
+    size_t first = std::min(n, capacity() - off);
+    out->append(buf_.get() + off, static_cast<int>(first));
+    if(n > first) out->append(buf_.get(), static_cast<int>(n - first));
+    tail_.store(head, std::memory_order_release);
+    return n;
+  }
+
+  // the producer may overwrite the lines while they are copied. what
+  // it did overwrite it has moved tail_ past first, so the part of
+  // the copy that is still ahead of tail_ afterwards is intact
+  size_t drainOverwritten(LogSink* out, size_t head, size_t tail)
+  {
+    size_t from = tail;
+    stage_.resize(head - from);
+    copy(from, head - from, &stage_[0]);
+    while(!tail_.compare_exchange_weak(tail, head, std::memory_order_acq_rel))
+      if(tail >= head) return 0; // all of it
+    out->append(stage_.data() + (tail - from), static_cast<int>(head - tail));
+    return head - tail;
+  }
+
+  void reportDrops(LogSink* out, DropNote note)
+  {
+    size_t lines = droppedLines();
+    size_t bytes = droppedBytes();
+    if(lines == reportedLines_) return;
+    Timestamp now = Timestamp::now();
+    char buf[256];
+    int len = textDropNote(buf, sizeof buf, now, lines - reportedLines_,
+      bytes - reportedBytes_, tid_);
+    fputs(buf, stderr);
+    if(note != textDropNote)
+      len = note(buf, sizeof buf, now, lines - reportedLines_, bytes - reportedBytes_, tid_);
+    out->append(buf, len);
+    reportedLines_ = lines;
+    reportedBytes_ = bytes;
+  }
+};
+
 AsyncLogging::AsyncLogging(const std::string& name, off_t rollsz,
     int flushInter)  
   : flushInter_(flushInter),
     running_(false),
     name_(name),
     rollsz_(rollsz),
+    ringSz_(512*1024), // 512 KB
+    overflow_(Overflow::Block),
+    sync_(LogFile::Sync::None),
+    syncBytes_(0),
+    archive_(),
+    sink_(NULL),
+    dropNote_(textDropNote),
     thread_([this](){this->threadFunc();}, "Logging"),
     latch_(1),
     mutex_(),
     cond_(mutex_),
-    curBuf_(new Buf),
-    nxtBuf_(new Buf),
-    bufs_()
+    drained_(mutex_),
+    rings_(),
+    wakeup_(false),
+    waiters_(0),
+    blocked_(0),
+    retiredLines_(0),
+    retiredBytes_(0),
+    writtenBytes_(0),
+    writes_(0),
+    writeUsMax_(0),
+    writeUsTotal_(0)
 {
-  curBuf_->zero();
-  nxtBuf_->zero();
-  bufs_.reserve(16);
+  MCHECK(pthread_key_create(&key_, &AsyncLogging::releaseRing));
 }
-void AsyncLogging::append(const char* line, int len)
+
+int AsyncLogging::textDropNote(char* buf, size_t len, Timestamp when,
+  size_t lines, size_t bytes, int tid)
+{
+  int n = snprintf(buf, len, "drop log at %s, %zu lines (%zu bytes) of thread %d\n",
+    when.toString().c_str(), lines, bytes, tid);
+  return std::min(n, static_cast<int>(len) - 1);
+}
+
+AsyncLogging::~AsyncLogging()
+{
+  if(running_) stop();
+  // no destructor runs for the key once it is deleted, threads that
+  // are still alive just forget their rings
+  pthread_key_delete(key_);
+  for(Ring* r : rings_) delete r;
+}
+
+void AsyncLogging::setRingSize(size_t sz)
 {
+  size_t size = 4096;
+  while(size < sz) size <<= 1;
   MutexLockGuard lock(mutex_);
-  if(curBuf_->avail() > len)
+  ringSz_ = size;
+}
+
+void AsyncLogging::releaseRing(void* ring)
+{
+  static_cast<Ring*>(ring)->close();
+}
+
+AsyncLogging::Ring* AsyncLogging::ring()
+{
+  Ring* r = static_cast<Ring*>(pthread_getspecific(key_));
+  if(__glibc_unlikely(r == NULL))
+  {
+    MutexLockGuard lock(mutex_);
+    r = new Ring(ringSz_, overflow_ == Overflow::DropOldest);
+    rings_.push_back(r);
+    pthread_setspecific(key_, r);
+  }
+  return r;
+}
+
+void AsyncLogging::wake()
+{
+  MutexLockGuard lock(mutex_);
+  wakeup_ = true;
+  cond_.notify();
+}
+
+void AsyncLogging::append(const char* line, int len)
+{
+  append(line, len, Logger::outputLevel());
+}
+
+// a line larger than the whole ring is always dropped
+bool AsyncLogging::append(const char* line, int len, Logger::Level level)
+{
+  Ring* r = ring();
+  size_t n = static_cast<size_t>(len);
+  size_t limit = r->capacity();
+  // how full the ring may get for lines of this level
+  if(overflow_ == Overflow::DropByLevel && level < Logger::Level::ERR)
+    limit = level == Logger::Level::WARN ? limit / 8 * 7
+      : level == Logger::Level::INFO ? limit / 4 * 3 : limit / 2;
+  bool half = false;
+  if(__glibc_likely(r->push(line, n, limit, &half)))
+  {
+    if(half) wake();
+    return true;
+  }
+  if(n > limit)
+  {
+    r->drop(n);
+    return false;
+  }
+  if(overflow_ == Overflow::DropOldest)
+  {
+    r->overwrite(line, n, &half);
+    if(half) wake();
+    return true;
+  }
+  // ERR and FATAL wait under DropByLevel as well
+  if(overflow_ == Overflow::DropNewest || limit < r->capacity() || t_noWait)
   {
-    curBuf_->append(line, len);
+    r->drop(n);
+    return false;
   }
-  else  
+  return wait(r, line, len);
+}
+
+// holds the thread up until the back end has made room. a line that
+// comes while the back end isn't running is dropped
+bool AsyncLogging::wait(Ring* r, const char* line, int len)
+{
+  bool half = false;
+  bool pushed = true;
+  MutexLockGuard lock(mutex_);
+  ++waiters_;
+  ++blocked_;
+  while(!r->push(line, len, r->capacity(), &half))
   {
-    // if current buffer cannot hold so much data
-    // use next buffer, if next buffer is nullptr
-    // the create a new one 
-    bufs_.push_back(std::move(curBuf_));
-    if(nxtBuf_) curBuf_ = std::move(nxtBuf_);
-    else curBuf_.reset(new Buf); // rare case 
-    curBuf_->append(line, len);
+    if(!running_)
+    {
+      r->drop(len);
+      pushed = false;
+      break;
+    }
+    wakeup_ = true;
     cond_.notify();
+    // the timeout only covers a back end that is stopping
+    drained_.waitForSecs(0.01);
   }
+  --waiters_;
+  return pushed;
 }
+
+void AsyncLogging::dropInsteadOfWait()
+{
+  t_noWait = true;
+}
+
+AsyncLogging::Stats AsyncLogging::stats()
+{
+  Stats st;
+  MutexLockGuard lock(mutex_);
+  st.droppedLines = retiredLines_;
+  st.droppedBytes = retiredBytes_;
+  st.ringBytes = 0;
+  for(Ring* r : rings_)
+  {
+    st.droppedLines += r->droppedLines();
+    st.droppedBytes += r->droppedBytes();
+    st.ringBytes += r->capacity();
+  }
+  st.rings = rings_.size();
+  st.blocked = blocked_;
+  st.writtenBytes = writtenBytes_.load(std::memory_order_relaxed);
+  st.writes = writes_.load(std::memory_order_relaxed);
+  st.writeUsMax = writeUsMax_.load(std::memory_order_relaxed);
+  st.writeUsTotal = writeUsTotal_.load(std::memory_order_relaxed);
+  return st;
+}
+
+void AsyncLogging::stop()
+{
+  running_ = false;
+  wake();
+  thread_.join();
+}
+
 void AsyncLogging::threadFunc()
 {
   assert(running_ == true);
@@ -53,79 +422,80 @@ void AsyncLogging::threadFunc()
   // this guarantees the thread function successfully
   // starts 
   latch_.countDown(); 
-  LogFile output(name_, rollsz_, false); // false for threadsafe
-  BufPtr buf1(new Buf); // two empty buffers 
-  BufPtr buf2(new Buf);
-  buf1->zero();
-  buf2->zero();
-  BufVec bufs;
-  bufs.reserve(16);
-  while(running_)
-  {
-    assert(buf1 && buf1->length() == 0);
-    assert(buf2 && buf2->length() == 0);
-    assert(bufs.empty());
-
-    // buffers_ stores the pointers to buffers that need to be written to disk
-    // buffers is used to swap with buffers_ so the writing process can be 
-    // continued on buffers instead of buffers_. this can narrow down the size 
-    // of critical section, since the front end need to call append to write new 
-    // messages to the current buffer and the current buffer might be full so as 
-    // to be pushed back into buffers_. 
-    { // starting critical section 
+  // a sink that logs must not wait for this thread
+  t_noWait = true;
+  std::unique_ptr<FileSink> file;
+  LogSink* output = sink_;
+  if(!output)
+  {
+    file.reset(new FileSink(name_, rollsz_));
+    file->file().setSync(sync_, syncBytes_);
+    // rolling never holds up the draining
+    file->file().setBackgroundRoll(true);
+    if(archive_) file->file().setArchive(*archive_);
+    output = file.get();
+  }
+  std::vector<Ring*> rings;
+  bool busy = false;
+  bool starved = false;
+  for(;;)
+  {
+    bool running = running_;
+    { // the lock is only held to look at the rings, never while writing
       MutexLockGuard lock(mutex_);
-      // waiting conditions: 1. timeout, 2. one or more buffers are filled by front end 
-      if(bufs_.empty()) cond_.waitForSecs(flushInter_); // the default flush interval is 3s
-      bufs_.push_back(std::move(curBuf_));
-      curBuf_ = std::move(buf1);
-      // swap here is used to reduce critical section size
-      // furing writing process can be perform on bufs rather than bufs_ 
-      bufs.swap(bufs_); // bufs is actually buffers to write 
-      // this happens when the current buffer's space is insufficient and is pushed
-      // back to the buffers_. then the next buffer pointer is moved to current buffer
-      // pointer. this will result in the next buffer pointer being nullptr 
-      // in this case, the next buffer pointer is assigned a new buffer pointer 
-      if(!nxtBuf_) nxtBuf_ = std::move(buf2); 
+      // waiting conditions: 1. timeout, 2. a ring got half full,
+      // 3. a sink that was full may have room again
+      if(running && !wakeup_ && !busy) cond_.waitForSecs(starved ? 0.01 : flushInter_);
+      wakeup_ = false;
+      rings = rings_;
     }
-    // out of critical section, begin to write bufs to file 
-    assert(!bufs.empty());
-    // drop logs if too many 
-    if(bufs.size() > 25)
+    // a ring that filled up by a quarter while we wrote the others is
+    // drained again right away
+    busy = false;
+    starved = false;
+    std::vector<Ring*> exited;
+    Timestamp begin = Timestamp::now();
+    size_t written = 0;
+    for(Ring* r : rings)
     {
-      char buf[256];
-      snprintf(buf, sizeof(buf), "drop log at %s, %zd larger bufs\n",
-        Timestamp::now().toString().c_str(), bufs.size()-2);
-      fputs(buf, stderr);
-      output.append(buf, static_cast<int>(strlen(buf)));
-      bufs.erase(bufs.begin()+2, bufs.end());
+      // closed is read first, the last line before it is in the ring then
+      bool closed = r->closed();
+      if(running && r->pending() > output->room())
+      {
+        starved = true;
+        continue;
+      }
+      size_t n = r->drain(output);
+      r->reportDrops(output, dropNote_);
+      written += n;
+      if(n >= r->capacity() / 4) busy = true;
+      if(closed) exited.push_back(r);
     }
-    // call LogFile::append
-    for(const auto& buf : bufs)
-      output.append(buf->data(), buf->length());
-    
-    // drop buffers 
-    if(bufs.size() > 2)
-      bufs.resize(2);
-    
-    if(!buf1)
+    output->flush();
+    if(written > 0)
     {
-      assert(!bufs.empty());
-      buf1 = std::move(bufs.back());
-      bufs.pop_back();
-      buf1->reset();
+      // relaxed read-modify-writes, this thread is the only writer
+      int64_t us = Timestamp::now().usSinceE() - begin.usSinceE();
+      writtenBytes_.store(writtenBytes_.load(std::memory_order_relaxed) + written,
+        std::memory_order_relaxed);
+      writes_.store(writes_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      writeUsTotal_.store(writeUsTotal_.load(std::memory_order_relaxed) + us,
+        std::memory_order_relaxed);
+      if(us > writeUsMax_.load(std::memory_order_relaxed))
+        writeUsMax_.store(us, std::memory_order_relaxed);
     }
-
-    if(!buf2)
     {
-      assert(!bufs.empty());
-      buf2 = std::move(bufs.back());
-      bufs.pop_back();
-      buf2->reset();
+      MutexLockGuard lock(mutex_);
+      if(waiters_ > 0) drained_.notifyAll();
+      for(Ring* r : exited)
+      {
+        rings_.erase(std::find(rings_.begin(), rings_.end(), r));
+        retiredLines_ += r->droppedLines();
+        retiredBytes_ += r->droppedBytes();
+      }
     }
-
-    bufs.clear();
-    output.flush();
+    for(Ring* r : exited) delete r;
+    if(!running) break;
   }
-  output.flush();
 }
 } // namespace chtho
@@ -10,54 +10,147 @@
 #include "base/noncopyable.h"
 #include "Logger.h"
 #include "LogFile.h"
+#include "LogSink.h"
 #include "threads/Thread.h"
 
 #include <vector> 
 #include <memory> 
 #include <atomic> 
 
+#include <pthread.h> // pthread_key_t
+
 namespace chtho
 {
+// every front end thread appends to a ring of its own, a single
+// producer single consumer queue, so a log line costs one memcpy and
+// an atomic store, no lock is shared with the other threads. the back
+// end thread drains the rings into the LogFile when one of them is
+// half full, or every flushInter seconds.
+// lines of one thread stay in order, lines of different threads are
+// written in batches and may interleave out of time order.
+// memory is bounded by the ring size times the number of threads
+// that log. what happens to a line that doesn't fit into its ring is
+// the overflow policy, see Overflow
 class AsyncLogging : noncopyable
 {
+public:
+  enum class Overflow
+  {
+    // the thread waits until the back end has made room, the default.
+    // nothing is lost, logging slows down to the speed of the disk
+    Block,
+    // the line is dropped
+    DropNewest,
+    // the oldest lines of the thread that are still waiting are
+    // dropped to make room
+    DropOldest,
+    // lines below ERR are dropped early, the less important ones
+    // first: TRACE and DEBUG once the ring is half full, INFO at 3/4,
+    // WARN at 7/8. ERR and FATAL wait for room like Block
+    DropByLevel,
+  };
+  struct Stats
+  {
+    size_t droppedLines;
+    size_t droppedBytes;
+    size_t blocked; // times a thread waited for room
+    size_t writtenBytes;
+    size_t writes; // rounds of the back end that wrote something
+    int64_t writeUsMax; // the longest round, draining and flushing
+    int64_t writeUsTotal;
+    size_t rings; // of threads that are logging
+    size_t ringBytes;
+  };
+  // writes the note on the lines a thread dropped into buf, at most
+  // len bytes, and returns its length
+  using DropNote = int (*)(char* buf, size_t len, Timestamp when,
+    size_t lines, size_t bytes, int tid);
+
 private:
-  using Buf = FixedBuffer<kLarge>; // 4MB 
-  using BufVec = std::vector<std::unique_ptr<Buf>>;
-  using BufPtr = std::unique_ptr<Buf>; // BufPtr is unique pointer 
+  class Ring; // see AsyncLogging.cpp
 
   const int flushInter_;
   std::atomic_bool running_;
   const std::string name_;
   const off_t rollsz_;
+  size_t ringSz_;
+  Overflow overflow_;
+  LogFile::Sync sync_;
+  off_t syncBytes_;
+  std::unique_ptr<LogArchiver::Options> archive_;
+  LogSink* sink_;
+  DropNote dropNote_;
+  pthread_key_t key_; // the calling thread's Ring
   Thread thread_;
   CountDownLatch latch_;
   MutexLock mutex_; // protects the following members 
-  Condition cond_;
-  BufPtr curBuf_;
-  BufPtr nxtBuf_;
-  BufVec bufs_; // stores buffers to be written to file 
+  Condition cond_; // wakes the back end
+  Condition drained_; // wakes front ends waiting for room
+  std::vector<Ring*> rings_;
+  bool wakeup_;
+  int waiters_;
+  size_t blocked_;
+  // of rings that are gone
+  size_t retiredLines_;
+  size_t retiredBytes_;
+  // the back end's
+  std::atomic<size_t> writtenBytes_;
+  std::atomic<size_t> writes_;
+  std::atomic<int64_t> writeUsMax_;
+  std::atomic<int64_t> writeUsTotal_;
 
+  Ring* ring();
+  void wake();
+  bool wait(Ring* r, const char* line, int len);
   void threadFunc();
+  static void releaseRing(void* ring);
 
 public:
   AsyncLogging(const std::string& name, off_t rollsz, int flushInter=3);
-  ~AsyncLogging()
+  ~AsyncLogging();
+  // the ring of each thread that starts logging afterwards,
+  // rounded up to a power of two. 512 KB by default
+  void setRingSize(size_t sz);
+  // before the first line
+  void setOverflow(Overflow policy) { overflow_ = policy; }
+  // before start(), see LogFile::setSync
+  void setSync(LogFile::Sync policy, off_t bytes=0)
   {
-    if(running_) stop();
+    sync_ = policy;
+    syncBytes_ = bytes;
   }
+  // before start(), see LogFile::setArchive
+  void setArchive(const LogArchiver::Options& opts)
+  { archive_.reset(new LogArchiver::Options(opts)); }
+  // before start(). the lines go to sink instead of a LogFile, none
+  // is created then and the settings above don't apply. the sink
+  // isn't owned, it has to outlive stop()
+  void setSink(LogSink* sink) { sink_ = sink; }
+  // the note, "drop log at ...", as a line of text
+  static int textDropNote(char* buf, size_t len, Timestamp when,
+    size_t lines, size_t bytes, int tid);
+  // before start(). the note goes into the output among the lines,
+  // textDropNote by default. a log that isn't text writes one in its
+  // own format, see BinaryLogging. stderr always gets the text
+  void setDropNote(DropNote note) { dropNote_ = note; }
+  // the calling thread's lines are dropped rather than waited for,
+  // under any policy. for threads the sink itself waits on, e.g. the
+  // loop of a net::LogShipper, which would wait for room forever
+  static void dropInsteadOfWait();
+  // the level is Logger::outputLevel(), i.e. the line's if it comes
+  // from a Logger, INFO otherwise
   void append(const char* line, int len);
+  // false if the line was dropped, a line DropOldest drops later
+  // doesn't show here
+  bool append(const char* line, int len, Logger::Level level);
+  Stats stats();
   void start() 
   {
     running_ = true;
     thread_.start();
     latch_.wait();
   }
-  void stop()
-  {
-    running_ = false;
-    cond_.notify();
-    thread_.join();
-  }
+  void stop();
 };
 } // namespace chtho
-#endif // !CHTHO_LOGGING_ASYNCLOGGING_H
\ No newline at end of file
+#endif // !CHTHO_LOGGING_ASYNCLOGGING_H
@@ -0,0 +1,397 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "BinaryLogDecoder.h"
+#include "BinaryLogging.h"
+#include "Logger.h"
+
+#include <stdio.h>
+#include <string.h>
+
+namespace chtho
+{
+namespace
+{
+// one printf conversion: %[flags][width][.precision][length]conv
+struct Spec
+{
+  std::string flags;
+  bool starWidth;
+  std::string width;
+  bool hasPrecision;
+  bool starPrecision;
+  std::string precision;
+  char conv;
+};
+
+// p points behind the '%', returns the end of the conversion or NULL
+const char* parseSpec(const char* p, const char* end, Spec* spec)
+{
+  spec->flags.clear();
+  spec->width.clear();
+  spec->precision.clear();
+  spec->starWidth = spec->hasPrecision = spec->starPrecision = false;
+  while(p < end && strchr("-+ #0'", *p)) spec->flags += *p++;
+  if(p < end && *p == '*')
+  {
+    spec->starWidth = true;
+    ++p;
+  }
+  else while(p < end && *p >= '0' && *p <= '9') spec->width += *p++;
+  if(p < end && *p == '.')
+  {
+    spec->hasPrecision = true;
+    ++p;
+    if(p < end && *p == '*')
+    {
+      spec->starPrecision = true;
+      ++p;
+    }
+    else while(p < end && *p >= '0' && *p <= '9') spec->precision += *p++;
+  }
+  // the arguments carry their own size
+  while(p < end && strchr("hlLqjzt", *p)) ++p;
+  if(p == end || !strchr("diouxXcfFeEgGaAsp", *p)) return NULL;
+  spec->conv = *p;
+  return p + 1;
+}
+
+bool isIntConv(char c) { return strchr("diouxXc", c) != NULL; }
+bool isFloatConv(char c) { return strchr("fFeEgGaA", c) != NULL; }
+bool isInt(char t) { return t == 'i' || t == 'u' || t == 'l' || t == 'L'; }
+
+bool fits(char conv, char type)
+{
+  if(isIntConv(conv)) return isInt(type);
+  if(isFloatConv(conv)) return type == 'd';
+  return conv == type; // 's', 'p'
+}
+
+template<typename T>
+void appendf(std::string* out, const std::string& fmt, T v)
+{
+  char buf[256];
+  int n = snprintf(buf, sizeof buf, fmt.c_str(), v);
+  if(n < 0) return;
+  if(static_cast<size_t>(n) < sizeof buf) out->append(buf, n);
+  else
+  {
+    std::string big(n + 1, '\0');
+    snprintf(&big[0], big.size(), fmt.c_str(), v);
+    out->append(big.data(), n);
+  }
+}
+
+// reads the arguments one by one
+class ArgReader
+{
+private:
+  const std::string& types_;
+  size_t next_;
+  const char* p_;
+  const char* end_;
+public:
+  ArgReader(const std::string& types, const char* p, size_t len)
+    : types_(types), next_(0), p_(p), end_(p + len)
+  {}
+  bool done() const { return next_ == types_.size(); }
+  char type() const { return types_[next_]; }
+  // integer arguments as int64, for the '*' widths
+  bool readInt(int64_t* v)
+  {
+    if(done() || !isInt(type())) return false;
+    size_t n = type() == 'i' || type() == 'u' ? 4 : 8;
+    if(static_cast<size_t>(end_ - p_) < n) return false;
+    if(n == 4)
+    {
+      uint32_t x;
+      memcpy(&x, p_, 4);
+      *v = type() == 'i' ? static_cast<int32_t>(x) : static_cast<int64_t>(x);
+    }
+    else memcpy(v, p_, 8);
+    p_ += n;
+    ++next_;
+    return true;
+  }
+  // formats the next argument with spec, whose conversion is kept
+  // if it fits the argument's type
+  bool format(std::string fmt, char conv, std::string* out)
+  {
+    if(done()) return false;
+    char t = type();
+    if(!fits(conv, t)) conv = isInt(t) ? (t == 'u' || t == 'L' ? 'u' : 'd')
+      : t == 'd' ? 'g' : t;
+    if(t == 'i' || t == 'u' || t == 'l' || t == 'L')
+    {
+      int64_t v;
+      if(!readInt(&v)) return false;
+      if(t == 'i') appendf(out, fmt + conv, static_cast<int>(v));
+      else if(t == 'u') appendf(out, fmt + conv, static_cast<unsigned>(v));
+      else if(t == 'l') appendf(out, fmt + "ll" + conv, static_cast<long long>(v));
+      else appendf(out, fmt + "ll" + conv, static_cast<unsigned long long>(v));
+      return true;
+    }
+    if(t == 'd' || t == 'p')
+    {
+      if(end_ - p_ < 8) return false;
+      if(t == 'd')
+      {
+        double d;
+        memcpy(&d, p_, 8);
+        appendf(out, fmt + conv, d);
+      }
+      else
+      {
+        uint64_t x;
+        memcpy(&x, p_, 8);
+        appendf(out, fmt + conv, reinterpret_cast<void*>(static_cast<uintptr_t>(x)));
+      }
+      p_ += 8;
+      ++next_;
+      return true;
+    }
+    if(t == 's')
+    {
+      uint32_t n;
+      if(end_ - p_ < 4) return false;
+      memcpy(&n, p_, 4);
+      if(static_cast<size_t>(end_ - p_ - 4) < n) return false;
+      std::string s(p_ + 4, n);
+      appendf(out, fmt + 's', s.c_str());
+      p_ += 4 + n;
+      ++next_;
+      return true;
+    }
+    return false;
+  }
+};
+
+const char* const levelStr[] = { "TRACE ", "DEBUG ", "INFO  ", "WARN  ", "ERROR ", "FATAL " };
+} // namespace
+
+namespace binlog
+{
+bool checkFormat(const char* format, const std::string& types)
+{
+  size_t next = 0;
+  const char* end = format + strlen(format);
+  Spec spec;
+  for(const char* p = format; p < end; )
+  {
+    if(*p++ != '%') continue;
+    if(p < end && *p == '%')
+    {
+      ++p;
+      continue;
+    }
+    p = parseSpec(p, end, &spec);
+    if(!p) return false;
+    int stars = spec.starWidth + spec.starPrecision;
+    for(int i = 0; i < stars; ++i)
+      if(next >= types.size() || !isInt(types[next++])) return false;
+    if(next >= types.size() || !fits(spec.conv, types[next++])) return false;
+  }
+  return next == types.size();
+}
+} // namespace binlog
+
+BinaryLogDecoder::BinaryLogDecoder()
+  : timeZone_(Logger::timeZone),
+    records_(0),
+    unknown_(0),
+    dropped_(0),
+    broken_(false)
+{}
+
+bool BinaryLogDecoder::render(const std::string& format, const std::string& types,
+  const char* args, size_t len, std::string* out)
+{
+  ArgReader reader(types, args, len);
+  const char* p = format.data();
+  const char* end = p + format.size();
+  bool ok = true;
+  Spec spec;
+  while(p < end)
+  {
+    const char* pct = static_cast<const char*>(memchr(p, '%', end - p));
+    if(!pct)
+    {
+      out->append(p, end - p);
+      break;
+    }
+    out->append(p, pct - p);
+    p = pct + 1;
+    if(p < end && *p == '%')
+    {
+      out->push_back('%');
+      ++p;
+      continue;
+    }
+    const char* specEnd = parseSpec(p, end, &spec);
+    if(!specEnd)
+    {
+      // not a conversion we know, kept as it is
+      out->push_back('%');
+      ok = false;
+      continue;
+    }
+    std::string fmt = "%" + spec.flags;
+    int64_t star;
+    if(spec.starWidth)
+    {
+      if(!reader.readInt(&star)) ok = false;
+      else fmt += std::to_string(star);
+    }
+    else fmt += spec.width;
+    if(spec.hasPrecision)
+    {
+      fmt += '.';
+      if(spec.starPrecision)
+      {
+        if(!reader.readInt(&star)) ok = false;
+        else fmt += std::to_string(star);
+      }
+      else fmt += spec.precision;
+    }
+    if(!reader.format(fmt, spec.conv, out))
+    {
+      out->append(pct, specEnd - pct);
+      ok = false;
+    }
+    p = specEnd;
+  }
+  return ok && reader.done();
+}
+
+bool BinaryLogDecoder::feed(const char* data, size_t len, std::string* out)
+{
+  if(broken_) return false;
+  if(!pending_.empty())
+  {
+    pending_.append(data, len);
+    std::string buf;
+    buf.swap(pending_);
+    return feed(buf.data(), buf.size(), out);
+  }
+  const char* p = data;
+  const char* end = data + len;
+  while(p < end)
+  {
+    if(end - p < binlog::kHeaderLen)
+      break;
+    size_t n = record(p, end - p, out);
+    if(broken_) return false;
+    if(n == 0) break;
+    p += n;
+  }
+  pending_.assign(p, end - p);
+  return true;
+}
+
+size_t BinaryLogDecoder::record(const char* p, size_t len, std::string* out)
+{
+  uint8_t kind = static_cast<uint8_t>(p[0]);
+  uint32_t n;
+  memcpy(&n, p + 1, 4);
+  if((kind != binlog::kSiteRecord && kind != binlog::kLogRecord
+    && kind != binlog::kDropRecord) || n < binlog::kHeaderLen + 4u)
+  {
+    broken_ = true;
+    return 0;
+  }
+  if(len < n) return 0;
+  if(kind == binlog::kSiteRecord) site(p + binlog::kHeaderLen, p + n);
+  else if(kind == binlog::kLogRecord) line(p + binlog::kHeaderLen, p + n, out);
+  else drop(p + binlog::kHeaderLen, p + n, out);
+  return n;
+}
+
+void BinaryLogDecoder::site(const char* p, const char* end)
+{
+  SiteInfo info;
+  uint32_t id, line;
+  uint16_t fileLen, fmtLen;
+  // id, level, line, file len
+  if(end - p < 11) return;
+  memcpy(&id, p, 4);
+  if(id == 0 || id > binlog::kMaxSiteId)
+  {
+    broken_ = true;
+    return;
+  }
+  info.level = static_cast<uint8_t>(p[4]);
+  memcpy(&line, p + 5, 4);
+  info.line = static_cast<int>(line);
+  memcpy(&fileLen, p + 9, 2);
+  p += 11;
+  if(end - p < fileLen + 2) return;
+  info.file.assign(p, fileLen);
+  p += fileLen;
+  memcpy(&fmtLen, p, 2);
+  p += 2;
+  if(end - p < fmtLen + 1) return;
+  info.format.assign(p, fmtLen);
+  p += fmtLen;
+  uint8_t argc = static_cast<uint8_t>(*p++);
+  if(end - p < argc) return;
+  info.types.assign(p, argc);
+  if(info.level >= static_cast<int>(Logger::Level::NUM_LEVEL)) return;
+  sites_[id] = info;
+}
+
+// like Logger's lines, with the thread id only
+void BinaryLogDecoder::line(const char* p, const char* end, std::string* out)
+{
+  ++records_;
+  uint32_t id, tid;
+  int64_t us;
+  if(end - p < 16) return;
+  memcpy(&id, p, 4);
+  memcpy(&tid, p + 4, 4);
+  memcpy(&us, p + 8, 8);
+  p += 16;
+  time_t secs = static_cast<time_t>(us / Timestamp::usPerSec);
+  struct tm m;
+  if(timeZone_.valid()) m = timeZone_.toLocal(secs);
+  else ::gmtime_r(&secs, &m);
+  char head[64];
+  int n = snprintf(head, sizeof head, "%4d%02d%02d %02d:%02d:%02d.%06d %5u ",
+    m.tm_year+1900, m.tm_mon+1, m.tm_mday, m.tm_hour, m.tm_min, m.tm_sec,
+    static_cast<int>(us % Timestamp::usPerSec), tid);
+  out->append(head, n);
+  auto it = sites_.find(id);
+  if(it == sites_.end())
+  {
+    ++unknown_;
+    snprintf(head, sizeof head, "?     <statement %u> %zu bytes\n", id,
+      static_cast<size_t>(end - p));
+    out->append(head);
+    return;
+  }
+  const SiteInfo& s = it->second;
+  out->append(levelStr[s.level]);
+  render(s.format, s.types, p, end - p, out);
+  out->push_back(' ');
+  out->append(s.file);
+  snprintf(head, sizeof head, ":%d\n", s.line);
+  out->append(head);
+}
+void BinaryLogDecoder::drop(const char* p, const char* end, std::string* out)
+{
+  uint32_t tid;
+  int64_t us;
+  uint64_t lines, bytes;
+  if(end - p < binlog::kDropRecordLen - binlog::kHeaderLen) return;
+  memcpy(&tid, p, 4);
+  memcpy(&us, p + 4, 8);
+  memcpy(&lines, p + 12, 8);
+  memcpy(&bytes, p + 20, 8);
+  dropped_ += lines;
+  char buf[256];
+  int n = AsyncLogging::textDropNote(buf, sizeof buf, Timestamp(us), lines, bytes,
+    static_cast<int>(tid));
+  out->append(buf, n);
+}
+} // namespace chtho
@@ -0,0 +1,73 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_LOGGING_BINARYLOGDECODER_H
+#define CHTHO_LOGGING_BINARYLOGDECODER_H
+// Renders the records written by BinaryLogging as the lines Logger
+// would have written
+
+#include "base/noncopyable.h"
+#include "time/TimeZone.h"
+
+#include <string>
+#include <unordered_map>
+
+#include <stdint.h>
+
+namespace chtho
+{
+class BinaryLogDecoder : noncopyable
+{
+private:
+  struct SiteInfo
+  {
+    int level;
+    int line;
+    std::string file;
+    std::string format;
+    std::string types;
+  };
+  std::unordered_map<uint32_t, SiteInfo> sites_; // by id
+  std::string pending_; // an incomplete record
+  TimeZone timeZone_;
+  size_t records_;
+  size_t unknown_;
+  size_t dropped_;
+  bool broken_;
+
+  // the length of the record at p, 0 if it is incomplete
+  size_t record(const char* p, size_t len, std::string* out);
+  void site(const char* p, const char* end);
+  void line(const char* p, const char* end, std::string* out);
+  void drop(const char* p, const char* end, std::string* out);
+public:
+  // the time zone defaults to Logger's
+  BinaryLogDecoder();
+  void setTimeZone(const TimeZone& tz) { timeZone_ = tz; }
+
+  // decodes the complete records in data and appends their lines to
+  // out, an incomplete one at the end waits for the next call.
+  // false once the data turned out not to be a binary log
+  bool feed(const char* data, size_t len, std::string* out);
+  // the bytes of the incomplete record, non-zero at the end of the
+  // input if the log was cut off
+  size_t pending() const { return pending_.size(); }
+  size_t records() const { return records_; }
+  // records of statements that weren't described, e.g. when a file
+  // from the middle of a run is decoded without the ones before it.
+  // their lines show the statement id and the size of the arguments
+  size_t unknown() const { return unknown_; }
+  // the lines the log says were dropped before they were written,
+  // each drop record is rendered as AsyncLogging's text note
+  size_t dropped() const { return dropped_; }
+
+  // appends format with the encoded arguments (see BinaryLogging.h),
+  // false if they don't fit each other
+  static bool render(const std::string& format, const std::string& types,
+    const char* args, size_t len, std::string* out);
+};
+} // namespace chtho
+
+#endif // !CHTHO_LOGGING_BINARYLOGDECODER_H
@@ -0,0 +1,148 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "BinaryLogging.h"
+#include "threads/MutexLockGuard.h"
+
+#include <vector>
+
+namespace chtho
+{
+namespace
+{
+struct SiteInfo
+{
+  binlog::Site* site;
+  std::string types;
+};
+
+// every statement that has run, by id - 1
+class SiteRegistry : noncopyable
+{
+public:
+  MutexLock mutex_;
+  std::vector<SiteInfo> sites_;
+};
+
+SiteRegistry& registry()
+{
+  static SiteRegistry* r = new SiteRegistry; // leaked, see LogModule
+  return *r;
+}
+
+std::atomic<BinaryLogging*> g_instance(NULL);
+// bumped when the instance changes, a new log starts without sites
+std::atomic<int> g_epoch(0);
+
+// the sites this thread has described in the current log. ids beyond
+// the bitmap are described every time, correct if wasteful
+const uint32_t kMaxTracked = 4096;
+__thread uint64_t t_described[kMaxTracked / 64];
+__thread int t_epoch;
+
+// the AsyncLogging::DropNote of the binary files
+int dropRecord(char* buf, size_t, Timestamp when, size_t lines, size_t bytes, int tid)
+{
+  buf[0] = binlog::kDropRecord;
+  uint32_t len32 = binlog::kDropRecordLen;
+  uint32_t tid32 = static_cast<uint32_t>(tid);
+  int64_t us = when.usSinceE();
+  uint64_t lines64 = lines, bytes64 = bytes;
+  memcpy(buf + 1, &len32, 4);
+  memcpy(buf + 5, &tid32, 4);
+  memcpy(buf + 9, &us, 8);
+  memcpy(buf + 17, &lines64, 8);
+  memcpy(buf + 25, &bytes64, 8);
+  return binlog::kDropRecordLen;
+}
+} // namespace
+
+BinaryLogging::BinaryLogging(const std::string& name, off_t rollsz, int flushInter)
+  : async_(name, rollsz, flushInter)
+{
+  async_.setDropNote(dropRecord);
+}
+
+BinaryLogging::~BinaryLogging()
+{
+  BinaryLogging* self = this;
+  g_instance.compare_exchange_strong(self, NULL);
+}
+
+void BinaryLogging::setInstance(BinaryLogging* log)
+{
+  g_epoch.fetch_add(1, std::memory_order_relaxed);
+  g_instance.store(log, std::memory_order_release);
+}
+
+BinaryLogging* BinaryLogging::instance()
+{
+  return g_instance.load(std::memory_order_acquire);
+}
+
+uint32_t BinaryLogging::registerSite(binlog::Site* site, const std::string& types)
+{
+  SiteRegistry& r = registry();
+  uint32_t id;
+  {
+    MutexLockGuard guard(r.mutex_);
+    // another thread may have got here first
+    id = site->id.load(std::memory_order_relaxed);
+    if(id != 0) return id;
+    r.sites_.push_back(SiteInfo{ site, types });
+    id = static_cast<uint32_t>(r.sites_.size());
+    site->id.store(id, std::memory_order_release);
+  }
+  if(!binlog::checkFormat(site->format, types))
+    LOG_WARN << "LOG_BIN format \"" << site->format << "\" doesn't match its arguments ("
+      << types << ") at " << site->file << ':' << site->line;
+  return id;
+}
+
+bool BinaryLogging::described(uint32_t id)
+{
+  int epoch = g_epoch.load(std::memory_order_relaxed);
+  if(__glibc_unlikely(t_epoch != epoch))
+  {
+    memset(t_described, 0, sizeof t_described);
+    t_epoch = epoch;
+  }
+  if(id >= kMaxTracked) return false;
+  return t_described[id / 64] & (uint64_t(1) << (id % 64));
+}
+
+void BinaryLogging::describe(uint32_t id)
+{
+  SiteInfo info;
+  {
+    SiteRegistry& r = registry();
+    MutexLockGuard guard(r.mutex_);
+    info = r.sites_[id - 1];
+  }
+  const binlog::Site* site = info.site;
+  uint16_t fileLen = static_cast<uint16_t>(strlen(site->file));
+  uint16_t fmtLen = static_cast<uint16_t>(strlen(site->format));
+  uint8_t argc = static_cast<uint8_t>(info.types.size());
+  uint32_t len = binlog::kHeaderLen + 4 + 1 + 4 + 2 + fileLen + 2 + fmtLen + 1 + argc;
+  std::string rec(len, '\0');
+  char* p = &rec[0];
+  *p++ = binlog::kSiteRecord;
+  memcpy(p, &len, 4); p += 4;
+  memcpy(p, &id, 4); p += 4;
+  *p++ = static_cast<char>(site->level);
+  uint32_t line = static_cast<uint32_t>(site->line);
+  memcpy(p, &line, 4); p += 4;
+  memcpy(p, &fileLen, 2); p += 2;
+  memcpy(p, site->file, fileLen); p += fileLen;
+  memcpy(p, &fmtLen, 2); p += 2;
+  memcpy(p, site->format, fmtLen); p += fmtLen;
+  *p++ = static_cast<char>(argc);
+  memcpy(p, info.types.data(), argc);
+  // the lines are undecodable without it, it's dropped as late as
+  // an error is. if it is, it's written again with the next line
+  if(!async_.append(rec.data(), static_cast<int>(len), Logger::Level::ERR)) return;
+  if(id < kMaxTracked) t_described[id / 64] |= uint64_t(1) << (id % 64);
+}
+} // namespace chtho
@@ -0,0 +1,266 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_LOGGING_BINARYLOGGING_H
+#define CHTHO_LOGGING_BINARYLOGGING_H
+// Deferred formatting: log statements write raw arguments, the text
+// is rendered later by BinaryLogDecoder (or the chtho_logdecode tool)
+
+#include "base/noncopyable.h"
+#include "base/StringPiece.h"
+#include "AsyncLogging.h"
+#include "Logger.h"
+#include "threads/CurrentThread.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <type_traits>
+
+#include <stdint.h>
+#include <string.h>
+
+namespace chtho
+{
+namespace binlog
+{
+// every record starts with its kind and its total length (u32).
+// a site record describes a statement once per thread, before the
+// thread's first log record that uses it:
+//   kind, len, u32 id, u8 level, u32 line, u16 file len, file,
+//   u16 format len, format, u8 argc, the argument type codes
+// a log record:
+//   kind, len, u32 id, u32 tid, i64 us since epoch, the arguments.
+// a drop record, for the lines a thread dropped (AsyncLogging::Overflow):
+//   kind, len, u32 tid, i64 us since epoch, u64 lines, u64 bytes.
+// integers are native endian, 'i' int32, 'u' uint32, 'l' int64,
+// 'L' uint64, 'd' double, 'p' pointer as uint64, 's' u32 len + bytes
+const int kHeaderLen = 5; // kind, len
+enum RecordKind : uint8_t { kSiteRecord = 1, kLogRecord = 2, kDropRecord = 3 };
+const int kDropRecordLen = kHeaderLen + 28;
+// statement ids run from 1, a program has far fewer statements
+const uint32_t kMaxSiteId = 1 << 24;
+
+// one LOG_BIN statement, a static object with constant initialization.
+// the id is handed out the first time it is executed
+struct Site
+{
+  const char* format;
+  const char* file;
+  int line;
+  Logger::Level level;
+  std::atomic<uint32_t> id;
+
+  constexpr Site(const char* fmt, const char* f, int l, Logger::Level lv)
+    : format(fmt), file(f), line(l), level(lv), id(0)
+  {}
+};
+
+// how each argument type is written, others don't compile
+template<typename T, typename Enable = void>
+struct Arg;
+
+template<typename T>
+struct Arg<T, typename std::enable_if<std::is_integral<T>::value && sizeof(T) <= 4>::type>
+{
+  static const char code = std::is_signed<T>::value ? 'i' : 'u';
+  static size_t size(T) { return 4; }
+  static char* put(char* p, T v)
+  {
+    uint32_t x = static_cast<uint32_t>(v);
+    memcpy(p, &x, 4);
+    return p + 4;
+  }
+};
+
+template<typename T>
+struct Arg<T, typename std::enable_if<std::is_integral<T>::value && sizeof(T) == 8>::type>
+{
+  static const char code = std::is_signed<T>::value ? 'l' : 'L';
+  static size_t size(T) { return 8; }
+  static char* put(char* p, T v)
+  {
+    uint64_t x = static_cast<uint64_t>(v);
+    memcpy(p, &x, 8);
+    return p + 8;
+  }
+};
+
+template<typename T>
+struct Arg<T, typename std::enable_if<std::is_floating_point<T>::value>::type>
+{
+  static const char code = 'd';
+  static size_t size(T) { return 8; }
+  static char* put(char* p, T v)
+  {
+    double x = static_cast<double>(v);
+    memcpy(p, &x, 8);
+    return p + 8;
+  }
+};
+
+inline char* putString(char* p, const char* s, uint32_t len)
+{
+  memcpy(p, &len, 4);
+  memcpy(p + 4, s, len);
+  return p + 4 + len;
+}
+
+template<typename T>
+struct Arg<T, typename std::enable_if<std::is_same<T, const char*>::value
+  || std::is_same<T, char*>::value>::type>
+{
+  static const char code = 's';
+  static size_t size(const char* s) { return 4 + (s ? strlen(s) : 6); }
+  static char* put(char* p, const char* s)
+  {
+    if(!s) return putString(p, "(null)", 6);
+    return putString(p, s, static_cast<uint32_t>(strlen(s)));
+  }
+};
+
+template<>
+struct Arg<std::string>
+{
+  static const char code = 's';
+  static size_t size(const std::string& s) { return 4 + s.size(); }
+  static char* put(char* p, const std::string& s)
+  {
+    return putString(p, s.data(), static_cast<uint32_t>(s.size()));
+  }
+};
+
+template<>
+struct Arg<StringPiece>
+{
+  static const char code = 's';
+  static size_t size(const StringPiece& s) { return 4 + s.size(); }
+  static char* put(char* p, const StringPiece& s)
+  {
+    return putString(p, s.data(), static_cast<uint32_t>(s.size()));
+  }
+};
+
+template<typename T>
+struct Arg<T, typename std::enable_if<std::is_pointer<T>::value
+  && !std::is_same<T, const char*>::value && !std::is_same<T, char*>::value>::type>
+{
+  static const char code = 'p';
+  static size_t size(T) { return 8; }
+  static char* put(char* p, T v)
+  {
+    uint64_t x = reinterpret_cast<uintptr_t>(v);
+    memcpy(p, &x, 8);
+    return p + 8;
+  }
+};
+
+template<typename T>
+using ArgOf = Arg<typename std::decay<T>::type>;
+
+inline size_t argsSize() { return 0; }
+template<typename T, typename... Rest>
+size_t argsSize(const T& v, const Rest&... rest)
+{
+  return ArgOf<T>::size(v) + argsSize(rest...);
+}
+
+inline char* putArgs(char* p) { return p; }
+template<typename T, typename... Rest>
+char* putArgs(char* p, const T& v, const Rest&... rest)
+{
+  return putArgs(ArgOf<T>::put(p, v), rest...);
+}
+
+template<typename... Args>
+std::string typeCodes()
+{
+  const char codes[] = { ArgOf<Args>::code..., '\0' };
+  return std::string(codes, sizeof...(Args));
+}
+
+// whether the conversions of format fit the argument type codes,
+// i.e. the decoder can render them. checked once per statement
+bool checkFormat(const char* format, const std::string& types);
+} // namespace binlog
+
+// the back end of the LOG_BIN statements: an AsyncLogging whose files
+// hold binary records instead of lines. a statement costs about what
+// copying its arguments does, the format is never looked at while
+// logging, and the files are a fraction of the size of the text.
+// the files of a process are decoded in order, a statement is
+// described only the first time each thread uses it
+class BinaryLogging : noncopyable
+{
+private:
+  AsyncLogging async_;
+
+  uint32_t registerSite(binlog::Site* site, const std::string& types);
+  void describe(uint32_t id);
+  bool described(uint32_t id);
+public:
+  BinaryLogging(const std::string& name, off_t rollsz, int flushInter=3);
+  ~BinaryLogging();
+  void start() { async_.start(); }
+  void stop() { async_.stop(); }
+  // Overflow::DropOldest may drop the description of a statement
+  // before its lines, they decode as unknown then
+  AsyncLogging& async() { return async_; }
+
+  // where the LOG_BIN statements go, NULL (the default) turns them off
+  static void setInstance(BinaryLogging* log);
+  static BinaryLogging* instance();
+
+  template<typename... Args>
+  void log(binlog::Site* site, const Args&... args)
+  {
+    uint32_t id = site->id.load(std::memory_order_acquire);
+    if(__glibc_unlikely(id == 0))
+      id = registerSite(site, binlog::typeCodes<Args...>());
+    if(__glibc_unlikely(!described(id))) describe(id);
+    size_t len = binlog::kHeaderLen + 16 + binlog::argsSize(args...);
+    char stack[512];
+    std::unique_ptr<char[]> heap;
+    char* buf = stack;
+    if(len > sizeof stack)
+    {
+      heap.reset(new char[len]);
+      buf = heap.get();
+    }
+    buf[0] = binlog::kLogRecord;
+    uint32_t len32 = static_cast<uint32_t>(len);
+    uint32_t tid = static_cast<uint32_t>(CurrentThread::tid());
+    int64_t us = Timestamp::now().usSinceE();
+    memcpy(buf + 1, &len32, 4);
+    memcpy(buf + 5, &id, 4);
+    memcpy(buf + 9, &tid, 4);
+    memcpy(buf + 13, &us, 8);
+    binlog::putArgs(buf + 21, args...);
+    async_.append(buf, static_cast<int>(len), site->level);
+  }
+};
+} // namespace chtho
+
+// LOG_BIN_INFO("conn %d sent %zu bytes to %s", fd, n, peer)
+// the format is printf's, checked against the arguments when the
+// statement first runs, a mismatch is logged as a warning. the arguments
+// are integers, floating point, pointers and strings (const char*,
+// std::string, StringPiece), the length modifiers don't matter
+#define CHTHO_LOG_BIN(lvl, fmt, ...) do { \
+  if(CHTHO_LOG_ENABLED(lvl)) { \
+    chtho::BinaryLogging* chtho_binlog = chtho::BinaryLogging::instance(); \
+    if(chtho_binlog) { \
+      static chtho::binlog::Site chtho_site(fmt, CHTHO_SOURCE_FILE.data_, __LINE__, lvl); \
+      chtho_binlog->log(&chtho_site, ##__VA_ARGS__); \
+    } \
+  } } while(0)
+
+#define LOG_BIN_TRACE(fmt, ...) CHTHO_LOG_BIN(chtho::Logger::Level::TRACE, fmt, ##__VA_ARGS__)
+#define LOG_BIN_DEBUG(fmt, ...) CHTHO_LOG_BIN(chtho::Logger::Level::DEBUG, fmt, ##__VA_ARGS__)
+#define LOG_BIN_INFO(fmt, ...) CHTHO_LOG_BIN(chtho::Logger::Level::INFO, fmt, ##__VA_ARGS__)
+#define LOG_BIN_WARN(fmt, ...) CHTHO_LOG_BIN(chtho::Logger::Level::WARN, fmt, ##__VA_ARGS__)
+#define LOG_BIN_ERR(fmt, ...) CHTHO_LOG_BIN(chtho::Logger::Level::ERR, fmt, ##__VA_ARGS__)
+
+#endif // !CHTHO_LOGGING_BINARYLOGGING_H
@@ -6,51 +6,102 @@
 #include "FileUtil.h"
 #include "logging/Logger.h"
 
+#include <algorithm>
+
 #include <assert.h> 
+#include <errno.h>
+#include <fcntl.h> // open, fallocate
+#include <stdio.h> // rename
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 namespace chtho
 {
 namespace futil
 {
-AppendFile::AppendFile(std::string name)
-  : fp_(::fopen(name.c_str(), "ae")),  // ae: O_APPEND|O_CLOEXEC
-    written_(0)
+AppendFile::AppendFile(std::string name, off_t prealloc)
+  : fd_(::open(name.c_str(), O_WRONLY|O_CREAT|O_APPEND|O_CLOEXEC, 0644)),
+    name_(std::move(name)),
+    buf_(new char[kBufSize]),
+    len_(0),
+    written_(0),
+    size_(0),
+    reserved_(0),
+    step_(prealloc),
+    synced_(0)
 {
-  assert(fp_);
-  ::setbuffer(fp_, buf_, sizeof(buf_));
+  if(fd_ < 0)
+    fprintf(stderr, "AppendFile: open %s failed %s\n", name_.c_str(), strerror_tl(errno));
+  assert(fd_ >= 0);
+  struct stat st;
+  if(::fstat(fd_, &st) == 0) size_ = reserved_ = synced_ = st.st_size;
+  reserve();
 }
 AppendFile::~AppendFile()
 {
-  ::fclose(fp_);
+  writeOut();
+  // the reserved space beyond the end
+  if(reserved_ > size_) ::ftruncate(fd_, size_);
+  ::close(fd_);
 }
 void AppendFile::append(const char* line, const size_t len)
 {
-  size_t n = write(line, len);
-  size_t remain = len - n;
-  while(remain > 0)
+  if(len_ + len > kBufSize) writeOut();
+  if(len >= kBufSize) write(line, len);
+  else
   {
-    size_t x = write(line + n, remain);
-    if(x == 0)
-    {
-      int err = ferror(fp_);
-      if(err)
-      {
-        fprintf(stderr, "AppendFile::append() failed %s\n", strerror_tl(err));
-      }
-      break;
-    }
-    n += x; 
-    remain -= x; 
+    memcpy(buf_.get() + len_, line, len);
+    len_ += len;
   }
   written_ += len;
 }
 void AppendFile::flush()
 {
-  ::fflush(fp_);
+  writeOut();
+}
+void AppendFile::sync()
+{
+  writeOut();
+  ::fdatasync(fd_);
+  synced_ = size_;
+}
+bool AppendFile::rename(const std::string& name)
+{
+  if(::rename(name_.c_str(), name.c_str()) != 0) return false;
+  name_ = name;
+  return true;
+}
+void AppendFile::writeOut()
+{
+  if(len_ == 0) return;
+  write(buf_.get(), len_);
+  len_ = 0;
+}
+void AppendFile::write(const char* data, size_t len)
+{
+  while(len > 0)
+  {
+    ssize_t n = ::write(fd_, data, len);
+    if(n < 0)
+    {
+      if(errno == EINTR) continue;
+      fprintf(stderr, "AppendFile::append() failed %s\n", strerror_tl(errno));
+      break;
+    }
+    data += n;
+    len -= n;
+    size_ += n;
+  }
+  reserve();
 }
-size_t AppendFile::write(const char* line, size_t len)
+// keeps at least half a step reserved ahead
+void AppendFile::reserve()
 {
-  return ::fwrite_unlocked(line, 1, len, fp_);
+  if(step_ == 0 || size_ + step_ / 2 <= reserved_) return;
+  off_t from = std::max(size_, reserved_);
+  if(::fallocate(fd_, FALLOC_FL_KEEP_SIZE, from, step_) == 0) reserved_ = from + step_;
+  else step_ = 0; // e.g. EOPNOTSUPP
 }
 } // namespace futil
 } // namespace chtho
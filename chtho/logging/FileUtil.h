@@ -8,31 +8,57 @@
 
 #include "base/noncopyable.h"
 
+#include <memory>
 #include <string>
 
-#include <stdio.h> // FILE 
+#include <sys/types.h> // off_t
 
 namespace chtho
 {
 namespace futil
 {
+// appends to a file with write(2), small appends are gathered in a
+// buffer of its own, large ones are written straight from the
+// caller's memory. the disk space ahead of the end of the file is
+// reserved in steps of prealloc bytes (fallocate, the file size stays
+// the same), so the file system doesn't have to find blocks on every
+// write and the file stays in one piece. what's left over is given
+// back when the file is closed
 class AppendFile : noncopyable
 {
 private:
-  FILE* fp_;
-  char buf_[64*1024]; // 64 KiB 
-  off_t written_; 
+  static const size_t kBufSize = 64*1024; // 64 KiB 
 
-  size_t write(const char* line, size_t len);
+  const int fd_;
+  std::string name_;
+  std::unique_ptr<char[]> buf_;
+  size_t len_; // in buf_
+  off_t written_; // appended, including what is still in buf_
+  off_t size_; // of the file
+  off_t reserved_; // the end of the reserved space
+  off_t step_; // 0 if the file system can't reserve
+  off_t synced_; // size_ at the last sync()
+
+  void write(const char* data, size_t len);
+  void writeOut();
+  void reserve();
 public:
-  explicit AppendFile(std::string name);
+  explicit AppendFile(std::string name, off_t prealloc=0);
   ~AppendFile();
   void append(const char* line, size_t len);
+  // hands the buffer to the kernel
   void flush();
+  // and to the disk, fdatasync(2)
+  void sync();
+  // the file is renamed, it stays open. false if that failed
+  bool rename(const std::string& name);
   off_t written() const { return written_; }
+  // written since the last sync()
+  off_t unsynced() const { return size_ + static_cast<off_t>(len_) - synced_; }
+  const std::string& name() const { return name_; }
 };
 } // namespace futil
 } // namespace chtho
 
 
-#endif // !CHTHO_LOGGING_FILEUTIL_H
\ No newline at end of file
+#endif // !CHTHO_LOGGING_FILEUTIL_H
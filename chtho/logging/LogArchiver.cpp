@@ -0,0 +1,405 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "LogArchiver.h"
+#include "Logger.h"
+#include "threads/CurrentThread.h"
+#include "threads/MutexLockGuard.h"
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h> // kill
+#include <stdio.h>
+#include <stdlib.h> // atoi
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h> // setpriority
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace chtho
+{
+namespace
+{
+// the time at the start of a Logger line, "20210407 15:24:36.123456"
+const size_t kTimeLen = 24;
+
+bool isTime(const char* p, const char* end)
+{
+  if(static_cast<size_t>(end - p) < kTimeLen) return false;
+  static const char pattern[] = "dddddddd dd:dd:dd.dddddd";
+  for(size_t i = 0; i < kTimeLen; ++i)
+  {
+    if(pattern[i] == 'd' ? (p[i] < '0' || p[i] > '9') : p[i] != pattern[i])
+      return false;
+  }
+  return true;
+}
+
+// the time of the first line in [p, end) that has one
+std::string firstTime(const char* p, const char* end)
+{
+  while(p < end)
+  {
+    if(isTime(p, end)) return std::string(p, kTimeLen);
+    const char* nl = static_cast<const char*>(memchr(p, '\n', end - p));
+    if(!nl) break;
+    p = nl + 1;
+  }
+  return std::string();
+}
+
+// and of the last one
+std::string lastTime(const char* begin, const char* end)
+{
+  const char* p = end;
+  while(p > begin)
+  {
+    // the start of the line before p
+    const char* nl = static_cast<const char*>(memrchr(begin, '\n', p - 1 - begin));
+    const char* line = nl ? nl + 1 : begin;
+    if(isTime(line, end)) return std::string(line, kTimeLen);
+    p = line;
+  }
+  return std::string();
+}
+
+// a log file mapped for reading
+class MappedFile : noncopyable
+{
+private:
+  int fd_;
+  const char* data_;
+  size_t size_;
+public:
+  explicit MappedFile(const std::string& name)
+    : fd_(::open(name.c_str(), O_RDONLY|O_CLOEXEC)), data_(NULL), size_(0)
+  {
+    struct stat st;
+    if(fd_ < 0 || ::fstat(fd_, &st) != 0 || st.st_size == 0) return;
+    void* p = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if(p == MAP_FAILED) return;
+    ::madvise(p, st.st_size, MADV_SEQUENTIAL);
+    data_ = static_cast<const char*>(p);
+    size_ = st.st_size;
+  }
+  ~MappedFile()
+  {
+    if(data_) ::munmap(const_cast<char*>(data_), size_);
+    if(fd_ >= 0) ::close(fd_);
+  }
+  bool ok() const { return fd_ >= 0; }
+  const char* data() const { return data_; }
+  size_t size() const { return size_; }
+};
+
+struct Member
+{
+  std::string time;
+  off_t raw;
+  off_t gz;
+};
+
+// the end of the member that starts at off, at a line boundary
+size_t memberEnd(const char* data, size_t size, size_t off)
+{
+  size_t end = off + LogArchiver::kMemberSize;
+  if(end >= size) return size;
+  const char* nl = static_cast<const char*>(memchr(data + end - 1, '\n', size - end + 1));
+  return nl ? nl - data + 1 : size;
+}
+
+// one gzip member of [p, p + len) appended to out, its size or -1
+off_t deflateMember(const char* p, size_t len, int level, FILE* out)
+{
+  z_stream zs;
+  memset(&zs, 0, sizeof zs);
+  // 16 + 15: a gzip header, the largest window
+  if(deflateInit2(&zs, level, Z_DEFLATED, 16 + 15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    return -1;
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(p));
+  zs.avail_in = static_cast<uInt>(len);
+  off_t written = 0;
+  unsigned char buf[64*1024];
+  int ret;
+  do
+  {
+    zs.next_out = buf;
+    zs.avail_out = sizeof buf;
+    ret = deflate(&zs, Z_FINISH);
+    size_t n = sizeof buf - zs.avail_out;
+    if(fwrite(buf, 1, n, out) != n)
+    {
+      ret = Z_ERRNO;
+      break;
+    }
+    written += n;
+  } while(ret == Z_OK);
+  deflateEnd(&zs);
+  return ret == Z_STREAM_END ? written : -1;
+}
+
+bool writeIndex(const std::string& file, const std::string& first,
+  const std::string& last, const std::vector<Member>& members, bool gz)
+{
+  std::string tmp = file + ".idx.tmp";
+  FILE* out = ::fopen(tmp.c_str(), "we");
+  if(!out) return false;
+  fprintf(out, "first %s\nlast %s\n", first.c_str(), last.c_str());
+  for(const Member& m : members)
+  {
+    if(m.time.empty()) continue;
+    if(gz) fprintf(out, "%s %lld %lld\n", m.time.c_str(),
+      static_cast<long long>(m.raw), static_cast<long long>(m.gz));
+    else fprintf(out, "%s %lld -\n", m.time.c_str(), static_cast<long long>(m.raw));
+  }
+  bool ok = ::fclose(out) == 0;
+  if(ok) ok = ::rename(tmp.c_str(), (file + ".idx").c_str()) == 0;
+  if(!ok) ::unlink(tmp.c_str());
+  return ok;
+}
+
+bool endsWith(const std::string& s, const char* suffix)
+{
+  size_t n = strlen(suffix);
+  return s.size() >= n && s.compare(s.size() - n, n, suffix) == 0;
+}
+
+// the lowest priorities, for this thread only
+void lowerPriority()
+{
+  ::setpriority(PRIO_PROCESS, CurrentThread::tid(), 19);
+#ifdef SYS_ioprio_set
+  const int kWhoProcess = 1, kClassIdle = 3, kClassShift = 13;
+  ::syscall(SYS_ioprio_set, kWhoProcess, CurrentThread::tid(), kClassIdle << kClassShift);
+#endif
+}
+} // namespace
+
+LogArchiver::LogArchiver(const std::string& name, const Options& opts,
+    const std::string& current)
+  : name_(name),
+    opts_(opts),
+    cond_(mutex_),
+    current_(current),
+    running_(true),
+    thread_([this](){ threadFunc(); }, "LogArchiver")
+{
+  thread_.start();
+}
+
+LogArchiver::~LogArchiver()
+{
+  {
+    MutexLockGuard lock(mutex_);
+    running_ = false;
+    cond_.notify();
+  }
+  thread_.join();
+}
+
+void LogArchiver::archive(const std::string& file, const std::string& current)
+{
+  MutexLockGuard lock(mutex_);
+  files_.push_back(file);
+  current_ = current;
+  cond_.notify();
+}
+
+void LogArchiver::threadFunc()
+{
+  lowerPriority();
+  // what earlier runs have left
+  bool retain = true;
+  for(;;)
+  {
+    std::string file, current;
+    bool running;
+    {
+      MutexLockGuard lock(mutex_);
+      while(running_ && files_.empty() && !retain) cond_.wait();
+      if(!files_.empty())
+      {
+        file = files_.front();
+        files_.pop_front();
+      }
+      current = current_;
+      running = running_ || !files_.empty();
+    }
+    if(!file.empty())
+    {
+      std::string done = file;
+      if(opts_.compress && compress(file, opts_.level, opts_.index)) done = file + ".gz";
+      else if(!opts_.compress && opts_.index) index(file);
+      if(opts_.archived) opts_.archived(done);
+      retain = true;
+    }
+    if(retain && (opts_.maxAgeSecs > 0 || opts_.maxTotalBytes > 0))
+      enforceRetention(name_, current, opts_.maxAgeSecs, opts_.maxTotalBytes);
+    retain = false;
+    if(!running && file.empty()) break;
+  }
+}
+
+bool LogArchiver::compress(const std::string& file, int level, bool index)
+{
+  MappedFile in(file);
+  if(!in.ok()) return false;
+  std::string gz = file + ".gz";
+  std::string tmp = gz + ".tmp";
+  FILE* out = ::fopen(tmp.c_str(), "we");
+  if(!out) return false;
+  std::vector<Member> members;
+  const char* data = in.data();
+  size_t size = in.size();
+  off_t gzOff = 0;
+  bool ok = true;
+  for(size_t off = 0; ok && off < size; )
+  {
+    size_t end = memberEnd(data, size, off);
+    if(index)
+      members.push_back(Member{ firstTime(data + off, data + end), static_cast<off_t>(off), gzOff });
+    off_t n = deflateMember(data + off, end - off, level, out);
+    ok = n >= 0;
+    gzOff += n;
+    off = end;
+  }
+  ok = ::fclose(out) == 0 && ok;
+  if(ok) ok = ::rename(tmp.c_str(), gz.c_str()) == 0;
+  if(!ok)
+  {
+    ::unlink(tmp.c_str());
+    LOG_WARN << "LogArchiver can't compress " << file;
+    return false;
+  }
+  if(index) writeIndex(file, firstTime(data, data + size), lastTime(data, data + size),
+    members, true);
+  ::unlink(file.c_str());
+  return true;
+}
+
+bool LogArchiver::index(const std::string& file)
+{
+  MappedFile in(file);
+  if(!in.ok()) return false;
+  std::vector<Member> members;
+  const char* data = in.data();
+  size_t size = in.size();
+  for(size_t off = 0; off < size; )
+  {
+    size_t end = memberEnd(data, size, off);
+    members.push_back(Member{ firstTime(data + off, data + end), static_cast<off_t>(off), 0 });
+    off = end;
+  }
+  return writeIndex(file, firstTime(data, data + size), lastTime(data, data + size),
+    members, false);
+}
+
+namespace
+{
+bool digits(const std::string& s, size_t from, size_t to)
+{
+  if(from >= to) return false;
+  for(size_t i = from; i < to; ++i)
+    if(s[i] < '0' || s[i] > '9') return false;
+  return true;
+}
+
+// the host and pid of a file of the log name, i.e. of the form
+// name.YYYYMMDD-HHMMSS.host.pid.log[.gz] (see LogFile::filename).
+// false for any other file, e.g. those of a log named name.access
+bool parseLogName(const std::string& f, const std::string& name,
+  std::string* host, pid_t* pid)
+{
+  size_t end = f.size();
+  if(endsWith(f, ".gz")) end -= 3;
+  if(end < 4 || f.compare(end - 4, 4, ".log") != 0) return false;
+  end -= 4;
+  // the time, 15 characters between dots
+  size_t t = name.size() + 1;
+  if(f.size() < t + 16 || f.compare(0, name.size(), name) != 0 || f[name.size()] != '.'
+    || !digits(f, t, t + 8) || f[t + 8] != '-' || !digits(f, t + 9, t + 15)
+    || f[t + 15] != '.')
+    return false;
+  // the host may have dots of its own, the pid is after the last one
+  size_t dot = f.rfind('.', end - 1);
+  if(dot == std::string::npos || dot <= t + 16 || !digits(f, dot + 1, end)) return false;
+  host->assign(f, t + 16, dot - (t + 16));
+  *pid = static_cast<pid_t>(atoi(f.c_str() + dot + 1));
+  return true;
+}
+
+std::string hostName()
+{
+  char buf[256];
+  if(::gethostname(buf, sizeof buf) != 0) return "unknownhost";
+  buf[sizeof(buf) - 1] = '\0';
+  return buf;
+}
+
+// another process on this host that may still write its files
+bool liveOther(const std::string& host, pid_t pid)
+{
+  static const std::string self = hostName();
+  if(pid == ::getpid() || host != self) return false;
+  return ::kill(pid, 0) == 0 || errno == EPERM;
+}
+} // namespace
+
+int LogArchiver::enforceRetention(const std::string& name, const std::string& current,
+  int64_t maxAgeSecs, int64_t maxTotalBytes)
+{
+  struct Entry
+  {
+    std::string file;
+    time_t mtime;
+    int64_t size;
+  };
+  std::vector<Entry> entries;
+  int64_t total = 0;
+  DIR* d = ::opendir(".");
+  if(!d) return 0;
+  while(struct dirent* e = ::readdir(d))
+  {
+    std::string f = e->d_name;
+    std::string host;
+    pid_t pid;
+    if(!parseLogName(f, name, &host, &pid)) continue;
+    struct stat st;
+    if(::stat(f.c_str(), &st) != 0) continue;
+    total += st.st_size;
+    // the files of another process that is still running are left to
+    // its own archiver, the last of them may be its current file
+    if(f != current && !liveOther(host, pid))
+      entries.push_back(Entry{ f, st.st_mtime, st.st_size });
+  }
+  ::closedir(d);
+  // oldest first
+  std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b)
+    { return a.mtime != b.mtime ? a.mtime < b.mtime : a.file < b.file; });
+  time_t now = ::time(NULL);
+  int removed = 0;
+  for(const Entry& e : entries)
+  {
+    bool old = maxAgeSecs > 0 && now - e.mtime > maxAgeSecs;
+    bool big = maxTotalBytes > 0 && total > maxTotalBytes;
+    if(!old && !big) break;
+    if(::unlink(e.file.c_str()) != 0) continue;
+    std::string log = endsWith(e.file, ".gz") ? e.file.substr(0, e.file.size() - 3) : e.file;
+    ::unlink((log + ".idx").c_str());
+    total -= e.size;
+    ++removed;
+  }
+  return removed;
+}
+} // namespace chtho
@@ -0,0 +1,91 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_LOGGING_LOGARCHIVER_H
+#define CHTHO_LOGGING_LOGARCHIVER_H
+// What happens to a log file after LogFile has rolled past it
+
+#include "base/noncopyable.h"
+#include "threads/Condition.h"
+#include "threads/MutexLock.h"
+#include "threads/Thread.h"
+
+#include <deque>
+#include <functional>
+#include <string>
+
+#include <stdint.h>
+#include <sys/types.h> // off_t
+
+namespace chtho
+{
+// compresses the rolled files of a LogFile, writes their index and
+// removes the ones past the retention limits, on a thread of its own
+// that runs at the lowest CPU and IO priority.
+// a compressed file, <file>.gz, is a series of gzip members of about
+// 1 MB of lines each, zcat reads it as one. the index, <file>.idx,
+// lists where each member starts, so a time range can be read without
+// inflating what comes before it:
+//   first <time of the first line>
+//   last <time of the last line>
+//   <time of the member's first line> <offset in the log> <offset in the .gz>
+// the times are the Logger's, lines without one are skipped
+class LogArchiver : noncopyable
+{
+public:
+  // called with the file's final name once it is archived
+  using Callback = std::function<void(const std::string& file)>;
+  struct Options
+  {
+    bool compress;
+    int level; // zlib's, 1 (fastest) by default
+    bool index;
+    // retention, 0 for no limit. the age is from the last change,
+    // the size counts every file of the log. the current one is
+    // never removed, nor are the files of other processes on this
+    // host that are still running
+    int64_t maxAgeSecs;
+    int64_t maxTotalBytes;
+    Callback archived;
+
+    Options()
+      : compress(true), level(1), index(false), maxAgeSecs(0), maxTotalBytes(0)
+    {}
+  };
+  static const off_t kMemberSize = 1024*1024;
+
+private:
+  const std::string name_; // of the LogFile
+  const Options opts_;
+  MutexLock mutex_;
+  Condition cond_;
+  std::deque<std::string> files_;
+  std::string current_;
+  bool running_;
+  Thread thread_;
+
+  void threadFunc();
+public:
+  // current is the file the LogFile is writing
+  LogArchiver(const std::string& name, const Options& opts, const std::string& current);
+  // archives what has been handed over so far
+  ~LogArchiver();
+  // file has been closed, current is the one the LogFile rolled to
+  void archive(const std::string& file, const std::string& current);
+
+  // the steps, synchronous. compress() leaves file as it is if it
+  // fails, index alone writes the index of the uncompressed file with
+  // '-' for the offsets in the .gz
+  static bool compress(const std::string& file, int level, bool index);
+  static bool index(const std::string& file);
+  // removes the files of the log name (named as by LogFile) in the
+  // working directory that are past the limits, oldest first,
+  // returns how many
+  static int enforceRetention(const std::string& name, const std::string& current,
+    int64_t maxAgeSecs, int64_t maxTotalBytes);
+};
+} // namespace chtho
+
+#endif // !CHTHO_LOGGING_LOGARCHIVER_H
@@ -4,13 +4,148 @@
 // https://opensource.org/licenses/MIT
 
 #include "LogFile.h"
+#include "threads/Condition.h"
+#include "threads/Thread.h"
 
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include <dirent.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
 #include <unistd.h> // gethostname 
 
 namespace chtho
 {
 using namespace futil;
 
+namespace
+{
+// the disk space reserved ahead of the end of a log file
+const off_t kPrealloc = 8*1024*1024; // 8 MB
+
+// removes the .<name>.<pid>.next files left behind by processes that
+// died before their roller could, each holds up to kPrealloc of disk
+void removeStaleNext(const std::string& name)
+{
+  const std::string prefix = "." + name + ".";
+  const std::string suffix = ".next";
+  DIR* d = ::opendir(".");
+  if(!d) return;
+  while(struct dirent* e = ::readdir(d))
+  {
+    std::string f(e->d_name);
+    if(f.size() <= prefix.size() + suffix.size()
+      || f.compare(0, prefix.size(), prefix) != 0
+      || f.compare(f.size() - suffix.size(), suffix.size(), suffix) != 0)
+      continue;
+    std::string id = f.substr(prefix.size(), f.size() - prefix.size() - suffix.size());
+    if(id.find_first_not_of("0123456789") != std::string::npos || id.size() > 9) continue;
+    pid_t pid = static_cast<pid_t>(::atoi(id.c_str()));
+    // only a pid that surely is gone, EPERM means it is alive
+    if(pid > 0 && pid != ::getpid() && ::kill(pid, 0) < 0 && errno == ESRCH)
+      ::unlink(f.c_str());
+  }
+  ::closedir(d);
+}
+} // namespace
+
+class LogFile::Roller : noncopyable
+{
+private:
+  const std::string tmpName_; // of the next file until the roll
+  const off_t prealloc_;
+  MutexLock mutex_;
+  Condition cond_;
+  std::unique_ptr<AppendFile> next_;
+  struct Retired
+  {
+    std::unique_ptr<AppendFile> file;
+    bool sync; // before closing it
+    std::function<void()> closed;
+  };
+  std::vector<Retired> retired_;
+  bool running_;
+  Thread thread_;
+
+  void threadFunc()
+  {
+    for(;;)
+    {
+      std::vector<Retired> retired;
+      bool running, prepare;
+      {
+        MutexLockGuard lock(mutex_);
+        while(running_ && retired_.empty() && next_) cond_.wait();
+        retired.swap(retired_);
+        running = running_;
+        prepare = running_ && !next_;
+      }
+      for(Retired& r : retired)
+      {
+        if(r.sync) r.file->sync();
+        r.file.reset();
+        if(r.closed) r.closed();
+      }
+      retired.clear();
+      if(prepare)
+      {
+        std::unique_ptr<AppendFile> f(new AppendFile(tmpName_, prealloc_));
+        MutexLockGuard lock(mutex_);
+        next_ = std::move(f);
+      }
+      if(!running) break;
+    }
+  }
+public:
+  // the next file is hidden from ls by a leading '.'
+  Roller(const std::string& name, off_t prealloc)
+    : tmpName_("." + name + "." + std::to_string(::getpid()) + ".next"),
+      prealloc_(prealloc),
+      cond_(mutex_),
+      running_(true),
+      thread_([this](){ threadFunc(); }, "LogRoller")
+  {
+    removeStaleNext(name);
+    thread_.start();
+  }
+  ~Roller()
+  {
+    {
+      MutexLockGuard lock(mutex_);
+      running_ = false;
+      cond_.notify();
+    }
+    thread_.join();
+    if(next_) ::unlink(next_->name().c_str());
+  }
+
+  // the next file under its final name, NULL if it isn't ready. it is
+  // renamed with the lock held, otherwise the thread could open the
+  // hidden name for the one after while it still is this file
+  std::unique_ptr<AppendFile> take(const std::string& name)
+  {
+    std::unique_ptr<AppendFile> f;
+    MutexLockGuard lock(mutex_);
+    f.swap(next_);
+    if(f && !f->rename(name))
+    {
+      ::unlink(f->name().c_str());
+      f.reset();
+    }
+    cond_.notify();
+    return f;
+  }
+  void retire(std::unique_ptr<AppendFile> f, bool sync, std::function<void()> closed)
+  {
+    MutexLockGuard lock(mutex_);
+    retired_.push_back(Retired{ std::move(f), sync, std::move(closed) });
+    cond_.notify();
+  }
+};
+
 LogFile::LogFile(const std::string& name, off_t rollsz, bool threadsafe,
     int flushInter, int checkEveryN)
   : name_(name),
@@ -21,12 +156,36 @@ LogFile::LogFile(const std::string& name, off_t rollsz, bool threadsafe,
     mutex_(threadsafe?new MutexLock:nullptr),
     startOfPeriod_(0),
     lastRoll_(0),
-    lastFlush_(0)
+    lastFlush_(0),
+    prealloc_(std::min(rollsz, kPrealloc)),
+    sync_(Sync::None),
+    syncBytes_(0)
 {
   assert(name.find('/') == std::string::npos); // will not find '/' in name
   roll();
 }
-LogFile::~LogFile() = default;
+LogFile::~LogFile()
+{
+  if(sync_ != Sync::None) file_->sync();
+  file_.reset();
+  // the roller hands the files it closes to the archiver
+  roller_.reset();
+  archiver_.reset();
+}
+void LogFile::setSync(Sync policy, off_t bytes)
+{
+  sync_ = policy;
+  syncBytes_ = bytes;
+}
+void LogFile::setBackgroundRoll(bool on)
+{
+  if(on && !roller_) roller_.reset(new Roller(name_, prealloc_));
+  else if(!on) roller_.reset();
+}
+void LogFile::setArchive(const LogArchiver::Options& opts)
+{
+  archiver_.reset(new LogArchiver(name_, opts, file_->name()));
+}
 void LogFile::append(const char* line, int len)
 {
   if(mutex_)
@@ -41,13 +200,19 @@ void LogFile::flush()
   if(mutex_)
   {
     MutexLockGuard lock(*mutex_);
-    file_->flush();
+    flush_unlocked();
   }
+  else flush_unlocked();
+}
+void LogFile::flush_unlocked()
+{
+  if(sync_ == Sync::Flush) file_->sync();
   else file_->flush();
 }
 void LogFile::append_unlocked(const char* line, int len)
 {
   file_->append(line, len);
+  if(sync_ == Sync::Bytes && file_->unsynced() >= syncBytes_) file_->sync();
   if(file_->written() > rollsz_) roll();
   else  
   {
@@ -61,7 +226,7 @@ void LogFile::append_unlocked(const char* line, int len)
       else if(now - lastFlush_ > flushInter_)
       {
         lastFlush_ = now;
-        file_->flush(); 
+        flush_unlocked();
       }
     }
   }
@@ -76,7 +241,27 @@ bool LogFile::roll()
     lastRoll_ = now;
     lastFlush_ = now;
     startOfPeriod_ = start;
-    file_.reset(new AppendFile(name));
+    std::unique_ptr<AppendFile> file;
+    if(roller_) file = roller_->take(name);
+    if(!file) file.reset(new AppendFile(name, prealloc_));
+    if(file_)
+    {
+      std::function<void()> closed;
+      if(archiver_)
+      {
+        LogArchiver* archiver = archiver_.get();
+        std::string old = file_->name(), cur = file->name();
+        closed = [archiver, old, cur](){ archiver->archive(old, cur); };
+      }
+      if(roller_) roller_->retire(std::move(file_), sync_ != Sync::None, std::move(closed));
+      else
+      {
+        if(sync_ != Sync::None) file_->sync();
+        file_.reset();
+        if(closed) closed();
+      }
+    }
+    file_ = std::move(file);
     return true;
   }
   return false;
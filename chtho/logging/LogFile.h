@@ -10,6 +10,7 @@
 #include "base/noncopyable.h"
 #include "threads/MutexLockGuard.h"
 #include "FileUtil.h"
+#include "LogArchiver.h"
 
 #include <string> 
 #include <memory> 
@@ -19,7 +20,18 @@ namespace chtho
 using namespace futil;
 class LogFile : noncopyable
 {
+public:
+  // when the data goes to the disk, not just to the page cache
+  enum class Sync
+  {
+    None, // when the kernel gets to it, the default
+    Flush, // on every flush()
+    Bytes, // every so many bytes
+  };
+
 private:
+  class Roller; // see LogFile.cpp
+
   const std::string name_;
   const off_t rollsz_;
   const int flushInter_; // flush interval 
@@ -32,15 +44,31 @@ private:
   time_t lastRoll_;
   time_t lastFlush_;
   std::unique_ptr<AppendFile> file_;
+  const off_t prealloc_;
+  Sync sync_;
+  off_t syncBytes_;
+  std::unique_ptr<LogArchiver> archiver_;
+  std::unique_ptr<Roller> roller_;
 
   static const int rollPerSec_ = 60*60*24; // 60 days
 
   static std::string filename(const std::string& name, time_t* now); 
   void append_unlocked(const char* line, int len);
+  void flush_unlocked();
 public:
   LogFile(const std::string& name, off_t rollsz, bool threadsafe=true,
       int flushInter=3, int checkEveryN=1024);
   ~LogFile();
+  // the setters aren't thread safe, call them before the LogFile is
+  // shared. the file a roll closes is synced as well
+  void setSync(Sync policy, off_t bytes=0);
+  // a thread of its own opens the next file ahead of time and closes
+  // the old ones, a roll only renames the next file then. the hidden
+  // next files of processes that died with theirs open are removed
+  void setBackgroundRoll(bool on);
+  // compression, index and retention of the files rolled past, see
+  // LogArchiver. off by default
+  void setArchive(const LogArchiver::Options& opts);
   void append(const char* line, int len);
   void flush();
   bool roll();
@@ -0,0 +1,30 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "LogSampling.h"
+
+#include <time.h>
+
+namespace chtho
+{
+int64_t LogSite::now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+bool LogSite::everyT(double secs)
+{
+  int64_t t = now();
+  int64_t next = next_.load(std::memory_order_relaxed);
+  if(t < next) return skip();
+  // only the thread that moves next_ on writes
+  if(!next_.compare_exchange_strong(next, t + static_cast<int64_t>(secs * 1000000),
+      std::memory_order_relaxed))
+    return skip();
+  return pass();
+}
+} // namespace chtho
@@ -0,0 +1,84 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_LOGGING_LOGSAMPLING_H
+#define CHTHO_LOGGING_LOGSAMPLING_H
+// Log statements that write only some of the times they run
+
+#include "base/noncopyable.h"
+#include "Logger.h"
+
+#include <atomic>
+#include <stdint.h>
+
+namespace chtho
+{
+// the state of one sampled log statement. every LOG_EVERY_N etc.
+// has its own, a static that is constant initialized, so there is
+// no guard to check. a statement that is skipped is counted and
+// nothing else, no Logger is made and the operands of its << chain
+// aren't evaluated. the next line it writes starts with
+// "(N suppressed)"
+class LogSite : noncopyable
+{
+private:
+  std::atomic<uint64_t> count_; // times the statement ran
+  std::atomic<uint64_t> skipped_; // since the last line written
+  std::atomic<int64_t> next_; // LOG_EVERY_T: when a line may be written again
+
+  bool pass()
+  {
+    if(skipped_.load(std::memory_order_relaxed) != 0)
+      t_logSuppressed += skipped_.exchange(0, std::memory_order_relaxed);
+    return true;
+  }
+  bool skip()
+  {
+    skipped_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+  }
+
+public:
+  constexpr LogSite() : count_(0), skipped_(0), next_(0) {}
+
+  // the 1st, the n+1th, the 2n+1th... time
+  bool everyN(uint64_t n)
+  {
+    uint64_t c = count_.fetch_add(1, std::memory_order_relaxed);
+    return n <= 1 || c % n == 0 ? pass() : skip();
+  }
+  // the first n times. afterwards only a load
+  bool firstN(uint64_t n)
+  {
+    if(count_.load(std::memory_order_relaxed) >= n) return skip();
+    return count_.fetch_add(1, std::memory_order_relaxed) < n ? pass() : skip();
+  }
+  // at most once every secs seconds, by now()
+  bool everyT(double secs);
+
+  // a monotonic time in microseconds that is cheap to read, it
+  // moves on with the timer tick (a few ms)
+  static int64_t now();
+};
+} // namespace chtho
+
+// one LogSite for every place the macro is expanded in: each lambda
+// is of a type of its own, and so is its static
+#define CHTHO_LOG_SITE() \
+  ([]() -> chtho::LogSite& { static chtho::LogSite site; return site; }())
+
+// the level is checked first, a statement below it doesn't count
+#define CHTHO_LOG_SAMPLED(lvl, check) \
+  !(CHTHO_LOG_ENABLED(lvl) && CHTHO_LOG_SITE().check && CHTHO_LOG_ADMIT(lvl)) \
+    ? (void)0 : chtho::LogVoidify() & \
+  chtho::Logger(CHTHO_SOURCE_FILE, __LINE__, lvl).stream()
+
+// LOG_EVERY_N(ERR, 100) << "...";  lvl is TRACE, DEBUG, INFO, WARN or ERR
+#define LOG_EVERY_N(lvl, n) CHTHO_LOG_SAMPLED(chtho::Logger::Level::lvl, everyN(n))
+#define LOG_FIRST_N(lvl, n) CHTHO_LOG_SAMPLED(chtho::Logger::Level::lvl, firstN(n))
+// LOG_EVERY_T(ERR, 1.0) << "...";  at most once a second
+#define LOG_EVERY_T(lvl, secs) CHTHO_LOG_SAMPLED(chtho::Logger::Level::lvl, everyT(secs))
+
+#endif // !CHTHO_LOGGING_LOGSAMPLING_H
@@ -0,0 +1,33 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_LOGGING_LOGSINK_H
+#define CHTHO_LOGGING_LOGSINK_H
+// Where the back end of AsyncLogging writes to
+
+#include "base/noncopyable.h"
+
+#include <stddef.h>
+#include <stdint.h> // SIZE_MAX
+
+namespace chtho
+{
+// a LogFile by default. all calls come from the back end thread. a
+// round of the back end appends whole lines, a thread's lines in
+// order, and ends with flush()
+class LogSink : noncopyable
+{
+public:
+  virtual ~LogSink() {}
+  virtual void append(const char* data, int len) = 0;
+  virtual void flush() = 0;
+  // the bytes the sink takes now. the lines of a thread that don't
+  // fit stay in its ring and the overflow policy applies to them,
+  // that is how a slow sink pushes back on the front ends. at stop()
+  // the sink gets whatever is left regardless
+  virtual size_t room() { return SIZE_MAX; }
+};
+} // namespace chtho
+#endif // !CHTHO_LOGGING_LOGSINK_H
@@ -5,9 +5,389 @@
 
 #include "LogStream.h"
 
+#include <cmath> // signbit
+#include <limits>
+
 namespace chtho
 {
-const char digits[] = "9876543210123456789";
-const char* pzo = digits + 9;
-  
+const char digitPairs[] =
+  "00010203040506070809"
+  "10111213141516171819"
+  "20212223242526272829"
+  "30313233343536373839"
+  "40414243444546474849"
+  "50515253545556575859"
+  "60616263646566676869"
+  "70717273747576777879"
+  "80818283848586878889"
+  "90919293949596979899";
+
+size_t convertHex(char buf[], uintptr_t value)
+{
+  static const char hex[] = "0123456789abcdef";
+  int n = 1;
+  for(uintptr_t v = value >> 4; v; v >>= 4) ++n;
+  buf[0] = '0';
+  buf[1] = 'x';
+  char* p = buf + 2 + n;
+  do
+  {
+    *--p = hex[value & 0xf];
+    value >>= 4;
+  } while(value);
+  return 2 + n;
+}
+
+namespace
+{
+// Grisu2 by Florian Loitsch, "Printing Floating-Point Numbers Quickly
+// and Accurately with Integers" (PLDI 2010). the value and its two
+// boundaries are scaled by a cached power of ten into a range where
+// the digits fall out of a 64-bit integer. the result always reads
+// back as the same value and is the shortest one in all but a few
+// cases, without any big integer arithmetic
+struct DiyFp // f * 2^e
+{
+  uint64_t f;
+  int e;
+  DiyFp(uint64_t f_, int e_) : f(f_), e(e_) {}
+};
+
+DiyFp sub(DiyFp x, DiyFp y) { return DiyFp(x.f - y.f, x.e); }
+
+// the upper 64 bits of the 128-bit product, rounded
+DiyFp mul(DiyFp x, DiyFp y)
+{
+  const uint64_t M32 = 0xFFFFFFFFu;
+  uint64_t a = x.f >> 32, b = x.f & M32;
+  uint64_t c = y.f >> 32, d = y.f & M32;
+  uint64_t ac = a * c, bc = b * c, ad = a * d, bd = b * d;
+  uint64_t mid = (bd >> 32) + (ad & M32) + (bc & M32);
+  mid += 1u << 31; // round
+  return DiyFp(ac + (ad >> 32) + (bc >> 32) + (mid >> 32), x.e + y.e + 64);
+}
+
+DiyFp normalize(DiyFp x)
+{
+  while((x.f >> 63) == 0)
+  {
+    x.f <<= 1;
+    --x.e;
+  }
+  return x;
+}
+
+// the value with its lower and upper boundary, the midpoints to its
+// neighbours, all normalized to the exponent of the upper one
+template<typename Float, typename Bits>
+void boundaries(Float value, DiyFp* v, DiyFp* minus, DiyFp* plus)
+{
+  const int kPrecision = std::numeric_limits<Float>::digits; // with the hidden bit
+  const int kBias = std::numeric_limits<Float>::max_exponent - 1 + (kPrecision - 1);
+  const int kMinExp = 1 - kBias;
+  const uint64_t kHiddenBit = uint64_t(1) << (kPrecision - 1);
+  Bits bits;
+  memcpy(&bits, &value, sizeof bits);
+  uint64_t E = bits >> (kPrecision - 1);
+  uint64_t F = bits & (kHiddenBit - 1);
+  DiyFp w = E == 0 ? DiyFp(F, kMinExp)
+    : DiyFp(F + kHiddenBit, static_cast<int>(E) - kBias);
+  // the gap below a power of two is half the one above it
+  bool lowerCloser = F == 0 && E > 1;
+  DiyFp p = normalize(DiyFp(2*w.f + 1, w.e - 1));
+  DiyFp m = lowerCloser ? DiyFp(4*w.f - 1, w.e - 2) : DiyFp(2*w.f - 1, w.e - 1);
+  m.f <<= m.e - p.e;
+  m.e = p.e;
+  *v = normalize(w);
+  *minus = m;
+  *plus = p;
+}
+
+struct CachedPower
+{
+  uint64_t f;
+  int e;
+  int k; // 10^k = f * 2^e
+};
+
+// 10^k for k = -300, -292, ... 324, rounded to 64 bits
+const CachedPower kCachedPowers[] =
+{
+  { 0xAB70FE17C79AC6CA, -1060, -300 },
+  { 0xFF77B1FCBEBCDC4F, -1034, -292 },
+  { 0xBE5691EF416BD60C, -1007, -284 },
+  { 0x8DD01FAD907FFC3C,  -980, -276 },
+  { 0xD3515C2831559A83,  -954, -268 },
+  { 0x9D71AC8FADA6C9B5,  -927, -260 },
+  { 0xEA9C227723EE8BCB,  -901, -252 },
+  { 0xAECC49914078536D,  -874, -244 },
+  { 0x823C12795DB6CE57,  -847, -236 },
+  { 0xC21094364DFB5637,  -821, -228 },
+  { 0x9096EA6F3848984F,  -794, -220 },
+  { 0xD77485CB25823AC7,  -768, -212 },
+  { 0xA086CFCD97BF97F4,  -741, -204 },
+  { 0xEF340A98172AACE5,  -715, -196 },
+  { 0xB23867FB2A35B28E,  -688, -188 },
+  { 0x84C8D4DFD2C63F3B,  -661, -180 },
+  { 0xC5DD44271AD3CDBA,  -635, -172 },
+  { 0x936B9FCEBB25C996,  -608, -164 },
+  { 0xDBAC6C247D62A584,  -582, -156 },
+  { 0xA3AB66580D5FDAF6,  -555, -148 },
+  { 0xF3E2F893DEC3F126,  -529, -140 },
+  { 0xB5B5ADA8AAFF80B8,  -502, -132 },
+  { 0x87625F056C7C4A8B,  -475, -124 },
+  { 0xC9BCFF6034C13053,  -449, -116 },
+  { 0x964E858C91BA2655,  -422, -108 },
+  { 0xDFF9772470297EBD,  -396, -100 },
+  { 0xA6DFBD9FB8E5B88F,  -369,  -92 },
+  { 0xF8A95FCF88747D94,  -343,  -84 },
+  { 0xB94470938FA89BCF,  -316,  -76 },
+  { 0x8A08F0F8BF0F156B,  -289,  -68 },
+  { 0xCDB02555653131B6,  -263,  -60 },
+  { 0x993FE2C6D07B7FAC,  -236,  -52 },
+  { 0xE45C10C42A2B3B06,  -210,  -44 },
+  { 0xAA242499697392D3,  -183,  -36 },
+  { 0xFD87B5F28300CA0E,  -157,  -28 },
+  { 0xBCE5086492111AEB,  -130,  -20 },
+  { 0x8CBCCC096F5088CC,  -103,  -12 },
+  { 0xD1B71758E219652C,   -77,   -4 },
+  { 0x9C40000000000000,   -50,    4 },
+  { 0xE8D4A51000000000,   -24,   12 },
+  { 0xAD78EBC5AC620000,     3,   20 },
+  { 0x813F3978F8940984,    30,   28 },
+  { 0xC097CE7BC90715B3,    56,   36 },
+  { 0x8F7E32CE7BEA5C70,    83,   44 },
+  { 0xD5D238A4ABE98068,   109,   52 },
+  { 0x9F4F2726179A2245,   136,   60 },
+  { 0xED63A231D4C4FB27,   162,   68 },
+  { 0xB0DE65388CC8ADA8,   189,   76 },
+  { 0x83C7088E1AAB65DB,   216,   84 },
+  { 0xC45D1DF942711D9A,   242,   92 },
+  { 0x924D692CA61BE758,   269,  100 },
+  { 0xDA01EE641A708DEA,   295,  108 },
+  { 0xA26DA3999AEF774A,   322,  116 },
+  { 0xF209787BB47D6B85,   348,  124 },
+  { 0xB454E4A179DD1877,   375,  132 },
+  { 0x865B86925B9BC5C2,   402,  140 },
+  { 0xC83553C5C8965D3D,   428,  148 },
+  { 0x952AB45CFA97A0B3,   455,  156 },
+  { 0xDE469FBD99A05FE3,   481,  164 },
+  { 0xA59BC234DB398C25,   508,  172 },
+  { 0xF6C69A72A3989F5C,   534,  180 },
+  { 0xB7DCBF5354E9BECE,   561,  188 },
+  { 0x88FCF317F22241E2,   588,  196 },
+  { 0xCC20CE9BD35C78A5,   614,  204 },
+  { 0x98165AF37B2153DF,   641,  212 },
+  { 0xE2A0B5DC971F303A,   667,  220 },
+  { 0xA8D9D1535CE3B396,   694,  228 },
+  { 0xFB9B7CD9A4A7443C,   720,  236 },
+  { 0xBB764C4CA7A44410,   747,  244 },
+  { 0x8BAB8EEFB6409C1A,   774,  252 },
+  { 0xD01FEF10A657842C,   800,  260 },
+  { 0x9B10A4E5E9913129,   827,  268 },
+  { 0xE7109BFBA19C0C9D,   853,  276 },
+  { 0xAC2820D9623BF429,   880,  284 },
+  { 0x80444B5E7AA7CF85,   907,  292 },
+  { 0xBF21E44003ACDD2D,   933,  300 },
+  { 0x8E679C2F5E44FF8F,   960,  308 },
+  { 0xD433179D9C8CB841,   986,  316 },
+  { 0x9E19DB92B4E31BA9,  1013,  324 },
+};
+
+// the scaled exponent lands in [kAlpha, kGamma]
+const int kAlpha = -60;
+const int kGamma = -32;
+
+CachedPower cachedPower(int e)
+{
+  // k = ceil((kAlpha - e - 1) * log10(2))
+  int f = kAlpha - e - 1;
+  int k = (f * 78913) / (1 << 18) + (f > 0);
+  int index = (300 + k + 7) / 8;
+  return kCachedPowers[index];
+}
+
+// the number of decimal digits of n, and 10^(count-1)
+int largestPow10(uint32_t n, uint32_t* pow10)
+{
+  static const uint32_t kPow10[] = { 1, 10, 100, 1000, 10000, 100000,
+    1000000, 10000000, 100000000, 1000000000 };
+  int count = 10;
+  while(count > 1 && n < kPow10[count-1]) --count;
+  *pow10 = kPow10[count-1];
+  return count;
+}
+
+// moves the last digit towards w while that stays inside the bounds
+void roundWeed(char* buf, int len, uint64_t dist, uint64_t delta,
+  uint64_t rest, uint64_t tenK)
+{
+  while(rest < dist && delta - rest >= tenK
+    && (rest + tenK < dist || dist - rest > rest + tenK - dist))
+  {
+    --buf[len-1];
+    rest += tenK;
+  }
+}
+
+// generates the digits of w = (M-, M+), stopping as soon as they
+// identify a number inside the interval
+void digitGen(char* buf, int* len, int* k, DiyFp mMinus, DiyFp w, DiyFp mPlus)
+{
+  uint64_t delta = sub(mPlus, mMinus).f;
+  uint64_t dist = sub(mPlus, w).f;
+  const int shift = -mPlus.e;
+  const uint64_t one = uint64_t(1) << shift;
+  uint32_t p1 = static_cast<uint32_t>(mPlus.f >> shift); // integral part
+  uint64_t p2 = mPlus.f & (one - 1);                     // fractional part
+  uint32_t pow10;
+  int n = largestPow10(p1, &pow10);
+  while(n > 0)
+  {
+    buf[(*len)++] = static_cast<char>('0' + p1 / pow10);
+    p1 %= pow10;
+    --n;
+    uint64_t rest = (static_cast<uint64_t>(p1) << shift) + p2;
+    if(rest <= delta)
+    {
+      *k += n;
+      roundWeed(buf, *len, dist, delta, rest, static_cast<uint64_t>(pow10) << shift);
+      return;
+    }
+    pow10 /= 10;
+  }
+  int m = 0;
+  for(;;)
+  {
+    p2 *= 10;
+    buf[(*len)++] = static_cast<char>('0' + (p2 >> shift));
+    p2 &= one - 1;
+    ++m;
+    delta *= 10;
+    dist *= 10;
+    if(p2 <= delta) break;
+  }
+  *k -= m;
+  roundWeed(buf, *len, dist, delta, p2, one);
+}
+
+// value = buf[0, len) * 10^k
+template<typename Float, typename Bits>
+void grisu2(Float value, char* buf, int* len, int* k)
+{
+  DiyFp v(0, 0), minus(0, 0), plus(0, 0);
+  boundaries<Float, Bits>(value, &v, &minus, &plus);
+  CachedPower c = cachedPower(plus.e);
+  DiyFp cp(c.f, c.e);
+  DiyFp w = mul(v, cp);
+  DiyFp wMinus = mul(minus, cp);
+  DiyFp wPlus = mul(plus, cp);
+  // one unit of imprecision on either side
+  wMinus.f += 1;
+  wPlus.f -= 1;
+  *len = 0;
+  *k = -c.k;
+  digitGen(buf, len, k, wMinus, w, wPlus);
+}
+
+// d.ddde+XX, at least two exponent digits like printf
+char* appendExp(char* p, int e)
+{
+  *p++ = 'e';
+  if(e < 0)
+  {
+    *p++ = '-';
+    e = -e;
+  }
+  else *p++ = '+';
+  if(e >= 100)
+  {
+    *p++ = static_cast<char>('0' + e / 100);
+    e %= 100;
+  }
+  memcpy(p, digitPairs + e * 2, 2);
+  return p + 2;
+}
+
+// the digits with the decimal point at position pt: fixed notation
+// when -4 < pt <= 17, like %g, scientific otherwise
+size_t format(char buf[], const char* digits, int len, int pt)
+{
+  char* p = buf;
+  if(len <= pt && pt <= 17) // 12300
+  {
+    memcpy(p, digits, len);
+    memset(p + len, '0', pt - len);
+    p += pt;
+  }
+  else if(0 < pt && pt <= 17) // 12.3
+  {
+    memcpy(p, digits, pt);
+    p[pt] = '.';
+    memcpy(p + pt + 1, digits + pt, len - pt);
+    p += len + 1;
+  }
+  else if(-4 < pt && pt <= 0) // 0.00123
+  {
+    *p++ = '0';
+    *p++ = '.';
+    memset(p, '0', -pt);
+    p += -pt;
+    memcpy(p, digits, len);
+    p += len;
+  }
+  else // 1.23e+20
+  {
+    *p++ = digits[0];
+    if(len > 1)
+    {
+      *p++ = '.';
+      memcpy(p, digits + 1, len - 1);
+      p += len - 1;
+    }
+    p = appendExp(p, pt - 1);
+  }
+  return p - buf;
+}
+
+template<typename Float, typename Bits>
+size_t convertFloating(char buf[], Float value)
+{
+  char* p = buf;
+  if(value != value)
+  {
+    memcpy(p, "nan", 3);
+    return 3;
+  }
+  if(std::signbit(value))
+  {
+    *p++ = '-';
+    value = -value;
+  }
+  if(value == std::numeric_limits<Float>::infinity())
+  {
+    memcpy(p, "inf", 3);
+    return p + 3 - buf;
+  }
+  if(value == 0)
+  {
+    *p = '0';
+    return p + 1 - buf;
+  }
+  char digits[24];
+  int len, k;
+  grisu2<Float, Bits>(value, digits, &len, &k);
+  return p - buf + format(p, digits, len, len + k);
+}
+} // namespace
+
+size_t convertFloat(char buf[], double value)
+{
+  return convertFloating<double, uint64_t>(buf, value);
+}
+
+size_t convertFloat(char buf[], float value)
+{
+  return convertFloating<float, uint32_t>(buf, value);
+}
 } // namespace chtho
@@ -10,17 +10,23 @@
 #include "FixedBuffer.h"
 
 #include <cstddef> // size_t 
-#include <cstdio> // snprintf
-#include <cstring> // strlen 
+#include <cstdint> // uintptr_t
+#include <cstring> // strlen, memcpy
 #include <string>
 #include <type_traits> // enable_if, is_integral, is_floating_point
-#include <algorithm> // reverse
 
 namespace chtho
 {
 static const int kMaxNumSize = 32; 
+// the formatters below write at most kMaxNumSize bytes, no '\0'
 template<typename T>
 size_t convert(char buf[], T value);
+// "0x" and the lowercase hex digits
+size_t convertHex(char buf[], uintptr_t value);
+// the shortest digits that read back as the same value (Grisu2),
+// in the style of %g: 0.1, 1e+20, 1.5e-07, nan, -inf
+size_t convertFloat(char buf[], double value);
+size_t convertFloat(char buf[], float value);
 // rewrite output stream for log, like iostream
 class LogStream : noncopyable
 {
@@ -68,7 +74,7 @@ public:
     typename std::enable_if<std::is_integral<Integer>::value, bool>::type = true>
   self& operator<<(Integer v)
   {
-    if(buffer_.avail() >= static_cast<int>(sizeof(v)))
+    if(buffer_.avail() >= kMaxNumSize)
     {
       size_t len = convert(buffer_.cur(), v);
       buffer_.add(len);
@@ -82,7 +88,7 @@ public:
   {
     if(buffer_.avail() >= kMaxNumSize)
     {
-      size_t len = snprintf(buffer_.cur(), kMaxNumSize, "%.12g", v);
+      size_t len = convertFloat(buffer_.cur(), v);
       buffer_.add(len);
     }
     return *this;
@@ -94,36 +100,67 @@ public:
   {
     if(buffer_.avail() >= kMaxNumSize)
     {
-      int len = snprintf(buffer_.cur(), kMaxNumSize, "%p", p);
+      size_t len = convertHex(buffer_.cur(), reinterpret_cast<uintptr_t>(p));
       buffer_.add(len);
     }
     return *this;
   }
 
+  void append(const char* data, int len) { buffer_.append(data, len); }
   const Buffer& buffer() const { return buffer_; }
 private:
   Buffer buffer_; 
 };
 
-extern const char digits[];
-extern const char* pzo;
+// "00" "01" ... "99"
+extern const char digitPairs[];
 
+template<typename U>
+int countDigits(U n)
+{
+  int count = 1;
+  for(;;)
+  {
+    // four comparisons per division
+    if(n < 10) return count;
+    if(n < 100) return count + 1;
+    if(n < 1000) return count + 2;
+    if(n < 10000) return count + 3;
+    n /= 10000u;
+    count += 4;
+  }
+}
+
+// the length is known up front, so the digits are written from the
+// back, two per division, straight into place
 template<typename T>
 size_t convert(char buf[], T value)
 {
-  T i = value;
+  using U = typename std::make_unsigned<T>::type;
+  U u = static_cast<U>(value);
   char* p = buf;
-  do 
-  {
-    int lsd = static_cast<int>(i % 10);
-    i /= 10;
-    *p++ = pzo[lsd];
-  } while (i != 0);
   if(value < 0)
+  {
     *p++ = '-';
-  *p = '\0';
-  std::reverse(buf, p);
-  return p - buf;
+    u = static_cast<U>(0) - u;
+  }
+  int n = countDigits(u);
+  char* end = p + n;
+  p = end;
+  while(u >= 100)
+  {
+    unsigned i = static_cast<unsigned>(u % 100) * 2;
+    u /= 100;
+    p -= 2;
+    memcpy(p, digitPairs + i, 2);
+  }
+  if(u >= 10)
+  {
+    p -= 2;
+    memcpy(p, digitPairs + static_cast<unsigned>(u) * 2, 2);
+  }
+  else *--p = static_cast<char>('0' + u);
+  return end - buf;
 }
 
 } // namespace chtho
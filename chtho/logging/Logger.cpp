@@ -4,18 +4,52 @@
 // https://opensource.org/licenses/MIT
 
 #include "Logger.h"
+#include "LogSampling.h"
 #include "threads/CurrentThread.h"
+#include "threads/MutexLockGuard.h"
 #include "time/TimeZone.h"
 
+#include <algorithm>
+#include <map>
+#include <vector>
+
 #include <stdlib.h> // getenv 
+#include <string.h>
 #include <time.h>
 
 namespace chtho
 {
-// time string e.g. "20210407 15:24:36"
-__thread char time_str[64];
-// lastly saved second (used to optimize generation of time string)
-__thread time_t last_sec; 
+// the fixed head of every line a thread writes,
+// "20210407 15:24:36.123456 pid tid ". it is rebuilt once a second,
+// in between only the microsecond digits are patched in
+struct LineHeader
+{
+  char buf[96];
+  int len;
+  int usOff; // of the microsecond digits
+  time_t sec;
+  int tzGen;
+};
+__thread LineHeader t_header;
+// bumped by setTimeZone(), every thread rebuilds its header then
+std::atomic<int> g_tzGen(1);
+std::atomic<int> g_clock(static_cast<int>(Logger::Clock::Precise));
+// see Logger::outputLevel
+__thread Logger::Level t_outputLevel = Logger::Level::INFO;
+__thread uint64_t t_logSuppressed = 0;
+
+// a level's token bucket, kept as the time it will be empty again
+// (the generic cell rate algorithm), so that taking a token is one CAS
+struct RateLimit
+{
+  std::atomic<int64_t> full; // us, when no line is owed any more
+  std::atomic<int64_t> interval; // us a line, 0 without a limit
+  std::atomic<int64_t> tolerance; // how far full may be ahead, (burst - 1) lines
+  std::atomic<uint64_t> pending; // dropped, not reported yet
+  std::atomic<uint64_t> dropped;
+};
+RateLimit g_rateLimits[static_cast<int>(Logger::Level::NUM_LEVEL)];
+std::atomic<int> g_rateLimited(0);
 
 __thread char errnobuf[512];
 const char* strerror_tl(int savedErrno)
@@ -34,32 +68,168 @@ Logger::Level initLogLevel()
   return Logger::Level::INFO;
 }
 // global veriable set for log level
-// can be retrieve by Logger::logLevel()
-Logger::Level g_logLevel = initLogLevel();
-Logger::Level Logger::logLevel() 
+// can be retrieve by Logger::logLevel().
+// constant initialized, so it is valid before any constructor runs,
+// the environment is read once the first module registers
+std::atomic<int> g_logLevel(static_cast<int>(Logger::Level::INFO));
+
+namespace
+{
+const char* const levelStr[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERR", "FATAL" };
+
+bool parseLevel(const std::string& s, Logger::Level* level)
 {
-  return g_logLevel;
+  for(int i = 0; i < static_cast<int>(Logger::Level::NUM_LEVEL); ++i)
+  {
+    if(::strcasecmp(s.c_str(), levelStr[i]) == 0)
+    {
+      *level = static_cast<Logger::Level>(i);
+      return true;
+    }
+  }
+  if(::strcasecmp(s.c_str(), "ERROR") == 0)
+  {
+    *level = Logger::Level::ERR;
+    return true;
+  }
+  return false;
 }
 
-const char* levelName[static_cast<unsigned long>(Logger::Level::NUM_LEVEL)] = 
+// every registered module and the levels set by name. modules are
+// usually static objects of their translation units, the registry is
+// leaked so that none of them outlives it
+class ModuleRegistry : noncopyable
+{
+public:
+  MutexLock mutex_;
+  std::map<std::string, Logger::Level> levels_;
+  std::multimap<std::string, LogModule*> modules_;
+
+  ModuleRegistry()
+  {
+    g_logLevel.store(static_cast<int>(initLogLevel()), std::memory_order_relaxed);
+    // CHTHO_LOG_MODULES=TcpConnection=TRACE,EPoll=DEBUG
+    const char* env = ::getenv("CHTHO_LOG_MODULES");
+    if(!env) return;
+    std::string spec(env);
+    size_t pos = 0;
+    while(pos < spec.size())
+    {
+      size_t comma = spec.find(',', pos);
+      if(comma == std::string::npos) comma = spec.size();
+      std::string item = spec.substr(pos, comma - pos);
+      size_t eq = item.find('=');
+      Logger::Level level;
+      if(eq != std::string::npos && eq > 0 && parseLevel(item.substr(eq+1), &level))
+        levels_[item.substr(0, eq)] = level;
+      else
+        fprintf(stderr, "CHTHO_LOG_MODULES: ignoring '%s'\n", item.c_str());
+      pos = comma + 1;
+    }
+  }
+};
+
+ModuleRegistry& registry()
+{
+  static ModuleRegistry* r = new ModuleRegistry;
+  return *r;
+}
+
+// stored as level + 1, 0 is 'not registered'
+int threshold(Logger::Level level) { return static_cast<int>(level) + 1; }
+} // namespace
+
+LogModule::LogModule(SourceFile file)
+  : threshold_(0),
+    name_(file.data_),
+    nameLen_(file.size_)
+{
+  const char* dot = static_cast<const char*>(::memchr(name_, '.', nameLen_));
+  if(dot) nameLen_ = static_cast<int>(dot - name_);
+  ModuleRegistry& r = registry();
+  MutexLockGuard guard(r.mutex_);
+  std::string n = name();
+  r.modules_.insert(std::make_pair(n, this));
+  auto it = r.levels_.find(n);
+  threshold_.store(it != r.levels_.end() ? threshold(it->second)
+    : g_logLevel.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+LogModule inlineLogModule("inline");
+
+void Logger::setLogLevel(Level level)
+{
+  ModuleRegistry& r = registry();
+  MutexLockGuard guard(r.mutex_);
+  g_logLevel.store(static_cast<int>(level), std::memory_order_relaxed);
+  for(auto& m : r.modules_)
+  {
+    if(r.levels_.find(m.first) == r.levels_.end())
+      m.second->threshold_.store(threshold(level), std::memory_order_relaxed);
+  }
+}
+
+void Logger::setModuleLevel(const std::string& module, Level level)
+{
+  ModuleRegistry& r = registry();
+  MutexLockGuard guard(r.mutex_);
+  r.levels_[module] = level;
+  auto range = r.modules_.equal_range(module);
+  for(auto it = range.first; it != range.second; ++it)
+    it->second->threshold_.store(threshold(level), std::memory_order_relaxed);
+}
+
+void Logger::clearModuleLevel(const std::string& module)
+{
+  ModuleRegistry& r = registry();
+  MutexLockGuard guard(r.mutex_);
+  r.levels_.erase(module);
+  auto range = r.modules_.equal_range(module);
+  for(auto it = range.first; it != range.second; ++it)
+    it->second->threshold_.store(g_logLevel.load(std::memory_order_relaxed) + 1,
+      std::memory_order_relaxed);
+}
+
+Logger::Level Logger::moduleLevel(const std::string& module)
+{
+  ModuleRegistry& r = registry();
+  MutexLockGuard guard(r.mutex_);
+  auto it = r.levels_.find(module);
+  return it != r.levels_.end() ? it->second : logLevel();
+}
+
+struct LevelName
+{
+  const char* str;
+  int len;
+};
+#define CHTHO_LEVEL_NAME(s) { s, sizeof(s) - 1 }
+const LevelName levelName[static_cast<unsigned long>(Logger::Level::NUM_LEVEL)] = 
 {
   // let's have some colorful outputs :)
 #ifdef CHTHO_COLORED
-  "\033[35mTRACE\033[0m ",
-  "\033[36mDEBUG\033[0m ",
-  "\033[97mINFO\033[0m  ",
-  "\033[33mWARN\033[0m  ",
-  "\033[31mERROR\033[0m ",
-  "\033[1;31mFATAL\033[0m ",
+  CHTHO_LEVEL_NAME("\033[35mTRACE\033[0m "),
+  CHTHO_LEVEL_NAME("\033[36mDEBUG\033[0m "),
+  CHTHO_LEVEL_NAME("\033[97mINFO\033[0m  "),
+  CHTHO_LEVEL_NAME("\033[33mWARN\033[0m  "),
+  CHTHO_LEVEL_NAME("\033[31mERROR\033[0m "),
+  CHTHO_LEVEL_NAME("\033[1;31mFATAL\033[0m "),
 #else
-  "TRACE ",
-  "DEBUG ",
-  "INFO  ",
-  "WARN  ",
-  "ERROR ",
-  "FATAL ",
+  CHTHO_LEVEL_NAME("TRACE "),
+  CHTHO_LEVEL_NAME("DEBUG "),
+  CHTHO_LEVEL_NAME("INFO  "),
+  CHTHO_LEVEL_NAME("WARN  "),
+  CHTHO_LEVEL_NAME("ERROR "),
+  CHTHO_LEVEL_NAME("FATAL "),
 #endif
 };
+#undef CHTHO_LEVEL_NAME
+
+Timestamp Logger::lineTime()
+{
+  return g_clock.load(std::memory_order_relaxed) == static_cast<int>(Logger::Clock::Coarse)
+    ? Timestamp::nowCoarse() : Timestamp::now();
+}
 
 void defaultOutput(const char* str, int len)
 {
@@ -79,14 +249,74 @@ Logger::FlushFunc Logger::flush = defaultFlush;
 // so the default time zone will be Beijing.
 TimeZone Logger::timeZone = TimeZone(8*3600, "CST"); 
 
+void Logger::setTimeZone(const TimeZone& tz)
+{
+  timeZone = tz;
+  g_tzGen.fetch_add(1, std::memory_order_relaxed);
+}
+
+void Logger::setClock(Clock clock)
+{
+  g_clock.store(static_cast<int>(clock), std::memory_order_relaxed);
+}
+
 void Logger::commonInit()
 {
-  formTimeStr();
-  CurrentThread::pid();
-  CurrentThread::tid();
-  stream_ << CurrentThread::pidStr();
-  stream_ << CurrentThread::tidStr();
-  stream_ << levelName[static_cast<int>(level_)];
+  formHeader();
+  const LevelName& name = levelName[static_cast<int>(level_)];
+  stream_.append(name.str, name.len);
+  if(t_logSuppressed != 0)
+  {
+    stream_ << '(' << t_logSuppressed << " suppressed) ";
+    t_logSuppressed = 0;
+  }
+}
+
+void Logger::setRateLimit(Level level, double perSec, double burst)
+{
+  int l = static_cast<int>(level);
+  RateLimit& r = g_rateLimits[l];
+  if(perSec <= 0)
+  {
+    g_rateLimited.fetch_and(~(1 << l), std::memory_order_relaxed);
+    r.interval.store(0, std::memory_order_relaxed);
+    return;
+  }
+  int64_t interval = std::max<int64_t>(1, static_cast<int64_t>(1000000 / perSec));
+  if(burst < 1) burst = std::max(perSec, 1.0);
+  r.tolerance.store(static_cast<int64_t>((burst - 1) * interval), std::memory_order_relaxed);
+  r.interval.store(interval, std::memory_order_relaxed);
+  g_rateLimited.fetch_or(1 << l, std::memory_order_relaxed);
+}
+
+uint64_t Logger::rateLimited(Level level)
+{
+  return g_rateLimits[static_cast<int>(level)].dropped.load(std::memory_order_relaxed);
+}
+
+bool Logger::admit(Level level)
+{
+  RateLimit& r = g_rateLimits[static_cast<int>(level)];
+  int64_t interval = r.interval.load(std::memory_order_relaxed);
+  if(interval == 0) return true;
+  int64_t tolerance = r.tolerance.load(std::memory_order_relaxed);
+  int64_t now = LogSite::now();
+  int64_t full = r.full.load(std::memory_order_relaxed);
+  for(;;)
+  {
+    int64_t from = std::max(full, now);
+    if(from - now > tolerance)
+    {
+      r.pending.fetch_add(1, std::memory_order_relaxed);
+      r.dropped.fetch_add(1, std::memory_order_relaxed);
+      return false;
+    }
+    if(r.full.compare_exchange_weak(full, from + interval, std::memory_order_relaxed))
+      break;
+  }
+  if(r.pending.load(std::memory_order_relaxed) != 0)
+    t_logSuppressed += r.pending.exchange(0, std::memory_order_relaxed);
+  return true;
 }
 
 Logger::Logger(SourceFile file, int line)
@@ -94,28 +324,59 @@ Logger::Logger(SourceFile file, int line)
     line_(line),
     level_(Level::INFO),
     stream_(),
-    time_(Timestamp::now())
+    time_(lineTime())
 {
   commonInit();
 }
 
-void Logger::formTimeStr()
+namespace
+{
+// the thread's header for a line at time t
+const LineHeader& header(Timestamp t)
 {
-  time_t secs =  time_.secsSinceE();
-  int us = time_.us();
-  if(secs != last_sec) 
+  LineHeader& h = t_header;
+  time_t secs = t.secsSinceE();
+  int gen = g_tzGen.load(std::memory_order_relaxed);
+  if(secs != h.sec || gen != h.tzGen || h.len == 0)
   {
-    last_sec = secs;
+    h.sec = secs;
+    h.tzGen = gen;
     struct tm m;
-    if(timeZone.valid())
-      m = timeZone.toLocal(secs);
+    if(Logger::timeZone.valid())
+      m = Logger::timeZone.toLocal(secs);
     else ::gmtime_r(&secs, &m);
-    snprintf(time_str, sizeof(time_str), "%4d%02d%02d %02d:%02d:%02d",
+    int n = snprintf(h.buf, sizeof(h.buf), "%4d%02d%02d %02d:%02d:%02d.",
       m.tm_year+1900, m.tm_mon+1, m.tm_mday, m.tm_hour, m.tm_min, m.tm_sec);
+    h.usOff = n;
+    memset(h.buf + n, '0', 6);
+    n += 6;
+    h.buf[n++] = ' ';
+    CurrentThread::pid();
+    CurrentThread::tid();
+    memcpy(h.buf + n, CurrentThread::pidStr(), CurrentThread::pidLen());
+    n += CurrentThread::pidLen();
+    memcpy(h.buf + n, CurrentThread::tidStr(), CurrentThread::tidLen());
+    n += CurrentThread::tidLen();
+    h.len = n;
   }
-  char u[32];
-  snprintf(u, 32, ".%06d ", us);
-  stream_ << time_str << u;
+  int us = t.us();
+  char* p = h.buf + h.usOff;
+  memcpy(p, digitPairs + us / 10000 * 2, 2);
+  memcpy(p + 2, digitPairs + us / 100 % 100 * 2, 2);
+  memcpy(p + 4, digitPairs + us % 100 * 2, 2);
+  return h;
+}
+} // namespace
+
+void Logger::formHeader()
+{
+  const LineHeader& h = header(time_);
+  stream_.append(h.buf, h.len);
+}
+
+const char* Logger::timeString(Timestamp t)
+{
+  return header(t).buf;
 }
 
 Logger::Logger(SourceFile file, int line, Level level, const char* func)
@@ -123,7 +384,7 @@ Logger::Logger(SourceFile file, int line, Level level, const char* func)
     line_(line),
     level_(level),
     stream_(),
-    time_(Timestamp::now())
+    time_(lineTime())
 {
   commonInit();
   stream_ << func << ' '; 
@@ -134,7 +395,7 @@ Logger::Logger(SourceFile file, int line, Level level)
     line_(line),
     level_(level),
     stream_(),
-    time_(Timestamp::now())
+    time_(lineTime())
 {
   commonInit();
 }
@@ -144,7 +405,7 @@ Logger::Logger(SourceFile file, int line, bool abortFlag)
     line_(line),
     level_(abortFlag?Level::FATAL:Level::ERR),
     stream_(),
-    time_(Timestamp::now())
+    time_(lineTime())
 {
   commonInit();
 }
@@ -153,21 +414,30 @@ Logger::~Logger()
 {
   finish();
   const LogStream::Buffer& buf(stream().buffer());
-  output(buf.data(), buf.length());
-  if(level_ == Level::FATAL)
+  write(level_, buf.data(), static_cast<int>(buf.length()));
+}
+
+void Logger::write(Level level, const char* line, int len)
+{
+  t_outputLevel = level;
+  output(line, len);
+  t_outputLevel = Level::INFO;
+  if(level == Level::FATAL)
   {
     flush();
     abort();
   }
 }
 
-void Logger::finish()
+Logger::Level Logger::outputLevel()
 {
-  stream_ << " " << basename_.data_ << ':' << line_ << '\n';
+  return t_outputLevel;
 }
 
-void Logger::setLogLevel(Level level)
+void Logger::finish()
 {
-  g_logLevel = level;
+  stream_ << ' ';
+  stream_.append(basename_.data_, basename_.size_);
+  stream_ << ':' << line_ << '\n';
 }
 } // namespace chtho
@@ -5,13 +5,33 @@
 
 #ifndef CHTHO_LOGGING_LOGGER_H
 #define CHTHO_LOGGING_LOGGER_H
+#include "base/noncopyable.h"
 #include "SourceFile.h"
 #include "LogStream.h"
 #include "time/Timestamp.h"
 #include "time/TimeZone.h"
 
+#include <atomic>
+#include <string>
+
+// statements below this level are compiled out entirely:
+// 0 TRACE, 1 DEBUG, 2 INFO, 3 WARN, 4 ERR. FATAL is always kept.
+// set with -DCHTHO_MIN_LOG_LEVEL=n (the CMake cache variable of the
+// same name), everything is compiled in by default
+#ifndef CHTHO_MIN_LOG_LEVEL
+#define CHTHO_MIN_LOG_LEVEL 0
+#endif
+
 namespace chtho
 {
+// the global runtime level, see Logger::setLogLevel
+extern std::atomic<int> g_logLevel;
+// a bit for every level with a rate limit, see Logger::setRateLimit
+extern std::atomic<int> g_rateLimited;
+// lines this thread has dropped since it last wrote one, by rate
+// limits or sampling. the next line of the thread says how many
+extern __thread uint64_t t_logSuppressed;
+
 class Logger
 {
 public:
@@ -21,6 +41,10 @@ public:
   // see Effective Modern C++ Item 9. 
   using OutputFunc =  void (*)(const char* str, int len);
   using FlushFunc = void (*)();
+  // where the time of a line comes from. Coarse is the time of the
+  // last timer tick, a few ms behind, but reading it costs next to
+  // nothing. Precise by default
+  enum class Clock { Precise, Coarse };
   static OutputFunc output;
   static FlushFunc flush; 
   static TimeZone timeZone;
@@ -32,7 +56,7 @@ private:
   LogStream stream_; 
   Timestamp time_;
 
-  void formTimeStr();
+  void formHeader();
   void finish();
   void commonInit();
 
@@ -47,28 +71,141 @@ public:
 
 
   ~Logger();
-  static Level logLevel();
+  static Level logLevel()
+  { return static_cast<Level>(g_logLevel.load(std::memory_order_relaxed)); }
+  // the level of every module without a level of its own
   static void setLogLevel(Level level);
+  // per source module, named by the file's basename without the
+  // extension, e.g. setModuleLevel("TcpConnection", Level::TRACE).
+  // also applies to modules that register later. the environment
+  // sets them with CHTHO_LOG_MODULES=TcpConnection=TRACE,EPoll=DEBUG
+  static void setModuleLevel(const std::string& module, Level level);
+  // the module follows the global level again
+  static void clearModuleLevel(const std::string& module);
+  static Level moduleLevel(const std::string& module);
   static void setOutput(OutputFunc out) { output = out; }
   static void setFlush(FlushFunc flu) { flush = flu; }
-  static void setTimeZone(const TimeZone& tz) { timeZone = tz; }
+  static void setTimeZone(const TimeZone& tz);
+  static void setClock(Clock clock);
+  // the level of the line being handed to output, for outputs that
+  // treat lines differently by level. INFO outside of output
+  static Level outputLevel();
+  // for other front ends, e.g. StructLogger: the time of a line by
+  // the clock set, the header's text for it (kTimeLen bytes,
+  // "20210407 15:24:36.123456", the thread caches all but the
+  // microseconds), and handing a finished line to output, a FATAL
+  // one aborts
+  static const int kTimeLen = 24;
+  static Timestamp lineTime();
+  static const char* timeString(Timestamp t);
+  static void write(Level level, const char* line, int len);
+  // at most perSec lines of the level a second on average, and up
+  // to burst (1s worth by default) in a row. the lines over it are
+  // dropped before anything is formatted, the next line of the level
+  // a thread writes says how many. perSec 0 lifts the limit. LOG_FATAL
+  // has none. the clock ticks every few ms, so rates of a few hundred
+  // a second and more are kept on average, not line by line
+  static void setRateLimit(Level level, double perSec, double burst = 0);
+  // the lines of the level dropped so far
+  static uint64_t rateLimited(Level level);
+  // a token of the level's bucket, for CHTHO_LOG_ADMIT
+  static bool admit(Level level);
   LogStream& stream() { return stream_; }
 };
 
+// the runtime level of one source module, i.e. of the translation
+// unit a log statement is compiled in. every file including this
+// header gets one (tuLogModule below) that registers itself during
+// static initialization, so checking a statement's level is a single
+// relaxed load and compare, inlined at the statement.
+// tuLogModule has internal linkage: an inline function or a template
+// defined in a header and using LOG_* (or SLOG_*, LOG_EVERY_N, ...)
+// would refer to a different object in every file it is compiled in,
+// which breaks the one definition rule. such code logs with
+// LOG_INLINE(lvl) instead, through inlineLogModule
+class LogModule : noncopyable
+{
+private:
+  friend class Logger;
+  // the module's level + 1, or 0 while it has not registered yet
+  // (static initialization order), then the global level applies
+  std::atomic<int> threshold_;
+  const char* name_;
+  int nameLen_; // without the extension
+public:
+  explicit LogModule(SourceFile file);
+  bool enabled(Logger::Level level) const
+  {
+    int t = threshold_.load(std::memory_order_relaxed);
+    if(t == 0) t = g_logLevel.load(std::memory_order_relaxed) + 1;
+    return static_cast<int>(level) + 1 >= t;
+  }
+  std::string name() const { return std::string(name_, nameLen_); }
+};
+
+namespace
+{
+// __BASE_FILE__ names the .cpp file being compiled, also when the log
+// statement sits in a header it includes
+#ifdef __BASE_FILE__
+LogModule tuLogModule(__BASE_FILE__);
+#else
+LogModule tuLogModule(__FILE__);
+#endif
+} // namespace
+
+// the module of the LOG_INLINE statements, named "inline"
+extern LogModule inlineLogModule;
+
 const char* strerror_tl(int savedErrno);
 
-#define LOG_TRACE if(chtho::Logger::logLevel() <= chtho::Logger::Level::TRACE)\
-  chtho::Logger(__FILE__, __LINE__, chtho::Logger::Level::TRACE, __func__).stream()
-#define LOG_DEBUG if(chtho::Logger::logLevel() <= chtho::Logger::Level::DEBUG)\
-  chtho::Logger(__FILE__, __LINE__, chtho::Logger::Level::DEBUG, __func__).stream()
-#define LOG_INFO if(chtho::Logger::logLevel() <= chtho::Logger::Level::INFO)\
-  chtho::Logger(__FILE__, __LINE__).stream()
-#define LOG_WARN chtho::Logger(__FILE__, __LINE__, chtho::Logger::Level::WARN).stream()
-#define LOG_ERR chtho::Logger(__FILE__, __LINE__, chtho::Logger::Level::ERR).stream()
-#define LOG_FATAL chtho::Logger(__FILE__, __LINE__, chtho::Logger::Level::FATAL).stream()
-#define LOG_SYSERR chtho::Logger(__FILE__, __LINE__, false).stream()
-#define LOG_SYSFATAL chtho::Logger(__FILE__, __LINE__, true).stream()
+// turns the << chain of a log statement into void, so that it can be
+// the second operand of the ?: in CHTHO_LOG_IF. & binds looser than <<
+struct LogVoidify
+{
+  template<typename Stream>
+  void operator&(Stream&&) {}
+};
 
 } // namespace chtho
 
+// true if a statement of level lvl would be written here. a level
+// below CHTHO_MIN_LOG_LEVEL is a constant false, the compiler drops
+// the statement and the operands of its << chain
+#define CHTHO_LOG_ENABLED(lvl) CHTHO_LOG_ENABLED_IN(chtho::tuLogModule, lvl)
+#define CHTHO_LOG_ENABLED_IN(module, lvl) (CHTHO_MIN_LOG_LEVEL <= static_cast<int>(lvl) \
+  && (module).enabled(lvl))
+
+// false if the level's rate limit drops the statement, a load and a
+// test while the level has none
+#define CHTHO_LOG_ADMIT(lvl) ((chtho::g_rateLimited.load(std::memory_order_relaxed) \
+  & (1 << static_cast<int>(lvl))) == 0 || chtho::Logger::admit(lvl))
+
+// an expression rather than an if, a statement like
+// 'if(x) LOG_ERR << y; else ...' keeps its else
+#define CHTHO_LOG_IF(lvl) !(CHTHO_LOG_ENABLED(lvl) && CHTHO_LOG_ADMIT(lvl)) \
+  ? (void)0 : chtho::LogVoidify() &
+
+#define LOG_TRACE CHTHO_LOG_IF(chtho::Logger::Level::TRACE) \
+  chtho::Logger(CHTHO_SOURCE_FILE, __LINE__, chtho::Logger::Level::TRACE, __func__).stream()
+#define LOG_DEBUG CHTHO_LOG_IF(chtho::Logger::Level::DEBUG) \
+  chtho::Logger(CHTHO_SOURCE_FILE, __LINE__, chtho::Logger::Level::DEBUG, __func__).stream()
+#define LOG_INFO CHTHO_LOG_IF(chtho::Logger::Level::INFO) \
+  chtho::Logger(CHTHO_SOURCE_FILE, __LINE__).stream()
+#define LOG_WARN CHTHO_LOG_IF(chtho::Logger::Level::WARN) \
+  chtho::Logger(CHTHO_SOURCE_FILE, __LINE__, chtho::Logger::Level::WARN).stream()
+#define LOG_ERR CHTHO_LOG_IF(chtho::Logger::Level::ERR) \
+  chtho::Logger(CHTHO_SOURCE_FILE, __LINE__, chtho::Logger::Level::ERR).stream()
+#define LOG_SYSERR CHTHO_LOG_IF(chtho::Logger::Level::ERR) \
+  chtho::Logger(CHTHO_SOURCE_FILE, __LINE__, false).stream()
+// for inline functions and templates in headers, see LogModule.
+// LOG_INLINE(WARN) << "...";  lvl is TRACE, DEBUG, INFO, WARN or ERR
+#define LOG_INLINE(lvl) !(CHTHO_LOG_ENABLED_IN(chtho::inlineLogModule, \
+  chtho::Logger::Level::lvl) && CHTHO_LOG_ADMIT(chtho::Logger::Level::lvl)) \
+  ? (void)0 : chtho::LogVoidify() & \
+  chtho::Logger(CHTHO_SOURCE_FILE, __LINE__, chtho::Logger::Level::lvl, __func__).stream()
+// never filtered, they abort
+#define LOG_FATAL chtho::Logger(CHTHO_SOURCE_FILE, __LINE__, chtho::Logger::Level::FATAL).stream()
+#define LOG_SYSFATAL chtho::Logger(CHTHO_SOURCE_FILE, __LINE__, true).stream()
+
 #endif // !CHTHO_LOGGING_LOGGER_H
\ No newline at end of file
@@ -3,34 +3,45 @@
 // This software is released under the MIT License.
 // https://opensource.org/licenses/MIT
 
-#include <cstring>
+#ifndef CHTHO_LOGGING_SOURCEFILE_H
+#define CHTHO_LOGGING_SOURCEFILE_H
+
+#include <type_traits>
 
 namespace chtho
 {
-// this class is a helper, it will automatically
-// convert a filepath to its file base name at compile time
-// its aim is to reduce runtime overhead (reduce the need to
-// call strlen). 
+// this class is a helper, it converts a filepath to its file base
+// name at compile time, so no log statement has to call strrchr
+// or strlen. CHTHO_SOURCE_FILE below forces the evaluation into a
+// template argument, the constructor itself is constexpr as well
 class SourceFile
 {
 public:
-  const char* data_; 
-  int size_; 
-  // given filepath, it will calculate the basename of the file
-  // at compile time 
-  template<int N> 
-  SourceFile(const char (&s)[N])
-    : data_(s),
-      size_(N-1)
+  const char* data_;
+  int size_;
+
+  // the offset of the basename in s[0, len), i.e. one past the
+  // last slash. C++11 constexpr has to recurse instead of loop
+  static constexpr int baseOffset(const char* s, int len)
   {
-    // strtchr will find the character position
-    // in reverse order 
-    const char* begin = strrchr(data_, '/');
-    if(begin) // has a slash, extract the basename 
-    { // update the data pointer and size 
-      data_ = begin+1; 
-      size_ -= static_cast<int>(data_ - s); 
-    }
+    return len == 0 ? 0 : s[len-1] == '/' ? len : baseOffset(s, len-1);
   }
+
+  constexpr SourceFile(const char* path, int len, int offset)
+    : data_(path + offset),
+      size_(len - offset)
+  {}
+  // given filepath, it calculates the basename of the file
+  template<int N>
+  constexpr SourceFile(const char (&s)[N])
+    : data_(s + baseOffset(s, N-1)),
+      size_(N-1 - baseOffset(s, N-1))
+  {}
 };
 } // namespace chtho
+
+#define CHTHO_SOURCE_FILE chtho::SourceFile(__FILE__, sizeof(__FILE__) - 1, \
+  std::integral_constant<int, \
+    chtho::SourceFile::baseOffset(__FILE__, sizeof(__FILE__) - 1)>::value)
+
+#endif // !CHTHO_LOGGING_SOURCEFILE_H
@@ -0,0 +1,255 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "StructLogger.h"
+#include "threads/CurrentThread.h"
+
+#include <algorithm>
+#include <atomic>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace chtho
+{
+namespace
+{
+std::atomic<int> g_format(static_cast<int>(StructLogger::Format::Json));
+
+const StringPiece levelStr[] = { "TRACE", "DEBUG", "INFO", "WARN", "ERROR", "FATAL" };
+
+const char hexDigits[] = "0123456789abcdef";
+
+// the escape sequence of c, its length
+int escape(unsigned char c, char* seq)
+{
+  seq[0] = '\\';
+  switch(c)
+  {
+  case '"': seq[1] = '"'; return 2;
+  case '\\': seq[1] = '\\'; return 2;
+  case '\n': seq[1] = 'n'; return 2;
+  case '\r': seq[1] = 'r'; return 2;
+  case '\t': seq[1] = 't'; return 2;
+  default:
+    memcpy(seq + 1, "u00", 3);
+    seq[4] = hexDigits[c >> 4];
+    seq[5] = hexDigits[c & 0xf];
+    return 6;
+  }
+}
+} // namespace
+
+void StructLogger::setFormat(Format format)
+{
+  g_format.store(static_cast<int>(format), std::memory_order_relaxed);
+}
+
+StructLogger::Format StructLogger::format()
+{
+  return static_cast<Format>(g_format.load(std::memory_order_relaxed));
+}
+
+size_t StructLogger::findSpecial(const char* s, size_t len, bool quote)
+{
+  size_t i = 0;
+#ifdef __SSE2__
+  const __m128i dquote = _mm_set1_epi8('"');
+  const __m128i bslash = _mm_set1_epi8('\\');
+  const __m128i ctl = _mm_set1_epi8(0x1f);
+  // '"' again if spaces and '=' don't matter
+  const __m128i space = _mm_set1_epi8(quote ? ' ' : '"');
+  const __m128i equal = _mm_set1_epi8(quote ? '=' : '"');
+  for(; i + 16 <= len; i += 16)
+  {
+    __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, dquote), _mm_cmpeq_epi8(v, bslash));
+    // the control characters, v <= 0x1f unsigned
+    m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, ctl), v));
+    m = _mm_or_si128(m, _mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, equal)));
+    int mask = _mm_movemask_epi8(m);
+    if(mask) return i + __builtin_ctz(mask);
+  }
+#endif
+  for(; i < len; ++i)
+  {
+    unsigned char c = static_cast<unsigned char>(s[i]);
+    if(c < 0x20 || c == '"' || c == '\\' || (quote && (c == ' ' || c == '=')))
+      return i;
+  }
+  return len;
+}
+
+StructLogger::StructLogger(SourceFile file, int line, Logger::Level level, StringPiece msg)
+  : file_(file),
+    line_(line),
+    level_(level),
+    format_(format()),
+    full_(false),
+    keyed_(false)
+{
+  const char* time = Logger::timeString(Logger::lineTime());
+  const StringPiece& lvl = levelStr[static_cast<int>(level)];
+  char tid[kMaxNumSize];
+  size_t tidLen = convert(tid, CurrentThread::tid());
+  if(format_ == Format::Json)
+  {
+    raw("{\"time\":\"", 9);
+    raw(time, Logger::kTimeLen);
+    raw("\",\"level\":\"", 11);
+    raw(lvl.data(), lvl.size());
+    raw("\",\"tid\":", 8);
+    raw(tid, tidLen);
+  }
+  else
+  {
+    raw("time=\"", 6);
+    raw(time, Logger::kTimeLen);
+    raw("\" level=", 8);
+    raw(lvl.data(), lvl.size());
+    raw(" tid=", 5);
+    raw(tid, tidLen);
+  }
+  kv("msg", msg);
+  if(t_logSuppressed != 0)
+  {
+    kv("suppressed", t_logSuppressed);
+    t_logSuppressed = 0;
+  }
+}
+
+StructLogger::~StructLogger()
+{
+  char num[kMaxNumSize];
+  size_t len = convert(num, line_);
+  // reserve() has kept the room for it
+  if(format_ == Format::Json) buf_.append(",\"src\":\"", 8);
+  else buf_.append(" src=", 5);
+  buf_.append(file_.data_, file_.size_);
+  buf_.append(":", 1);
+  buf_.append(num, len);
+  if(format_ == Format::Json) buf_.append("\"}\n", 3);
+  else buf_.append("\n", 1);
+  Logger::write(level_, buf_.data(), static_cast<int>(buf_.length()));
+}
+
+// as much of it as there is room for
+void StructLogger::raw(const char* s, size_t len)
+{
+  if(static_cast<int>(len) > room())
+  {
+    len = std::max(room(), 0);
+    // not in the middle of a UTF-8 sequence
+    while(len > 0 && (static_cast<unsigned char>(s[len]) & 0xc0) == 0x80) --len;
+    full_ = true;
+  }
+  memcpy(buf_.cur(), s, len);
+  buf_.add(len);
+}
+
+// a key goes only with room for a number or a few bytes of a string
+void StructLogger::key(const char* k)
+{
+  size_t len = strlen(k);
+  if(full_ || static_cast<int>(len + 4 + kMaxNumSize) > room())
+  {
+    full_ = true;
+    return;
+  }
+  if(format_ == Format::Json)
+  {
+    raw(",\"", 2);
+    raw(k, len);
+    raw("\":", 2);
+  }
+  else
+  {
+    raw(" ", 1);
+    raw(k, len);
+    raw("=", 1);
+  }
+  keyed_ = true;
+}
+
+void StructLogger::number(const char* digits, size_t len)
+{
+  if(!keyed_) return;
+  raw(digits, len);
+  keyed_ = false;
+}
+
+void StructLogger::nullValue()
+{
+  if(!keyed_) return;
+  if(format_ == Format::Json) raw("null", 4);
+  keyed_ = false;
+}
+
+// in quotes, escaped, unless it's logfmt and doesn't need them
+void StructLogger::string(const char* s, size_t len)
+{
+  if(!keyed_) return;
+  keyed_ = false;
+  if(format_ == Format::Logfmt && len > 0 && findSpecial(s, len, true) == len)
+  {
+    raw(s, len);
+    return;
+  }
+  // the closing quote is kept out of room() meanwhile
+  raw("\"", 1);
+  int closing = 1;
+  const char* end = s + len;
+  while(s < end && !full_)
+  {
+    size_t clean = findSpecial(s, end - s, false);
+    if(static_cast<int>(clean) > room() - closing)
+    {
+      size_t n = std::max(room() - closing, 0);
+      while(n > 0 && (static_cast<unsigned char>(s[n]) & 0xc0) == 0x80) --n;
+      raw(s, n);
+      full_ = true;
+      break;
+    }
+    raw(s, clean);
+    s += clean;
+    if(s == end) break;
+    char seq[6];
+    int n = escape(static_cast<unsigned char>(*s), seq);
+    if(n > room() - closing)
+    {
+      full_ = true;
+      break;
+    }
+    raw(seq, n);
+    ++s;
+  }
+  memcpy(buf_.cur(), "\"", 1);
+  buf_.add(1);
+}
+
+StructLogger& StructLogger::kv(const char* k, bool v)
+{
+  key(k);
+  if(v) number("true", 4);
+  else number("false", 5);
+  return *this;
+}
+
+StructLogger& StructLogger::kv(const char* k, const char* v)
+{
+  key(k);
+  if(v) string(v, strlen(v));
+  else nullValue();
+  return *this;
+}
+
+StructLogger& StructLogger::kv(const char* k, StringPiece v)
+{
+  key(k);
+  string(v.data(), v.size());
+  return *this;
+}
+} // namespace chtho
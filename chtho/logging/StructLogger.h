@@ -0,0 +1,114 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_LOGGING_STRUCTLOGGER_H
+#define CHTHO_LOGGING_STRUCTLOGGER_H
+// Log lines of typed key/value fields, JSON or logfmt
+
+#include "base/noncopyable.h"
+#include "base/StringPiece.h"
+#include "FixedBuffer.h"
+#include "Logger.h"
+#include "LogStream.h"
+
+#include <cmath> // isfinite
+#include <string>
+#include <type_traits>
+
+namespace chtho
+{
+// SLOG_INFO("connection closed").kv("fd", fd).kv("peer", peer);
+// is written, as one line, like
+//   {"time":"20210407 15:24:36.123456","level":"INFO","tid":1234,
+//    "msg":"connection closed","fd":12,"peer":"10.0.0.1:80","src":"Foo.cpp:42"}
+// or in logfmt
+//   time="20210407 15:24:36.123456" level=INFO tid=1234
+//   msg="connection closed" fd=12 peer=10.0.0.1:80 src=Foo.cpp:42
+// the fields are encoded straight into the line's buffer, nothing is
+// allocated. strings are escaped, or quoted in logfmt if they have to
+// be, 16 bytes at a time. keys are taken as they are, they should be
+// identifiers. a line that would be longer than the buffer keeps its
+// head and tail, the field that doesn't fit is cut short
+class StructLogger : noncopyable
+{
+public:
+  enum class Format { Json, Logfmt };
+  static const int kLineSize = kSmall;
+
+private:
+  SourceFile file_;
+  int line_;
+  Logger::Level level_;
+  Format format_;
+  FixedBuffer<kLineSize> buf_;
+  bool full_; // fields are dropped from here on
+  bool keyed_; // a key waits for its value
+
+  // bytes to spare for what ends a line, "src", the file and the line
+  int reserve() const { return 32 + file_.size_; }
+  int room() const { return buf_.avail() - reserve(); }
+  void raw(const char* s, size_t len);
+  void key(const char* k);
+  void string(const char* s, size_t len);
+  void nullValue();
+  void number(const char* digits, size_t len);
+
+public:
+  StructLogger(SourceFile file, int line, Logger::Level level, StringPiece msg);
+  ~StructLogger();
+
+  StructLogger& kv(const char* k, bool v);
+  StructLogger& kv(const char* k, char v) { return kv(k, StringPiece(&v, 1)); }
+  StructLogger& kv(const char* k, const char* v);
+  StructLogger& kv(const char* k, StringPiece v);
+  StructLogger& kv(const char* k, const std::string& v)
+  { return kv(k, StringPiece(v.data(), static_cast<int>(v.size()))); }
+
+  template<typename Integer, typename std::enable_if<std::is_integral<Integer>::value
+    && !std::is_same<Integer, bool>::value && !std::is_same<Integer, char>::value,
+    bool>::type = true>
+  StructLogger& kv(const char* k, Integer v)
+  {
+    char digits[kMaxNumSize];
+    key(k);
+    number(digits, convert(digits, v));
+    return *this;
+  }
+  // nan and inf aren't JSON numbers, they are written as strings
+  template<typename Float,
+    typename std::enable_if<std::is_floating_point<Float>::value, bool>::type = true>
+  StructLogger& kv(const char* k, Float v)
+  {
+    char digits[kMaxNumSize];
+    key(k);
+    size_t len = convertFloat(digits, v);
+    if(std::isfinite(v)) number(digits, len);
+    else string(digits, len);
+    return *this;
+  }
+
+  // the format of the lines that start afterwards, Json by default
+  static void setFormat(Format format);
+  static Format format();
+
+  // the first byte in [s, s + len) that has to be escaped in a JSON
+  // string, with quote set also a space or '=', which make a logfmt
+  // value need quotes. len if there is none
+  static size_t findSpecial(const char* s, size_t len, bool quote);
+};
+} // namespace chtho
+
+// a statement of level lvl with the message msg, fields are added
+// with .kv(key, value)
+#define CHTHO_SLOG(lvl, msg) CHTHO_LOG_IF(lvl) \
+  chtho::StructLogger(CHTHO_SOURCE_FILE, __LINE__, lvl, msg)
+
+#define SLOG_TRACE(msg) CHTHO_SLOG(chtho::Logger::Level::TRACE, msg)
+#define SLOG_DEBUG(msg) CHTHO_SLOG(chtho::Logger::Level::DEBUG, msg)
+#define SLOG_INFO(msg) CHTHO_SLOG(chtho::Logger::Level::INFO, msg)
+#define SLOG_WARN(msg) CHTHO_SLOG(chtho::Logger::Level::WARN, msg)
+#define SLOG_ERR(msg) CHTHO_SLOG(chtho::Logger::Level::ERR, msg)
+
+#endif // !CHTHO_LOGGING_STRUCTLOGGER_H
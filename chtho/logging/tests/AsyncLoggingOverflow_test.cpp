@@ -0,0 +1,242 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/logging/Logger.h"
+#include "chtho/logging/AsyncLogging.h"
+#include "chtho/threads/Thread.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <fstream>
+#include <ftw.h> // nftw
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace chtho;
+
+using Overflow = AsyncLogging::Overflow;
+
+const size_t kRing = 4096;
+const int kLine = 100;
+
+// a line of kLine bytes, "line <i> xxx...\n"
+std::string line(int i)
+{
+  char buf[32];
+  int n = snprintf(buf, sizeof buf, "line %d ", i);
+  std::string l(buf, n);
+  l.append(kLine - n - 1, 'x');
+  l.push_back('\n');
+  return l;
+}
+
+// the numbers of the lines in the files of a log, the drop reports
+// are left out
+std::vector<int> readLog(const std::string& prefix)
+{
+  std::vector<int> res;
+  DIR* d = opendir(".");
+  while(struct dirent* e = readdir(d))
+  {
+    if(strncmp(e->d_name, prefix.c_str(), prefix.size()) != 0) continue;
+    std::ifstream in(e->d_name);
+    std::string l;
+    while(std::getline(in, l))
+    {
+      if(l.find("drop log at") == 0) continue;
+      int i;
+      int n = sscanf(l.c_str(), "line %d ", &i);
+      assert(n == 1);
+      assert(l.size() == kLine - 1u);
+      (void)n;
+      res.push_back(i);
+    }
+  }
+  closedir(d);
+  return res;
+}
+
+// the back end isn't running, nothing leaves the ring
+void testDropNewest()
+{
+  AsyncLogging log("newest", 1 << 30);
+  log.setRingSize(kRing);
+  log.setOverflow(Overflow::DropNewest);
+  int accepted = 0;
+  for(int i = 0; i < 100; ++i)
+  {
+    std::string l = line(i);
+    if(log.append(l.data(), kLine, Logger::Level::INFO)) ++accepted;
+  }
+  const int fit = kRing / kLine;
+  assert(accepted == fit);
+  AsyncLogging::Stats st = log.stats();
+  assert(st.droppedLines == 100u - fit);
+  assert(st.droppedBytes == (100u - fit) * kLine);
+  assert(st.rings == 1 && st.ringBytes == kRing);
+  log.start();
+  log.stop();
+  std::vector<int> lines = readLog("newest");
+  assert(lines.size() == static_cast<size_t>(fit));
+  for(int i = 0; i < fit; ++i) assert(lines[i] == i);
+  st = log.stats();
+  assert(st.writtenBytes == static_cast<size_t>(fit) * kLine);
+  assert(st.writes == 1);
+}
+
+void testDropOldest()
+{
+  AsyncLogging log("oldest", 1 << 30);
+  log.setRingSize(kRing);
+  log.setOverflow(Overflow::DropOldest);
+  for(int i = 0; i < 100; ++i)
+  {
+    std::string l = line(i);
+    bool ok = log.append(l.data(), kLine, Logger::Level::INFO);
+    assert(ok);
+    (void)ok;
+  }
+  const int fit = kRing / kLine;
+  AsyncLogging::Stats st = log.stats();
+  assert(st.droppedLines == 100u - fit);
+  assert(st.droppedBytes == (100u - fit) * kLine);
+  log.start();
+  log.stop();
+  std::vector<int> lines = readLog("oldest");
+  assert(lines.size() == static_cast<size_t>(fit));
+  for(int i = 0; i < fit; ++i) assert(lines[i] == 100 - fit + i);
+}
+
+// the producer overwrites while the back end drains: every line in
+// the file is intact and in order, and what's missing was counted
+void testDropOldestConcurrent()
+{
+  AsyncLogging log("racing", 1 << 30, 1);
+  log.setRingSize(kRing);
+  log.setOverflow(Overflow::DropOldest);
+  log.start();
+  const int total = 200000;
+  Thread t([&](){
+    for(int i = 0; i < total; ++i)
+    {
+      std::string l = line(i);
+      log.append(l.data(), kLine, Logger::Level::INFO);
+    }
+  }, "producer");
+  t.start();
+  t.join();
+  log.stop();
+  std::vector<int> lines = readLog("racing");
+  for(size_t i = 1; i < lines.size(); ++i) assert(lines[i] > lines[i - 1]);
+  AsyncLogging::Stats st = log.stats();
+  assert(lines.size() + st.droppedLines == static_cast<size_t>(total));
+  assert(st.droppedBytes == st.droppedLines * kLine);
+  assert(st.rings == 0); // the producer has exited
+  printf("drop oldest: %zu of %d lines written, %zu dropped\n",
+    lines.size(), total, st.droppedLines);
+}
+
+AsyncLogging* g_log = NULL;
+void output(const char* msg, int len) { g_log->append(msg, len); }
+
+// DEBUG goes at half full, INFO at 3/4, WARN at 7/8, ERR last. the
+// levels come from the Logger
+void testDropByLevel()
+{
+  AsyncLogging log("bylevel", 1 << 30);
+  log.setRingSize(kRing);
+  log.setOverflow(Overflow::DropByLevel);
+  g_log = &log;
+  Logger::setOutput(output);
+  Logger::Level saved = Logger::logLevel();
+  Logger::setLogLevel(Logger::Level::TRACE);
+  size_t debug = 0;
+  while(log.stats().droppedLines == 0)
+  {
+    LOG_DEBUG << "filling";
+    ++debug;
+  }
+  LOG_ERR << "still there";
+  LOG_WARN << "still there";
+  LOG_INFO << "still there";
+  assert(log.stats().droppedLines == 1);
+  LOG_DEBUG << "dropped";
+  assert(log.stats().droppedLines == 2);
+  // plain lines count as INFO
+  std::string l = line(0);
+  size_t info = 0;
+  for(size_t dropped = 2; log.stats().droppedLines == dropped; ++info)
+    log.append(l.data(), kLine);
+  assert(info > 1);
+  bool ok = log.append(l.data(), kLine, Logger::Level::WARN);
+  assert(ok);
+  while(log.append(l.data(), kLine, Logger::Level::WARN)) {}
+  ok = log.append(l.data(), kLine, Logger::Level::ERR);
+  assert(ok);
+  (void)ok;
+  Logger::setLogLevel(saved);
+  Logger::setOutput([](const char* msg, int len){ fwrite(msg, 1, len, stdout); });
+  printf("drop by level: %zu DEBUG lines before the first drop\n", debug);
+}
+
+// nothing is lost, the thread waits for the back end instead
+void testBlock()
+{
+  AsyncLogging log("block", 1 << 30, 1);
+  log.setRingSize(kRing);
+  log.start();
+  const int total = 20000;
+  for(int i = 0; i < total; ++i)
+  {
+    std::string l = line(i);
+    bool ok = log.append(l.data(), kLine, Logger::Level::DEBUG);
+    assert(ok);
+    (void)ok;
+  }
+  log.stop();
+  std::vector<int> lines = readLog("block");
+  assert(lines.size() == static_cast<size_t>(total));
+  for(int i = 0; i < total; ++i) assert(lines[i] == i);
+  AsyncLogging::Stats st = log.stats();
+  assert(st.droppedLines == 0);
+  assert(st.writtenBytes == static_cast<size_t>(total) * kLine);
+  assert(st.writes > 0 && st.writeUsMax <= st.writeUsTotal);
+  printf("block: waited %zu times, %zu writes, %.1f us on average, %ld us max\n",
+    st.blocked, st.writes, static_cast<double>(st.writeUsTotal) / st.writes,
+    static_cast<long>(st.writeUsMax));
+}
+
+int removeEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+  return ::remove(path);
+}
+
+int main()
+{
+  // LogFile writes into the working directory
+  char dir[] = "/tmp/chtho_overflow_XXXXXX";
+  if(!mkdtemp(dir) || chdir(dir) != 0)
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+  testDropNewest();
+  testDropOldest();
+  testDropOldestConcurrent();
+  testDropByLevel();
+  testBlock();
+  // the files go with the directory, children first
+  if(chdir("/") != 0 || nftw(dir, removeEntry, 16, FTW_DEPTH | FTW_PHYS) != 0)
+  {
+    perror(dir);
+    return 1;
+  }
+  printf("all passed\n");
+  return 0;
+}
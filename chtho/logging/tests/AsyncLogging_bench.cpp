@@ -0,0 +1,251 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/logging/Logger.h"
+#include "chtho/logging/AsyncLogging.h"
+#include "chtho/threads/Thread.h"
+#include "chtho/threads/CountDownLatch.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <dirent.h>
+#include <fstream>
+#include <map>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <unistd.h>
+#include <vector>
+
+using namespace chtho;
+
+// the front end AsyncLogging had before the per-thread rings: every
+// line takes one mutex and is copied into the shared current buffer,
+// the back end swaps in empty ones
+class DoubleBuffering : noncopyable
+{
+private:
+  using Buf = FixedBuffer<kLarge>;
+  using BufPtr = std::unique_ptr<Buf>;
+  using BufVec = std::vector<BufPtr>;
+
+  std::atomic_bool running_;
+  const std::string name_;
+  Thread thread_;
+  CountDownLatch latch_;
+  MutexLock mutex_;
+  Condition cond_;
+  BufPtr curBuf_;
+  BufPtr nxtBuf_;
+  BufVec bufs_;
+
+  void threadFunc()
+  {
+    latch_.countDown();
+    LogFile output(name_, 500*1000*1000, false);
+    BufPtr buf1(new Buf), buf2(new Buf);
+    BufVec bufs;
+    while(running_)
+    {
+      {
+        MutexLockGuard lock(mutex_);
+        if(bufs_.empty()) cond_.waitForSecs(3);
+        bufs_.push_back(std::move(curBuf_));
+        curBuf_ = std::move(buf1);
+        bufs.swap(bufs_);
+        if(!nxtBuf_) nxtBuf_ = std::move(buf2);
+      }
+      if(bufs.size() > 25) bufs.erase(bufs.begin()+2, bufs.end());
+      for(const auto& buf : bufs) output.append(buf->data(), buf->length());
+      if(bufs.size() > 2) bufs.resize(2);
+      if(!buf1) { buf1 = std::move(bufs.back()); bufs.pop_back(); buf1->reset(); }
+      if(!buf2) { buf2 = std::move(bufs.back()); bufs.pop_back(); buf2->reset(); }
+      bufs.clear();
+      output.flush();
+    }
+    output.append(curBuf_->data(), curBuf_->length());
+    output.flush();
+  }
+public:
+  explicit DoubleBuffering(const std::string& name)
+    : running_(false), name_(name),
+      thread_([this](){ threadFunc(); }, "Logging"),
+      latch_(1), cond_(mutex_), curBuf_(new Buf), nxtBuf_(new Buf)
+  {}
+  void append(const char* line, int len)
+  {
+    MutexLockGuard lock(mutex_);
+    if(curBuf_->avail() > len) curBuf_->append(line, len);
+    else
+    {
+      bufs_.push_back(std::move(curBuf_));
+      if(nxtBuf_) curBuf_ = std::move(nxtBuf_);
+      else curBuf_.reset(new Buf);
+      curBuf_->append(line, len);
+      cond_.notify();
+    }
+  }
+  void start() { running_ = true; thread_.start(); latch_.wait(); }
+  void stop() { running_ = false; cond_.notify(); thread_.join(); }
+};
+
+template<typename Log>
+Log*& instance()
+{
+  static Log* log = NULL;
+  return log;
+}
+
+template<typename Log>
+void output(const char* msg, int len)
+{
+  instance<Log>()->append(msg, len);
+}
+
+int64_t nowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+struct Result
+{
+  double linesPerSec;
+  int64_t p50, p99, p999, max; // ns per call
+};
+
+// n threads log lines concurrently, every call is timed
+template<typename Log>
+Result run(Log* log, int nthreads, int lines)
+{
+  instance<Log>() = log;
+  Logger::setOutput(output<Log>);
+  std::vector<std::vector<int64_t>> lat(nthreads);
+  std::vector<std::unique_ptr<Thread>> threads;
+  CountDownLatch ready(nthreads), go(1);
+  for(int t = 0; t < nthreads; ++t)
+  {
+    threads.emplace_back(new Thread([&, t](){
+      std::vector<int64_t>& l = lat[t];
+      l.reserve(lines);
+      ready.countDown();
+      go.wait();
+      for(int i = 0; i < lines; ++i)
+      {
+        int64_t start = nowNs();
+        LOG_INFO << "thread " << t << " line " << i << " payload qwertyuiopasdfghjklzxcvbnm";
+        l.push_back(nowNs() - start);
+      }
+    }));
+    threads.back()->start();
+  }
+  ready.wait();
+  int64_t start = nowNs();
+  go.countDown();
+  for(auto& t : threads) t->join();
+  double sec = static_cast<double>(nowNs() - start) / 1e9;
+  std::vector<int64_t> all;
+  for(auto& l : lat) all.insert(all.end(), l.begin(), l.end());
+  std::sort(all.begin(), all.end());
+  Result r;
+  r.linesPerSec = all.size() / sec;
+  r.p50 = all[all.size() / 2];
+  r.p99 = all[all.size() * 99 / 100];
+  r.p999 = all[all.size() * 999 / 1000];
+  r.max = all.back();
+  return r;
+}
+
+std::vector<std::string> files(const std::string& dir, const std::string& prefix)
+{
+  std::vector<std::string> res;
+  DIR* d = opendir(dir.c_str());
+  while(struct dirent* e = readdir(d))
+  {
+    if(strncmp(e->d_name, prefix.c_str(), prefix.size()) == 0)
+      res.push_back(dir + "/" + e->d_name);
+  }
+  closedir(d);
+  return res;
+}
+
+// every line written by a thread is in the log once and in order,
+// unless it was reported as dropped
+void verify(const std::string& dir, const std::string& prefix, int nthreads, int lines)
+{
+  std::map<int, int> next;
+  long written = 0, dropped = 0;
+  for(const std::string& f : files(dir, prefix))
+  {
+    std::ifstream in(f);
+    std::string l;
+    while(std::getline(in, l))
+    {
+      size_t p = l.find(" thread ");
+      if(l.find("drop log at") == 0)
+      {
+        dropped += atol(l.c_str() + l.rfind(", ") + 2);
+        continue;
+      }
+      assert(p != std::string::npos);
+      int t, i;
+      int n = sscanf(l.c_str() + p, " thread %d line %d", &t, &i);
+      assert(n == 2);
+      (void)n;
+      assert(i >= next[t]);
+      next[t] = i + 1;
+      ++written;
+    }
+  }
+  assert(written + dropped == static_cast<long>(nthreads) * lines);
+  if(dropped) printf("  (%ld lines dropped)\n", dropped);
+}
+
+void cleanup(const std::string& dir)
+{
+  for(const std::string& f : files(dir, "")) unlink(f.c_str());
+  rmdir(dir.c_str());
+}
+
+void report(const char* name, const Result& r)
+{
+  printf("  %-18s %12.0f %8lld %8lld %8lld %10lld\n", name, r.linesPerSec,
+    static_cast<long long>(r.p50), static_cast<long long>(r.p99),
+    static_cast<long long>(r.p999), static_cast<long long>(r.max));
+}
+
+int main(int argc, char* argv[])
+{
+  int total = argc > 1 ? atoi(argv[1]) : 640000;
+  char tmpl[] = "/tmp/asynclogging_bench.XXXXXX";
+  // LogFile writes into the working directory
+  std::string dir = mkdtemp(tmpl);
+  if(chdir(dir.c_str()) != 0) return 1;
+  const int counts[] = { 1, 4, 16, 64 };
+  printf("  %-18s %12s %8s %8s %8s %10s   (ns/call)\n",
+    "", "lines/s", "p50", "p99", "p99.9", "max");
+  for(int n : counts)
+  {
+    int lines = total / n;
+    printf("%d threads, %d lines each\n", n, lines);
+    {
+      DoubleBuffering log("old");
+      log.start();
+      report("double buffering", run(&log, n, lines));
+      log.stop();
+    }
+    {
+      AsyncLogging log("new", 500*1000*1000);
+      log.start();
+      report("per-thread rings", run(&log, n, lines));
+      log.stop();
+    }
+    verify(dir, "new", n, lines);
+    for(const std::string& f : files(dir, "")) unlink(f.c_str());
+  }
+  cleanup(dir);
+}
@@ -0,0 +1,87 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/logging/AsyncLogging.h"
+#include "chtho/logging/BinaryLogging.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace chtho;
+
+AsyncLogging* g_async = NULL;
+
+void output(const char* msg, int len) { g_async->append(msg, len); }
+
+int64_t nowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// the bytes of the files starting with prefix, which are removed
+off_t consume(const char* prefix)
+{
+  off_t total = 0;
+  DIR* d = opendir(".");
+  while(struct dirent* e = readdir(d))
+  {
+    if(strncmp(e->d_name, prefix, strlen(prefix)) != 0) continue;
+    struct stat st;
+    if(stat(e->d_name, &st) == 0) total += st.st_size;
+    unlink(e->d_name);
+  }
+  closedir(d);
+  return total;
+}
+
+// a typical request trace line
+std::string g_peer = "192.168.10.24:51234";
+
+int main(int argc, char* argv[])
+{
+  int n = argc > 1 ? atoi(argv[1]) : 1000000;
+  char tmpl[] = "/tmp/binarylogging_bench.XXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  if(chdir(dir.c_str()) != 0) return 1;
+
+  double textNs, binNs;
+  off_t textBytes, binBytes;
+  {
+    AsyncLogging log("text", 1000*1000*1000);
+    g_async = &log;
+    Logger::setOutput(output);
+    log.start();
+    int64_t start = nowNs();
+    for(int i = 0; i < n; ++i)
+      LOG_INFO << "conn " << i % 1000 << " from " << g_peer << " sent " << i * 17
+        << " bytes in " << i * 0.001 << " ms";
+    textNs = static_cast<double>(nowNs() - start) / n;
+    log.stop();
+    textBytes = consume("text");
+  }
+  {
+    BinaryLogging log("bin", 1000*1000*1000);
+    BinaryLogging::setInstance(&log);
+    log.start();
+    int64_t start = nowNs();
+    for(int i = 0; i < n; ++i)
+      LOG_BIN_INFO("conn %d from %s sent %d bytes in %g ms", i % 1000, g_peer, i * 17,
+        i * 0.001);
+    binNs = static_cast<double>(nowNs() - start) / n;
+    log.stop();
+    BinaryLogging::setInstance(NULL);
+    binBytes = consume("bin");
+  }
+  rmdir(dir.c_str());
+  printf("%-8s %10s %12s\n", "", "ns/line", "bytes/line");
+  printf("%-8s %10.1f %12.1f\n", "text", textNs, static_cast<double>(textBytes) / n);
+  printf("%-8s %10.1f %12.1f\n", "binary", binNs, static_cast<double>(binBytes) / n);
+}
@@ -0,0 +1,235 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/logging/BinaryLogging.h"
+#include "chtho/logging/BinaryLogDecoder.h"
+#include "chtho/threads/Thread.h"
+
+#include <assert.h>
+#include <dirent.h>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace chtho;
+
+void testCheckFormat()
+{
+  using binlog::checkFormat;
+  assert(checkFormat("plain", ""));
+  assert(checkFormat("%d %u %ld %zu %c", "iuLLi"));
+  assert(checkFormat("%5.2f %s %p %%", "dsp"));
+  assert(checkFormat("%*d %.*s", "iiis"));
+  assert(!checkFormat("%d", ""));
+  assert(!checkFormat("%d", "ii"));
+  assert(!checkFormat("%s", "i"));
+  assert(!checkFormat("%f", "i"));
+  assert(!checkFormat("%n", "i"));
+}
+
+std::string render(const std::string& format, const std::string& types,
+  const std::string& args, bool* ok)
+{
+  std::string out;
+  *ok = BinaryLogDecoder::render(format, types, args.data(), args.size(), &out);
+  return out;
+}
+
+template<typename... Args>
+std::string encode(const Args&... args)
+{
+  std::string s(binlog::argsSize(args...), '\0');
+  char* end = binlog::putArgs(&s[0], args...);
+  assert(end == &s[0] + s.size());
+  (void)end;
+  return s;
+}
+
+void testRender()
+{
+  bool ok;
+  std::string s = "abc";
+  int64_t big = -1234567890123LL;
+  assert(render("fd %d sent %zu bytes to %s (%.3f ms) %x", "iLsdu",
+    encode(7, size_t(4096), s, 1.5, 255u), &ok) == "fd 7 sent 4096 bytes to abc (1.500 ms) ff");
+  assert(ok);
+  assert(render("%ld|%-5s|%5d|%%", "lsi", encode(big, "ab", 42), &ok)
+    == "-1234567890123|ab   |   42|%");
+  assert(ok);
+  assert(render("[%*d] [%.*s]", "iiis", encode(4, 7, 2, std::string("xyz")), &ok)
+    == "[   7] [xy]");
+  assert(ok);
+  // a conversion that doesn't fit the argument prints the argument
+  assert(render("%s and %d", "is", encode(5, "x"), &ok) == "5 and x");
+  assert(ok);
+  // missing arguments keep their conversions
+  assert(render("%d %d", "i", encode(1), &ok) == "1 %d");
+  assert(!ok);
+}
+
+int g_lines = 200;
+
+void logSome(int t)
+{
+  for(int i = 0; i < g_lines; ++i)
+  {
+    LOG_BIN_INFO("thread %d line %d: %s %.2f %lu", t, i, std::string("str"), i * 0.5,
+      static_cast<unsigned long>(i) * 1000000007UL);
+    if(i % 50 == 0) LOG_BIN_WARN("thread %d checkpoint %s", t, "cp");
+    LOG_BIN_DEBUG("filtered %d", i); // below INFO
+  }
+}
+
+std::string readLogs()
+{
+  std::vector<std::string> names;
+  DIR* d = opendir(".");
+  while(struct dirent* e = readdir(d))
+    if(strncmp(e->d_name, "binlog_test", 11) == 0) names.push_back(e->d_name);
+  closedir(d);
+  assert(names.size() == 1);
+  std::ifstream in(names[0], std::ios::binary);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  unlink(names[0].c_str());
+  return ss.str();
+}
+
+void testLog()
+{
+  char tmpl[] = "/tmp/binarylogging_test.XXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  if(chdir(dir.c_str()) != 0) abort();
+  {
+    BinaryLogging log("binlog_test", 500*1000*1000);
+    log.start();
+    BinaryLogging::setInstance(&log);
+    std::vector<std::unique_ptr<Thread>> threads;
+    for(int t = 0; t < 4; ++t)
+    {
+      threads.emplace_back(new Thread([t](){ logSome(t); }));
+      threads.back()->start();
+    }
+    logSome(4);
+    for(auto& t : threads) t->join();
+    log.stop();
+    BinaryLogging::setInstance(NULL);
+  }
+  LOG_BIN_INFO("no instance %d", 1); // goes nowhere
+  std::string data = readLogs();
+  rmdir(dir.c_str());
+
+  // decoded in odd sized pieces, records get split between feeds
+  BinaryLogDecoder decoder;
+  decoder.setTimeZone(TimeZone());
+  std::string text;
+  for(size_t off = 0; off < data.size(); off += 333)
+  {
+    bool ok = decoder.feed(data.data() + off, std::min<size_t>(333, data.size() - off), &text);
+    assert(ok);
+    (void)ok;
+  }
+  assert(decoder.pending() == 0);
+  assert(decoder.unknown() == 0);
+  assert(decoder.records() == 5u * (g_lines + g_lines / 50));
+
+  std::istringstream lines(text);
+  std::string l;
+  std::vector<int> next(5, 0);
+  int warns = 0;
+  while(std::getline(lines, l))
+  {
+    // "20210407 15:24:36.123456 12345 INFO  thread ..."
+    assert(l[8] == ' ' && l[17] == '.');
+    assert(l.find(" BinaryLogging_test.cpp:") != std::string::npos);
+    if(l.find("WARN  thread ") != std::string::npos)
+    {
+      assert(l.find(" checkpoint cp ") != std::string::npos);
+      ++warns;
+      continue;
+    }
+    size_t p = l.find("INFO  thread ");
+    assert(p != std::string::npos);
+    int t, i;
+    char expect[128];
+    int n = sscanf(l.c_str() + p, "INFO  thread %d line %d", &t, &i);
+    assert(n == 2);
+    (void)n;
+    snprintf(expect, sizeof expect, "INFO  thread %d line %d: str %.2f %lu ", t, i, i * 0.5,
+      static_cast<unsigned long>(i) * 1000000007UL);
+    assert(l.compare(p, strlen(expect), expect) == 0);
+    assert(next[t] == i);
+    ++next[t];
+  }
+  assert(warns == 5 * g_lines / 50);
+  for(int n : next) assert(n == g_lines);
+
+  // garbage is noticed
+  BinaryLogDecoder bad;
+  assert(!bad.feed("20210407 12:00:00 INFO", 22, &text));
+
+  // and so is a site record with an id no statement has
+  const uint32_t ids[] = { 0, 0xFFFFFFFF, binlog::kMaxSiteId + 1 };
+  for(uint32_t id : ids)
+  {
+    char rec[23] = { binlog::kSiteRecord, 23 };
+    memcpy(rec + 5, &id, 4);
+    rec[9] = 2; // INFO
+    rec[14] = 4; // file len
+    memcpy(rec + 16, "a.cc", 4);
+    BinaryLogDecoder damaged;
+    assert(!damaged.feed(rec, sizeof rec, &text));
+  }
+}
+
+// the lines a full ring drops are noted in a record of their own, the
+// records after it still decode
+void testDrops()
+{
+  char tmpl[] = "/tmp/binarylogging_test.XXXXXX";
+  std::string dir = mkdtemp(tmpl);
+  if(chdir(dir.c_str()) != 0) abort();
+  const int kLines = 20000;
+  {
+    BinaryLogging log("binlog_test", 500*1000*1000);
+    log.async().setRingSize(4096);
+    log.async().setOverflow(AsyncLogging::Overflow::DropNewest);
+    log.start();
+    BinaryLogging::setInstance(&log);
+    for(int i = 0; i < kLines; ++i) LOG_BIN_INFO("line %d", i);
+    log.stop();
+    assert(log.async().stats().droppedLines > 0);
+    BinaryLogging::setInstance(NULL);
+  }
+  std::string data = readLogs();
+  rmdir(dir.c_str());
+
+  BinaryLogDecoder decoder;
+  std::string text;
+  bool ok = decoder.feed(data.data(), data.size(), &text);
+  assert(ok);
+  (void)ok;
+  assert(decoder.pending() == 0);
+  assert(decoder.dropped() > 0);
+  // every line is either decoded or counted as dropped, the
+  // description of the statement may be among the dropped
+  size_t all = decoder.records() + decoder.dropped();
+  assert(all == kLines || all == kLines + 1);
+  (void)all;
+  assert(text.find("drop log at ") != std::string::npos);
+}
+
+int main()
+{
+  testCheckFormat();
+  testRender();
+  testLog();
+  testDrops();
+  printf("ok\n");
+}
@@ -0,0 +1,279 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/logging/LogArchiver.h"
+#include "chtho/logging/LogFile.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <atomic>
+#include <dirent.h>
+#include <fstream>
+#include <ftw.h> // nftw
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/time.h> // utimes
+#include <sys/wait.h> // waitpid
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+using namespace chtho;
+
+std::string readFile(const std::string& name)
+{
+  std::ifstream in(name);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+void writeFile(const std::string& name, const std::string& data)
+{
+  std::ofstream out(name);
+  out << data;
+}
+
+bool exists(const std::string& name)
+{
+  struct stat st;
+  return ::stat(name.c_str(), &st) == 0;
+}
+
+// all members from offset on
+std::string gunzip(const std::string& name, off_t offset = 0)
+{
+  FILE* f = fopen(name.c_str(), "r");
+  fseek(f, offset, SEEK_SET);
+  gzFile gz = gzdopen(dup(fileno(f)), "r");
+  fclose(f);
+  std::string res;
+  char buf[64*1024];
+  int n;
+  while((n = gzread(gz, buf, sizeof buf)) > 0) res.append(buf, n);
+  assert(n == 0);
+  gzclose(gz);
+  return res;
+}
+
+std::vector<std::string> files(const std::string& prefix)
+{
+  std::vector<std::string> res;
+  DIR* d = opendir(".");
+  while(struct dirent* e = readdir(d))
+    if(strncmp(e->d_name, prefix.c_str(), prefix.size()) == 0)
+      res.push_back(e->d_name);
+  closedir(d);
+  std::sort(res.begin(), res.end());
+  return res;
+}
+
+// a Logger like line, one a millisecond from 12:00:00
+std::string line(int i)
+{
+  char buf[128];
+  int n = snprintf(buf, sizeof buf,
+    "20210407 12:%02d:%02d.%06d 1234 INFO  line %d - LogArchiver_test.cpp:1\n",
+    i / 60000 % 60, i / 1000 % 60, i % 1000 * 1000, i);
+  return std::string(buf, n);
+}
+
+std::string lines(int n)
+{
+  std::string res;
+  for(int i = 0; i < n; ++i) res += line(i);
+  return res;
+}
+
+// every member can be inflated on its own from the offset the index
+// has for it
+void testCompressAndIndex()
+{
+  std::string data = "a line without a time\n" + lines(50000);
+  writeFile("idx.log", data);
+  bool ok = LogArchiver::compress("idx.log", 1, true);
+  assert(ok);
+  (void)ok;
+  assert(!exists("idx.log"));
+  assert(gunzip("idx.log.gz") == data);
+  std::ifstream idx("idx.log.idx");
+  std::string key, date, time;
+  idx >> key >> date >> time;
+  assert(key == "first" && date + " " + time == "20210407 12:00:00.000000");
+  idx >> key >> date >> time;
+  assert(key == "last" && date + " " + time == "20210407 12:00:49.999000");
+  long long raw, gz;
+  int members = 0;
+  while(idx >> date >> time >> raw >> gz)
+  {
+    ++members;
+    assert(data.compare(raw, 24, date + " " + time) == 0 || raw == 0);
+    assert(raw == 0 || data[raw - 1] == '\n');
+    std::string rest = gunzip("idx.log.gz", gz);
+    assert(rest == data.substr(raw));
+  }
+  assert(members == static_cast<int>(data.size() / LogArchiver::kMemberSize) + 1);
+  struct stat st;
+  ::stat("idx.log.gz", &st);
+  printf("compressed %zu bytes to %lld in %d members\n", data.size(),
+    static_cast<long long>(st.st_size), members);
+}
+
+void age(const std::string& name, int secs)
+{
+  struct timeval tv[2];
+  gettimeofday(&tv[0], NULL);
+  tv[0].tv_sec -= secs;
+  tv[1] = tv[0];
+  utimes(name.c_str(), tv);
+}
+
+// a file of log as LogFile names it, second i of the day
+std::string logName(const char* log, int i, const char* host, pid_t pid, const char* ext = ".log")
+{
+  char buf[256];
+  snprintf(buf, sizeof buf, "%s.20210401-0000%02d.%s.%d%s", log, i, host, static_cast<int>(pid), ext);
+  return buf;
+}
+
+// by age first, then the oldest until the total fits. the current
+// file stays, and so do the files of other logs and of live processes
+void testRetention()
+{
+  char host[256];
+  if(gethostname(host, sizeof host) != 0) strcpy(host, "unknownhost");
+  pid_t self = getpid();
+  // a process that is gone
+  pid_t dead = fork();
+  if(dead == 0) _exit(0);
+  waitpid(dead, NULL, 0);
+  std::string kb(1000, 'x');
+  std::string names[] = { logName("ret", 1, host, self, ".log.gz"),
+    logName("ret", 2, host, dead, ".log.gz"), logName("ret", 3, host, self),
+    logName("ret", 4, host, self), logName("ret", 5, host, self) };
+  for(int i = 0; i < 5; ++i)
+  {
+    writeFile(names[i], kb);
+    age(names[i], (5 - i) * 100);
+  }
+  std::string idx = names[0].substr(0, names[0].size() - 3) + ".idx";
+  writeFile(idx, "first\nlast\n");
+  // not of this log, or of a process that is running (init)
+  std::string others[] = { "retained.log", logName("ret.access", 1, host, self),
+    logName("ret", 0, host, 1), "ret.1.log", logName("ret", 1, "host.example.com", self, ".log.tmp") };
+  for(const std::string& f : others)
+  {
+    writeFile(f, kb);
+    age(f, 1000);
+  }
+  const std::string& current = names[4];
+  // ret.1 is older than 450 seconds
+  int removed = LogArchiver::enforceRetention("ret", current, 450, 0);
+  assert(removed == 1);
+  assert(!exists(names[0]) && !exists(idx));
+  // 5000 bytes left (4000 and init's), 3500 allowed
+  removed = LogArchiver::enforceRetention("ret", current, 0, 3500);
+  assert(removed == 2);
+  assert(!exists(names[1]) && !exists(names[2]));
+  // the current one is the oldest now, it counts but stays
+  age(current, 2000);
+  removed = LogArchiver::enforceRetention("ret", current, 0, 2500);
+  assert(removed == 1);
+  assert(!exists(names[3]) && exists(current));
+  for(const std::string& f : others)
+  {
+    assert(exists(f));
+    unlink(f.c_str());
+  }
+  unlink(current.c_str());
+}
+
+std::atomic<int> g_archived(0);
+
+// rolled files are compressed in the background, with nothing lost
+void testLogFile()
+{
+  std::string expect;
+  {
+    LogFile log("roll", 256*1024, false, 3, 64);
+    log.setBackgroundRoll(true);
+    LogArchiver::Options opts;
+    opts.index = true;
+    opts.archived = [](const std::string& f)
+    {
+      assert(f.size() > 3 && f.compare(f.size() - 3, 3, ".gz") == 0);
+      ++g_archived;
+    };
+    log.setArchive(opts);
+    // rolls are at most once a second
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    time_t end = ts.tv_sec + 3;
+    for(int i = 0; ts.tv_sec < end; ++i)
+    {
+      std::string l = line(i);
+      log.append(l.data(), static_cast<int>(l.size()));
+      expect += l;
+      if(i % 64 == 0)
+      {
+        usleep(200);
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+      }
+    }
+  }
+  std::string all;
+  int gz = 0, plain = 0;
+  for(const std::string& f : files("roll."))
+  {
+    if(f.size() > 3 && f.compare(f.size() - 3, 3, ".gz") == 0)
+    {
+      all += gunzip(f);
+      ++gz;
+      assert(exists(f.substr(0, f.size() - 3) + ".idx"));
+    }
+    else if(f.compare(f.size() - 4, 4, ".log") == 0)
+    {
+      all += readFile(f); // the last one
+      ++plain;
+    }
+  }
+  assert(gz >= 2 && plain == 1);
+  assert(gz == g_archived);
+  assert(all == expect);
+  assert(files(".roll").empty());
+  printf("%d files compressed, %zu bytes in all\n", gz, all.size());
+}
+
+int removeEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+  return ::remove(path);
+}
+
+int main()
+{
+  // LogFile writes into the working directory
+  char dir[] = "/tmp/chtho_archiver_XXXXXX";
+  if(!mkdtemp(dir) || chdir(dir) != 0)
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+  testCompressAndIndex();
+  testRetention();
+  testLogFile();
+  // the files go with the directory, children first
+  if(chdir("/") != 0 || nftw(dir, removeEntry, 16, FTW_DEPTH | FTW_PHYS) != 0)
+  {
+    perror(dir);
+    return 1;
+  }
+  printf("all passed\n");
+  return 0;
+}
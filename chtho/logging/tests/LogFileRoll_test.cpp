@@ -0,0 +1,191 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/logging/LogFile.h"
+
+#include <algorithm>
+#include <assert.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <ftw.h> // nftw
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace chtho;
+
+std::string readFile(const std::string& name)
+{
+  std::ifstream in(name);
+  std::stringstream ss;
+  ss << in.rdbuf();
+  return ss.str();
+}
+
+// the names in the working directory starting with prefix, in order
+std::vector<std::string> files(const std::string& prefix)
+{
+  std::vector<std::string> res;
+  DIR* d = opendir(".");
+  while(struct dirent* e = readdir(d))
+    if(strncmp(e->d_name, prefix.c_str(), prefix.size()) == 0)
+      res.push_back(e->d_name);
+  closedir(d);
+  std::sort(res.begin(), res.end());
+  return res;
+}
+
+bool canReserve()
+{
+  int fd = ::open("reserve", O_WRONLY|O_CREAT, 0644);
+  bool ok = ::fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, 4096) == 0;
+  ::close(fd);
+  ::unlink("reserve");
+  return ok;
+}
+
+int64_t nowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// small appends go through the buffer, large ones around it, in order
+void testAppendFile()
+{
+  const off_t prealloc = 1024*1024;
+  std::string expect;
+  {
+    futil::AppendFile f("append", prealloc);
+    std::string big(200*1024, 'b');
+    for(int i = 0; i < 1000; ++i)
+    {
+      std::string l = "line " + std::to_string(i) + "\n";
+      if(i % 100 == 99) l = big;
+      f.append(l.data(), l.size());
+      expect += l;
+    }
+    assert(f.written() == static_cast<off_t>(expect.size()));
+    f.flush();
+    struct stat st;
+    ::stat("append", &st);
+    assert(st.st_size == static_cast<off_t>(expect.size()));
+    // the space ahead is reserved, the size isn't
+    if(canReserve()) assert(st.st_blocks * 512 >= st.st_size + prealloc / 2);
+    assert(f.unsynced() > 0);
+    f.sync();
+    assert(f.unsynced() == 0);
+    bool ok = f.rename("renamed");
+    assert(ok);
+    (void)ok;
+    f.append("last\n", 5);
+    expect += "last\n";
+  }
+  assert(readFile("renamed") == expect);
+  struct stat st;
+  ::stat("renamed", &st);
+  // given back on close
+  assert(st.st_blocks * 512 < st.st_size + 64*1024);
+}
+
+// with the roller the next file is ready before each roll, a roll
+// doesn't open or close anything on the appending thread
+void testRoll(bool background, LogFile::Sync sync, const char* name)
+{
+  std::string expect;
+  int64_t maxNs = 0;
+  {
+    LogFile log(name, 64*1024, false, 3, 64);
+    log.setSync(sync, 16*1024);
+    log.setBackgroundRoll(background);
+    // rolls are at most once a second
+    int64_t end = nowNs() + 2500*1000*1000LL;
+    for(int i = 0; nowNs() < end; ++i)
+    {
+      char buf[64];
+      int n = snprintf(buf, sizeof buf, "line %08d of the rolling log\n", i);
+      int64_t start = nowNs();
+      log.append(buf, n);
+      maxNs = std::max(maxNs, nowNs() - start);
+      expect.append(buf, n);
+      if(i % 16 == 0) usleep(100);
+    }
+  }
+  std::vector<std::string> logs = files(name);
+  assert(logs.size() >= 3);
+  std::string all;
+  for(const std::string& f : logs) all += readFile(f);
+  assert(all == expect);
+  // the unused next file is gone
+  assert(files("." + std::string(name)).empty());
+  printf("%s: %zu files, the slowest append took %ld us\n", name, logs.size(),
+    static_cast<long>(maxNs / 1000));
+}
+
+// the next file of a process that died is removed when a roller
+// starts, those of live processes and other names are not
+void testStaleNext()
+{
+  pid_t dead = fork();
+  if(dead == 0) _exit(0);
+  waitpid(dead, NULL, 0);
+  std::string stale = ".stale." + std::to_string(dead) + ".next";
+  std::vector<std::string> kept = {
+    ".stale.1.next", // init
+    ".stale." + std::to_string(getpid()) + "x.next",
+    ".stale.access." + std::to_string(dead) + ".next",
+    ".other." + std::to_string(dead) + ".next" };
+  for(const std::string& f : kept) ::close(::open(f.c_str(), O_WRONLY|O_CREAT, 0644));
+  ::close(::open(stale.c_str(), O_WRONLY|O_CREAT, 0644));
+  {
+    LogFile log("stale", 64*1024, false, 3, 64);
+    log.setBackgroundRoll(true);
+    log.append("x\n", 2);
+  }
+  assert(::access(stale.c_str(), F_OK) != 0);
+  for(const std::string& f : kept)
+  {
+    assert(::access(f.c_str(), F_OK) == 0);
+    ::unlink(f.c_str());
+  }
+}
+
+int removeEntry(const char* path, const struct stat*, int, struct FTW*)
+{
+  return ::remove(path);
+}
+
+int main()
+{
+  // LogFile writes into the working directory
+  char dir[] = "/tmp/chtho_logfile_XXXXXX";
+  if(!mkdtemp(dir) || chdir(dir) != 0)
+  {
+    perror("mkdtemp");
+    return 1;
+  }
+  testAppendFile();
+  testRoll(false, LogFile::Sync::None, "inline");
+  testRoll(true, LogFile::Sync::None, "background");
+  testRoll(true, LogFile::Sync::Bytes, "bytesync");
+  testStaleNext();
+  // the files go with the directory, children first
+  if(chdir("/") != 0 || nftw(dir, removeEntry, 16, FTW_DEPTH | FTW_PHYS) != 0)
+  {
+    perror(dir);
+    return 1;
+  }
+  printf("all passed\n");
+  return 0;
+}
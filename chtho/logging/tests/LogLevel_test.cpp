@@ -0,0 +1,96 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/logging/Logger.h"
+
+// TRACE is compiled out of this file whatever the runtime level
+#undef CHTHO_MIN_LOG_LEVEL
+#define CHTHO_MIN_LOG_LEVEL 1
+
+#include <assert.h>
+#include <stdio.h>
+#include <string>
+
+using chtho::Logger;
+
+std::string g_out;
+int g_lines = 0;
+
+void output(const char* msg, int len)
+{
+  g_out.assign(msg, len);
+  ++g_lines;
+}
+
+int g_evaluated = 0;
+int sideEffect()
+{
+  return ++g_evaluated;
+}
+
+// as if defined in a header
+inline void inlineCode(int x)
+{
+  LOG_INLINE(DEBUG) << "inline " << x;
+}
+
+int main()
+{
+  Logger::setOutput(output);
+  assert(chtho::tuLogModule.name() == "LogLevel_test");
+  assert(Logger::logLevel() == Logger::Level::INFO);
+
+  // the basename is computed at compile time
+  constexpr chtho::SourceFile f("a/b/c/Foo.cpp");
+  static_assert(f.size_ == 7, "basename");
+  LOG_INFO << "hello";
+  assert(g_lines == 1);
+  assert(g_out.find(" LogLevel_test.cpp:") != std::string::npos);
+
+  // below the runtime level, the operands are not evaluated
+  LOG_DEBUG << sideEffect();
+  assert(g_lines == 1 && g_evaluated == 0);
+
+  // a module level overrides the global one
+  Logger::setModuleLevel("LogLevel_test", Logger::Level::DEBUG);
+  assert(Logger::moduleLevel("LogLevel_test") == Logger::Level::DEBUG);
+  assert(Logger::moduleLevel("Other") == Logger::Level::INFO);
+  LOG_DEBUG << sideEffect();
+  assert(g_lines == 2 && g_evaluated == 1);
+
+  // and is kept when the global level changes
+  Logger::setLogLevel(Logger::Level::WARN);
+  LOG_DEBUG << "still";
+  assert(g_lines == 3);
+  Logger::clearModuleLevel("LogLevel_test");
+  LOG_INFO << "gone";
+  assert(g_lines == 3);
+  LOG_WARN << "warn";
+  assert(g_lines == 4);
+
+  // compiled out: even at TRACE nothing is evaluated
+  Logger::setModuleLevel("LogLevel_test", Logger::Level::TRACE);
+  LOG_TRACE << sideEffect();
+  assert(g_lines == 4 && g_evaluated == 1);
+  static_assert(!CHTHO_LOG_ENABLED(Logger::Level::TRACE), "compiled out");
+
+  // no dangling else
+  if(g_lines == 0)
+    LOG_ERR << "never";
+  else
+    ++g_lines;
+  assert(g_lines == 5);
+
+  // inline code has a module of its own, shared by every file
+  assert(chtho::inlineLogModule.name() == "inline");
+  inlineCode(1);
+  assert(g_lines == 5);
+  Logger::setModuleLevel("inline", Logger::Level::DEBUG);
+  inlineCode(2);
+  assert(g_lines == 6);
+  assert(g_out.find("inlineCode inline 2") != std::string::npos);
+
+  printf("ok\n");
+}
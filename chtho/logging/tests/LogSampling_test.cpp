@@ -0,0 +1,167 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/logging/LogSampling.h"
+#include "chtho/logging/StructLogger.h"
+#include "chtho/threads/Thread.h"
+#include "chtho/threads/MutexLock.h"
+#include "chtho/threads/MutexLockGuard.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <unistd.h>
+#include <memory>
+#include <vector>
+
+using namespace chtho;
+
+MutexLock g_mutex;
+std::vector<std::string> g_lines;
+
+void output(const char* msg, int len)
+{
+  MutexLockGuard lock(g_mutex);
+  g_lines.push_back(std::string(msg, len));
+}
+
+// the N of "(N suppressed)" in a line, 0 without
+uint64_t suppressed(const std::string& line)
+{
+  size_t p = line.find('(');
+  if(p == std::string::npos || line.find(" suppressed)", p) == std::string::npos) return 0;
+  return strtoull(line.c_str() + p + 1, NULL, 10);
+}
+
+int g_evaluated = 0;
+int evaluated() { return ++g_evaluated; }
+
+// a skipped statement evaluates nothing of its << chain
+void testEveryN()
+{
+  g_lines.clear();
+  for(int i = 0; i < 100; ++i)
+    LOG_EVERY_N(INFO, 10) << "every 10th " << evaluated();
+  assert(g_lines.size() == 10);
+  assert(g_evaluated == 10);
+  assert(suppressed(g_lines[0]) == 0);
+  for(size_t i = 1; i < g_lines.size(); ++i) assert(suppressed(g_lines[i]) == 9);
+  // a level that is off doesn't count
+  Logger::setLogLevel(Logger::Level::WARN);
+  for(int i = 0; i < 5; ++i) LOG_EVERY_N(INFO, 2) << "off";
+  Logger::setLogLevel(Logger::Level::INFO);
+  for(int i = 0; i < 4; ++i) LOG_EVERY_N(INFO, 2) << "on";
+  assert(g_lines.size() == 12);
+}
+
+void testFirstN()
+{
+  g_lines.clear();
+  for(int i = 0; i < 10; ++i)
+  {
+    // each statement has its own count
+    LOG_FIRST_N(INFO, 3) << "first 3";
+    LOG_FIRST_N(WARN, 1) << "first 1";
+  }
+  assert(g_lines.size() == 4);
+  assert(g_lines[0].find("first 3") != std::string::npos);
+  assert(g_lines[1].find("first 1") != std::string::npos);
+}
+
+void testEveryT()
+{
+  g_lines.clear();
+  int64_t end = LogSite::now() + 300000;
+  int runs = 0;
+  while(LogSite::now() < end)
+  {
+    LOG_EVERY_T(ERR, 0.1) << "every 100ms";
+    ++runs;
+    usleep(100);
+  }
+  // 0, 100, 200 ms, maybe once more with the clock's tick
+  assert(g_lines.size() >= 3 && g_lines.size() <= 4);
+  uint64_t total = g_lines.size();
+  for(const std::string& l : g_lines) total += suppressed(l);
+  assert(total <= static_cast<uint64_t>(runs));
+  printf("every_t: %zu lines of %d runs\n", g_lines.size(), runs);
+}
+
+// exactly every nth of all threads' runs is written
+void testThreads()
+{
+  g_lines.clear();
+  const int kThreads = 4, kRuns = 100000;
+  std::vector<std::unique_ptr<Thread>> threads;
+  for(int i = 0; i < kThreads; ++i)
+  {
+    threads.emplace_back(new Thread([]
+    {
+      for(int j = 0; j < kRuns; ++j) LOG_EVERY_N(INFO, 1000) << "threads";
+    }, "sampler"));
+    threads.back()->start();
+  }
+  for(auto& t : threads) t->join();
+  assert(g_lines.size() == kThreads * kRuns / 1000);
+  uint64_t total = 0;
+  for(const std::string& l : g_lines) total += suppressed(l);
+  assert(total <= static_cast<uint64_t>(kThreads * kRuns) - g_lines.size());
+  assert(total >= static_cast<uint64_t>(kThreads * kRuns) - g_lines.size() - 999);
+}
+
+// a burst, then the average rate, the drops are reported
+void testRateLimit()
+{
+  g_lines.clear();
+  Logger::setRateLimit(Logger::Level::WARN, 100, 10);
+  for(int i = 0; i < 1000; ++i) LOG_WARN << "burst " << evaluated();
+  // the clock may tick during the loop
+  assert(g_lines.size() >= 10 && g_lines.size() <= 12);
+  assert(Logger::rateLimited(Logger::Level::WARN) == 1000 - g_lines.size());
+  // other levels have no limit
+  for(int i = 0; i < 100; ++i) LOG_INFO << "info";
+  assert(g_lines.size() >= 110);
+  usleep(100000);
+  g_lines.clear();
+  LOG_WARN << "after";
+  assert(g_lines.size() == 1);
+  assert(suppressed(g_lines[0]) == Logger::rateLimited(Logger::Level::WARN));
+  // about 100 a second on average
+  g_lines.clear();
+  int64_t end = LogSite::now() + 500000;
+  while(LogSite::now() < end)
+  {
+    LOG_WARN << "steady";
+    usleep(50);
+  }
+  printf("rate limit: %zu lines in 0.5s at 100/s, burst 10\n", g_lines.size());
+  assert(g_lines.size() >= 45 && g_lines.size() <= 70);
+  // StructLogger goes by the same bucket
+  usleep(100000);
+  g_lines.clear();
+  for(int i = 0; i < 20; ++i) SLOG_WARN("struct").kv("i", i);
+  assert(g_lines.size() >= 10 && g_lines.size() <= 12);
+  usleep(100000);
+  g_lines.clear();
+  SLOG_WARN("struct after");
+  assert(g_lines.size() == 1 && g_lines[0].find("\"suppressed\":") != std::string::npos);
+  Logger::setRateLimit(Logger::Level::WARN, 0);
+  g_lines.clear();
+  for(int i = 0; i < 1000; ++i) LOG_WARN << "unlimited";
+  assert(g_lines.size() == 1000);
+}
+
+int main()
+{
+  Logger::setOutput(output);
+  testEveryN();
+  testFirstN();
+  testEveryT();
+  testThreads();
+  testRateLimit();
+  printf("all passed\n");
+  return 0;
+}
@@ -0,0 +1,111 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/logging/LogStream.h"
+#include "chtho/time/Timestamp.h"
+
+#include <algorithm>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+using namespace chtho;
+
+// the formatting LogStream did before: a digit per division and a
+// reverse, snprintf for the rest
+const char kDigits[] = "9876543210123456789";
+const char* kZero = kDigits + 9;
+
+template<typename T>
+size_t oldConvert(char buf[], T value)
+{
+  T i = value;
+  char* p = buf;
+  do
+  {
+    int lsd = static_cast<int>(i % 10);
+    i /= 10;
+    *p++ = kZero[lsd];
+  } while(i != 0);
+  if(value < 0) *p++ = '-';
+  std::reverse(buf, p);
+  return p - buf;
+}
+
+size_t oldFloat(char buf[], double v) { return snprintf(buf, kMaxNumSize, "%.12g", v); }
+size_t oldPointer(char buf[], const void* p) { return snprintf(buf, kMaxNumSize, "%p", p); }
+
+size_t newFloat(char buf[], double v) { return convertFloat(buf, v); }
+size_t newPointer(char buf[], const void* p)
+{
+  return convertHex(buf, reinterpret_cast<uintptr_t>(p));
+}
+
+// ns per value, the sink keeps the calls alive
+template<typename T, typename F>
+double bench(const std::vector<T>& values, int rounds, F fmt, size_t* sink)
+{
+  char buf[kMaxNumSize];
+  Timestamp start = Timestamp::now();
+  for(int r = 0; r < rounds; ++r)
+    for(const T& v : values) *sink += fmt(buf, v) + buf[0];
+  double sec = Timestamp::diffInSec(Timestamp::now(), start);
+  return sec * 1e9 / (static_cast<double>(rounds) * values.size());
+}
+
+void report(const char* name, double before, double after)
+{
+  printf("%-22s %10.1f %10.1f %8.2fx\n", name, before, after, before / after);
+}
+
+int main(int argc, char* argv[])
+{
+  int rounds = argc > 1 ? atoi(argv[1]) : 20;
+  const int kN = 100000;
+  std::mt19937_64 rng(1);
+  std::vector<int> smallInts; // ports, fds, lengths
+  std::vector<int64_t> bigInts; // byte counters, timestamps
+  std::vector<double> doubles; // latencies, ratios
+  std::vector<const void*> pointers;
+  for(int i = 0; i < kN; ++i)
+  {
+    smallInts.push_back(static_cast<int>(rng() % 65536));
+    bigInts.push_back(static_cast<int64_t>(rng() >> (rng() % 32)));
+    doubles.push_back(std::uniform_real_distribution<double>(0, 1000)(rng));
+    pointers.push_back(reinterpret_cast<const void*>(0x7f0000000000 + (rng() & 0xffffffffff)));
+  }
+  size_t sink = 0;
+  printf("%-22s %10s %10s %9s   (ns/value)\n", "", "before", "after", "speedup");
+  report("int < 65536",
+    bench(smallInts, rounds, oldConvert<int>, &sink),
+    bench(smallInts, rounds, convert<int>, &sink));
+  report("int64",
+    bench(bigInts, rounds, oldConvert<int64_t>, &sink),
+    bench(bigInts, rounds, convert<int64_t>, &sink));
+  report("double (%.12g)",
+    bench(doubles, rounds, oldFloat, &sink),
+    bench(doubles, rounds, newFloat, &sink));
+  report("pointer",
+    bench(pointers, rounds, oldPointer, &sink),
+    bench(pointers, rounds, newPointer, &sink));
+
+  // a whole log line body
+  Timestamp start = Timestamp::now();
+  for(int r = 0; r < rounds; ++r)
+  {
+    for(int i = 0; i < kN; ++i)
+    {
+      LogStream os;
+      os << "conn " << smallInts[i] << " sent " << bigInts[i] << " bytes in "
+         << doubles[i] << " ms, ctx " << pointers[i];
+      sink += os.buffer().length();
+    }
+  }
+  double sec = Timestamp::diffInSec(Timestamp::now(), start);
+  printf("LogStream line         %10.1f ns\n", sec * 1e9 / (static_cast<double>(rounds) * kN));
+  return sink == 0;
+}
@@ -0,0 +1,151 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/logging/LogStream.h"
+
+#include <assert.h>
+#include <limits>
+#include <random>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+using chtho::LogStream;
+
+template<typename T>
+std::string str(T v)
+{
+  LogStream os;
+  os << v;
+  return std::string(os.buffer().data(), os.buffer().length());
+}
+
+template<typename T>
+void checkInt(T v, const char* fmt)
+{
+  char expect[64];
+  snprintf(expect, sizeof expect, fmt, v);
+  assert(str(v) == expect);
+}
+
+void testIntegers()
+{
+  assert(str(0) == "0");
+  assert(str(-1) == "-1");
+  assert(str(std::numeric_limits<int>::min()) == "-2147483648");
+  assert(str(std::numeric_limits<int64_t>::min()) == "-9223372036854775808");
+  assert(str(std::numeric_limits<uint64_t>::max()) == "18446744073709551615");
+  assert(str(static_cast<short>(-32768)) == "-32768");
+  assert(str(static_cast<unsigned char>(255)) == "255");
+  uint64_t p = 1;
+  for(int i = 0; i < 20; ++i, p *= 10)
+  {
+    checkInt(p, "%llu");
+    checkInt(p - 1, "%llu");
+    checkInt(static_cast<long long>(p) + 1, "%lld");
+    checkInt(-static_cast<long long>(p), "%lld");
+  }
+  std::mt19937_64 rng(42);
+  for(int i = 0; i < 100000; ++i)
+  {
+    uint64_t v = rng() >> (rng() % 64);
+    checkInt(static_cast<unsigned long long>(v), "%llu");
+    checkInt(static_cast<long long>(v), "%lld");
+    checkInt(static_cast<int>(v), "%d");
+  }
+}
+
+void testPointers()
+{
+  assert(str(static_cast<void*>(NULL)) == "0x0");
+  assert(str(reinterpret_cast<void*>(0x1234abcdu)) == "0x1234abcd");
+  int x;
+  char expect[64];
+  snprintf(expect, sizeof expect, "%p", static_cast<void*>(&x));
+  assert(str(&x) == expect);
+}
+
+void testFloats()
+{
+  assert(str(0.0) == "0");
+  assert(str(-0.0) == "-0");
+  assert(str(1.0) == "1");
+  assert(str(0.1) == "0.1");
+  assert(str(-1.5) == "-1.5");
+  assert(str(0.1f) == "0.1");
+  assert(str(3.14f) == "3.14");
+  assert(str(1.0/3) == "0.3333333333333333");
+  assert(str(123456.0) == "123456");
+  assert(str(1e16) == "10000000000000000");
+  assert(str(1e20) == "1e+20");
+  assert(str(0.001) == "0.001");
+  assert(str(1.5e-7) == "1.5e-07");
+  assert(str(5e-324) == "5e-324");
+  assert(str(1.7976931348623157e308) == "1.7976931348623157e+308");
+  assert(str(std::numeric_limits<double>::quiet_NaN()) == "nan");
+  assert(str(std::numeric_limits<double>::infinity()) == "inf");
+  assert(str(-std::numeric_limits<float>::infinity()) == "-inf");
+
+  // every value reads back exactly
+  std::mt19937_64 rng(7);
+  for(int i = 0; i < 1000000; ++i)
+  {
+    uint64_t bits = rng();
+    double d;
+    memcpy(&d, &bits, sizeof d);
+    if(d != d || d == std::numeric_limits<double>::infinity()
+      || d == -std::numeric_limits<double>::infinity()) continue;
+    std::string s = str(d);
+    assert(s.size() <= 25);
+    assert(strtod(s.c_str(), NULL) == d);
+
+    uint32_t fbits = static_cast<uint32_t>(bits);
+    float f;
+    memcpy(&f, &fbits, sizeof f);
+    if(f != f || f == std::numeric_limits<float>::infinity()
+      || f == -std::numeric_limits<float>::infinity()) continue;
+    s = str(f);
+    assert(strtof(s.c_str(), NULL) == f);
+  }
+  // and is never longer than the shortest %.17g that does
+  for(int i = 0; i < 100000; ++i)
+  {
+    double d = std::uniform_real_distribution<double>(-1e6, 1e6)(rng);
+    char buf[32];
+    int prec = 1;
+    for(; prec <= 17; ++prec)
+    {
+      snprintf(buf, sizeof buf, "%.*g", prec, d);
+      if(strtod(buf, NULL) == d) break;
+    }
+    std::string s = str(d);
+    size_t digits = 0;
+    for(char c : s) if(c >= '0' && c <= '9') ++digits;
+    // leading zeros of 0.00x count once more in ours
+    assert(static_cast<int>(digits) <= prec + 5);
+  }
+}
+
+void testFull()
+{
+  // a number never goes in partially
+  LogStream os;
+  std::string fill(os.buffer().avail() - 10, 'x');
+  os << fill;
+  os << std::numeric_limits<int64_t>::min();
+  os << 1.0/3;
+  assert(os.buffer().avail() == 10);
+}
+
+int main()
+{
+  testIntegers();
+  testPointers();
+  testFloats();
+  testFull();
+  printf("ok\n");
+}
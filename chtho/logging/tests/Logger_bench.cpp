@@ -0,0 +1,86 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/logging/Logger.h"
+#include "chtho/threads/CurrentThread.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+using chtho::Logger;
+using chtho::Timestamp;
+
+std::string g_last;
+size_t g_bytes = 0;
+
+void output(const char* msg, int len)
+{
+  g_bytes += len;
+}
+
+void capture(const char* msg, int len)
+{
+  g_last.assign(msg, len);
+}
+
+// the header is "YYYYMMDD HH:MM:SS.uuuuuu pid tid LEVEL "
+void checkHeader()
+{
+  Logger::setOutput(capture);
+  Logger::setTimeZone(chtho::TimeZone(0, "UTC"));
+  for(int i = 0; i < 1000; ++i)
+  {
+    Timestamp before = Timestamp::now();
+    LOG_INFO << "x";
+    Timestamp after = Timestamp::now();
+    struct tm m;
+    time_t secs = before.secsSinceE();
+    gmtime_r(&secs, &m);
+    char expect[64];
+    snprintf(expect, sizeof expect, "%4d%02d%02d %02d:%02d:%02d.",
+      m.tm_year+1900, m.tm_mon+1, m.tm_mday, m.tm_hour, m.tm_min, m.tm_sec);
+    if(after.secsSinceE() != secs) continue; // crossed a second
+    assert(g_last.compare(0, strlen(expect), expect) == 0);
+    int us = atoi(g_last.c_str() + 18);
+    assert(us >= before.us() && us <= after.us());
+    std::string ids = std::string(chtho::CurrentThread::pidStr())
+      + chtho::CurrentThread::tidStr();
+    assert(g_last.compare(25, ids.size(), ids) == 0);
+  }
+  // a new time zone is picked up within the same second
+  Logger::setTimeZone(chtho::TimeZone(3600, "CET"));
+  Timestamp now = Timestamp::now();
+  LOG_INFO << "x";
+  struct tm m;
+  time_t secs = now.secsSinceE() + 3600;
+  gmtime_r(&secs, &m);
+  char hour[8];
+  snprintf(hour, sizeof hour, " %02d:", m.tm_hour);
+  assert(g_last.compare(8, 4, hour) == 0);
+}
+
+double bench(int n)
+{
+  Timestamp start = Timestamp::now();
+  for(int i = 0; i < n; ++i)
+    LOG_INFO << "request " << i << " done";
+  return Timestamp::diffInSec(Timestamp::now(), start) * 1e9 / n;
+}
+
+int main(int argc, char* argv[])
+{
+  int n = argc > 1 ? atoi(argv[1]) : 1000000;
+  checkHeader();
+  Logger::setOutput(output);
+  bench(n / 10); // warm up
+  printf("precise clock %6.1f ns/line\n", bench(n));
+  Logger::setClock(Logger::Clock::Coarse);
+  printf("coarse clock  %6.1f ns/line\n", bench(n));
+  Logger::setClock(Logger::Clock::Precise);
+  return g_bytes == 0;
+}
@@ -0,0 +1,51 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/logging/StructLogger.h"
+
+#include <stdio.h>
+#include <string>
+#include <time.h>
+
+using namespace chtho;
+
+void discard(const char*, int) {}
+
+int64_t nowNs()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return static_cast<int64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+// the same fields as a text line and as structured lines
+int main()
+{
+  Logger::setOutput(discard);
+  const int n = 1000000;
+  std::string peer = "192.168.100.200:54321";
+  int64_t start = nowNs();
+  for(int i = 0; i < n; ++i)
+    LOG_INFO << "connection closed fd=" << i << " peer=" << peer << " bytes=" << i * 7;
+  int64_t text = nowNs() - start;
+  StructLogger::setFormat(StructLogger::Format::Json);
+  start = nowNs();
+  for(int i = 0; i < n; ++i)
+    SLOG_INFO("connection closed").kv("fd", i).kv("peer", peer).kv("bytes", i * 7);
+  int64_t json = nowNs() - start;
+  StructLogger::setFormat(StructLogger::Format::Logfmt);
+  start = nowNs();
+  for(int i = 0; i < n; ++i)
+    SLOG_INFO("connection closed").kv("fd", i).kv("peer", peer).kv("bytes", i * 7);
+  int64_t logfmt = nowNs() - start;
+  std::string msg(1000, 'x');
+  start = nowNs();
+  size_t found = 0;
+  for(int i = 0; i < n; ++i) found += StructLogger::findSpecial(msg.data(), msg.size(), true);
+  int64_t scan = nowNs() - start;
+  printf("text %.0f ns, json %.0f ns, logfmt %.0f ns a line, escape scan %.2f GB/s\n",
+    static_cast<double>(text) / n, static_cast<double>(json) / n,
+    static_cast<double>(logfmt) / n, static_cast<double>(found) / scan);
+}
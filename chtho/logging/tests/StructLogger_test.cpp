@@ -0,0 +1,125 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/logging/StructLogger.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+using namespace chtho;
+
+std::string g_out;
+void output(const char* msg, int len) { g_out.assign(msg, len); }
+
+// the line without its time and tid, and the src without the line
+std::string body()
+{
+  size_t head = g_out.find(g_out[0] == '{' ? "\"msg\"" : "msg=");
+  size_t tail = g_out.rfind(':');
+  assert(head != std::string::npos && tail != std::string::npos);
+  return g_out.substr(head, tail - head);
+}
+
+void testJson()
+{
+  StructLogger::setFormat(StructLogger::Format::Json);
+  SLOG_INFO("connection closed").kv("fd", 12).kv("peer", "10.0.0.1:80")
+    .kv("ok", true).kv("ratio", 0.25).kv("bytes", static_cast<uint64_t>(1) << 40);
+  assert(g_out.compare(0, 9, "{\"time\":\"") == 0);
+  assert(g_out.compare(9 + Logger::kTimeLen, 19, "\",\"level\":\"INFO\",\"t") == 0);
+  assert(body() == "\"msg\":\"connection closed\",\"fd\":12,\"peer\":\"10.0.0.1:80\","
+    "\"ok\":true,\"ratio\":0.25,\"bytes\":1099511627776,\"src\":\"StructLogger_test.cpp");
+  assert(g_out.compare(g_out.size() - 3, 3, "\"}\n") == 0);
+
+  std::string s = "quote \" backslash \\ tab\t newline\n bell\x07 utf8 \xc3\xa9";
+  SLOG_WARN("odd").kv("s", s).kv("null", static_cast<const char*>(NULL))
+    .kv("nan", 0.0 / 0.0).kv("c", 'x');
+  assert(body() == "\"msg\":\"odd\",\"s\":\"quote \\\" backslash \\\\ tab\\t newline\\n"
+    " bell\\u0007 utf8 \xc3\xa9\",\"null\":null,\"nan\":\"nan\",\"c\":\"x\","
+    "\"src\":\"StructLogger_test.cpp");
+}
+
+void testLogfmt()
+{
+  StructLogger::setFormat(StructLogger::Format::Logfmt);
+  SLOG_ERR("write failed").kv("fd", -1).kv("path", "/tmp/x").kv("empty", "")
+    .kv("eq", "a=b").kv("nl", "a\nb");
+  assert(g_out.compare(0, 6, "time=\"") == 0);
+  assert(g_out.compare(6 + Logger::kTimeLen, 14, "\" level=ERROR ") == 0);
+  assert(body() == "msg=\"write failed\" fd=-1 path=/tmp/x empty=\"\" eq=\"a=b\" nl=\"a\\nb\""
+    " src=StructLogger_test.cpp");
+  assert(g_out.compare(g_out.size() - 1, 1, "\n") == 0);
+}
+
+// a value longer than the line is cut, the line stays well formed
+void testTruncate()
+{
+  StructLogger::setFormat(StructLogger::Format::Json);
+  std::string big(StructLogger::kLineSize * 2, 'x');
+  for(size_t i = 0; i < big.size(); i += 7) big[i] = '"';
+  SLOG_INFO("big").kv("v", big).kv("after", 1);
+  assert(g_out.size() < static_cast<size_t>(StructLogger::kLineSize));
+  assert(g_out.size() > static_cast<size_t>(StructLogger::kLineSize) - 100);
+  assert(g_out.compare(g_out.size() - 3, 3, "\"}\n") == 0);
+  assert(g_out.find("\"after\"") == std::string::npos);
+  // the quotes that aren't escaped pair up
+  int quotes = 0;
+  for(size_t i = 0; i < g_out.size(); ++i)
+  {
+    if(g_out[i] == '\\') ++i;
+    else if(g_out[i] == '"') ++quotes;
+  }
+  assert(quotes % 2 == 0);
+  // the cut doesn't split a UTF-8 sequence
+  std::string utf8;
+  while(utf8.size() < static_cast<size_t>(StructLogger::kLineSize)) utf8 += "\xe4\xb8\xad";
+  SLOG_INFO("utf8").kv("v", utf8);
+  size_t end = g_out.rfind("\",\"src\"");
+  size_t start = g_out.find("\"v\":\"") + 5;
+  assert((end - start) % 3 == 0);
+}
+
+// the SSE2 scan agrees with the plain one, at every offset
+void testFindSpecial()
+{
+  srand(1);
+  std::string s(300, 'a');
+  const char special[] = "\"\\ =\x01\x1f\x7f\x80\xff";
+  for(int round = 0; round < 2000; ++round)
+  {
+    for(char& c : s) c = 'a' + rand() % 26;
+    int n = rand() % 3;
+    for(int i = 0; i < n; ++i) s[rand() % s.size()] = special[rand() % (sizeof special - 1)];
+    size_t off = rand() % 40;
+    size_t len = rand() % (s.size() - off);
+    for(int q = 0; q < 2; ++q)
+    {
+      size_t expect = len;
+      for(size_t i = 0; i < len; ++i)
+      {
+        unsigned char c = s[off + i];
+        if(c < 0x20 || c == '"' || c == '\\' || (q && (c == ' ' || c == '=')))
+        {
+          expect = i;
+          break;
+        }
+      }
+      assert(StructLogger::findSpecial(s.data() + off, len, q) == expect);
+    }
+  }
+}
+
+int main()
+{
+  Logger::setOutput(output);
+  testJson();
+  testLogfmt();
+  testTruncate();
+  testFindSpecial();
+  printf("all passed\n");
+  return 0;
+}
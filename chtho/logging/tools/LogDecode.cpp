@@ -0,0 +1,60 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+// chtho_logdecode [-u] file...
+// prints the lines of binary logs written by BinaryLogging. the files
+// of one process go in the order they were written, -u prints UTC
+
+#include "chtho/logging/BinaryLogDecoder.h"
+
+#include <stdio.h>
+#include <string.h>
+
+int main(int argc, char* argv[])
+{
+  chtho::BinaryLogDecoder decoder;
+  int first = 1;
+  if(argc > 1 && strcmp(argv[1], "-u") == 0)
+  {
+    decoder.setTimeZone(chtho::TimeZone());
+    ++first;
+  }
+  if(first >= argc)
+  {
+    fprintf(stderr, "usage: %s [-u] file...\n", argv[0]);
+    return 2;
+  }
+  std::string out;
+  char buf[64*1024];
+  for(int i = first; i < argc; ++i)
+  {
+    FILE* fp = fopen(argv[i], "rb");
+    if(!fp)
+    {
+      perror(argv[i]);
+      return 1;
+    }
+    size_t n;
+    while((n = fread(buf, 1, sizeof buf, fp)) > 0)
+    {
+      out.clear();
+      bool ok = decoder.feed(buf, n, &out);
+      fwrite(out.data(), 1, out.size(), stdout);
+      if(!ok)
+      {
+        fprintf(stderr, "%s: not a binary log\n", argv[i]);
+        fclose(fp);
+        return 1;
+      }
+    }
+    fclose(fp);
+  }
+  if(decoder.pending())
+    fprintf(stderr, "the log ends in the middle of a record (%zu bytes)\n", decoder.pending());
+  if(decoder.unknown())
+    fprintf(stderr, "%zu of %zu records are of statements not described in these files\n",
+      decoder.unknown(), decoder.records());
+  return 0;
+}
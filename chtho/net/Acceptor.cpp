@@ -4,6 +4,7 @@
 // https://opensource.org/licenses/MIT
 
 #include "Acceptor.h"
+#include "logging/LogSampling.h"
 
 #include <fcntl.h> // open
 #include <unistd.h> // close 
@@ -66,8 +67,11 @@ void Acceptor::handleRead()
   }
   else
   {
-    LOG_SYSERR << "in Acceptor::handleRead";
-    if(errno == EMFILE)
+    int savedErrno = errno;
+    // out of fds the listening socket stays readable, this runs for
+    // every connection attempt
+    LOG_EVERY_T(ERR, 1.0) << "in Acceptor::handleRead: " << strerror_tl(savedErrno);
+    if(savedErrno == EMFILE)
     {
       ::close(idleFd_);
       idleFd_ = ::accept(acceptSocket_.fd(), NULL, NULL);
@@ -5,6 +5,8 @@
 
 #include "Buffer.h"
 
+#include <sys/uio.h>
+
 namespace chtho
 {
 namespace net
@@ -7,6 +7,7 @@
 #define CHTHO_NET_BUFFER_H
 
 #include "base/StringPiece.h"
+#include "Simd.h"
 
 #include <vector>
 #include <algorithm>
@@ -201,14 +202,18 @@ public:
   {
     assert(peek() <= start);
     assert(start <= writePtr());
-    const void* eol = memchr(start, '\n', writePtr()-start);
-    return static_cast<const char*>(eol);
+    return simd::findChar(start, writePtr(), '\n');
   }
 
   const char* findCRLF() const 
   {
-    const char* crlf = std::search(peek(), writePtr(), CRLF, CRLF+2);
-    return crlf == writePtr() ? NULL : crlf;
+    return simd::findCRLF(peek(), writePtr());
+  }
+  const char* findCRLF(const char* start) const 
+  {
+    assert(peek() <= start);
+    assert(start <= writePtr());
+    return simd::findCRLF(start, writePtr());
   }
 
   ssize_t readFd(int fd, int* savedErrno);
@@ -45,12 +45,15 @@ void Connector::startInLoop()
 void Connector::stop()
 {
   connect_ = false;
-  loop_->queueInLoop([this](){this->stopInLoop();});
+  // the owner (e.g. a TcpClient) may be gone by the time this runs
+  auto p = shared_from_this();
+  loop_->queueInLoop([p](){p->stopInLoop();});
 }
 void Connector::stopInLoop()
 {
   loop_->assertInLoopThread();
-  if(state_ == Disconnected)
+  // only a connection attempt in flight has a channel to tear down
+  if(state_ == Connecting)
   {
     setState(Disconnected);
     int sockfd = removeAndResetChannel();
@@ -115,7 +118,8 @@ int Connector::removeAndResetChannel()
   channel_->disableAll();
   channel_->remove();
   int sockfd = channel_->fd();
-  loop_->queueInLoop([this](){this->resetChannel();});
+  auto p = shared_from_this();
+  loop_->queueInLoop([p](){p->resetChannel();});
   return sockfd;
 }
 void Connector::resetChannel()
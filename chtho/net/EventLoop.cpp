@@ -8,6 +8,7 @@
 #include "threads/MutexLockGuard.h" // MutexLockGuard
 #include "poller/Poller.h"
 
+#include <algorithm> // find
 #include <unistd.h> // write 
 #include <sys/eventfd.h> // eventfd 
 
@@ -85,7 +86,7 @@ void EventLoop::loop()
     activeChannels_.clear();
     pollReturnTime_ = poller_->poll(kPollTimeMs, &activeChannels_);
     ++iter_;
-    if(Logger::logLevel() <= Logger::Level::TRACE)
+    if(CHTHO_LOG_ENABLED(Logger::Level::TRACE))
       printActiveChannels();
     handlingEvents_ = true;
     for(auto channel : activeChannels_)
@@ -0,0 +1,336 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "LogShipper.h"
+#include "Buffer.h"
+#include "EventLoop.h"
+#include "TcpClient.h"
+#include "TcpConnection.h"
+#include "logging/AsyncLogging.h"
+#include "threads/CountDownLatch.h"
+#include "threads/MutexLockGuard.h"
+
+#include <algorithm>
+
+#include <arpa/inet.h> // htonl
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h> // rename
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace chtho
+{
+namespace net
+{
+namespace
+{
+bool writeAll(int fd, const char* p, size_t len)
+{
+  while(len > 0)
+  {
+    ssize_t n = ::write(fd, p, len);
+    if(n < 0)
+    {
+      if(errno == EINTR) continue;
+      return false;
+    }
+    p += n;
+    len -= n;
+  }
+  return true;
+}
+
+bool readAll(int fd, char* p, size_t len, off_t off)
+{
+  while(len > 0)
+  {
+    ssize_t n = ::pread(fd, p, len, off);
+    if(n <= 0)
+    {
+      if(n < 0 && errno == EINTR) continue;
+      return false;
+    }
+    p += n;
+    len -= n;
+    off += n;
+  }
+  return true;
+}
+} // namespace
+
+const size_t LogShipper::kHeader;
+const size_t LogShipper::kMaxBatch;
+
+LogShipper::LogShipper(EventLoop* loop, const InetAddr& collector, const Options& opts)
+  : loop_(loop),
+    opts_(opts),
+    client_(new TcpClient(loop, collector, "LogShipper")),
+    batch_(kHeader, '\0'),
+    kicked_(false),
+    inflight_(0),
+    acked_(0),
+    memory_(0),
+    spoolFd_(-1),
+    spoolRead_(0),
+    spoolSize_(0),
+    batches_(0),
+    bytes_(0),
+    connects_(0)
+{
+  client_->enableRetry();
+  client_->setConnCB([this](const TcpConnPtr& conn){ onConn(conn); });
+  client_->setCloseCB([this](const TcpConnPtr& conn){ onClose(conn); });
+  client_->setMsgCB([this](const TcpConnPtr& conn, Buffer* buf, Timestamp t)
+    { onMsg(conn, buf, t); });
+  if(!opts_.spool.empty())
+  {
+    spoolFd_ = ::open(opts_.spool.c_str(), O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC, 0644);
+    struct stat st;
+    if(spoolFd_ < 0 || ::fstat(spoolFd_, &st) != 0)
+      LOG_SYSERR << "LogShipper can't open the spool " << opts_.spool;
+    else
+      spoolSize_ = st.st_size; // a previous run's
+  }
+}
+
+LogShipper::~LogShipper()
+{
+  if(loop_->isInLoopThread())
+  {
+    teardown();
+  }
+  else
+  {
+    CountDownLatch latch(1);
+    loop_->runInLoop([this, &latch]()
+    {
+      teardown();
+      latch.countDown();
+    });
+    latch.wait();
+  }
+  if(spoolFd_ >= 0) ::close(spoolFd_);
+}
+
+void LogShipper::start()
+{
+  // a collector that goes away mid batch must not take the process
+  // with it, the batch is sent again on the next connection
+  ::signal(SIGPIPE, SIG_IGN);
+  // the loop's own lines must not wait for the room only it can make
+  loop_->runInLoop([](){ AsyncLogging::dropInsteadOfWait(); });
+  client_->connect();
+}
+
+// nothing calls back into the shipper afterwards. the spool is
+// rewritten to hold what isn't answered yet, in order
+void LogShipper::teardown()
+{
+  loop_->assertInLoopThread();
+  client_->stop();
+  client_->setCloseCB(CloseCB());
+  if(conn_)
+  {
+    conn_->setConnCB([](const TcpConnPtr&){});
+    conn_->setMsgCB([](const TcpConnPtr&, Buffer* buf, Timestamp){ buf->retrieveAll(); });
+    conn_.reset();
+  }
+  client_.reset();
+  MutexLockGuard lock(mutex_);
+  while(!unacked_.empty())
+  {
+    queue_.push_front(std::move(unacked_.back()));
+    unacked_.pop_back();
+  }
+  if(spoolFd_ < 0 || (queue_.empty() && spoolRead_ == 0)) return;
+  std::string tmp = opts_.spool + ".tmp";
+  int fd = ::open(tmp.c_str(), O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC, 0644);
+  bool ok = fd >= 0;
+  for(const std::string& b : queue_)
+    ok = ok && writeAll(fd, b.data(), b.size());
+  char buf[64*1024];
+  for(off_t off = spoolRead_; ok && off < spoolSize_; )
+  {
+    size_t n = static_cast<size_t>(std::min<off_t>(sizeof buf, spoolSize_ - off));
+    ok = readAll(spoolFd_, buf, n, off) && writeAll(fd, buf, n);
+    off += n;
+  }
+  if(fd >= 0) ok = ::close(fd) == 0 && ok;
+  if(ok) ok = ::rename(tmp.c_str(), opts_.spool.c_str()) == 0;
+  if(!ok) ::unlink(tmp.c_str());
+}
+
+void LogShipper::append(const char* data, int len)
+{
+  batch_.append(data, len);
+}
+
+// with the lock held. a batch goes to the spool while there is
+// something in it, so the order holds, or when memory is full
+bool LogShipper::spool(const std::string& batch)
+{
+  if(spoolFd_ < 0) return false;
+  if(spoolSize_ == spoolRead_ && memory_ + batch.size() <= opts_.maxMemory) return false;
+  if(!writeAll(spoolFd_, batch.data(), batch.size()))
+  {
+    LOG_SYSERR << "LogShipper can't write the spool " << opts_.spool;
+    // a partly written batch is cut off again
+    if(::ftruncate(spoolFd_, spoolSize_) < 0)
+      LOG_SYSERR << "LogShipper can't truncate the spool " << opts_.spool;
+    return false;
+  }
+  spoolSize_ += batch.size();
+  return true;
+}
+
+void LogShipper::flush()
+{
+  if(batch_.size() == kHeader) return;
+  uint32_t len = htonl(static_cast<uint32_t>(batch_.size() - kHeader));
+  memcpy(&batch_[0], &len, kHeader);
+  {
+    MutexLockGuard lock(mutex_);
+    if(!spool(batch_))
+    {
+      memory_ += batch_.size();
+      queue_.push_back(std::move(batch_));
+    }
+  }
+  batch_.assign(kHeader, '\0');
+  if(!kicked_.exchange(true)) loop_->queueInLoop([this](){ sendMore(); });
+}
+
+size_t LogShipper::room()
+{
+  MutexLockGuard lock(mutex_);
+  size_t used = memory_ + batch_.size();
+  size_t room = used < opts_.maxMemory ? opts_.maxMemory - used : 0;
+  off_t spooled = spoolSize_ - spoolRead_;
+  if(spoolFd_ >= 0 && spooled < opts_.maxSpool) room += opts_.maxSpool - spooled;
+  return room;
+}
+
+LogShipper::Stats LogShipper::stats()
+{
+  MutexLockGuard lock(mutex_);
+  Stats st;
+  st.batches = batches_;
+  st.bytes = bytes_;
+  st.memory = memory_;
+  st.spooled = spoolSize_ - spoolRead_;
+  st.connects = connects_;
+  return st;
+}
+
+// the oldest batch not sent yet
+bool LogShipper::next(std::string* batch)
+{
+  MutexLockGuard lock(mutex_);
+  if(!queue_.empty())
+  {
+    batch->swap(queue_.front());
+    queue_.pop_front();
+    return true;
+  }
+  if(spoolRead_ == spoolSize_) return false;
+  uint32_t len = 0;
+  bool ok = readAll(spoolFd_, reinterpret_cast<char*>(&len), kHeader, spoolRead_);
+  len = ntohl(len);
+  ok = ok && len <= kMaxBatch && spoolRead_ + static_cast<off_t>(kHeader + len) <= spoolSize_;
+  if(ok)
+  {
+    batch->resize(kHeader + len);
+    ok = readAll(spoolFd_, &(*batch)[0], batch->size(), spoolRead_);
+  }
+  if(ok)
+  {
+    spoolRead_ += batch->size();
+    memory_ += batch->size();
+  }
+  else
+  {
+    // the rest is damaged, e.g. a run that crashed while writing
+    LOG_ERR << "LogShipper drops " << spoolSize_ - spoolRead_ << " bytes of the spool "
+      << opts_.spool;
+    spoolSize_ = spoolRead_;
+  }
+  if(spoolRead_ == spoolSize_)
+  {
+    if(::ftruncate(spoolFd_, 0) < 0)
+      LOG_SYSERR << "LogShipper can't truncate the spool " << opts_.spool;
+    spoolRead_ = spoolSize_ = 0;
+  }
+  return ok;
+}
+
+void LogShipper::sendMore()
+{
+  loop_->assertInLoopThread();
+  kicked_ = false;
+  if(!conn_) return;
+  std::string batch;
+  while(inflight_ < opts_.window && next(&batch))
+  {
+    inflight_ += batch.size();
+    conn_->send(batch);
+    unacked_.push_back(std::move(batch));
+    batch.clear();
+  }
+}
+
+void LogShipper::onConn(const TcpConnPtr& conn)
+{
+  if(!conn->connected()) return;
+  conn_ = conn;
+  acked_ = 0;
+  inflight_ = 0;
+  {
+    MutexLockGuard lock(mutex_);
+    ++connects_;
+  }
+  sendMore();
+}
+
+void LogShipper::onClose(const TcpConnPtr& conn)
+{
+  if(conn != conn_) return;
+  conn_.reset();
+  inflight_ = 0;
+  // sent again first on the next connection
+  MutexLockGuard lock(mutex_);
+  while(!unacked_.empty())
+  {
+    queue_.push_front(std::move(unacked_.back()));
+    unacked_.pop_back();
+  }
+}
+
+void LogShipper::onMsg(const TcpConnPtr&, Buffer* buf, Timestamp)
+{
+  size_t count = 0, bytes = 0;
+  while(buf->readableBytes() >= sizeof(uint32_t))
+  {
+    uint32_t n = static_cast<uint32_t>(buf->readInt32());
+    for(; acked_ != n && !unacked_.empty(); ++acked_, ++count)
+    {
+      bytes += unacked_.front().size();
+      unacked_.pop_front();
+    }
+  }
+  if(count == 0) return;
+  inflight_ -= bytes;
+  {
+    MutexLockGuard lock(mutex_);
+    memory_ -= bytes;
+    batches_ += count;
+    bytes_ += bytes - count * kHeader;
+  }
+  sendMore();
+}
+} // namespace net
+} // namespace chtho
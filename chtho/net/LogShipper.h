@@ -0,0 +1,123 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_NET_LOGSHIPPER_H
+#define CHTHO_NET_LOGSHIPPER_H
+// Ship the lines of AsyncLogging to a collector over TCP
+
+#include "base/noncopyable.h"
+#include "logging/LogSink.h"
+#include "threads/MutexLock.h"
+#include "Callbacks.h"
+#include "InetAddr.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <string>
+
+#include <sys/types.h> // off_t
+
+namespace chtho
+{
+namespace net
+{
+class TcpClient;
+
+// a LogSink for AsyncLogging::setSink. every round of the back end is
+// one batch, sent as a 4 byte length in network byte order and the
+// lines. the collector answers every batch with the number of batches
+// it has taken on the connection so far, also 4 bytes. the batches not
+// answered when the connection goes down are sent again on the next
+// one, so a batch may arrive twice but none is lost.
+// batches wait in memory while the collector is away or behind, then
+// in the spool file if there is one. the spool is appended to and
+// read from the front, and is sent before anything newer. what is
+// left in it when the process exits is sent by the next shipper on
+// the same spool. once memory and spool are full room() is 0 and the
+// lines stay in AsyncLogging's rings, where its overflow policy
+// decides whether threads wait or lines are dropped.
+//
+//   EventLoopThread t;
+//   LogShipper shipper(t.startLoop(), InetAddr("10.0.0.2", 5140));
+//   shipper.start();
+//   AsyncLogging log("app", rollsz);
+//   log.setSink(&shipper);
+//   log.start();
+//   ...
+//   log.stop(); // before the shipper goes
+class LogShipper : public LogSink
+{
+public:
+  struct Options
+  {
+    size_t maxMemory; // of batches not answered yet, 16 MB by default
+    // the spool file, empty (the default) for none
+    std::string spool;
+    off_t maxSpool; // 1 GB by default
+    size_t window; // bytes sent ahead of the answers, 4 MB by default
+    Options()
+      : maxMemory(16*1024*1024), maxSpool(1024*1024*1024), window(4*1024*1024)
+    {}
+  };
+  struct Stats
+  {
+    size_t batches; // answered
+    size_t bytes; // of the answered batches
+    size_t memory; // of the batches waiting in memory, sent or not
+    off_t spooled; // of the batches waiting in the spool
+    size_t connects;
+  };
+  static const size_t kHeader = 4;
+  // a length above it in the spool means the file is damaged
+  static const size_t kMaxBatch = 256*1024*1024;
+
+private:
+  EventLoop* loop_;
+  const Options opts_;
+  std::unique_ptr<TcpClient> client_;
+  std::string batch_; // the back end's, being filled
+  std::atomic<bool> kicked_; // a sendMore() is queued
+  // the loop's
+  TcpConnPtr conn_;
+  std::deque<std::string> unacked_; // sent on conn_, oldest first
+  size_t inflight_;
+  uint32_t acked_; // the collector's count on conn_
+  MutexLock mutex_; // protects the following members
+  std::deque<std::string> queue_; // not sent yet, before the spool
+  size_t memory_; // of queue_ and unacked_
+  int spoolFd_;
+  off_t spoolRead_;
+  off_t spoolSize_;
+  size_t batches_;
+  size_t bytes_;
+  size_t connects_;
+
+  void onConn(const TcpConnPtr& conn);
+  void onClose(const TcpConnPtr& conn);
+  void onMsg(const TcpConnPtr& conn, Buffer* buf, Timestamp);
+  void sendMore();
+  bool next(std::string* batch);
+  bool spool(const std::string& batch);
+  void teardown();
+
+public:
+  LogShipper(EventLoop* loop, const InetAddr& collector, const Options& opts = Options());
+  // what hasn't been answered goes to the spool, if there is one
+  ~LogShipper();
+  // connects, and reconnects whenever the connection goes down.
+  // it ignores SIGPIPE for the whole process, otherwise a collector
+  // resetting the connection while a batch is written would kill it
+  void start();
+  Stats stats();
+
+  // the back end's
+  void append(const char* data, int len) override;
+  void flush() override;
+  size_t room() override;
+};
+} // namespace net
+} // namespace chtho
+#endif // !CHTHO_NET_LOGSHIPPER_H
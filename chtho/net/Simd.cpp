@@ -0,0 +1,322 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "Simd.h"
+
+#include <stdlib.h> // getenv
+#include <string.h> // memchr, strcmp
+
+#if defined(__x86_64__) || defined(__i386__)
+#define CHTHO_SIMD_X86
+#include <immintrin.h>
+#endif
+
+namespace chtho
+{
+namespace net
+{
+namespace simd
+{
+namespace
+{
+using FindCRLF = const char* (*)(const char*, const char*);
+using FindChar = const char* (*)(const char*, const char*, char);
+using FindFirstOf = const char* (*)(const char*, const char*, const char*, int);
+using XorMask = void (*)(char*, size_t, uint32_t);
+
+struct Kernels
+{
+  Level level;
+  FindCRLF crlf;
+  FindChar chr;
+  FindFirstOf firstOf;
+  XorMask xorMask;
+};
+
+// scalar fallbacks, memchr is already vectorized by libc
+
+const char* findCRLFScalar(const char* begin, const char* end)
+{
+  while(begin < end)
+  {
+    const void* cr = memchr(begin, '\r', end-begin);
+    if(!cr) return NULL;
+    const char* p = static_cast<const char*>(cr);
+    if(p+1 == end) return NULL;
+    if(p[1] == '\n') return p;
+    begin = p+1;
+  }
+  return NULL;
+}
+
+const char* findCharScalar(const char* begin, const char* end, char c)
+{
+  return static_cast<const char*>(memchr(begin, c, end-begin));
+}
+
+const char* findFirstOfScalar(const char* begin, const char* end,
+  const char* set, int n)
+{
+  for(; begin < end; ++begin)
+  {
+    for(int i = 0; i < n; ++i)
+      if(*begin == set[i]) return begin;
+  }
+  return NULL;
+}
+
+// 8 bytes per step, the compiler may vectorize this further
+void xorMaskScalar(char* data, size_t len, uint32_t key)
+{
+  uint64_t k8 = (static_cast<uint64_t>(key) << 32) | key;
+  size_t i = 0;
+  for(; i + 8 <= len; i += 8)
+  {
+    uint64_t x;
+    memcpy(&x, data+i, 8);
+    x ^= k8;
+    memcpy(data+i, &x, 8);
+  }
+  const char* k = reinterpret_cast<const char*>(&key);
+  for(; i < len; ++i) data[i] ^= k[i & 3];
+}
+
+#ifdef CHTHO_SIMD_X86
+
+// SSE4.2: 16 bytes per step, pcmpestri matches against any set of
+// up to 16 bytes in one instruction
+
+__attribute__((target("sse4.2")))
+const char* findCRLFSSE42(const char* begin, const char* end)
+{
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  // the '\n' lane is loaded one byte ahead, keep both loads in range
+  while(end - begin >= 17)
+  {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin+1));
+    int mask = _mm_movemask_epi8(_mm_and_si128(_mm_cmpeq_epi8(a, cr),
+      _mm_cmpeq_epi8(b, lf)));
+    if(mask) return begin + __builtin_ctz(mask);
+    begin += 16;
+  }
+  return findCRLFScalar(begin, end);
+}
+
+__attribute__((target("sse4.2")))
+const char* findCharSSE42(const char* begin, const char* end, char c)
+{
+  const __m128i x = _mm_set1_epi8(c);
+  while(end - begin >= 16)
+  {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(a, x));
+    if(mask) return begin + __builtin_ctz(mask);
+    begin += 16;
+  }
+  return findCharScalar(begin, end, c);
+}
+
+__attribute__((target("sse4.2")))
+const char* findFirstOfSSE42(const char* begin, const char* end,
+  const char* set, int n)
+{
+  char s[16] = {0};
+  memcpy(s, set, n);
+  const __m128i needles = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+  while(end - begin >= 16)
+  {
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(begin));
+    int idx = _mm_cmpestri(needles, n, a, 16,
+      _SIDD_UBYTE_OPS|_SIDD_CMP_EQUAL_ANY|_SIDD_LEAST_SIGNIFICANT);
+    if(idx < 16) return begin + idx;
+    begin += 16;
+  }
+  return findFirstOfScalar(begin, end, set, n);
+}
+
+// every step is a multiple of 4 bytes, so the key stays aligned
+// with the payload when the tail is handed to the narrower kernel
+__attribute__((target("sse4.2")))
+void xorMaskSSE42(char* data, size_t len, uint32_t key)
+{
+  const __m128i k = _mm_set1_epi32(static_cast<int>(key));
+  size_t i = 0;
+  for(; i + 16 <= len; i += 16)
+  {
+    __m128i* p = reinterpret_cast<__m128i*>(data+i);
+    _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), k));
+  }
+  xorMaskScalar(data+i, len-i, key);
+}
+
+// AVX2: 32 bytes per step
+
+__attribute__((target("avx2")))
+const char* findCRLFAVX2(const char* begin, const char* end)
+{
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  while(end - begin >= 33)
+  {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin+1));
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+      _mm256_and_si256(_mm256_cmpeq_epi8(a, cr), _mm256_cmpeq_epi8(b, lf))));
+    if(mask) return begin + __builtin_ctz(mask);
+    begin += 32;
+  }
+  return findCRLFSSE42(begin, end);
+}
+
+__attribute__((target("avx2")))
+const char* findCharAVX2(const char* begin, const char* end, char c)
+{
+  const __m256i x = _mm256_set1_epi8(c);
+  while(end - begin >= 32)
+  {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    unsigned mask = static_cast<unsigned>(
+      _mm256_movemask_epi8(_mm256_cmpeq_epi8(a, x)));
+    if(mask) return begin + __builtin_ctz(mask);
+    begin += 32;
+  }
+  return findCharSSE42(begin, end, c);
+}
+
+// the HTTP tokenizer looks for two or three delimiters at a time,
+// a compare per delimiter is cheaper than pcmpestri for small sets
+__attribute__((target("avx2")))
+const char* findFirstOfAVX2(const char* begin, const char* end,
+  const char* set, int n)
+{
+  if(n > 4) return findFirstOfSSE42(begin, end, set, n);
+  __m256i needles[4];
+  for(int i = 0; i < n; ++i) needles[i] = _mm256_set1_epi8(set[i]);
+  while(end - begin >= 32)
+  {
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(begin));
+    __m256i eq = _mm256_cmpeq_epi8(a, needles[0]);
+    for(int i = 1; i < n; ++i)
+      eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(a, needles[i]));
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(eq));
+    if(mask) return begin + __builtin_ctz(mask);
+    begin += 32;
+  }
+  return findFirstOfSSE42(begin, end, set, n);
+}
+
+__attribute__((target("avx2")))
+void xorMaskAVX2(char* data, size_t len, uint32_t key)
+{
+  const __m256i k = _mm256_set1_epi32(static_cast<int>(key));
+  size_t i = 0;
+  for(; i + 32 <= len; i += 32)
+  {
+    __m256i* p = reinterpret_cast<__m256i*>(data+i);
+    _mm256_storeu_si256(p, _mm256_xor_si256(_mm256_loadu_si256(p), k));
+  }
+  xorMaskSSE42(data+i, len-i, key);
+}
+
+#endif // CHTHO_SIMD_X86
+
+Kernels kernelsFor(Level l)
+{
+#ifdef CHTHO_SIMD_X86
+  if(l == Level::AVX2)
+  {
+    Kernels k = { Level::AVX2, findCRLFAVX2, findCharAVX2, findFirstOfAVX2,
+      xorMaskAVX2 };
+    return k;
+  }
+  if(l == Level::SSE42)
+  {
+    Kernels k = { Level::SSE42, findCRLFSSE42, findCharSSE42, findFirstOfSSE42,
+      xorMaskSSE42 };
+    return k;
+  }
+#endif
+  Kernels k = { Level::Scalar, findCRLFScalar, findCharScalar, findFirstOfScalar,
+    xorMaskScalar };
+  return k;
+}
+
+Level initLevel()
+{
+  Level l = detect();
+  const char* env = ::getenv("CHTHO_SIMD");
+  if(env)
+  {
+    if(strcmp(env, "scalar") == 0) l = Level::Scalar;
+    else if(strcmp(env, "sse42") == 0 && l > Level::SSE42) l = Level::SSE42;
+  }
+  return l;
+}
+
+// resolved on first use, so the kernels also work from
+// static initializers of other translation units
+Kernels& kernels()
+{
+  static Kernels k = kernelsFor(initLevel());
+  return k;
+}
+} // namespace
+
+const char* findCRLF(const char* begin, const char* end)
+{
+  return kernels().crlf(begin, end);
+}
+
+const char* findChar(const char* begin, const char* end, char c)
+{
+  return kernels().chr(begin, end, c);
+}
+
+const char* findFirstOf(const char* begin, const char* end,
+  const char* set, int n)
+{
+  return kernels().firstOf(begin, end, set, n);
+}
+
+void xorMask(char* data, size_t len, uint32_t key)
+{
+  kernels().xorMask(data, len, key);
+}
+
+Level level()
+{
+  return kernels().level;
+}
+
+Level detect()
+{
+#ifdef CHTHO_SIMD_X86
+  __builtin_cpu_init();
+  if(__builtin_cpu_supports("avx2")) return Level::AVX2;
+  if(__builtin_cpu_supports("sse4.2")) return Level::SSE42;
+#endif
+  return Level::Scalar;
+}
+
+void setLevel(Level l)
+{
+  if(l > detect()) l = detect();
+  kernels() = kernelsFor(l);
+}
+
+const char* levelName(Level l)
+{
+  switch (l)
+  {
+  case Level::AVX2: return "avx2";
+  case Level::SSE42: return "sse4.2";
+  default: return "scalar";
+  }
+}
+} // namespace simd
+} // namespace net
+} // namespace chtho
@@ -0,0 +1,51 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_NET_SIMD_H
+#define CHTHO_NET_SIMD_H
+
+#include <stddef.h> // size_t
+#include <stdint.h> // uint32_t
+
+namespace chtho
+{
+namespace net
+{
+// byte scanning kernels used by Buffer and the HTTP parser, and the
+// payload unmasking of WebSocket frames.
+// each kernel comes in a scalar, an SSE4.2 and an AVX2 flavour,
+// the best one the cpu supports is picked on first use (it can be
+// forced with CHTHO_SIMD=scalar|sse42|avx2 in the environment).
+// all of them return NULL when nothing is found and never read
+// outside [begin, end)
+namespace simd
+{
+enum class Level { Scalar, SSE42, AVX2 };
+
+// first "\r\n" in [begin, end)
+const char* findCRLF(const char* begin, const char* end);
+// first occurrence of c in [begin, end)
+const char* findChar(const char* begin, const char* end, char c);
+// first byte in [begin, end) that is one of the n (at most 16)
+// bytes of set, the set must not contain '\0'
+const char* findFirstOf(const char* begin, const char* end,
+  const char* set, int n);
+// xors [data, data+len) with the 4 byte key repeated, key holds
+// the bytes in wire order (memcpy'd from the frame header)
+void xorMask(char* data, size_t len, uint32_t key);
+
+Level level();
+// the highest level supported by the cpu
+Level detect();
+// switches the kernels, e.g. for benchmarks. levels above detect()
+// are clamped. not thread safe, call it before any IO starts
+void setLevel(Level l);
+const char* levelName(Level l);
+} // namespace simd
+} // namespace net
+} // namespace chtho
+
+
+#endif // !CHTHO_NET_SIMD_H
@@ -41,7 +41,11 @@ TcpClient::~TcpClient()
   if(conn)
   {
     assert(loop_ == conn->loop());
-    auto cb = [this](const TcpConnPtr& p){this->rmConn(p);};
+    // the client is going away, the connection is only destroyed
+    EventLoop* loop = loop_;
+    auto cb = [loop](const TcpConnPtr& p){
+      loop->queueInLoop([p](){p->connDestroyed();});
+    };
     loop_->runInLoop([conn,cb](){conn->setCloseCB(cb);});
     if(unique)
     {
@@ -104,6 +108,7 @@ void TcpClient::rmConn(const TcpConnPtr& conn)
     assert(conn_ == conn);
     conn_.reset();
   }
+  if(closeCB_) closeCB_(conn);
   loop_->queueInLoop([conn](){conn->connDestroyed();});
   if(retry_ && connect_)
   {
@@ -27,6 +27,7 @@ private:
   ConnCB connCB_;
   MsgCB msgCB_;
   WriteCompleteCB writeCompleteCB_;
+  CloseCB closeCB_;
   std::atomic_bool retry_;
   std::atomic_bool connect_;
   int nxtConnID_;
@@ -49,6 +50,9 @@ public:
   void setConnCB(ConnCB cb) { connCB_ = cb; }
   void setMsgCB(MsgCB cb) { msgCB_ = cb; }
   void setWriteCompleteCB(WriteCompleteCB cb) { writeCompleteCB_ = cb; }
+  // called in the loop thread when the connection has gone down,
+  // before it is destroyed
+  void setCloseCB(CloseCB cb) { closeCB_ = cb; }
 
   bool retry() const { return retry_; }
   void enableRetry() { retry_ = true; }
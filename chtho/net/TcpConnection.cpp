@@ -6,7 +6,9 @@
 #include "TcpConnection.h"
 #include "Socket.h"
 #include "Channel.h"
+#include "logging/LogSampling.h"
 
+#include <sys/sendfile.h>
 #include <unistd.h> 
 
 namespace chtho
@@ -55,7 +57,8 @@ TcpConnection::TcpConnection(EventLoop* loop,
     channel_(new Channel(loop, sockfd)),
     localAddr_(localAddr),
     peerAddr_(peerAddr),
-    highWaterMark_(64*1024*1024)
+    highWaterMark_(64*1024*1024),
+    bufAccounted_(0)
 {
   channel_->setReadCB([this](Timestamp t){this->handleRead(t);});
   channel_->setWriteCB([this](){this->handleWrite();});
@@ -100,22 +103,75 @@ void TcpConnection::handleWrite()
   loop_->assertInLoopThread();
   if(channel_->isWriting())
   {
-    ssize_t n = ::write(channel_->fd(), outputBuf_.peek(), outputBuf_.readableBytes());
-    if(n > 0)
+    if(!writeOutput()) LOG_SYSERR << "TcpConnection::handleWrite";
+    if(outputBuf_.readableBytes() == 0 && files_.empty())
     {
-      outputBuf_.retrieve(n);
-      if(outputBuf_.readableBytes() == 0)
+      channel_->disableWrite();
+      if(writeCompleteCB_)
+        loop_->queueInLoop([this](){this->writeCompleteCB_(this->shared_from_this());});
+      if(state_ == State::Disconnecting)
+        shutdownInLoop();
+    }
+  }
+  else LOG_TRACE << "Connection fd = " << channel_->fd() << "is down, no more writing";
+}
+// writes outputBuf_ and the queued file segments in order until
+// everything is out or the socket is full. returns false on an error,
+// errno tells which
+bool TcpConnection::writeOutput()
+{
+  int fd = channel_->fd();
+  while(true)
+  {
+    size_t bufLen = files_.empty() ? outputBuf_.readableBytes() : files_.front().bufBefore;
+    ssize_t n;
+    if(bufLen > 0)
+    {
+      n = ::write(fd, outputBuf_.peek(), bufLen);
+      if(n > 0)
+      {
+        outputBuf_.retrieve(n);
+        if(!files_.empty())
+        {
+          files_.front().bufBefore -= n;
+          bufAccounted_ -= n;
+        }
+        if(static_cast<size_t>(n) < bufLen) return true; // socket is full
+        continue;
+      }
+    }
+    else if(!files_.empty())
+    {
+      FileSeg& f = files_.front();
+      n = ::sendfile(fd, f.fd, &f.off, f.len);
+      if(n > 0)
+      {
+        f.len -= n;
+        if(f.len > 0) return true;
+        files_.pop_front();
+        continue;
+      }
+      if(n == 0)
       {
-        channel_->disableWrite();
-        if(writeCompleteCB_)
-          loop_->queueInLoop([this](){this->writeCompleteCB_(this->shared_from_this());});
-        if(state_ == State::Disconnecting)
-          shutdownInLoop();
+        // the file shrank, the peer will never get the promised bytes
+        LOG_ERR << "TcpConnection::writeOutput [" << name_ << "] - file truncated";
+        outputBuf_.retrieveAll();
+        files_.clear();
+        bufAccounted_ = 0;
+        forceClose();
+        return true;
       }
     }
-    else LOG_SYSERR << "TcpConnection::handleWrite";
+    else return true;
+    if(errno == EWOULDBLOCK || errno == EINTR) return true;
+    if(errno == EPIPE || errno == ECONNRESET)
+    {
+      outputBuf_.retrieveAll();
+      files_.clear();
+      bufAccounted_ = 0;
+    }
+    return false;
   }
-  else LOG_TRACE << "Connection fd = " << channel_->fd() << "is down, no more writing";
 }
 // called when the client decides to close the connection
 // so the read inside handlRead function will return 0 
@@ -140,7 +196,9 @@ void TcpConnection::handleError()
 {
   loop_->assertInLoopThread();
   int err = Socket::getSocketError(channel_->fd());
-  LOG_ERR << "TcpConnection::handleError [" << name_ 
+  // once a second for all connections, a storm of errors would
+  // otherwise bury the logger with lines that say the same
+  LOG_EVERY_T(ERR, 1.0) << "TcpConnection::handleError [" << name_ 
     << "] - SO_ERROR = " << err << " " << strerror_tl(err);
 }
 
@@ -179,6 +237,36 @@ void TcpConnection::forceCloseInLoop()
   }
 }
 
+void TcpConnection::startRead()
+{
+  loop_->runInLoop([this](){this->startReadInLoop();});
+}
+
+void TcpConnection::startReadInLoop()
+{
+  loop_->assertInLoopThread();
+  if(!reading_ || !channel_->isReading())
+  {
+    channel_->enableRead();
+    reading_ = true;
+  }
+}
+
+void TcpConnection::stopRead()
+{
+  loop_->runInLoop([this](){this->stopReadInLoop();});
+}
+
+void TcpConnection::stopReadInLoop()
+{
+  loop_->assertInLoopThread();
+  if(reading_ || channel_->isReading())
+  {
+    channel_->disableRead();
+    reading_ = false;
+  }
+}
+
 void TcpConnection::connEstablished()
 {
   loop_->assertInLoopThread();
@@ -223,7 +311,7 @@ void TcpConnection::sendInLoop(const void* data, size_t len)
     LOG_WARN << "disconnected, give up writing";
     return;
   }
-  if(!channel_->isWriting() && outputBuf_.readableBytes() == 0)
+  if(!channel_->isWriting() && outputBuf_.readableBytes() == 0 && files_.empty())
   {
     nwritten = ::write(channel_->fd(), data, len);
     if(nwritten >= 0)
@@ -275,6 +363,87 @@ void TcpConnection::sendInLoop(const void* data, size_t len)
   }
 }
 
+Buffer* TcpConnection::outputBuf()
+{
+  loop_->assertInLoopThread();
+  return &outputBuf_;
+}
+Buffer* TcpConnection::inputBuf()
+{
+  loop_->assertInLoopThread();
+  return &inputBuf_;
+}
+// same as sendInLoop but the data is already in outputBuf_: try to
+// write it at once, leave the rest for handleWrite
+void TcpConnection::flushOutputBuf()
+{
+  loop_->assertInLoopThread();
+  if(state_ == State::Disconnected)
+  {
+    LOG_WARN << "disconnected, give up writing";
+    outputBuf_.retrieveAll();
+    files_.clear();
+    bufAccounted_ = 0;
+    return;
+  }
+  // handleWrite will get to it
+  if(channel_->isWriting()) return;
+  if(outputBuf_.readableBytes() == 0 && files_.empty()) return;
+  if(!writeOutput())
+  {
+    LOG_SYSERR << "TcpConnection::flushOutputBuf";
+    if(outputBuf_.readableBytes() == 0 && files_.empty()) return;
+  }
+  if(outputBuf_.readableBytes() == 0 && files_.empty())
+  {
+    if(writeCompleteCB_)
+    {
+#if __cplusplus >= 201402L
+      auto f = [this,p=shared_from_this()](){this->writeCompleteCB_(p);};
+#else  
+      auto f = [this](){this->writeCompleteCB_(this->shared_from_this());};
+#endif
+      loop_->queueInLoop(f);
+    }
+    return;
+  }
+  size_t remaining = outputBuf_.readableBytes();
+  if(remaining >= highWaterMark_ && highWaterMarkCB_)
+  {
+    auto p = shared_from_this();
+    loop_->queueInLoop([this,p,remaining](){this->highWaterMarkCB_(p,remaining);});
+  }
+  channel_->enableWrite();
+}
+
+void TcpConnection::sendFile(int fd, off_t off, size_t len,
+  const std::shared_ptr<void>& owner)
+{
+  if(state_ != State::Connected || len == 0) return;
+  FileSeg seg = { fd, off, len, 0, owner };
+  if(loop_->isInLoopThread()) sendFileInLoop(seg);
+  else
+  {
+    auto p = shared_from_this();
+    loop_->runInLoop([p,seg](){p->sendFileInLoop(seg);});
+  }
+}
+
+void TcpConnection::sendFileInLoop(const FileSeg& seg)
+{
+  loop_->assertInLoopThread();
+  if(state_ == State::Disconnected)
+  {
+    LOG_WARN << "disconnected, give up writing";
+    return;
+  }
+  files_.push_back(seg);
+  // everything already in outputBuf_ goes first
+  files_.back().bufBefore = outputBuf_.readableBytes() - bufAccounted_;
+  bufAccounted_ = outputBuf_.readableBytes();
+  flushOutputBuf();
+}
+
 void TcpConnection::send(Buffer* buf)
 {
   if(state_ == State::Connected)
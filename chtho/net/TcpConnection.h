@@ -13,8 +13,11 @@
 
 #include "InetAddr.h"
 
+#include <deque>
 #include <memory> 
 
+#include <sys/types.h> // off_t
+
 namespace chtho
 {
 namespace net
@@ -44,15 +47,35 @@ private:
   size_t highWaterMark_;
   Buffer inputBuf_;
   Buffer outputBuf_;
+  // a file region queued with sendFile(), it goes out after the
+  // first bufBefore bytes of outputBuf_ (counted from the previous
+  // segment) and before anything appended to outputBuf_ later
+  struct FileSeg
+  {
+    int fd;
+    off_t off;
+    size_t len;
+    size_t bufBefore;
+    std::shared_ptr<void> owner; // keeps fd open
+  };
+  std::deque<FileSeg> files_;
+  size_t bufAccounted_; // outputBuf_ bytes assigned to some segment
+  // per-connection state owned by the upper layer protocol
+  // (e.g. HTTPContext), kept alive as long as the connection 
+  std::shared_ptr<void> context_;
 
   void handleRead(Timestamp rcv);
   void handleWrite();
   void handleClose();
   void handleError();
+  bool writeOutput();
+  void sendFileInLoop(const FileSeg& seg);
 
   void setState(State s) { state_ = s; }
 
   void shutdownInLoop();
+  void startReadInLoop();
+  void stopReadInLoop();
 
   const char* stateToStr() const; 
   
@@ -72,14 +95,34 @@ public:
   void shutdown();
   void forceClose();
   void forceCloseInLoop();
+  // flow control on the input side, e.g. while the upper layer
+  // cannot keep up with the requests already received
+  void startRead();
+  void stopRead();
+  bool isReading() const { return reading_; }
 
   void send(Buffer* buf);
   void send(const StringPiece& msg);
   void sendInLoop(const StringPiece& msg);
   void sendInLoop(const void* data, size_t len);
+  // lets the loop thread serialize a message straight into the
+  // output buffer instead of building it elsewhere and copying it
+  // in with send(). flushOutputBuf() starts writing it out
+  Buffer* outputBuf();
+  // what has been read but not consumed by the message callback,
+  // e.g. a response delimited by the close. loop thread only
+  Buffer* inputBuf();
+  void flushOutputBuf();
+  // sends len bytes of fd from off with sendfile(2), in order with
+  // whatever was sent before and after. owner keeps the fd open
+  // until the segment has been written (or the connection is gone)
+  void sendFile(int fd, off_t off, size_t len, const std::shared_ptr<void>& owner);
 
   std::string getTcpInfoStr() const;
 
+  void setContext(const std::shared_ptr<void>& ctx) { context_ = ctx; }
+  const std::shared_ptr<void>& context() const { return context_; }
+
   void connEstablished();
   void connDestroyed(); 
 
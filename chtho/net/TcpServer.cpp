@@ -145,6 +145,7 @@ void TcpServer::newConn(int sockfd, const InetAddr& peerAddr)
 // will be called by TcpConnection::handleClose by closeCB_
 void TcpServer::rmConn(const TcpConnPtr& conn)
 {
+  if(closeCB_) closeCB_(conn);
   // the thread executing TcpConnection::handleClose is the
   // io thread for the connection fd, need to transfer control
   // to the main thread to remove the tcp connection stored
@@ -36,6 +36,7 @@ private:
   ConnCB connCB_;
   MsgCB msgCB_;
   WriteCompleteCB writeCompleteCB_;
+  CloseCB closeCB_;
   ThreadInitCB threadInitCB_;
   std::atomic_int32_t started_;
   int nxtConnID_;
@@ -59,6 +60,9 @@ public:
 
   void setConnCB(const ConnCB& cb) { connCB_ = cb; }
   void setMsgCB(const MsgCB& cb) { msgCB_ = cb; }
+  // called in the connection's loop thread when it has gone down,
+  // before it is removed from the server
+  void setCloseCB(const CloseCB& cb) { closeCB_ = cb; }
 
   void newConn(int sockfd, const InetAddr& peerAddr);
   void rmConn(const TcpConnPtr& conn);
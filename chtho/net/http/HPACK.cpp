@@ -0,0 +1,612 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "HPACK.h"
+
+#include <string.h> // memcmp
+
+#include <unordered_map>
+
+namespace chtho
+{
+namespace net
+{
+namespace
+{
+struct StaticEntry
+{
+  const char* name;
+  const char* value;
+};
+
+const StaticEntry kStaticTable[hpack::kStaticTableSize] = {
+  { ":authority", "" },
+  { ":method", "GET" },
+  { ":method", "POST" },
+  { ":path", "/" },
+  { ":path", "/index.html" },
+  { ":scheme", "http" },
+  { ":scheme", "https" },
+  { ":status", "200" },
+  { ":status", "204" },
+  { ":status", "206" },
+  { ":status", "304" },
+  { ":status", "400" },
+  { ":status", "404" },
+  { ":status", "500" },
+  { "accept-charset", "" },
+  { "accept-encoding", "gzip, deflate" },
+  { "accept-language", "" },
+  { "accept-ranges", "" },
+  { "accept", "" },
+  { "access-control-allow-origin", "" },
+  { "age", "" },
+  { "allow", "" },
+  { "authorization", "" },
+  { "cache-control", "" },
+  { "content-disposition", "" },
+  { "content-encoding", "" },
+  { "content-language", "" },
+  { "content-length", "" },
+  { "content-location", "" },
+  { "content-range", "" },
+  { "content-type", "" },
+  { "cookie", "" },
+  { "date", "" },
+  { "etag", "" },
+  { "expect", "" },
+  { "expires", "" },
+  { "from", "" },
+  { "host", "" },
+  { "if-match", "" },
+  { "if-modified-since", "" },
+  { "if-none-match", "" },
+  { "if-range", "" },
+  { "if-unmodified-since", "" },
+  { "last-modified", "" },
+  { "link", "" },
+  { "location", "" },
+  { "max-forwards", "" },
+  { "proxy-authenticate", "" },
+  { "proxy-authorization", "" },
+  { "range", "" },
+  { "referer", "" },
+  { "refresh", "" },
+  { "retry-after", "" },
+  { "server", "" },
+  { "set-cookie", "" },
+  { "strict-transport-security", "" },
+  { "transfer-encoding", "" },
+  { "user-agent", "" },
+  { "vary", "" },
+  { "via", "" },
+  { "www-authenticate", "" },
+};
+
+struct HuffSym
+{
+  uint32_t code; // right aligned
+  int len;
+};
+
+// appendix B, indexed by symbol, 256 is EOS
+const HuffSym kHuffTable[257] = {
+  /*   0 */ { 0x1ff8, 13 }, { 0x7fffd8, 23 }, { 0xfffffe2, 28 }, { 0xfffffe3, 28 },
+  /*   4 */ { 0xfffffe4, 28 }, { 0xfffffe5, 28 }, { 0xfffffe6, 28 }, { 0xfffffe7, 28 },
+  /*   8 */ { 0xfffffe8, 28 }, { 0xffffea, 24 }, { 0x3ffffffc, 30 }, { 0xfffffe9, 28 },
+  /*  12 */ { 0xfffffea, 28 }, { 0x3ffffffd, 30 }, { 0xfffffeb, 28 }, { 0xfffffec, 28 },
+  /*  16 */ { 0xfffffed, 28 }, { 0xfffffee, 28 }, { 0xfffffef, 28 }, { 0xffffff0, 28 },
+  /*  20 */ { 0xffffff1, 28 }, { 0xffffff2, 28 }, { 0x3ffffffe, 30 }, { 0xffffff3, 28 },
+  /*  24 */ { 0xffffff4, 28 }, { 0xffffff5, 28 }, { 0xffffff6, 28 }, { 0xffffff7, 28 },
+  /*  28 */ { 0xffffff8, 28 }, { 0xffffff9, 28 }, { 0xffffffa, 28 }, { 0xffffffb, 28 },
+  /*  32 */ { 0x14, 6 }, { 0x3f8, 10 }, { 0x3f9, 10 }, { 0xffa, 12 },
+  /*  36 */ { 0x1ff9, 13 }, { 0x15, 6 }, { 0xf8, 8 }, { 0x7fa, 11 },
+  /*  40 */ { 0x3fa, 10 }, { 0x3fb, 10 }, { 0xf9, 8 }, { 0x7fb, 11 },
+  /*  44 */ { 0xfa, 8 }, { 0x16, 6 }, { 0x17, 6 }, { 0x18, 6 },
+  /*  48 */ { 0x0, 5 }, { 0x1, 5 }, { 0x2, 5 }, { 0x19, 6 },
+  /*  52 */ { 0x1a, 6 }, { 0x1b, 6 }, { 0x1c, 6 }, { 0x1d, 6 },
+  /*  56 */ { 0x1e, 6 }, { 0x1f, 6 }, { 0x5c, 7 }, { 0xfb, 8 },
+  /*  60 */ { 0x7ffc, 15 }, { 0x20, 6 }, { 0xffb, 12 }, { 0x3fc, 10 },
+  /*  64 */ { 0x1ffa, 13 }, { 0x21, 6 }, { 0x5d, 7 }, { 0x5e, 7 },
+  /*  68 */ { 0x5f, 7 }, { 0x60, 7 }, { 0x61, 7 }, { 0x62, 7 },
+  /*  72 */ { 0x63, 7 }, { 0x64, 7 }, { 0x65, 7 }, { 0x66, 7 },
+  /*  76 */ { 0x67, 7 }, { 0x68, 7 }, { 0x69, 7 }, { 0x6a, 7 },
+  /*  80 */ { 0x6b, 7 }, { 0x6c, 7 }, { 0x6d, 7 }, { 0x6e, 7 },
+  /*  84 */ { 0x6f, 7 }, { 0x70, 7 }, { 0x71, 7 }, { 0x72, 7 },
+  /*  88 */ { 0xfc, 8 }, { 0x73, 7 }, { 0xfd, 8 }, { 0x1ffb, 13 },
+  /*  92 */ { 0x7fff0, 19 }, { 0x1ffc, 13 }, { 0x3ffc, 14 }, { 0x22, 6 },
+  /*  96 */ { 0x7ffd, 15 }, { 0x3, 5 }, { 0x23, 6 }, { 0x4, 5 },
+  /* 100 */ { 0x24, 6 }, { 0x5, 5 }, { 0x25, 6 }, { 0x26, 6 },
+  /* 104 */ { 0x27, 6 }, { 0x6, 5 }, { 0x74, 7 }, { 0x75, 7 },
+  /* 108 */ { 0x28, 6 }, { 0x29, 6 }, { 0x2a, 6 }, { 0x7, 5 },
+  /* 112 */ { 0x2b, 6 }, { 0x76, 7 }, { 0x2c, 6 }, { 0x8, 5 },
+  /* 116 */ { 0x9, 5 }, { 0x2d, 6 }, { 0x77, 7 }, { 0x78, 7 },
+  /* 120 */ { 0x79, 7 }, { 0x7a, 7 }, { 0x7b, 7 }, { 0x7ffe, 15 },
+  /* 124 */ { 0x7fc, 11 }, { 0x3ffd, 14 }, { 0x1ffd, 13 }, { 0xffffffc, 28 },
+  /* 128 */ { 0xfffe6, 20 }, { 0x3fffd2, 22 }, { 0xfffe7, 20 }, { 0xfffe8, 20 },
+  /* 132 */ { 0x3fffd3, 22 }, { 0x3fffd4, 22 }, { 0x3fffd5, 22 }, { 0x7fffd9, 23 },
+  /* 136 */ { 0x3fffd6, 22 }, { 0x7fffda, 23 }, { 0x7fffdb, 23 }, { 0x7fffdc, 23 },
+  /* 140 */ { 0x7fffdd, 23 }, { 0x7fffde, 23 }, { 0xffffeb, 24 }, { 0x7fffdf, 23 },
+  /* 144 */ { 0xffffec, 24 }, { 0xffffed, 24 }, { 0x3fffd7, 22 }, { 0x7fffe0, 23 },
+  /* 148 */ { 0xffffee, 24 }, { 0x7fffe1, 23 }, { 0x7fffe2, 23 }, { 0x7fffe3, 23 },
+  /* 152 */ { 0x7fffe4, 23 }, { 0x1fffdc, 21 }, { 0x3fffd8, 22 }, { 0x7fffe5, 23 },
+  /* 156 */ { 0x3fffd9, 22 }, { 0x7fffe6, 23 }, { 0x7fffe7, 23 }, { 0xffffef, 24 },
+  /* 160 */ { 0x3fffda, 22 }, { 0x1fffdd, 21 }, { 0xfffe9, 20 }, { 0x3fffdb, 22 },
+  /* 164 */ { 0x3fffdc, 22 }, { 0x7fffe8, 23 }, { 0x7fffe9, 23 }, { 0x1fffde, 21 },
+  /* 168 */ { 0x7fffea, 23 }, { 0x3fffdd, 22 }, { 0x3fffde, 22 }, { 0xfffff0, 24 },
+  /* 172 */ { 0x1fffdf, 21 }, { 0x3fffdf, 22 }, { 0x7fffeb, 23 }, { 0x7fffec, 23 },
+  /* 176 */ { 0x1fffe0, 21 }, { 0x1fffe1, 21 }, { 0x3fffe0, 22 }, { 0x1fffe2, 21 },
+  /* 180 */ { 0x7fffed, 23 }, { 0x3fffe1, 22 }, { 0x7fffee, 23 }, { 0x7fffef, 23 },
+  /* 184 */ { 0xfffea, 20 }, { 0x3fffe2, 22 }, { 0x3fffe3, 22 }, { 0x3fffe4, 22 },
+  /* 188 */ { 0x7ffff0, 23 }, { 0x3fffe5, 22 }, { 0x3fffe6, 22 }, { 0x7ffff1, 23 },
+  /* 192 */ { 0x3ffffe0, 26 }, { 0x3ffffe1, 26 }, { 0xfffeb, 20 }, { 0x7fff1, 19 },
+  /* 196 */ { 0x3fffe7, 22 }, { 0x7ffff2, 23 }, { 0x3fffe8, 22 }, { 0x1ffffec, 25 },
+  /* 200 */ { 0x3ffffe2, 26 }, { 0x3ffffe3, 26 }, { 0x3ffffe4, 26 }, { 0x7ffffde, 27 },
+  /* 204 */ { 0x7ffffdf, 27 }, { 0x3ffffe5, 26 }, { 0xfffff1, 24 }, { 0x1ffffed, 25 },
+  /* 208 */ { 0x7fff2, 19 }, { 0x1fffe3, 21 }, { 0x3ffffe6, 26 }, { 0x7ffffe0, 27 },
+  /* 212 */ { 0x7ffffe1, 27 }, { 0x3ffffe7, 26 }, { 0x7ffffe2, 27 }, { 0xfffff2, 24 },
+  /* 216 */ { 0x1fffe4, 21 }, { 0x1fffe5, 21 }, { 0x3ffffe8, 26 }, { 0x3ffffe9, 26 },
+  /* 220 */ { 0xffffffd, 28 }, { 0x7ffffe3, 27 }, { 0x7ffffe4, 27 }, { 0x7ffffe5, 27 },
+  /* 224 */ { 0xfffec, 20 }, { 0xfffff3, 24 }, { 0xfffed, 20 }, { 0x1fffe6, 21 },
+  /* 228 */ { 0x3fffe9, 22 }, { 0x1fffe7, 21 }, { 0x1fffe8, 21 }, { 0x7ffff3, 23 },
+  /* 232 */ { 0x3fffea, 22 }, { 0x3fffeb, 22 }, { 0x1ffffee, 25 }, { 0x1ffffef, 25 },
+  /* 236 */ { 0xfffff4, 24 }, { 0xfffff5, 24 }, { 0x3ffffea, 26 }, { 0x7ffff4, 23 },
+  /* 240 */ { 0x3ffffeb, 26 }, { 0x7ffffe6, 27 }, { 0x3ffffec, 26 }, { 0x3ffffed, 26 },
+  /* 244 */ { 0x7ffffe7, 27 }, { 0x7ffffe8, 27 }, { 0x7ffffe9, 27 }, { 0x7ffffea, 27 },
+  /* 248 */ { 0x7ffffeb, 27 }, { 0xffffffe, 28 }, { 0x7ffffec, 27 }, { 0x7ffffed, 27 },
+  /* 252 */ { 0x7ffffee, 27 }, { 0x7ffffef, 27 }, { 0x7fffff0, 27 }, { 0x3ffffee, 26 },
+  /* 256 */ { 0x3fffffff, 30 },
+};
+
+// canonical decoding: the codes of one length are consecutive and
+// follow the shorter ones, so a symbol is found from its length and
+// its distance to the first code of that length. codes up to 8 bits
+// (the common characters) come straight from a 256 entry table
+struct HuffDecodeTable
+{
+  uint32_t first[31]; // first code of each length
+  uint32_t count[31];
+  uint32_t offset[31]; // of that length's first symbol in syms
+  uint16_t syms[257]; // ordered by (length, symbol)
+  uint16_t fastSym[256];
+  uint8_t fastLen[256]; // 0 if no code of at most 8 bits fits
+
+  HuffDecodeTable()
+  {
+    memset(count, 0, sizeof count);
+    for(int s = 0; s < 257; ++s) ++count[kHuffTable[s].len];
+    uint32_t code = 0, off = 0;
+    for(int l = 1; l <= 30; ++l)
+    {
+      first[l] = code;
+      offset[l] = off;
+      code = (code + count[l]) << 1;
+      off += count[l];
+    }
+    uint32_t fill[31];
+    memcpy(fill, offset, sizeof fill);
+    for(int l = 1; l <= 30; ++l)
+      for(int s = 0; s < 257; ++s)
+        if(kHuffTable[s].len == l) syms[fill[l]++] = static_cast<uint16_t>(s);
+    memset(fastLen, 0, sizeof fastLen);
+    for(int s = 0; s < 257; ++s)
+    {
+      int l = kHuffTable[s].len;
+      if(l > 8) continue;
+      uint32_t base = kHuffTable[s].code << (8 - l);
+      for(uint32_t i = 0; i < (1u << (8 - l)); ++i)
+      {
+        fastSym[base + i] = static_cast<uint16_t>(s);
+        fastLen[base + i] = static_cast<uint8_t>(l);
+      }
+    }
+  }
+  // w holds the next 32 bits, left aligned
+  void lookup(uint32_t w, int* sym, int* len) const
+  {
+    if(fastLen[w >> 24])
+    {
+      *sym = fastSym[w >> 24];
+      *len = fastLen[w >> 24];
+      return;
+    }
+    for(int l = 9; l <= 30; ++l)
+    {
+      uint32_t code = w >> (32 - l);
+      if(code - first[l] < count[l])
+      {
+        *sym = syms[offset[l] + code - first[l]];
+        *len = l;
+        return;
+      }
+    }
+    *sym = 256;
+    *len = 30;
+  }
+};
+
+const HuffDecodeTable& huffDecodeTable()
+{
+  static HuffDecodeTable t;
+  return t;
+}
+
+// name -> first index and 'name\0value' -> index over the static table
+struct StaticIndex
+{
+  std::unordered_map<std::string, size_t> names;
+  std::unordered_map<std::string, size_t> fields;
+  StaticIndex()
+  {
+    for(size_t i = 0; i < hpack::kStaticTableSize; ++i)
+    {
+      std::string name(kStaticTable[i].name);
+      names.insert(std::make_pair(name, i + 1));
+      fields.insert(std::make_pair(name + '\0' + kStaticTable[i].value, i + 1));
+    }
+  }
+};
+
+const StaticIndex& staticIndex()
+{
+  static StaticIndex idx;
+  return idx;
+}
+
+bool oneOf(const StringPiece& name, const char* const* names, size_t n)
+{
+  for(size_t i = 0; i < n; ++i)
+    if(name == names[i]) return true;
+  return false;
+}
+
+// fields that change with every message would only churn the dynamic
+// table, they are sent without indexing
+bool volatileField(const StringPiece& name)
+{
+  static const char* const kNames[] = { ":path", "content-length", "date",
+    "etag", "last-modified", "content-range", "expires", "age", "location" };
+  return oneOf(name, kNames, sizeof kNames / sizeof kNames[0]);
+}
+
+// credentials are never indexed, not even by intermediaries, so they
+// cannot be probed through compression (section 7.1)
+bool sensitiveField(const StringPiece& name)
+{
+  static const char* const kNames[] = { "authorization", "proxy-authorization",
+    "cookie", "set-cookie" };
+  return oneOf(name, kNames, sizeof kNames / sizeof kNames[0]);
+}
+
+const size_t kEntryOverhead = 32;
+} // namespace
+
+namespace hpack
+{
+void encodeInt(uint64_t v, int n, uint8_t first, std::string* out)
+{
+  uint64_t max = (1u << n) - 1;
+  if(v < max)
+  {
+    out->push_back(static_cast<char>(first | v));
+    return;
+  }
+  out->push_back(static_cast<char>(first | max));
+  v -= max;
+  while(v >= 128)
+  {
+    out->push_back(static_cast<char>((v & 0x7f) | 0x80));
+    v >>= 7;
+  }
+  out->push_back(static_cast<char>(v));
+}
+
+const uint8_t* decodeInt(const uint8_t* p, const uint8_t* end, int n, uint64_t* v)
+{
+  if(p == end) return NULL;
+  uint64_t max = (1u << n) - 1;
+  *v = *p++ & max;
+  if(*v < max) return p;
+  int shift = 0;
+  for(;;)
+  {
+    // anything above 2^56 is an attack, not a header
+    if(p == end || shift > 49) return NULL;
+    uint8_t b = *p++;
+    *v += static_cast<uint64_t>(b & 0x7f) << shift;
+    shift += 7;
+    if(!(b & 0x80)) return p;
+  }
+}
+
+size_t huffmanLen(const StringPiece& s)
+{
+  size_t bits = 0;
+  for(int i = 0; i < s.size(); ++i)
+    bits += kHuffTable[static_cast<uint8_t>(s[i])].len;
+  return (bits + 7) / 8;
+}
+
+void huffmanEncode(const StringPiece& s, std::string* out)
+{
+  uint64_t acc = 0;
+  int nbits = 0;
+  for(int i = 0; i < s.size(); ++i)
+  {
+    const HuffSym& h = kHuffTable[static_cast<uint8_t>(s[i])];
+    acc = (acc << h.len) | h.code;
+    nbits += h.len;
+    while(nbits >= 8)
+    {
+      nbits -= 8;
+      out->push_back(static_cast<char>(acc >> nbits));
+    }
+  }
+  // padded with the most significant bits of EOS, i.e. ones
+  if(nbits > 0)
+    out->push_back(static_cast<char>((acc << (8 - nbits)) | (0xff >> nbits)));
+}
+
+bool huffmanDecode(const uint8_t* p, size_t len, std::string* out)
+{
+  const HuffDecodeTable& t = huffDecodeTable();
+  const uint8_t* end = p + len;
+  uint64_t acc = 0; // left aligned
+  int nbits = 0;
+  for(;;)
+  {
+    while(nbits <= 56 && p < end)
+    {
+      acc |= static_cast<uint64_t>(*p++) << (56 - nbits);
+      nbits += 8;
+    }
+    if(nbits == 0) return true;
+    uint32_t w = static_cast<uint32_t>(acc >> 32);
+    // past the end the window is filled with ones, like the padding
+    if(nbits < 32) w |= 0xffffffffu >> nbits;
+    int sym, l;
+    t.lookup(w, &sym, &l);
+    if(l > nbits)
+    {
+      // what is left has to be padding: fewer than 8 bits, all ones
+      uint32_t mask = ~(0xffffffffu >> nbits);
+      return nbits < 8 && (w & mask) == mask;
+    }
+    if(sym == 256) return false;
+    out->push_back(static_cast<char>(sym));
+    acc <<= l;
+    nbits -= l;
+  }
+}
+} // namespace hpack
+
+bool HPACKTable::get(size_t index, StringPiece* name, StringPiece* value) const
+{
+  if(index == 0) return false;
+  if(index <= hpack::kStaticTableSize)
+  {
+    *name = kStaticTable[index-1].name;
+    *value = kStaticTable[index-1].value;
+    return true;
+  }
+  index -= hpack::kStaticTableSize + 1;
+  if(index >= entries_.size()) return false;
+  *name = entries_[index].name;
+  *value = entries_[index].value;
+  return true;
+}
+
+void HPACKTable::evict(size_t limit)
+{
+  while(size_ > limit)
+  {
+    const Entry& e = entries_.back();
+    size_ -= e.name.size() + e.value.size() + kEntryOverhead;
+    entries_.pop_back();
+  }
+}
+
+void HPACKTable::add(const StringPiece& name, const StringPiece& value)
+{
+  size_t sz = name.size() + value.size() + kEntryOverhead;
+  // an entry larger than the table empties it and is not added
+  if(sz > maxSize_)
+  {
+    evict(0);
+    return;
+  }
+  evict(maxSize_ - sz);
+  Entry e;
+  e.name.assign(name.data(), name.size());
+  e.value.assign(value.data(), value.size());
+  entries_.push_front(std::move(e));
+  size_ += sz;
+}
+
+void HPACKTable::setMaxSize(size_t sz)
+{
+  maxSize_ = sz;
+  evict(sz);
+}
+
+size_t HPACKTable::find(const StringPiece& name, const StringPiece& value,
+  size_t* nameIndex) const
+{
+  *nameIndex = 0;
+  const StaticIndex& idx = staticIndex();
+  std::string key(name.data(), name.size());
+  auto n = idx.names.find(key);
+  if(n != idx.names.end())
+  {
+    *nameIndex = n->second;
+    key += '\0';
+    key.append(value.data(), value.size());
+    auto f = idx.fields.find(key);
+    if(f != idx.fields.end()) return f->second;
+  }
+  // the dynamic table holds a few dozen entries at most
+  for(size_t i = 0; i < entries_.size(); ++i)
+  {
+    const Entry& e = entries_[i];
+    if(e.name.size() != static_cast<size_t>(name.size())
+      || memcmp(e.name.data(), name.data(), name.size()) != 0) continue;
+    if(e.value.size() == static_cast<size_t>(value.size())
+      && memcmp(e.value.data(), value.data(), value.size()) == 0)
+      return hpack::kStaticTableSize + 1 + i;
+    if(*nameIndex == 0) *nameIndex = hpack::kStaticTableSize + 1 + i;
+  }
+  return 0;
+}
+
+// a string literal: H bit, 7 bit prefix length, then the bytes.
+// s points into the block, or into out after Huffman decoding
+const uint8_t* HPACKDecoder::readString(const uint8_t* p, const uint8_t* end,
+  std::string* out, StringPiece* s)
+{
+  if(p == end) return NULL;
+  bool huffman = (*p & 0x80) != 0;
+  uint64_t len;
+  p = hpack::decodeInt(p, end, 7, &len);
+  if(!p || len > static_cast<uint64_t>(end - p)) return NULL;
+  if(huffman)
+  {
+    out->clear();
+    if(!hpack::huffmanDecode(p, static_cast<size_t>(len), out)) return NULL;
+    *s = *out;
+  }
+  else s->set(reinterpret_cast<const char*>(p), static_cast<int>(len));
+  return p + len;
+}
+
+bool HPACKDecoder::decode(const char* data, size_t len, const FieldCB& cb)
+{
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+  const uint8_t* end = p + len;
+  size_t listSz = 0;
+  bool first = true;
+  while(p < end)
+  {
+    uint8_t b = *p;
+    StringPiece name, value;
+    if(b & 0x80) // indexed field
+    {
+      uint64_t index;
+      p = hpack::decodeInt(p, end, 7, &index);
+      if(!p || !table_.get(static_cast<size_t>(index), &name, &value)) return false;
+    }
+    else if((b & 0xe0) == 0x20) // dynamic table size update
+    {
+      uint64_t sz;
+      p = hpack::decodeInt(p, end, 5, &sz);
+      // only at the start of a block and within what we allowed
+      if(!p || !first || sz > maxTableSize_) return false;
+      table_.setMaxSize(static_cast<size_t>(sz));
+      continue;
+    }
+    else // literal, with (01), without (0000) or never (0001) indexing
+    {
+      bool indexing = (b & 0xc0) == 0x40;
+      int n = indexing ? 6 : 4;
+      uint64_t index;
+      p = hpack::decodeInt(p, end, n, &index);
+      if(!p) return false;
+      if(index)
+      {
+        StringPiece unused;
+        if(!table_.get(static_cast<size_t>(index), &name, &unused)) return false;
+        // the name may sit in the dynamic table, which add() below
+        // can evict from
+        name_.assign(name.data(), name.size());
+        name = name_;
+      }
+      else if(!(p = readString(p, end, &name_, &name))) return false;
+      if(!(p = readString(p, end, &value_, &value))) return false;
+      if(indexing)
+      {
+        // the slices may point into the entry evicted first
+        if(name.data() != name_.data())
+        {
+          name_.assign(name.data(), name.size());
+          name = name_;
+        }
+        if(value.data() != value_.data())
+        {
+          value_.assign(value.data(), value.size());
+          value = value_;
+        }
+        table_.add(name, value);
+      }
+    }
+    first = false;
+    listSz += name.size() + value.size() + kEntryOverhead;
+    if(listSz > maxHeaderListSz_) return false;
+    cb(name, value);
+  }
+  return true;
+}
+
+void HPACKEncoder::setMaxTableSize(size_t sz)
+{
+  // the decoder has to see the smallest size so it evicts the same
+  // entries, then the final one
+  if(sz < minPendingSize_) minPendingSize_ = sz;
+  pendingSize_ = sz;
+}
+
+void HPACKEncoder::beginBlock(std::string* out)
+{
+  if(pendingSize_ == SIZE_MAX) return;
+  if(minPendingSize_ < pendingSize_)
+  {
+    hpack::encodeInt(minPendingSize_, 5, 0x20, out);
+    table_.setMaxSize(minPendingSize_);
+  }
+  hpack::encodeInt(pendingSize_, 5, 0x20, out);
+  table_.setMaxSize(pendingSize_);
+  pendingSize_ = minPendingSize_ = SIZE_MAX;
+}
+
+namespace
+{
+void encodeString(const StringPiece& s, std::string* out)
+{
+  size_t hlen = hpack::huffmanLen(s);
+  if(hlen < static_cast<size_t>(s.size()))
+  {
+    hpack::encodeInt(hlen, 7, 0x80, out);
+    hpack::huffmanEncode(s, out);
+  }
+  else
+  {
+    hpack::encodeInt(s.size(), 7, 0, out);
+    out->append(s.data(), s.size());
+  }
+}
+} // namespace
+
+void HPACKEncoder::encode(const StringPiece& name, const StringPiece& value,
+  std::string* out)
+{
+  size_t nameIndex;
+  size_t index = table_.find(name, value, &nameIndex);
+  if(index)
+  {
+    hpack::encodeInt(index, 7, 0x80, out);
+    return;
+  }
+  bool indexing = false;
+  if(sensitiveField(name)) hpack::encodeInt(nameIndex, 4, 0x10, out);
+  else if(volatileField(name)) hpack::encodeInt(nameIndex, 4, 0x00, out);
+  else
+  {
+    hpack::encodeInt(nameIndex, 6, 0x40, out);
+    indexing = true;
+  }
+  if(!nameIndex) encodeString(name, out);
+  encodeString(value, out);
+  if(indexing) table_.add(name, value);
+}
+} // namespace net
+} // namespace chtho
@@ -0,0 +1,122 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_NET_HTTP_HPACK_H
+#define CHTHO_NET_HTTP_HPACK_H
+
+#include "base/noncopyable.h"
+#include "base/StringPiece.h"
+
+#include <deque>
+#include <functional>
+#include <string>
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace chtho
+{
+namespace net
+{
+// header compression for HTTP/2 (RFC 7541). one HPACKDecoder and one
+// HPACKEncoder per connection and direction, their dynamic tables
+// follow every header block in order, so blocks must be decoded
+// (and encoded) in the order they travel on the wire
+namespace hpack
+{
+// the 61 entries of appendix A
+const size_t kStaticTableSize = 61;
+// the default of SETTINGS_HEADER_TABLE_SIZE
+const size_t kDefaultTableSize = 4096;
+
+// appends v with an n bit prefix, first carries the bits above it
+void encodeInt(uint64_t v, int n, uint8_t first, std::string* out);
+// NULL when the integer is truncated or too large
+const uint8_t* decodeInt(const uint8_t* p, const uint8_t* end, int n, uint64_t* v);
+// appendix B, the code is canonical so it is decoded without a tree
+size_t huffmanLen(const StringPiece& s);
+void huffmanEncode(const StringPiece& s, std::string* out);
+bool huffmanDecode(const uint8_t* p, size_t len, std::string* out);
+} // namespace hpack
+
+// the static table followed by the dynamic one, indices are 1 based
+class HPACKTable : noncopyable
+{
+private:
+  struct Entry
+  {
+    std::string name;
+    std::string value;
+  };
+  std::deque<Entry> entries_; // newest first
+  size_t size_; // sum of name + value + 32 over the entries
+  size_t maxSize_;
+
+  void evict(size_t limit);
+public:
+  HPACKTable() : size_(0), maxSize_(hpack::kDefaultTableSize) {}
+  bool get(size_t index, StringPiece* name, StringPiece* value) const;
+  void add(const StringPiece& name, const StringPiece& value);
+  void setMaxSize(size_t sz);
+  size_t maxSize() const { return maxSize_; }
+  size_t size() const { return size_; }
+  size_t numEntries() const { return entries_.size(); }
+  // the index of name: value, 0 if absent. *nameIndex gets some entry
+  // with that name (or 0)
+  size_t find(const StringPiece& name, const StringPiece& value, size_t* nameIndex) const;
+};
+
+class HPACKDecoder : noncopyable
+{
+public:
+  // the pieces are only valid during the call
+  using FieldCB = std::function<void(const StringPiece& name, const StringPiece& value)>;
+private:
+  HPACKTable table_;
+  size_t maxTableSize_; // what we announced, the peer may not exceed it
+  size_t maxHeaderListSz_;
+  std::string name_; // literals land here after Huffman decoding
+  std::string value_;
+
+  const uint8_t* readString(const uint8_t* p, const uint8_t* end, std::string* out,
+    StringPiece* s);
+public:
+  HPACKDecoder()
+    : maxTableSize_(hpack::kDefaultTableSize),
+      maxHeaderListSz_(64*1024) // 64 KB
+  {}
+  // decodes a complete header block, false on a compression error
+  // (the connection can no longer be used then)
+  bool decode(const char* data, size_t len, const FieldCB& cb);
+  void setMaxHeaderListSz(size_t sz) { maxHeaderListSz_ = sz; }
+  const HPACKTable& table() const { return table_; }
+};
+
+// names must be lowercase, as HTTP/2 requires. fields that repeat
+// across responses go into the dynamic table, per-message values
+// (content-length, date, ...) are sent as plain literals and
+// credentials as never indexed ones. strings are Huffman coded when
+// that is shorter
+class HPACKEncoder : noncopyable
+{
+private:
+  HPACKTable table_;
+  size_t pendingSize_; // a size update to announce, SIZE_MAX if none
+  size_t minPendingSize_; // smallest size seen since the last block
+public:
+  HPACKEncoder() : pendingSize_(SIZE_MAX), minPendingSize_(SIZE_MAX) {}
+  void encode(const StringPiece& name, const StringPiece& value, std::string* out);
+  // the peer's SETTINGS_HEADER_TABLE_SIZE, the change is signalled
+  // at the start of the next header block
+  void setMaxTableSize(size_t sz);
+  // call before the first field of every header block
+  void beginBlock(std::string* out);
+  const HPACKTable& table() const { return table_; }
+};
+} // namespace net
+} // namespace chtho
+
+
+#endif // !CHTHO_NET_HTTP_HPACK_H
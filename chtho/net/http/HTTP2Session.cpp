@@ -0,0 +1,856 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "HTTP2Session.h"
+
+#include "logging/Logger.h"
+#include "net/Buffer.h"
+#include "net/EventLoop.h"
+#include "net/TcpConnection.h"
+
+#include <algorithm>
+
+#include <ctype.h> // tolower
+#include <stdio.h> // snprintf
+#include <string.h> // memcmp
+#include <unistd.h> // pread
+
+namespace chtho
+{
+namespace net
+{
+namespace
+{
+enum FrameType { Data = 0x0, Headers = 0x1, Priority = 0x2, RstStream = 0x3,
+  Settings = 0x4, PushPromise = 0x5, Ping = 0x6, GoAway = 0x7,
+  WindowUpdate = 0x8, Continuation = 0x9 };
+enum Flag { EndStream = 0x1, Ack = 0x1, EndHeaders = 0x4, Padded = 0x8,
+  PriorityFlag = 0x20 };
+enum SettingID { HeaderTableSize = 0x1, EnablePush = 0x2,
+  MaxConcurrentStreams = 0x3, InitialWindowSize = 0x4, MaxFrameSize = 0x5,
+  MaxHeaderListSize = 0x6 };
+
+const size_t kFrameHeaderLen = 9;
+const uint32_t kDefaultWindow = 65535;
+const uint32_t kDefaultMaxFrameSz = 16384; // also what we accept
+const int64_t kMaxWindow = 0x7fffffff;
+const size_t kMaxHeaderBlock = 256*1024;
+const size_t kMaxHeaderListSz = 64*1024;
+// DATA frames stop being queued above this much unsent output, they
+// resume from the write complete callback
+const size_t kOutputHighWater = 1024*1024;
+
+uint32_t readU32(const char* p)
+{
+  const uint8_t* u = reinterpret_cast<const uint8_t*>(p);
+  return (static_cast<uint32_t>(u[0]) << 24) | (u[1] << 16) | (u[2] << 8) | u[3];
+}
+
+void putU32(char* p, uint32_t v)
+{
+  p[0] = static_cast<char>(v >> 24);
+  p[1] = static_cast<char>(v >> 16);
+  p[2] = static_cast<char>(v >> 8);
+  p[3] = static_cast<char>(v);
+}
+
+// fields that only make sense for one HTTP/1.1 hop (section 8.1.2.2)
+bool connectionSpecific(const std::string& name)
+{
+  return name == "connection" || name == "keep-alive" || name == "proxy-connection"
+    || name == "transfer-encoding" || name == "upgrade";
+}
+} // namespace
+
+const char HTTP2Session::kPreface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+const size_t HTTP2Session::kPrefaceLen;
+const uint32_t HTTP2Session::kMaxConcurrentStreams;
+const uint32_t HTTP2Session::kInitialWindow;
+const uint32_t HTTP2Session::kConnWindow;
+
+struct HTTP2Session::Stream
+{
+  uint32_t id;
+  bool refused; // over the concurrency limit, reset once its headers are decoded
+  bool headersDone; // more HEADERS are trailers
+  bool remoteClosed; // END_STREAM received
+  bool responded; // HEADERS sent
+  std::string fields; // decoded names and values, req has slices into it
+  HTTPRequest req;
+  int64_t sendWindow;
+  int64_t recvWindow;
+  uint32_t consumed; // body bytes since the last WINDOW_UPDATE
+  // the response body still to be sent: body, a slice kept alive by
+  // owner, or a file region read with pread
+  std::string body;
+  StringPiece ref;
+  int fd;
+  off_t fileOff;
+  std::shared_ptr<void> owner;
+  size_t off; // sent so far
+  size_t len;
+
+  Stream(uint32_t i, int64_t window)
+    : id(i), refused(false), headersDone(false), remoteClosed(false),
+      responded(false), sendWindow(window), recvWindow(kInitialWindow),
+      consumed(0), fd(-1), fileOff(0), off(0), len(0)
+  {}
+};
+
+HTTP2Session::HTTP2Session(const TcpConnPtr& conn, const RequestCB& cb)
+  : conn_(conn),
+    loop_(conn->loop()),
+    requestCB_(cb),
+    lastStreamID_(0),
+    prefaceRcvd_(false),
+    dead_(false),
+    goawayRcvd_(false),
+    inRead_(false),
+    flushQueued_(false),
+    maxBodySz_(8*1024*1024), // 8 MB
+    peerInitialWindow_(kDefaultWindow),
+    peerMaxFrameSz_(kDefaultMaxFrameSz),
+    connSendWindow_(kDefaultWindow),
+    connRecvWindow_(kDefaultWindow),
+    connConsumed_(0),
+    headerStream_(0),
+    headerEndStream_(false)
+{
+  decoder_.setMaxHeaderListSz(kMaxHeaderListSz);
+}
+
+HTTP2Session::~HTTP2Session() = default;
+
+bool HTTP2Session::maybePreface(const char* data, size_t len)
+{
+  return memcmp(data, kPreface, std::min(len, kPrefaceLen)) == 0;
+}
+
+bool HTTP2Session::decodeSettingsHeader(const StringPiece& val, std::string* out)
+{
+  out->clear();
+  uint32_t acc = 0;
+  int bits = 0;
+  for(int i = 0; i < val.size(); ++i)
+  {
+    char c = val[i];
+    int v;
+    if(c >= 'A' && c <= 'Z') v = c - 'A';
+    else if(c >= 'a' && c <= 'z') v = c - 'a' + 26;
+    else if(c >= '0' && c <= '9') v = c - '0' + 52;
+    else if(c == '-' || c == '+') v = 62;
+    else if(c == '_' || c == '/') v = 63;
+    else if(c == '=') break;
+    else return false;
+    acc = (acc << 6) | v;
+    bits += 6;
+    if(bits >= 8)
+    {
+      bits -= 8;
+      out->push_back(static_cast<char>(acc >> bits));
+    }
+  }
+  return out->size() % 6 == 0;
+}
+
+void HTTP2Session::start()
+{
+  loop_->assertInLoopThread();
+  std::weak_ptr<HTTP2Session> weak(shared_from_this());
+  TcpConnPtr conn = conn_.lock();
+  if(conn)
+  {
+    // queued DATA continues once the socket has taken the rest
+    conn->setWriteCompleteCB([weak](const TcpConnPtr&){
+      HTTP2SessionPtr s = weak.lock();
+      if(s && !s->sending_.empty())
+      {
+        s->pumpAll();
+        s->flush();
+      }
+    });
+  }
+  writeSettings();
+}
+
+bool HTTP2Session::startUpgrade(const HTTPRequest& req, const std::string& settings)
+{
+  for(size_t i = 0; i + 6 <= settings.size(); i += 6)
+  {
+    uint16_t id = static_cast<uint16_t>((static_cast<uint8_t>(settings[i]) << 8)
+      | static_cast<uint8_t>(settings[i+1]));
+    if(!applySetting(id, readU32(&settings[i+2]))) return false;
+  }
+  start();
+  // the upgrade request is stream 1, already half closed (remote)
+  lastStreamID_ = 1;
+  StreamPtr s(new Stream(1, peerInitialWindow_));
+  s->req = req; // a copy owns its data
+  s->headersDone = true;
+  s->remoteClosed = true;
+  Stream* raw = s.get();
+  streams_[1] = std::move(s);
+  dispatch(raw);
+  return true;
+}
+
+// frames are handled once complete, a frame larger than the
+// SETTINGS_MAX_FRAME_SIZE we use (the default) is a connection error
+void HTTP2Session::handleMsg(Buffer* buf, Timestamp rcvTime)
+{
+  loop_->assertInLoopThread();
+  inRead_ = true;
+  rcvTime_ = rcvTime;
+  if(!prefaceRcvd_ && !dead_)
+  {
+    size_t n = std::min(buf->readableBytes(), kPrefaceLen);
+    if(!maybePreface(buf->peek(), n)) connError(ProtocolError);
+    else if(n == kPrefaceLen)
+    {
+      buf->retrieve(kPrefaceLen);
+      prefaceRcvd_ = true;
+    }
+  }
+  while(prefaceRcvd_ && !dead_ && buf->readableBytes() >= kFrameHeaderLen)
+  {
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(buf->peek());
+    size_t len = (static_cast<size_t>(p[0]) << 16) | (p[1] << 8) | p[2];
+    if(len > kDefaultMaxFrameSz)
+    {
+      connError(FrameSizeError);
+      break;
+    }
+    if(buf->readableBytes() < kFrameHeaderLen + len) break;
+    uint32_t id = readU32(buf->peek() + 5) & 0x7fffffff;
+    bool ok = handleFrame(p[3], p[4], id, buf->peek() + kFrameHeaderLen, len);
+    buf->retrieve(kFrameHeaderLen + len);
+    if(!ok) break;
+  }
+  if(dead_) buf->retrieveAll();
+  inRead_ = false;
+  // everything this read produced leaves in one write
+  flush();
+}
+
+bool HTTP2Session::handleFrame(uint8_t type, uint8_t flags, uint32_t id,
+  const char* p, size_t len)
+{
+  // a header block may not be interleaved with any other frame
+  if(headerStream_ && type != Continuation) return connError(ProtocolError);
+  switch (type)
+  {
+  case Data: return onData(flags, id, p, len);
+  case Headers: return onHeaders(flags, id, p, len);
+  case Continuation: return onContinuation(flags, id, p, len);
+  case Settings: return onSettings(flags, id, p, len);
+  case WindowUpdate: return onWindowUpdate(id, p, len);
+  case Priority:
+    // advisory, every stream is served alike
+    if(id == 0) return connError(ProtocolError);
+    if(len != 5) resetStream(id, FrameSizeError);
+    return true;
+  case RstStream:
+    if(id == 0 || id > lastStreamID_) return connError(ProtocolError);
+    if(len != 4) return connError(FrameSizeError);
+    closeStream(id);
+    return true;
+  case PushPromise:
+    // clients never push
+    return connError(ProtocolError);
+  case Ping:
+    if(id != 0) return connError(ProtocolError);
+    if(len != 8) return connError(FrameSizeError);
+    if(!(flags & Ack)) writeFrame(Ping, Ack, 0, p, len);
+    return true;
+  case GoAway:
+    if(id != 0) return connError(ProtocolError);
+    // the streams in flight are finished, then the connection goes
+    goawayRcvd_ = true;
+    if(streams_.empty())
+    {
+      dead_ = true;
+      TcpConnPtr conn = conn_.lock();
+      if(conn)
+      {
+        conn->flushOutputBuf();
+        conn->shutdown();
+      }
+    }
+    return true;
+  default:
+    // unknown frame types are ignored
+    return true;
+  }
+}
+
+bool HTTP2Session::onData(uint8_t flags, uint32_t id, const char* p, size_t len)
+{
+  if(id == 0) return connError(ProtocolError);
+  // flow control counts the whole payload, padding included
+  if(static_cast<int64_t>(len) > connRecvWindow_) return connError(FlowControlError);
+  connRecvWindow_ -= len;
+  connConsumed_ += static_cast<uint32_t>(len);
+  if(connConsumed_ >= kConnWindow / 2)
+  {
+    writeWindowUpdate(0, connConsumed_);
+    connRecvWindow_ += connConsumed_;
+    connConsumed_ = 0;
+  }
+  size_t frameLen = len;
+  if(flags & Padded)
+  {
+    if(len == 0) return connError(ProtocolError);
+    size_t pad = static_cast<uint8_t>(p[0]);
+    if(pad >= len) return connError(ProtocolError);
+    ++p;
+    len -= 1 + pad;
+  }
+  auto it = streams_.find(id);
+  if(it == streams_.end())
+  {
+    if(id > lastStreamID_) return connError(ProtocolError);
+    // a stream we have closed or reset, the data is dropped
+    return true;
+  }
+  Stream* s = it->second.get();
+  if(s->remoteClosed || !s->headersDone)
+  {
+    resetStream(id, StreamClosed);
+    closeStream(id);
+    return true;
+  }
+  if(static_cast<int64_t>(frameLen) > s->recvWindow)
+  {
+    resetStream(id, FlowControlError);
+    closeStream(id);
+    return true;
+  }
+  s->recvWindow -= frameLen;
+  if(!s->responded)
+  {
+    if(s->req.body().size() + len > maxBodySz_)
+    {
+      HTTPResponse tooLarge;
+      tooLarge.setStatus(HTTPResponse::PayloadTooLarge413);
+      respond(id, &tooLarge);
+      return true;
+    }
+    s->req.appendBody(p, len);
+  }
+  if(flags & EndStream)
+  {
+    s->remoteClosed = true;
+    if(!s->responded) dispatch(s);
+    else closeStream(id);
+    return true;
+  }
+  s->consumed += static_cast<uint32_t>(frameLen);
+  if(s->consumed >= kInitialWindow / 2)
+  {
+    writeWindowUpdate(id, s->consumed);
+    s->recvWindow += s->consumed;
+    s->consumed = 0;
+  }
+  return true;
+}
+
+bool HTTP2Session::onHeaders(uint8_t flags, uint32_t id, const char* p, size_t len)
+{
+  if(id == 0 || !(id & 1)) return connError(ProtocolError);
+  if(flags & Padded)
+  {
+    if(len == 0) return connError(ProtocolError);
+    size_t pad = static_cast<uint8_t>(p[0]);
+    if(pad >= len) return connError(ProtocolError);
+    ++p;
+    len -= 1 + pad;
+  }
+  if(flags & PriorityFlag)
+  {
+    if(len < 5) return connError(FrameSizeError);
+    p += 5;
+    len -= 5;
+  }
+  auto it = streams_.find(id);
+  if(it != streams_.end())
+  {
+    // trailers, they have to end the stream
+    Stream* s = it->second.get();
+    if(s->remoteClosed) return connError(StreamClosed);
+    if(!(flags & EndStream)) return connError(ProtocolError);
+  }
+  else
+  {
+    if(id <= lastStreamID_) return connError(StreamClosed);
+    lastStreamID_ = id;
+    StreamPtr s(new Stream(id, peerInitialWindow_));
+    // its header block still has to go through the decoder
+    s->refused = streams_.size() >= kMaxConcurrentStreams || goawayRcvd_;
+    streams_[id] = std::move(s);
+  }
+  headerStream_ = id;
+  headerEndStream_ = (flags & EndStream) != 0;
+  headerBlock_.assign(p, len);
+  if(flags & EndHeaders) return endHeaders();
+  return true;
+}
+
+bool HTTP2Session::onContinuation(uint8_t flags, uint32_t id, const char* p, size_t len)
+{
+  if(headerStream_ == 0 || id != headerStream_) return connError(ProtocolError);
+  if(headerBlock_.size() + len > kMaxHeaderBlock) return connError(ProtocolError);
+  headerBlock_.append(p, len);
+  if(flags & EndHeaders) return endHeaders();
+  return true;
+}
+
+// the block is decoded even for streams that are refused, the
+// decoder's dynamic table has to see every block
+bool HTTP2Session::endHeaders()
+{
+  uint32_t id = headerStream_;
+  headerStream_ = 0;
+  Stream* s = streams_[id].get();
+  if(s->headersDone)
+  {
+    bool ok = decoder_.decode(headerBlock_.data(), headerBlock_.size(),
+      [](const StringPiece&, const StringPiece&){});
+    if(!ok) return connError(CompressionError);
+    s->remoteClosed = true;
+    if(!s->responded) dispatch(s);
+    else closeStream(id);
+    return true;
+  }
+  // names and values are collected in one string first, the request
+  // gets its slices once it no longer grows
+  std::string& store = s->fields;
+  std::vector<uint32_t> offs;
+  bool ok = decoder_.decode(headerBlock_.data(), headerBlock_.size(),
+    [&store, &offs](const StringPiece& name, const StringPiece& value){
+      offs.push_back(static_cast<uint32_t>(store.size()));
+      store.append(name.data(), name.size());
+      offs.push_back(static_cast<uint32_t>(store.size()));
+      store.append(value.data(), value.size());
+    });
+  if(!ok) return connError(CompressionError);
+  if(s->refused)
+  {
+    resetStream(id, RefusedStream);
+    closeStream(id);
+    return true;
+  }
+  HTTPRequest& req = s->req;
+  bool hasMethod = false, hasPath = false, badMethod = false;
+  for(size_t i = 0; i < offs.size(); i += 2)
+  {
+    const char* name = store.data() + offs[i];
+    const char* value = store.data() + offs[i+1];
+    const char* valueEnd = store.data() + (i+2 < offs.size() ? offs[i+2] : store.size());
+    StringPiece n(name, static_cast<int>(value - name));
+    if(n == ":method")
+    {
+      hasMethod = true;
+      badMethod = !req.setMethod(value, valueEnd);
+    }
+    else if(n == ":path")
+    {
+      const char* q = std::find(value, valueEnd, '?');
+      req.setPath(value, q);
+      if(q != valueEnd) req.setQuery(q, valueEnd);
+      hasPath = value != valueEnd;
+    }
+    else if(n == ":authority")
+      req.addHeader("host", StringPiece(value, static_cast<int>(valueEnd - value)));
+    else if(!n.empty() && n[0] != ':')
+      req.addHeader(n, StringPiece(value, static_cast<int>(valueEnd - value)));
+  }
+  s->headersDone = true;
+  if(!hasMethod || !hasPath)
+  {
+    resetStream(id, ProtocolError);
+    closeStream(id);
+    return true;
+  }
+  if(badMethod)
+  {
+    HTTPResponse notAllowed;
+    notAllowed.setStatus(HTTPResponse::MethodNotAllowed405);
+    respond(id, &notAllowed);
+    return true;
+  }
+  if(headerEndStream_)
+  {
+    s->remoteClosed = true;
+    dispatch(s);
+  }
+  return true;
+}
+
+// the callback may respond right away, which can destroy s
+void HTTP2Session::dispatch(Stream* s)
+{
+  s->req.setRcvTime(rcvTime_);
+  s->req.setVersion(HTTPRequest::HTTP2);
+  TcpConnPtr conn = conn_.lock();
+  if(conn && requestCB_) requestCB_(conn, s->id, s->req);
+}
+
+bool HTTP2Session::onSettings(uint8_t flags, uint32_t id, const char* p, size_t len)
+{
+  if(id != 0) return connError(ProtocolError);
+  if(flags & Ack)
+  {
+    if(len != 0) return connError(FrameSizeError);
+    return true;
+  }
+  if(len % 6) return connError(FrameSizeError);
+  for(size_t i = 0; i < len; i += 6)
+  {
+    uint16_t sid = static_cast<uint16_t>((static_cast<uint8_t>(p[i]) << 8)
+      | static_cast<uint8_t>(p[i+1]));
+    if(!applySetting(sid, readU32(p + i + 2))) return false;
+  }
+  writeFrame(Settings, Ack, 0, NULL, 0);
+  // a larger initial window may unblock streams
+  pumpAll();
+  return true;
+}
+
+bool HTTP2Session::applySetting(uint16_t id, uint32_t val)
+{
+  switch (id)
+  {
+  case HeaderTableSize:
+    // the peer's decoder allows up to val, we stay within the default
+    encoder_.setMaxTableSize(std::min<size_t>(val, hpack::kDefaultTableSize));
+    return true;
+  case EnablePush:
+    if(val > 1) return connError(ProtocolError);
+    return true;
+  case InitialWindowSize:
+  {
+    if(val > kMaxWindow) return connError(FlowControlError);
+    // section 6.9.2: the difference applies to every open stream
+    int64_t delta = static_cast<int64_t>(val) - peerInitialWindow_;
+    for(auto& kv : streams_)
+    {
+      kv.second->sendWindow += delta;
+      if(kv.second->sendWindow > kMaxWindow) return connError(FlowControlError);
+    }
+    peerInitialWindow_ = val;
+    return true;
+  }
+  case MaxFrameSize:
+    if(val < kDefaultMaxFrameSz || val > 0xffffff) return connError(ProtocolError);
+    peerMaxFrameSz_ = val;
+    return true;
+  default:
+    // MAX_CONCURRENT_STREAMS only limits pushes, which we never make
+    return true;
+  }
+}
+
+bool HTTP2Session::onWindowUpdate(uint32_t id, const char* p, size_t len)
+{
+  if(len != 4) return connError(FrameSizeError);
+  uint32_t inc = readU32(p) & 0x7fffffff;
+  if(id == 0)
+  {
+    if(inc == 0) return connError(ProtocolError);
+    connSendWindow_ += inc;
+    if(connSendWindow_ > kMaxWindow) return connError(FlowControlError);
+  }
+  else
+  {
+    auto it = streams_.find(id);
+    if(it == streams_.end())
+    {
+      if(id > lastStreamID_) return connError(ProtocolError);
+      return true;
+    }
+    Stream* s = it->second.get();
+    if(inc == 0 || s->sendWindow + inc > kMaxWindow)
+    {
+      resetStream(id, inc == 0 ? ProtocolError : FlowControlError);
+      closeStream(id);
+      return true;
+    }
+    s->sendWindow += inc;
+  }
+  pumpAll();
+  return true;
+}
+
+void HTTP2Session::respond(uint32_t streamID, HTTPResponse* resp)
+{
+  loop_->assertInLoopThread();
+  auto it = streams_.find(streamID);
+  if(dead_ || it == streams_.end() || it->second->responded) return;
+  Stream* s = it->second.get();
+  s->responded = true;
+
+  int status = resp->status() == HTTPResponse::Unknown
+    ? HTTPResponse::InternalServerError500 : resp->status();
+  bool hasBody = status >= 200 && status != HTTPResponse::NoContent204
+    && status != HTTPResponse::NotModified304;
+  scratch_.clear();
+  encoder_.beginBlock(&scratch_);
+  char num[24];
+  snprintf(num, sizeof num, "%d", status);
+  encoder_.encode(":status", num, &scratch_);
+  // 'Date: ...\r\n', the value is the middle part
+  StringPiece date = HTTPResponse::dateHeader(rcvTime_);
+  encoder_.encode("date", StringPiece(date.data() + 6, date.size() - 8), &scratch_);
+  if(hasBody)
+  {
+    snprintf(num, sizeof num, "%zu", resp->bodySize());
+    encoder_.encode("content-length", num, &scratch_);
+  }
+  std::string name;
+  for(size_t i = 0; i < resp->numHeaders(); ++i)
+  {
+    StringPiece key = resp->headerKey(i);
+    name.assign(key.data(), key.size());
+    for(auto& c : name) c = static_cast<char>(::tolower(c));
+    if(connectionSpecific(name) || name == "content-length" || name == "date") continue;
+    encoder_.encode(name, resp->headerVal(i), &scratch_);
+  }
+
+  s->len = hasBody && !resp->headOnly() ? resp->bodySize() : 0;
+  writeHeaders(streamID, scratch_, s->len == 0);
+  if(s->len == 0)
+  {
+    closeStream(streamID);
+    return;
+  }
+  if(resp->hasFile())
+  {
+    s->fd = resp->fileFd();
+    s->fileOff = resp->fileOff();
+    s->owner = resp->owner();
+  }
+  else if(resp->bodyRef().data())
+  {
+    s->ref = resp->bodyRef();
+    s->owner = resp->owner();
+  }
+  else
+  {
+    s->body.swap(*resp->mutableBody());
+    s->ref = s->body;
+  }
+  sending_.push_back(streamID);
+  pumpAll();
+  if(!inRead_) scheduleFlush();
+}
+
+void HTTP2Session::reset(uint32_t streamID, ErrorCode code)
+{
+  loop_->assertInLoopThread();
+  if(dead_ || !streams_.count(streamID)) return;
+  resetStream(streamID, code);
+  // the peer knows the stream is gone, no RST_STREAM(NO_ERROR) follows
+  streams_[streamID]->remoteClosed = true;
+  closeStream(streamID);
+  if(!inRead_) scheduleFlush();
+}
+
+// one DATA frame of s, as large as the windows and the peer's frame
+// size allow. false if nothing could be sent
+bool HTTP2Session::sendData(Stream* s)
+{
+  TcpConnPtr conn = conn_.lock();
+  if(!conn) return false;
+  Buffer* out = conn->outputBuf();
+  if(out->readableBytes() >= kOutputHighWater) return false;
+  int64_t window = std::min(connSendWindow_, s->sendWindow);
+  size_t n = std::min<size_t>(s->len - s->off, peerMaxFrameSz_);
+  if(window <= 0) return false;
+  n = std::min<size_t>(n, static_cast<size_t>(window));
+  bool last = s->off + n == s->len;
+  out->ensure(kFrameHeaderLen + n);
+  char* h = out->writePtr();
+  h[0] = static_cast<char>(n >> 16);
+  h[1] = static_cast<char>(n >> 8);
+  h[2] = static_cast<char>(n);
+  h[3] = Data;
+  h[4] = last ? EndStream : 0;
+  putU32(h + 5, s->id);
+  if(s->fd >= 0)
+  {
+    ssize_t r = ::pread(s->fd, h + kFrameHeaderLen, n, s->fileOff + s->off);
+    if(r != static_cast<ssize_t>(n))
+    {
+      LOG_SYSERR << "HTTP2Session::sendData pread";
+      resetStream(s->id, InternalError);
+      s->off = s->len = 0;
+      return false;
+    }
+  }
+  else memcpy(h + kFrameHeaderLen, s->ref.data() + s->off, n);
+  out->written(kFrameHeaderLen + n);
+  s->off += n;
+  connSendWindow_ -= n;
+  s->sendWindow -= n;
+  return true;
+}
+
+// round robin over the streams with data, a frame each per round,
+// until the windows or the output limit stop it
+void HTTP2Session::pumpAll()
+{
+  bool progress = true;
+  while(progress && !sending_.empty())
+  {
+    progress = false;
+    for(size_t i = 0; i < sending_.size(); )
+    {
+      auto it = streams_.find(sending_[i]);
+      Stream* s = it == streams_.end() ? NULL : it->second.get();
+      if(s && sendData(s)) progress = true;
+      if(!s || s->off == s->len)
+      {
+        if(s) closeStream(s->id);
+        sending_.erase(sending_.begin() + i);
+        continue;
+      }
+      ++i;
+    }
+  }
+}
+
+// our side is done with the stream. if the peer is still sending
+// (e.g. a body that was refused) it is told to stop
+void HTTP2Session::closeStream(uint32_t id)
+{
+  auto it = streams_.find(id);
+  if(it == streams_.end()) return;
+  if(it->second->responded && !it->second->remoteClosed
+    && it->second->off == it->second->len)
+    resetStream(id, NoError);
+  streams_.erase(it);
+  if(goawayRcvd_ && streams_.empty() && !dead_)
+  {
+    dead_ = true;
+    TcpConnPtr conn = conn_.lock();
+    if(conn)
+    {
+      conn->flushOutputBuf();
+      conn->shutdown();
+    }
+  }
+}
+
+void HTTP2Session::writeFrame(uint8_t type, uint8_t flags, uint32_t id,
+  const char* p, size_t len)
+{
+  TcpConnPtr conn = conn_.lock();
+  if(!conn) return;
+  Buffer* out = conn->outputBuf();
+  out->ensure(kFrameHeaderLen + len);
+  char* h = out->writePtr();
+  h[0] = static_cast<char>(len >> 16);
+  h[1] = static_cast<char>(len >> 8);
+  h[2] = static_cast<char>(len);
+  h[3] = static_cast<char>(type);
+  h[4] = static_cast<char>(flags);
+  putU32(h + 5, id);
+  out->written(kFrameHeaderLen);
+  if(len) out->append(p, len);
+  if(!inRead_) scheduleFlush();
+}
+
+// a block larger than the peer's frame size continues in
+// CONTINUATION frames, which nothing may interrupt
+void HTTP2Session::writeHeaders(uint32_t id, const std::string& block, bool endStream)
+{
+  size_t n = std::min<size_t>(block.size(), peerMaxFrameSz_);
+  uint8_t flags = endStream ? EndStream : 0;
+  if(n == block.size()) flags |= EndHeaders;
+  writeFrame(Headers, flags, id, block.data(), n);
+  for(size_t off = n; off < block.size(); off += n)
+  {
+    n = std::min<size_t>(block.size() - off, peerMaxFrameSz_);
+    writeFrame(Continuation, off + n == block.size() ? EndHeaders : 0, id,
+      block.data() + off, n);
+  }
+}
+
+void HTTP2Session::writeWindowUpdate(uint32_t id, uint32_t inc)
+{
+  char p[4];
+  putU32(p, inc);
+  writeFrame(WindowUpdate, 0, id, p, 4);
+}
+
+// the server preface: our SETTINGS, then the connection window is
+// opened beyond the 64 KB default
+void HTTP2Session::writeSettings()
+{
+  char p[18];
+  const uint16_t ids[] = { MaxConcurrentStreams, InitialWindowSize, MaxHeaderListSize };
+  const uint32_t vals[] = { kMaxConcurrentStreams, kInitialWindow,
+    static_cast<uint32_t>(kMaxHeaderListSz) };
+  for(int i = 0; i < 3; ++i)
+  {
+    p[6*i] = static_cast<char>(ids[i] >> 8);
+    p[6*i+1] = static_cast<char>(ids[i]);
+    putU32(p + 6*i + 2, vals[i]);
+  }
+  writeFrame(Settings, 0, 0, p, sizeof p);
+  writeWindowUpdate(0, kConnWindow - kDefaultWindow);
+  connRecvWindow_ = kConnWindow;
+}
+
+void HTTP2Session::resetStream(uint32_t id, ErrorCode code)
+{
+  char p[4];
+  putU32(p, code);
+  writeFrame(RstStream, 0, id, p, 4);
+}
+
+// sends GOAWAY and closes the connection, returns false so frame
+// handlers can return it
+bool HTTP2Session::connError(ErrorCode code)
+{
+  if(dead_) return false;
+  LOG_WARN << "HTTP2Session::connError " << static_cast<int>(code);
+  char p[8];
+  putU32(p, lastStreamID_);
+  putU32(p + 4, code);
+  writeFrame(GoAway, 0, 0, p, 8);
+  dead_ = true;
+  streams_.clear();
+  sending_.clear();
+  TcpConnPtr conn = conn_.lock();
+  if(conn)
+  {
+    conn->flushOutputBuf();
+    conn->shutdown();
+  }
+  return false;
+}
+
+// responses completed outside a read (e.g. by an HTTPResponder) in
+// the same loop iteration share one write
+void HTTP2Session::scheduleFlush()
+{
+  if(flushQueued_) return;
+  flushQueued_ = true;
+  std::weak_ptr<HTTP2Session> weak(shared_from_this());
+  loop_->queueInLoop([weak](){
+    HTTP2SessionPtr s = weak.lock();
+    if(s) s->flush();
+  });
+}
+
+void HTTP2Session::flush()
+{
+  flushQueued_ = false;
+  TcpConnPtr conn = conn_.lock();
+  if(conn) conn->flushOutputBuf();
+}
+} // namespace net
+} // namespace chtho
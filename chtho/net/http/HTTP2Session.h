@@ -0,0 +1,144 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_NET_HTTP_HTTP2SESSION_H
+#define CHTHO_NET_HTTP_HTTP2SESSION_H
+
+#include "base/noncopyable.h"
+#include "net/Callbacks.h"
+#include "time/Timestamp.h"
+#include "HPACK.h"
+#include "HTTPRequest.h"
+#include "HTTPResponse.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <stdint.h>
+
+namespace chtho
+{
+namespace net
+{
+class Buffer;
+class EventLoop;
+
+// the server side of an HTTP/2 connection over cleartext (RFC 7540),
+// the second protocol engine behind HTTPServer. it is entered either
+// with the connection preface (prior knowledge) or through an
+// 'Upgrade: h2c' request, which becomes stream 1.
+// requests of many streams are multiplexed on the one connection:
+// every stream collects its headers (HPACK) and body into an
+// HTTPRequest that is handed to the request callback, the response is
+// given back with respond(), at once or later from the loop thread.
+// DATA frames obey the peer's connection and stream windows, streams
+// waiting for window are served round robin frame by frame when it
+// opens. frames are only appended to the output buffer, whatever one
+// read or one loop iteration produced leaves in a single write.
+// loop thread only
+class HTTP2Session : noncopyable,
+  public std::enable_shared_from_this<HTTP2Session>
+{
+public:
+  // the request stays valid until respond() for that stream
+  using RequestCB = std::function<void(const TcpConnPtr&, uint32_t streamID, HTTPRequest&)>;
+  enum ErrorCode { NoError = 0x0, ProtocolError = 0x1, InternalError = 0x2,
+    FlowControlError = 0x3, StreamClosed = 0x5, FrameSizeError = 0x6,
+    RefusedStream = 0x7, Cancel = 0x8, CompressionError = 0x9,
+    HTTP11Required = 0xd };
+  static const char kPreface[]; // 'PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n'
+  static const size_t kPrefaceLen = 24;
+  static const uint32_t kMaxConcurrentStreams = 128;
+  static const uint32_t kInitialWindow = 1024*1024; // what we grant per stream
+  static const uint32_t kConnWindow = 16*1024*1024; // and per connection
+private:
+  struct Stream;
+  using StreamPtr = std::unique_ptr<Stream>;
+
+  std::weak_ptr<TcpConnection> conn_;
+  EventLoop* loop_;
+  RequestCB requestCB_;
+  HPACKDecoder decoder_;
+  HPACKEncoder encoder_;
+  std::unordered_map<uint32_t, StreamPtr> streams_;
+  // streams with response data waiting for window, in arrival order
+  std::vector<uint32_t> sending_;
+  uint32_t lastStreamID_; // highest stream opened by the peer
+  bool prefaceRcvd_;
+  bool dead_; // after a connection error or GOAWAY
+  bool goawayRcvd_;
+  bool inRead_;
+  bool flushQueued_;
+  size_t maxBodySz_;
+  Timestamp rcvTime_; // of the input being handled
+  // the peer's settings
+  uint32_t peerInitialWindow_;
+  uint32_t peerMaxFrameSz_;
+  int64_t connSendWindow_;
+  // our side of flow control
+  int64_t connRecvWindow_;
+  uint32_t connConsumed_; // since the last WINDOW_UPDATE
+  // a header block spread over HEADERS and CONTINUATION frames
+  uint32_t headerStream_; // 0 unless CONTINUATION is expected
+  bool headerEndStream_;
+  std::string headerBlock_;
+  std::string scratch_; // encoded header blocks
+  HTTPResponse response_; // reused for synchronous responses
+
+  bool handleFrame(uint8_t type, uint8_t flags, uint32_t id, const char* p, size_t len);
+  bool onData(uint8_t flags, uint32_t id, const char* p, size_t len);
+  bool onHeaders(uint8_t flags, uint32_t id, const char* p, size_t len);
+  bool onContinuation(uint8_t flags, uint32_t id, const char* p, size_t len);
+  bool onSettings(uint8_t flags, uint32_t id, const char* p, size_t len);
+  bool onWindowUpdate(uint32_t id, const char* p, size_t len);
+  bool endHeaders();
+  void dispatch(Stream* s);
+  bool applySetting(uint16_t id, uint32_t val);
+  void writeFrame(uint8_t type, uint8_t flags, uint32_t id, const char* p, size_t len);
+  void writeHeaders(uint32_t id, const std::string& block, bool endStream);
+  void writeWindowUpdate(uint32_t id, uint32_t inc);
+  void writeSettings();
+  void resetStream(uint32_t id, ErrorCode code);
+  bool sendData(Stream* s);
+  void pumpAll();
+  void closeStream(uint32_t id);
+  bool connError(ErrorCode code);
+  void scheduleFlush();
+  void flush();
+public:
+  HTTP2Session(const TcpConnPtr& conn, const RequestCB& cb);
+  ~HTTP2Session();
+  // bodies above this are answered with 413, 8 MB by default
+  void setMaxBodySz(size_t sz) { maxBodySz_ = sz; }
+
+  // prior knowledge: sends our SETTINGS, the preface comes with input
+  void start();
+  // after '101 Switching Protocols' for req, whose HTTP2-Settings
+  // header has been decoded into settings. req becomes stream 1
+  bool startUpgrade(const HTTPRequest& req, const std::string& settings);
+  void handleMsg(Buffer* buf, Timestamp rcvTime);
+  // answers the stream, the body is taken from resp (which is left
+  // empty). a stream reset by the peer in the meantime is ignored
+  void respond(uint32_t streamID, HTTPResponse* resp);
+  // for synchronous handlers, reset for every request
+  HTTPResponse* response() { return &response_; }
+  // gives up on a stream with RST_STREAM, e.g. HTTP11Required
+  void reset(uint32_t streamID, ErrorCode code);
+  size_t numStreams() const { return streams_.size(); }
+
+  // whether data, which may be incomplete, starts like the preface
+  static bool maybePreface(const char* data, size_t len);
+  // the base64url payload of an HTTP2-Settings header
+  static bool decodeSettingsHeader(const StringPiece& val, std::string* out);
+};
+using HTTP2SessionPtr = std::shared_ptr<HTTP2Session>;
+} // namespace net
+} // namespace chtho
+
+
+#endif // !CHTHO_NET_HTTP_HTTP2SESSION_H
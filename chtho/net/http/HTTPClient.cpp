@@ -0,0 +1,449 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "HTTPClient.h"
+#include "HTTPClientContext.h"
+
+#include "logging/Logger.h"
+#include "net/Buffer.h"
+#include "net/EventLoop.h"
+#include "net/TcpClient.h"
+#include "net/TcpConnection.h"
+
+#include <algorithm>
+
+#include <stdio.h> // snprintf
+
+namespace chtho
+{
+namespace net
+{
+// a request from request() until its callback has run
+struct HTTPClient::Call
+{
+  HTTPClientRequest req;
+  ResponseCB cb;
+  Host* host;
+  Conn* conn; // the connection it was sent on, NULL while waiting
+  TimerID timer;
+  int retries;
+  bool done;
+};
+
+// one pooled connection, owning the TcpClient that makes it
+struct HTTPClient::Conn
+{
+  Host* host;
+  std::unique_ptr<TcpClient> client;
+  TcpConnPtr conn; // set once connected
+  HTTPClientContext context;
+  std::deque<CallPtr> inflight; // sent, in order
+  size_t nonIdempotent; // of inflight
+  bool persistent; // answered with keep-alive, may be pipelined on
+  bool closing; // the server is closing it, nothing new goes out
+  bool removed; // out of the pool, waiting to be destroyed
+  TimerID timer; // connect timeout, then idle timeout
+};
+
+struct HTTPClient::Host
+{
+  InetAddr addr;
+  std::string hostHeader;
+  std::vector<ConnPtr> conns;
+  std::deque<CallPtr> waiting; // not sent yet, in order
+};
+
+namespace
+{
+const HTTPClientResponse kEmpty;
+
+const char* methodName(HTTPRequest::Method m)
+{
+  switch(m)
+  {
+  case HTTPRequest::Get: return "GET";
+  case HTTPRequest::Post: return "POST";
+  case HTTPRequest::Head: return "HEAD";
+  case HTTPRequest::Put: return "PUT";
+  case HTTPRequest::Delete: return "DELETE";
+  default: return "GET";
+  }
+}
+} // namespace
+
+HTTPClient::HTTPClient(EventLoop* loop, const std::string& name)
+  : loop_(loop),
+    name_(name),
+    maxConnsPerHost_(8),
+    maxPipeline_(4),
+    timeout_(10),
+    connectTimeout_(3),
+    idleTimeout_(30),
+    nxtConnID_(1)
+{
+}
+
+HTTPClient::~HTTPClient()
+{
+  loop_->assertInLoopThread();
+  for(auto& h : hosts_)
+  {
+    for(const CallPtr& call : h.second->waiting) loop_->cancel(call->timer);
+    for(const ConnPtr& c : h.second->conns)
+    {
+      // its callbacks find the Conn gone from here on
+      c->removed = true;
+      loop_->cancel(c->timer);
+      for(const CallPtr& call : c->inflight) loop_->cancel(call->timer);
+      if(c->conn) c->conn->forceClose();
+    }
+  }
+}
+
+void HTTPClient::request(const InetAddr& addr, const HTTPClientRequest& req,
+  const ResponseCB& cb)
+{
+  loop_->runInLoop([this, addr, req, cb](){this->requestInLoop(addr, req, cb);});
+}
+
+size_t HTTPClient::numConns() const
+{
+  loop_->assertInLoopThread();
+  size_t n = 0;
+  for(const auto& h : hosts_) n += h.second->conns.size();
+  return n;
+}
+
+void HTTPClient::requestInLoop(const InetAddr& addr, const HTTPClientRequest& req,
+  const ResponseCB& cb)
+{
+  loop_->assertInLoopThread();
+  std::unique_ptr<Host>& host = hosts_[addr.ipPort()];
+  if(!host)
+  {
+    host.reset(new Host);
+    host->addr = addr;
+    host->hostHeader = addr.ipPort();
+  }
+  CallPtr call(new Call);
+  call->req = req;
+  call->cb = cb;
+  call->host = host.get();
+  call->conn = NULL;
+  call->retries = 0;
+  call->done = false;
+  std::weak_ptr<Call> weak(call);
+  call->timer = loop_->runAfter(req.timeout > 0 ? req.timeout : timeout_,
+    [this, weak](){
+      CallPtr c = weak.lock();
+      if(c) this->onTimeout(c);
+    });
+  host->waiting.push_back(call);
+  dispatch(host.get());
+}
+
+// hands waiting requests to idle connections, opens new ones while
+// the pool has room and pipelines once it is full
+void HTTPClient::dispatch(Host* host)
+{
+  while(!host->waiting.empty())
+  {
+    CallPtr call = host->waiting.front();
+    Conn* conn = findIdle(host);
+    if(!conn && host->conns.size() >= maxConnsPerHost_)
+      conn = findPipeline(host, *call);
+    if(!conn)
+    {
+      size_t connecting = 0;
+      for(const ConnPtr& c : host->conns) if(!c->conn) ++connecting;
+      if(host->conns.size() < maxConnsPerHost_ && connecting < host->waiting.size())
+      {
+        newConn(host);
+        continue;
+      }
+      break;
+    }
+    host->waiting.pop_front();
+    send(conn, call);
+  }
+}
+
+HTTPClient::Conn* HTTPClient::findIdle(Host* host)
+{
+  for(const ConnPtr& c : host->conns)
+  {
+    if(c->conn && c->inflight.empty() && !c->closing) return c.get();
+  }
+  return NULL;
+}
+
+// the least loaded persistent connection with room in its pipeline.
+// a request never waits behind a non-idempotent one (which cannot be
+// retried should the connection break) nor the other way round
+HTTPClient::Conn* HTTPClient::findPipeline(Host* host, const Call& call)
+{
+  if(maxPipeline_ <= 1 || !call.req.idempotent()) return NULL;
+  Conn* best = NULL;
+  for(const ConnPtr& c : host->conns)
+  {
+    if(!c->conn || !c->persistent || c->closing || c->nonIdempotent > 0
+      || c->inflight.size() >= maxPipeline_)
+      continue;
+    if(!best || c->inflight.size() < best->inflight.size()) best = c.get();
+  }
+  return best;
+}
+
+void HTTPClient::newConn(Host* host)
+{
+  ConnPtr c(new Conn);
+  c->host = host;
+  c->nonIdempotent = 0;
+  c->persistent = false;
+  c->closing = false;
+  c->removed = false;
+  char buf[64];
+  snprintf(buf, sizeof(buf), "-%s#%d", host->hostHeader.c_str(), nxtConnID_);
+  ++nxtConnID_;
+  c->client.reset(new TcpClient(loop_, host->addr, name_ + buf));
+  // the connection may outlive the pool entry, hence the weak pointers
+  std::weak_ptr<Conn> weak(c);
+  c->client->setConnCB([this, weak](const TcpConnPtr& tcpConn){
+    ConnPtr p = weak.lock();
+    if(p) this->onConn(p, tcpConn);
+  });
+  c->client->setCloseCB([this, weak](const TcpConnPtr& tcpConn){
+    ConnPtr p = weak.lock();
+    if(p) this->onConn(p, tcpConn);
+  });
+  c->client->setMsgCB([this, weak](const TcpConnPtr& tcpConn, Buffer* buf, Timestamp){
+    ConnPtr p = weak.lock();
+    if(p) this->onMsg(p, buf);
+    else buf->retrieveAll();
+  });
+  c->timer = loop_->runAfter(connectTimeout_, [this, weak](){
+    ConnPtr p = weak.lock();
+    if(p) this->onConnectTimeout(p);
+  });
+  host->conns.push_back(c);
+  c->client->connect();
+}
+
+// writes the request straight into the connection's output buffer
+void HTTPClient::send(Conn* conn, const CallPtr& call)
+{
+  const HTTPClientRequest& req = call->req;
+  loop_->cancel(conn->timer); // no longer idle
+  call->conn = conn;
+  conn->inflight.push_back(call);
+  if(!req.idempotent()) ++conn->nonIdempotent;
+
+  Buffer* out = conn->conn->outputBuf();
+  out->append(methodName(req.method));
+  out->append(" ", 1);
+  out->append(req.target.empty() ? StringPiece("/") : StringPiece(req.target));
+  out->append(" HTTP/1.1\r\nHost: ");
+  out->append(req.host.empty() ? call->host->hostHeader : req.host);
+  out->append("\r\n");
+  for(const auto& h : req.headers)
+  {
+    out->append(h.first);
+    out->append(": ", 2);
+    out->append(h.second);
+    out->append("\r\n", 2);
+  }
+  if(!req.body.empty() || req.method == HTTPRequest::Post
+    || req.method == HTTPRequest::Put)
+  {
+    char buf[48];
+    int n = snprintf(buf, sizeof(buf), "Content-Length: %zu\r\n", req.body.size());
+    out->append(buf, n);
+  }
+  out->append("\r\n", 2);
+  out->append(req.body);
+  conn->conn->flushOutputBuf();
+}
+
+void HTTPClient::onConn(const ConnPtr& conn, const TcpConnPtr& tcpConn)
+{
+  loop_->assertInLoopThread();
+  if(tcpConn->connected())
+  {
+    if(conn->removed)
+    {
+      // gave up on it while the connection was being made
+      tcpConn->forceClose();
+      return;
+    }
+    loop_->cancel(conn->timer);
+    conn->conn = tcpConn;
+    dispatch(conn->host);
+    return;
+  }
+  // the connection went down
+  if(conn->removed) return;
+  Host* host = conn->host;
+  // a body delimited by the close is complete now
+  if(!conn->inflight.empty() && conn->context.finishOnClose(tcpConn->inputBuf()))
+  {
+    CallPtr call = conn->inflight.front();
+    conn->inflight.pop_front();
+    if(!call->req.idempotent()) --conn->nonIdempotent;
+    finish(call, Ok, conn->context.response());
+    conn->context.retire(tcpConn->inputBuf());
+  }
+  closeConn(conn.get(), ConnectionClosed);
+  dispatch(host);
+}
+
+void HTTPClient::onMsg(const ConnPtr& conn, Buffer* buf)
+{
+  loop_->assertInLoopThread();
+  if(conn->removed)
+  {
+    buf->retrieveAll();
+    return;
+  }
+  Host* host = conn->host;
+  while(buf->readableBytes() > 0)
+  {
+    if(conn->inflight.empty())
+    {
+      LOG_ERR << "HTTPClient " << name_ << " - unexpected data from "
+        << host->hostHeader;
+      closeConn(conn.get(), BadResponse);
+      break;
+    }
+    CallPtr call = conn->inflight.front();
+    if(!conn->context.parse(buf, call->req.method == HTTPRequest::Head))
+    {
+      closeConn(conn.get(), BadResponse);
+      break;
+    }
+    if(!conn->context.done()) break;
+    conn->inflight.pop_front();
+    if(!call->req.idempotent()) --conn->nonIdempotent;
+    // requests issued from the callback must not go out on a
+    // connection the server is closing
+    if(!conn->context.response().keepAlive()) conn->closing = true;
+    finish(call, Ok, conn->context.response());
+    conn->context.retire(buf);
+    if(conn->closing)
+    {
+      closeConn(conn.get(), ConnectionClosed);
+      break;
+    }
+    conn->persistent = true;
+  }
+  if(!conn->removed && conn->inflight.empty())
+  {
+    std::weak_ptr<Conn> weak(conn);
+    conn->timer = loop_->runAfter(idleTimeout_, [this, weak](){
+      ConnPtr p = weak.lock();
+      if(p) this->onIdleTimeout(p);
+    });
+  }
+  dispatch(host);
+}
+
+void HTTPClient::onTimeout(const CallPtr& call)
+{
+  if(call->done) return;
+  Host* host = call->host;
+  Conn* conn = call->conn;
+  if(!conn)
+  {
+    auto it = std::find(host->waiting.begin(), host->waiting.end(), call);
+    if(it != host->waiting.end()) host->waiting.erase(it);
+  }
+  finish(call, Timeout, kEmpty);
+  // the responses behind it could not be told apart anymore
+  if(conn)
+  {
+    closeConn(conn, ConnectionClosed);
+    dispatch(host);
+  }
+}
+
+void HTTPClient::onConnectTimeout(const ConnPtr& conn)
+{
+  if(conn->conn || conn->removed) return;
+  Host* host = conn->host;
+  LOG_WARN << "HTTPClient " << name_ << " - connecting to "
+    << host->addr.ipPort() << " timed out";
+  closeConn(conn.get(), ConnectFailed);
+  bool up = false;
+  for(const ConnPtr& c : host->conns) if(c->conn) up = true;
+  // nothing else will get through to this server soon
+  if(!up)
+  {
+    std::deque<CallPtr> waiting;
+    waiting.swap(host->waiting);
+    for(const CallPtr& call : waiting) finish(call, ConnectFailed, kEmpty);
+  }
+  dispatch(host);
+}
+
+void HTTPClient::onIdleTimeout(const ConnPtr& conn)
+{
+  if(conn->removed || !conn->inflight.empty()) return;
+  closeConn(conn.get(), ConnectionClosed);
+}
+
+void HTTPClient::finish(const CallPtr& call, Error err, const HTTPClientResponse& resp)
+{
+  if(call->done) return;
+  call->done = true;
+  loop_->cancel(call->timer);
+  call->cb(err, resp);
+}
+
+// takes conn out of the pool and closes it. the request it failed on
+// gets err, the ones behind it are sent again elsewhere if they may
+// be, so are idempotent requests lost with a connection that had been
+// reused: the server may have closed it just as they went out
+void HTTPClient::closeConn(Conn* conn, Error err)
+{
+  if(conn->removed) return;
+  conn->removed = true;
+  Host* host = conn->host;
+  std::deque<CallPtr> calls;
+  calls.swap(conn->inflight);
+  conn->nonIdempotent = 0;
+  std::deque<CallPtr> retry;
+  bool first = true;
+  for(const CallPtr& call : calls)
+  {
+    if(call->done) continue;
+    bool again = call->req.idempotent() && call->retries == 0
+      && (!first || (err == ConnectionClosed && conn->persistent));
+    if(again)
+    {
+      ++call->retries;
+      call->conn = NULL;
+      retry.push_back(call);
+    }
+    else finish(call, first ? err : ConnectionClosed, kEmpty);
+    first = false;
+  }
+  host->waiting.insert(host->waiting.begin(), retry.begin(), retry.end());
+  removeConn(conn);
+}
+
+void HTTPClient::removeConn(Conn* conn)
+{
+  loop_->cancel(conn->timer);
+  if(conn->conn) conn->conn->forceClose();
+  Host* host = conn->host;
+  auto it = std::find_if(host->conns.begin(), host->conns.end(),
+    [conn](const ConnPtr& c){ return c.get() == conn; });
+  assert(it != host->conns.end());
+  // we may be inside one of its callbacks, the TcpClient goes later
+  ConnPtr keep(*it);
+  host->conns.erase(it);
+  loop_->queueInLoop([keep](){});
+}
+} // namespace net
+} // namespace chtho
@@ -0,0 +1,134 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_NET_HTTP_HTTPCLIENT_H
+#define CHTHO_NET_HTTP_HTTPCLIENT_H
+
+#include "base/noncopyable.h"
+#include "net/Callbacks.h"
+#include "net/InetAddr.h"
+#include "net/TimerID.h"
+#include "HTTPClientResponse.h"
+#include "HTTPRequest.h"
+
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace chtho
+{
+namespace net
+{
+class EventLoop;
+
+// what HTTPClient sends. Host defaults to the server's ip:port,
+// Content-Length is added for a body (and for POST/PUT without one)
+struct HTTPClientRequest
+{
+  HTTPRequest::Method method;
+  std::string target; // path and query, e.g. '/users?id=1'
+  std::string host;
+  std::vector<std::pair<std::string, std::string>> headers;
+  std::string body;
+  double timeout; // seconds, 0 means the client's default
+
+  explicit HTTPClientRequest(HTTPRequest::Method m = HTTPRequest::Get,
+    const std::string& t = "/")
+    : method(m), target(t), timeout(0)
+  {}
+  void addHeader(const std::string& key, const std::string& val)
+  { headers.push_back(std::make_pair(key, val)); }
+  // GET, HEAD, PUT and DELETE may be pipelined and retried
+  bool idempotent() const { return method != HTTPRequest::Post; }
+};
+
+// an asynchronous HTTP/1.1 client bound to one EventLoop. it keeps a
+// pool of keep-alive connections per server (each one a TcpClient),
+// requests wait for an idle connection or open a new one up to
+// maxConnsPerHost. once every connection of a server is busy,
+// idempotent requests are pipelined on connections that have shown to
+// be persistent, at most maxPipeline deep. responses are parsed in
+// place (see HTTPClientContext) and handed to the callback in the loop
+// thread. every request has a deadline on the loop's timer queue, a
+// connection whose request timed out is closed since the responses
+// behind it could no longer be matched. idempotent requests lost with
+// a reused connection (the server closed it while idle) are retried
+// once on another one.
+// request() is thread safe. for a multi-loop server create one
+// HTTPClient per loop, e.g. in the thread init callback, so requests
+// and their responses never leave the loop that issued them.
+// the client must be destroyed in its loop thread, outstanding
+// requests are dropped without their callbacks then
+class HTTPClient : noncopyable
+{
+public:
+  enum Error { Ok, Timeout, ConnectFailed, ConnectionClosed, BadResponse };
+  // resp is only valid during the call and empty unless err is Ok
+  using ResponseCB = std::function<void(Error err, const HTTPClientResponse& resp)>;
+private:
+  struct Call;
+  struct Conn;
+  struct Host;
+  using CallPtr = std::shared_ptr<Call>;
+  using ConnPtr = std::shared_ptr<Conn>;
+
+  EventLoop* loop_;
+  const std::string name_;
+  size_t maxConnsPerHost_;
+  size_t maxPipeline_;
+  double timeout_;
+  double connectTimeout_;
+  double idleTimeout_;
+  std::unordered_map<std::string, std::unique_ptr<Host>> hosts_;
+  int nxtConnID_;
+
+  void requestInLoop(const InetAddr& addr, const HTTPClientRequest& req,
+    const ResponseCB& cb);
+  void dispatch(Host* host);
+  Conn* findIdle(Host* host);
+  Conn* findPipeline(Host* host, const Call& call);
+  void newConn(Host* host);
+  void send(Conn* conn, const CallPtr& call);
+  void onConn(const ConnPtr& conn, const TcpConnPtr& tcpConn);
+  void onMsg(const ConnPtr& conn, Buffer* buf);
+  void onTimeout(const CallPtr& call);
+  void onConnectTimeout(const ConnPtr& conn);
+  void onIdleTimeout(const ConnPtr& conn);
+  void finish(const CallPtr& call, Error err, const HTTPClientResponse& resp);
+  void closeConn(Conn* conn, Error err);
+  void removeConn(Conn* conn);
+public:
+  HTTPClient(EventLoop* loop, const std::string& name);
+  ~HTTPClient();
+  // connections opened to one server, 8 by default
+  void setMaxConnsPerHost(size_t n) { maxConnsPerHost_ = n; }
+  // requests in flight on one connection, 4 by default, 1 disables
+  // pipelining
+  void setMaxPipeline(size_t n) { maxPipeline_ = n; }
+  // seconds until a request fails with Timeout, 10 by default
+  void setTimeout(double sec) { timeout_ = sec; }
+  // seconds a connection may take to establish, 3 by default
+  void setConnectTimeout(double sec) { connectTimeout_ = sec; }
+  // idle connections are closed after that many seconds, 30 by default
+  void setIdleTimeout(double sec) { idleTimeout_ = sec; }
+
+  void request(const InetAddr& addr, const HTTPClientRequest& req,
+    const ResponseCB& cb);
+  void get(const InetAddr& addr, const std::string& target, const ResponseCB& cb)
+  { request(addr, HTTPClientRequest(HTTPRequest::Get, target), cb); }
+
+  EventLoop* loop() const { return loop_; }
+  // open connections, loop thread only
+  size_t numConns() const;
+};
+} // namespace net
+} // namespace chtho
+
+
+#endif // !CHTHO_NET_HTTP_HTTPCLIENT_H
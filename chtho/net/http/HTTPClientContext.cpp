@@ -0,0 +1,261 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "HTTPClientContext.h"
+#include "net/Buffer.h"
+#include "net/Simd.h"
+
+namespace chtho
+{
+namespace net
+{
+/* response structure
+HTTP/1.1 200 OK
+Content-Length: 11
+
+hello world
+*/
+bool HTTPClientContext::parse(Buffer* buf, bool headRequest)
+{
+  if(bad_) return false;
+  // the Buffer moves its readable bytes as a block when it grows or
+  // compacts, shift the slices taken during earlier calls accordingly
+  if(base_ && base_ != buf->peek())
+    response_.rebase(base_, pos_, buf->peek());
+  base_ = buf->peek();
+  bool ok = true, more = true;
+  while(ok && more)
+  {
+    const char* cur = buf->peek() + pos_;
+    const char* end = buf->writePtr();
+    if(state_ == ExpStatus || state_ == ExpHeader)
+    {
+      const char* next = state_ == ExpStatus ? procStatus(cur, end) : procHeader(cur, end);
+      if(next)
+      {
+        pos_ = next - buf->peek();
+        if(state_ == ExpStatus) state_ = ExpHeader;
+        else if(state_ != ExpHeader) // empty line, no more headers
+          ok = procHeaderEnd(buf, headRequest);
+      }
+      else if(bad_) ok = false;
+      else
+      {
+        if(static_cast<size_t>(end - buf->peek()) > kMaxHeaderSz) ok = fail();
+        more = false;
+      }
+    }
+    else if(state_ == ExpBody) // body framed by Content-Length
+    {
+      // delivered as a whole slice of the Buffer once it is complete
+      if(static_cast<size_t>(end - cur) < remaining_) more = false;
+      else
+      {
+        response_.setBody(cur, remaining_);
+        pos_ += remaining_;
+        remaining_ = 0;
+        state_ = Done;
+      }
+    }
+    else if(state_ == ExpChunkSize)
+    {
+      const char* crlf = buf->findCRLF(cur);
+      if(crlf)
+      {
+        ok = procChunkSize(cur, crlf);
+        if(ok) pos_ = crlf + 2 - buf->peek();
+      }
+      else more = false;
+    }
+    else if(state_ == ExpChunkData)
+    {
+      size_t n = std::min(remaining_, static_cast<size_t>(end - cur));
+      if(n == 0) more = false;
+      else
+      {
+        response_.appendBody(cur, n);
+        pos_ += n;
+        remaining_ -= n;
+        if(remaining_ == 0) state_ = ExpChunkEnd;
+      }
+    }
+    else if(state_ == ExpChunkEnd) // CRLF closing the chunk data
+    {
+      if(end - cur < 2) more = false;
+      else if(cur[0] != '\r' || cur[1] != '\n') ok = fail();
+      else
+      {
+        pos_ += 2;
+        state_ = ExpChunkSize;
+      }
+    }
+    else if(state_ == ExpTrailer) // trailer fields are skipped
+    {
+      const char* crlf = buf->findCRLF(cur);
+      if(crlf)
+      {
+        if(crlf == cur) state_ = Done;
+        pos_ = crlf + 2 - buf->peek();
+      }
+      else more = false;
+    }
+    else if(state_ == ExpClose)
+    {
+      if(static_cast<size_t>(end - cur) > maxBodySz_) ok = fail();
+      more = false;
+    }
+    else more = false; // Done
+  }
+  base_ = buf->peek();
+  return ok;
+}
+
+bool HTTPClientContext::finishOnClose(Buffer* buf)
+{
+  if(state_ == ExpClose)
+  {
+    const char* cur = buf->peek() + pos_;
+    response_.setBody(cur, buf->writePtr() - cur);
+    pos_ = buf->readableBytes();
+    state_ = Done;
+  }
+  return state_ == Done;
+}
+
+void HTTPClientContext::retire(Buffer* buf)
+{
+  assert(state_ == Done);
+  buf->retrieve(pos_);
+  reset();
+}
+/* status line, something like
+HTTP/1.1 200 OK
+the reason phrase may be empty
+*/
+const char* HTTPClientContext::procStatus(const char* begin, const char* end)
+{
+  static const char kVersion[] = "HTTP/1.";
+  size_t avail = std::min(static_cast<size_t>(end - begin), sizeof kVersion - 1);
+  if(!std::equal(begin, begin + avail, kVersion)) return failAt();
+  // 'HTTP/1.1 200' at least
+  if(end - begin < 12) return NULL;
+  if(begin[7] == '1') response_.setVersion(HTTPRequest::HTTP11);
+  else if(begin[7] == '0') response_.setVersion(HTTPRequest::HTTP10);
+  else return failAt();
+  const char* p = begin + 8;
+  if(*p != ' ') return failAt();
+  int status = 0;
+  for(int i = 1; i <= 3; ++i)
+  {
+    if(p[i] < '0' || p[i] > '9') return failAt();
+    status = status*10 + (p[i] - '0');
+  }
+  response_.setStatus(status);
+  p += 4;
+  const char* crlf = simd::findCRLF(p, end);
+  if(!crlf) return NULL;
+  if(p < crlf && *p++ != ' ') return failAt();
+  response_.setReason(p, crlf);
+  return crlf + 2;
+}
+/* header line, something like
+Content-Length: 11
+same convention as HTTPContext::procHeader: an empty line ends the
+header section and sets state_ to ExpBody as a marker
+*/
+const char* HTTPClientContext::procHeader(const char* begin, const char* end)
+{
+  const char* delim = simd::findFirstOf(begin, end, ":\r\n", 3);
+  if(!delim) return NULL;
+  if(*delim == ':')
+  {
+    if(delim == begin) return failAt();
+    const char* crlf = simd::findCRLF(delim + 1, end);
+    if(!crlf) return NULL;
+    response_.addHeader(begin, delim, crlf);
+    return crlf + 2;
+  }
+  if(delim != begin || *delim != '\r') return failAt();
+  if(end - delim < 2) return NULL;
+  if(delim[1] != '\n') return failAt();
+  state_ = ExpBody;
+  return delim + 2;
+}
+// called on the empty line ending the header section,
+// decides how the body (if any) is framed
+bool HTTPClientContext::procHeaderEnd(Buffer* buf, bool headRequest)
+{
+  int status = response_.status();
+  if(status >= 100 && status < 200 && status != 101)
+  {
+    // '100 Continue' and friends, the real response follows
+    buf->retrieve(pos_);
+    reset();
+    base_ = buf->peek();
+    return true;
+  }
+  if(headRequest || status == 101 || status == 204 || status == 304)
+  {
+    state_ = Done;
+    return true;
+  }
+  StringPiece te = response_.getHeader("Transfer-Encoding");
+  if(!te.empty())
+  {
+    // chunked is the final coding or the body runs until the close
+    if(te.size() >= 7 && ::strncasecmp(te.end()-7, "chunked", 7) == 0)
+      state_ = ExpChunkSize;
+    else state_ = ExpClose;
+    return true;
+  }
+  StringPiece cl = response_.getHeader("Content-Length");
+  if(cl.empty())
+  {
+    state_ = ExpClose;
+    return true;
+  }
+  size_t len = 0;
+  for(char c : cl)
+  {
+    if(c < '0' || c > '9') return fail();
+    if(len > maxBodySz_/10) return fail();
+    len = len*10 + (c-'0');
+  }
+  if(len > maxBodySz_) return fail();
+  remaining_ = len;
+  state_ = ExpBody;
+  return true;
+}
+/* chunk size line, hex digits optionally followed by extensions
+1a;name=value
+*/
+bool HTTPClientContext::procChunkSize(const char* begin, const char* end)
+{
+  size_t sz = 0;
+  const char* p = begin;
+  for(; p != end; ++p)
+  {
+    int d;
+    if(*p >= '0' && *p <= '9') d = *p - '0';
+    else if(*p >= 'a' && *p <= 'f') d = *p - 'a' + 10;
+    else if(*p >= 'A' && *p <= 'F') d = *p - 'A' + 10;
+    else break;
+    if(sz > (maxBodySz_ >> 4)) return fail();
+    sz = (sz << 4) | d;
+  }
+  if(p == begin || (p != end && *p != ';' && *p != ' ' && *p != '\t'))
+    return fail();
+  if(sz > maxBodySz_ - bodyRcvd_) return fail();
+  bodyRcvd_ += sz;
+  if(sz == 0) state_ = ExpTrailer;
+  else
+  {
+    remaining_ = sz;
+    state_ = ExpChunkData;
+  }
+  return true;
+}
+} // namespace net
+} // namespace chtho
@@ -0,0 +1,83 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_NET_HTTP_HTTPCLIENTCONTEXT_H
+#define CHTHO_NET_HTTP_HTTPCLIENTCONTEXT_H
+
+#include "HTTPClientResponse.h"
+
+namespace chtho
+{
+namespace net
+{
+class Buffer;
+
+// the response side of HTTPContext: parses the responses arriving on a
+// client connection incrementally without copying them out of the
+// Buffer. the status line and the header section are tokenized with
+// the same SIMD kernels, a Content-Length body stays in the Buffer and
+// is delivered as one slice, a chunked body is decoded into the
+// response. interim 1xx responses are skipped. a body with neither
+// Content-Length nor chunked coding runs until the connection closes
+class HTTPClientContext
+{
+public:
+  enum ParseState { ExpStatus, ExpHeader, ExpBody, ExpChunkSize,
+    ExpChunkData, ExpChunkEnd, ExpTrailer, ExpClose, Done };
+  static const size_t kMaxHeaderSz = 64*1024; // 64 KB
+private:
+  ParseState state_;
+  bool bad_;
+  HTTPClientResponse response_;
+  size_t maxBodySz_;
+  size_t pos_; // parsed bytes of the response, counted from Buffer::peek()
+  const char* base_; // Buffer::peek() when the slices were taken
+  size_t remaining_; // bytes left of the current body or chunk
+  size_t bodyRcvd_;
+
+  const char* procStatus(const char* begin, const char* end);
+  const char* procHeader(const char* begin, const char* end);
+  bool procHeaderEnd(Buffer* buf, bool headRequest);
+  bool procChunkSize(const char* begin, const char* end);
+  bool fail() { bad_ = true; return false; }
+  const char* failAt() { bad_ = true; return NULL; }
+public:
+  HTTPClientContext()
+    : state_(ExpStatus),
+      bad_(false),
+      maxBodySz_(64*1024*1024), // 64 MB
+      pos_(0),
+      base_(nullptr),
+      remaining_(0),
+      bodyRcvd_(0)
+  {}
+  // false on a malformed response, the connection is unusable then.
+  // headRequest: the response answers a HEAD request and has no body
+  bool parse(Buffer* buf, bool headRequest);
+  bool done() const { return state_ == Done; }
+  // the peer closed the connection, which completes a body that is
+  // delimited by the close. true if a response is done now
+  bool finishOnClose(Buffer* buf);
+  // retrieves the bytes of the finished response from the Buffer and
+  // prepares for the next one
+  void retire(Buffer* buf);
+  void reset()
+  {
+    state_ = ExpStatus;
+    bad_ = false;
+    pos_ = 0;
+    base_ = nullptr;
+    remaining_ = 0;
+    bodyRcvd_ = 0;
+    response_.reset();
+  }
+  void setMaxBodySz(size_t sz) { maxBodySz_ = sz; }
+  const HTTPClientResponse& response() const { return response_; }
+};
+} // namespace net
+} // namespace chtho
+
+
+#endif // !CHTHO_NET_HTTP_HTTPCLIENTCONTEXT_H
@@ -0,0 +1,93 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_NET_HTTP_HTTPCLIENTRESPONSE_H
+#define CHTHO_NET_HTTP_HTTPCLIENTRESPONSE_H
+
+#include "HTTPHeaders.h"
+#include "HTTPRequest.h"
+
+#include <string>
+
+#include <ctype.h> // isspace
+
+namespace chtho
+{
+namespace net
+{
+// a response received by HTTPClient. like HTTPRequest it is a view:
+// the reason phrase, the headers and (unless the body was chunked)
+// the body are slices into the connection Buffer, which is retired
+// after the response callback returns. copy what has to outlive it
+class HTTPClientResponse
+{
+private:
+  int status_;
+  HTTPRequest::Version version_;
+  StringPiece reason_;
+  HTTPHeaders headers_;
+  StringPiece body_;
+  // a chunked body has to be decoded, it is collected here
+  std::string decodedBody_;
+public:
+  HTTPClientResponse() : status_(0), version_(HTTPRequest::Unknown) {}
+  void reset()
+  {
+    status_ = 0;
+    version_ = HTTPRequest::Unknown;
+    reason_.clear();
+    headers_.clear();
+    body_.clear();
+    decodedBody_.clear();
+  }
+  void setStatus(int status) { status_ = status; }
+  int status() const { return status_; }
+  void setVersion(HTTPRequest::Version v) { version_ = v; }
+  HTTPRequest::Version version() const { return version_; }
+  void setReason(const char* start, const char* end)
+  { reason_.set(start, static_cast<int>(end-start)); }
+  StringPiece reason() const { return reason_; }
+  void addHeader(const char* start, const char* colon, const char* end)
+  {
+    const char* key = start;
+    const char* keyEnd = colon;
+    while(++colon < end && isspace(*colon)) /* empty */ ;
+    while(end > colon && isspace(*(end-1))) --end;
+    headers_.add(StringPiece(key, static_cast<int>(keyEnd-key)),
+      StringPiece(colon, static_cast<int>(end-colon)));
+  }
+  // empty when the header is absent, field names are case-insensitive
+  StringPiece getHeader(const StringPiece& key) const { return headers_.get(key); }
+  const HTTPHeaders& headers() const { return headers_; }
+  void setBody(const char* start, size_t len)
+  { body_.set(start, static_cast<int>(len)); }
+  void appendBody(const char* start, size_t len)
+  {
+    decodedBody_.append(start, len);
+    body_ = decodedBody_;
+  }
+  StringPiece body() const { return body_; }
+  // whether the server keeps the connection open after this response
+  bool keepAlive() const
+  {
+    StringPiece c = getHeader("Connection");
+    if(version_ == HTTPRequest::HTTP11)
+      return !(c.size() == 5 && ::strncasecmp(c.data(), "close", 5) == 0);
+    return c.size() == 10 && ::strncasecmp(c.data(), "keep-alive", 10) == 0;
+  }
+  // shifts the slices pointing into [from, from+len) to 'to',
+  // called when the Buffer holding an incomplete response moves
+  void rebase(const char* from, size_t len, const char* to)
+  {
+    HTTPHeaders::rebase(&reason_, from, len, to);
+    HTTPHeaders::rebase(&body_, from, len, to);
+    headers_.rebase(from, len, to);
+  }
+};
+} // namespace net
+} // namespace chtho
+
+
+#endif // !CHTHO_NET_HTTP_HTTPCLIENTRESPONSE_H
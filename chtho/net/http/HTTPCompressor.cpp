@@ -0,0 +1,424 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "HTTPCompressor.h"
+#include "HTTPRequest.h"
+#include "HTTPResponse.h"
+
+#include "logging/Logger.h"
+#include "net/Buffer.h"
+#include "threads/MutexLockGuard.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h> // strtod
+#include <string.h> // memcpy, memset
+#include <strings.h> // strncasecmp
+#include <sys/stat.h> // fstat
+#include <unistd.h> // pread
+#include <zlib.h>
+
+namespace chtho
+{
+namespace net
+{
+namespace
+{
+// windowBits selecting the gzip or the zlib wrapper
+int windowBits(HTTPCompressor::Encoding enc)
+{
+  return enc == HTTPCompressor::Gzip ? 15 + 16 : 15;
+}
+
+// a deflate state per thread, reset between bodies instead of set
+// up again: deflateInit2 allocates about 256 KB
+class Deflater : noncopyable
+{
+private:
+  z_stream zs_;
+  HTTPCompressor::Encoding enc_;
+  int level_;
+  bool init_;
+public:
+  Deflater() : enc_(HTTPCompressor::Identity), level_(0), init_(false) {}
+  ~Deflater() { if(init_) deflateEnd(&zs_); }
+  z_stream* get(HTTPCompressor::Encoding enc, int level)
+  {
+    if(init_ && enc == enc_ && level == level_)
+    {
+      deflateReset(&zs_);
+      return &zs_;
+    }
+    if(init_) deflateEnd(&zs_);
+    memset(&zs_, 0, sizeof(zs_));
+    init_ = deflateInit2(&zs_, level, Z_DEFLATED, windowBits(enc), 8,
+      Z_DEFAULT_STRATEGY) == Z_OK;
+    enc_ = enc;
+    level_ = level;
+    return init_ ? &zs_ : NULL;
+  }
+};
+
+thread_local Deflater t_deflater;
+thread_local std::string t_scratch; // dynamic bodies
+thread_local std::string t_file; // file bodies read for compression
+
+bool startsWith(const StringPiece& s, const char* prefix)
+{
+  size_t n = strlen(prefix);
+  return static_cast<size_t>(s.size()) >= n && strncasecmp(s.data(), prefix, n) == 0;
+}
+
+bool contains(const StringPiece& s, const char* word)
+{
+  size_t n = strlen(word);
+  for(const char* p = s.data(); p + n <= s.end(); ++p)
+    if(strncasecmp(p, word, n) == 0) return true;
+  return false;
+}
+
+// images, video, archives and fonts are already compressed
+bool compressible(const StringPiece& type)
+{
+  return startsWith(type, "text/")
+    || contains(type, "json")
+    || contains(type, "javascript")
+    || contains(type, "xml")
+    || startsWith(type, "image/svg");
+}
+
+// the q value of an Accept-Encoding item, 1 without one
+double quality(const char* p, const char* end)
+{
+  for(; p < end; ++p)
+  {
+    if(*p != ';') continue;
+    const char* q = p + 1;
+    while(q < end && *q == ' ') ++q;
+    if(end - q > 2 && (q[0] == 'q' || q[0] == 'Q') && q[1] == '=')
+      return strtod(std::string(q + 2, end).c_str(), NULL);
+  }
+  return 1;
+}
+
+// reads the whole file region, pread does not move a shared offset
+bool readFile(int fd, off_t off, size_t len, std::string* out)
+{
+  out->resize(len);
+  size_t got = 0;
+  while(got < len)
+  {
+    ssize_t n = ::pread(fd, &(*out)[got], len - got, off + static_cast<off_t>(got));
+    if(n <= 0)
+    {
+      if(n < 0 && errno == EINTR) continue;
+      return false;
+    }
+    got += static_cast<size_t>(n);
+  }
+  return true;
+}
+
+// a cache key. 'F' and the identity of the file and range sent,
+// changed by any write that touches the mtime
+bool fileKey(HTTPCompressor::Encoding enc, const HTTPResponse* resp, std::string* key)
+{
+  struct stat st;
+  if(::fstat(resp->fileFd(), &st) != 0) return false;
+  int64_t id[] = { static_cast<int64_t>(st.st_dev), static_cast<int64_t>(st.st_ino),
+    static_cast<int64_t>(st.st_size), static_cast<int64_t>(st.st_mtim.tv_sec),
+    static_cast<int64_t>(st.st_mtim.tv_nsec), static_cast<int64_t>(resp->fileOff()),
+    static_cast<int64_t>(resp->fileLen()) };
+  key->assign(1, 'F');
+  key->push_back(static_cast<char>(enc));
+  key->append(reinterpret_cast<const char*>(id), sizeof id);
+  return true;
+}
+
+// 'M', the length and the crc32 of a body in memory
+std::string memoryKey(HTTPCompressor::Encoding enc, const StringPiece& body)
+{
+  uint64_t len = body.size();
+  uint32_t crc = static_cast<uint32_t>(crc32(0,
+    reinterpret_cast<const Bytef*>(body.data()), static_cast<uInt>(body.size())));
+  std::string key(1, 'M');
+  key.push_back(static_cast<char>(enc));
+  key.append(reinterpret_cast<const char*>(&len), sizeof len);
+  key.append(reinterpret_cast<const char*>(&crc), sizeof crc);
+  return key;
+}
+
+void addVary(HTTPResponse* resp)
+{
+  StringPiece vary = resp->getHeader("Vary");
+  if(vary.empty()) resp->addHeader("Vary", "Accept-Encoding");
+  else if(!contains(vary, "accept-encoding") && vary != "*")
+    resp->addHeader("Vary", vary.as_string() + ", Accept-Encoding");
+}
+
+void tagETag(HTTPResponse* resp, HTTPCompressor::Encoding enc)
+{
+  StringPiece etag = resp->getHeader("ETag");
+  if(etag.size() < 2 || etag[etag.size()-1] != '"') return;
+  std::string tagged(etag.data(), etag.size() - 1);
+  tagged += '-';
+  tagged += HTTPCompressor::name(enc);
+  tagged += '"';
+  resp->addHeader("ETag", tagged);
+}
+} // namespace
+
+HTTPCompressor::HTTPCompressor(int level)
+  : level_(level),
+    minSize_(256),
+    maxFileSize_(1024*1024),
+    maxCacheBytes_(64*1024*1024),
+    cacheBytes_(0),
+    hits_(0),
+    misses_(0)
+{
+}
+
+HTTPCompressor::Encoding HTTPCompressor::negotiate(const StringPiece& acceptEncoding)
+{
+  double gzip = 0, deflate = 0, star = -1;
+  const char* p = acceptEncoding.data();
+  const char* end = acceptEncoding.end();
+  while(p < end)
+  {
+    while(p < end && (*p == ' ' || *p == ',')) ++p;
+    const char* q = p;
+    while(q < end && *q != ',') ++q;
+    const char* tok = p;
+    while(tok < q && *tok != ';' && *tok != ' ') ++tok;
+    StringPiece name(p, static_cast<int>(tok - p));
+    double qv = quality(tok, q);
+    if(name.size() == 4 && strncasecmp(p, "gzip", 4) == 0) gzip = qv;
+    else if(name.size() == 7 && strncasecmp(p, "deflate", 7) == 0) deflate = qv;
+    else if(name == "*") star = qv;
+    p = q;
+  }
+  // '*' covers the codings not named explicitly
+  if(star >= 0)
+  {
+    if(!contains(acceptEncoding, "gzip")) gzip = star;
+    if(!contains(acceptEncoding, "deflate")) deflate = star;
+  }
+  if(gzip > 0 && gzip >= deflate) return Gzip;
+  if(deflate > 0) return Deflate;
+  return Identity;
+}
+
+const char* HTTPCompressor::name(Encoding enc)
+{
+  switch(enc)
+  {
+  case Gzip: return "gzip";
+  case Deflate: return "deflate";
+  default: return "identity";
+  }
+}
+
+bool HTTPCompressor::compress(Encoding enc, const StringPiece& in, std::string* out,
+  int level)
+{
+  assert(enc != Identity);
+  z_stream* zs = t_deflater.get(enc, level);
+  if(!zs) return false;
+  out->resize(deflateBound(zs, static_cast<uLong>(in.size())));
+  zs->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+  zs->avail_in = static_cast<uInt>(in.size());
+  zs->next_out = reinterpret_cast<Bytef*>(&(*out)[0]);
+  zs->avail_out = static_cast<uInt>(out->size());
+  int err = deflate(zs, Z_FINISH);
+  if(err != Z_STREAM_END)
+  {
+    LOG_ERR << "HTTPCompressor::compress " << err;
+    return false;
+  }
+  out->resize(zs->total_out);
+  return true;
+}
+
+size_t HTTPCompressor::cacheBytes()
+{
+  MutexLockGuard lock(mutex_);
+  return cacheBytes_;
+}
+
+// the entry of key, NULL if there is none or if it was made from
+// other bytes than source (unless source is NULL, for a file)
+std::shared_ptr<std::string> HTTPCompressor::lookup(const std::string& key,
+  const StringPiece& source)
+{
+  MutexLockGuard lock(mutex_);
+  auto it = cache_.find(key);
+  if(it == cache_.end()) return std::shared_ptr<std::string>();
+  const std::string& s = it->second.source;
+  if(source.data() && (s.size() != static_cast<size_t>(source.size())
+    || memcmp(s.data(), source.data(), s.size()) != 0))
+    return std::shared_ptr<std::string>();
+  lru_.splice(lru_.begin(), lru_, it->second.pos);
+  hits_.fetch_add(1, std::memory_order_relaxed);
+  return it->second.data;
+}
+
+// compresses body and puts it in the cache under key, replacing the
+// entry another body with the same checksum left there
+std::shared_ptr<std::string> HTTPCompressor::insert(Encoding enc,
+  const std::string& key, const StringPiece& body, bool keepSource)
+{
+  misses_.fetch_add(1, std::memory_order_relaxed);
+  // compressed outside the lock, two threads may race on the same
+  // body, the second insert is dropped
+  std::shared_ptr<std::string> data(new std::string);
+  if(!compress(enc, body, data.get(), level_)) return std::shared_ptr<std::string>();
+  // an incompressible body is cached too, so it is not tried again
+  data->shrink_to_fit();
+  size_t bytes = data->size() + (keepSource ? body.size() : 0);
+  if(bytes > maxCacheBytes_) return data;
+  MutexLockGuard lock(mutex_);
+  auto it = cache_.find(key);
+  if(it != cache_.end())
+  {
+    // the race above, a file key names its bytes
+    const std::string& src = it->second.source;
+    if(!keepSource || (src.size() == static_cast<size_t>(body.size())
+      && memcmp(src.data(), body.data(), src.size()) == 0))
+      return data;
+    cacheBytes_ -= it->second.data->size() + it->second.source.size();
+    lru_.erase(it->second.pos);
+    cache_.erase(it);
+  }
+  lru_.push_front(key);
+  Slot slot = { data, keepSource ? body.as_string() : std::string(), lru_.begin() };
+  cache_.emplace(key, std::move(slot));
+  cacheBytes_ += bytes;
+  while(cacheBytes_ > maxCacheBytes_)
+  {
+    auto victim = cache_.find(lru_.back());
+    cacheBytes_ -= victim->second.data->size() + victim->second.source.size();
+    cache_.erase(victim);
+    lru_.pop_back();
+  }
+  return data;
+}
+
+bool HTTPCompressor::apply(const HTTPRequest& req, HTTPResponse* resp)
+{
+  if(resp->status() != HTTPResponse::OK200) return false;
+  size_t sz = resp->bodySize();
+  if(sz < minSize_) return false;
+  if(resp->hasFile() && sz > maxFileSize_) return false;
+  if(!resp->getHeader("Content-Encoding").empty()) return false;
+  if(!compressible(resp->getHeader("Content-Type"))) return false;
+  // the response depends on Accept-Encoding even when it is not compressed
+  addVary(resp);
+  Encoding enc = negotiate(req.getHeader("Accept-Encoding"));
+  if(enc == Identity) return false;
+
+  if(resp->cacheable())
+  {
+    std::shared_ptr<std::string> z;
+    if(resp->hasFile())
+    {
+      std::string key;
+      if(!fileKey(enc, resp, &key)) return false;
+      z = lookup(key, StringPiece());
+      if(!z)
+      {
+        if(!readFile(resp->fileFd(), resp->fileOff(), resp->fileLen(), &t_file))
+          return false;
+        z = insert(enc, key, StringPiece(t_file.data(), static_cast<int>(t_file.size())),
+          false);
+      }
+    }
+    else
+    {
+      StringPiece body = resp->bodyRef();
+      if(!body.data()) body.set(resp->body().data(), static_cast<int>(resp->body().size()));
+      std::string key = memoryKey(enc, body);
+      z = lookup(key, body);
+      if(!z) z = insert(enc, key, body, true);
+    }
+    if(!z || z->size() >= sz) return false;
+    resp->setBodyRef(StringPiece(z->data(), static_cast<int>(z->size())), z);
+  }
+  else
+  {
+    const std::string& body = resp->body();
+    if(!compress(enc, StringPiece(body.data(), static_cast<int>(body.size())),
+      &t_scratch, level_) || t_scratch.size() >= sz)
+      return false;
+    // both strings keep their capacity for the next response
+    resp->mutableBody()->swap(t_scratch);
+  }
+  resp->addHeader("Content-Encoding", name(enc));
+  tagETag(resp, enc);
+  return true;
+}
+
+HTTPCompressor::Encoding HTTPCompressor::applyStream(Encoding accepted,
+  HTTPResponse* resp)
+{
+  if(resp->status() != HTTPResponse::OK200) return Identity;
+  if(!resp->getHeader("Content-Encoding").empty()) return Identity;
+  if(!compressible(resp->getHeader("Content-Type"))) return Identity;
+  addVary(resp);
+  if(accepted != Identity) resp->addHeader("Content-Encoding", name(accepted));
+  return accepted;
+}
+
+ZlibStream::ZlibStream(HTTPCompressor::Encoding enc, int level)
+  : zs_(new z_stream),
+    finished_(false)
+{
+  assert(enc != HTTPCompressor::Identity);
+  memset(zs_.get(), 0, sizeof(z_stream));
+  if(deflateInit2(zs_.get(), level, Z_DEFLATED, windowBits(enc), 8,
+    Z_DEFAULT_STRATEGY) != Z_OK)
+    LOG_FATAL << "ZlibStream: deflateInit2";
+}
+
+ZlibStream::~ZlibStream()
+{
+  deflateEnd(zs_.get());
+}
+
+void ZlibStream::deflateTo(const StringPiece& data, Buffer* out, int flush)
+{
+  assert(!finished_);
+  z_stream* zs = zs_.get();
+  zs->next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data.data()));
+  zs->avail_in = static_cast<uInt>(data.size());
+  int err;
+  do
+  {
+    // enough for the input seen so far in most cases, deflate is
+    // simply called again when it is not
+    size_t room = deflateBound(zs, zs->avail_in) + 16;
+    out->ensure(room);
+    zs->next_out = reinterpret_cast<Bytef*>(out->writePtr());
+    zs->avail_out = static_cast<uInt>(room);
+    err = deflate(zs, flush);
+    out->written(room - zs->avail_out);
+  } while(zs->avail_out == 0 || (zs->avail_in > 0 && err == Z_OK));
+  if(err == Z_STREAM_END) finished_ = true;
+  else if(err != Z_OK && err != Z_BUF_ERROR)
+    LOG_ERR << "ZlibStream::deflate " << err;
+}
+
+void ZlibStream::write(const StringPiece& data, Buffer* out, bool flush)
+{
+  deflateTo(data, out, flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+}
+
+void ZlibStream::finish(Buffer* out)
+{
+  deflateTo(StringPiece(), out, Z_FINISH);
+  assert(finished_);
+}
+} // namespace net
+} // namespace chtho
@@ -0,0 +1,127 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_NET_HTTP_HTTPCOMPRESSOR_H
+#define CHTHO_NET_HTTP_HTTPCOMPRESSOR_H
+
+#include "base/noncopyable.h"
+#include "base/StringPiece.h"
+#include "threads/MutexLock.h"
+
+#include <atomic>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+struct z_stream_s;
+
+namespace chtho
+{
+namespace net
+{
+class Buffer;
+class HTTPRequest;
+class HTTPResponse;
+
+// compresses response bodies with zlib according to the request's
+// Accept-Encoding, e.g.
+//   server.setCompressor(std::make_shared<HTTPCompressor>());
+// only 200 responses of a compressible Content-Type (text/*, json,
+// javascript, xml, svg) and at least minSize bytes are touched.
+// a repeatable body (a file, a setBodyRef body or one marked with
+// HTTPResponse::setCacheable) is compressed once: the result is kept
+// in an LRU cache bounded in bytes, so every later response with the
+// same bytes is served from memory without running deflate again.
+// a file is keyed by its identity (device, inode, size, mtime and
+// the range sent), a hit doesn't read it. a body in memory is keyed
+// by its checksum and kept along with its compressed form, a hit is
+// compared with it byte by byte. other bodies are
+// compressed into a per-thread scratch string swapped with the body.
+// apply() may be called from any number of threads
+class HTTPCompressor : noncopyable
+{
+public:
+  enum Encoding { Identity, Gzip, Deflate };
+private:
+  using LRU = std::list<std::string>;
+  struct Slot
+  {
+    std::shared_ptr<std::string> data;
+    std::string source; // of a body in memory, empty for a file
+    LRU::iterator pos;
+  };
+  const int level_;
+  size_t minSize_;
+  size_t maxFileSize_;
+  size_t maxCacheBytes_;
+  MutexLock mutex_;
+  std::unordered_map<std::string, Slot> cache_; // guarded by mutex_
+  LRU lru_; // most recently used first, guarded by mutex_
+  size_t cacheBytes_; // guarded by mutex_
+  std::atomic<size_t> hits_;
+  std::atomic<size_t> misses_;
+
+  std::shared_ptr<std::string> lookup(const std::string& key, const StringPiece& source);
+  std::shared_ptr<std::string> insert(Encoding enc, const std::string& key,
+    const StringPiece& body, bool keepSource);
+public:
+  // level as for zlib, 1 (fastest) to 9 (smallest)
+  explicit HTTPCompressor(int level = 6);
+  // bodies below sz bytes are sent as they are, 256 by default
+  void setMinSize(size_t sz) { minSize_ = sz; }
+  // larger files are left to sendfile(2), 1 MB by default
+  void setMaxFileSize(size_t sz) { maxFileSize_ = sz; }
+  // bytes kept, 64 MB by default: the compressed bodies, and the
+  // bodies in memory they were made from
+  void setMaxCacheBytes(size_t sz) { maxCacheBytes_ = sz; }
+
+  // compresses resp's body in place if req accepts it, true if it did.
+  // adds Content-Encoding and Vary, and tags a present ETag with the
+  // encoding ('"abc"' becomes '"abc-gzip"')
+  bool apply(const HTTPRequest& req, HTTPResponse* resp);
+  // for a response streamed piece by piece (see HTTPStream): the
+  // encoding to deflate it with through a ZlibStream, Identity if it
+  // goes out as it is. accepted is negotiate() of the request.
+  // adds Content-Encoding and Vary like apply()
+  Encoding applyStream(Encoding accepted, HTTPResponse* resp);
+  int level() const { return level_; }
+
+  size_t hits() const { return hits_.load(std::memory_order_relaxed); }
+  size_t misses() const { return misses_.load(std::memory_order_relaxed); }
+  size_t cacheBytes();
+
+  // the preferred encoding acceptable by an Accept-Encoding value,
+  // gzip over deflate, honouring 'q=0'
+  static Encoding negotiate(const StringPiece& acceptEncoding);
+  static const char* name(Encoding enc);
+  // compresses in into out (replacing its content), false on error
+  static bool compress(Encoding enc, const StringPiece& in, std::string* out,
+    int level = 6);
+};
+
+// incremental compression of a body produced piece by piece, e.g. a
+// chunked response. write() deflates into out what zlib is ready to
+// emit, flush forces all input out (Z_SYNC_FLUSH) so the peer can
+// decode it right away. finish() writes the trailer
+class ZlibStream : noncopyable
+{
+private:
+  std::unique_ptr<z_stream_s> zs_;
+  bool finished_;
+
+  void deflateTo(const StringPiece& data, Buffer* out, int flush);
+public:
+  explicit ZlibStream(HTTPCompressor::Encoding enc, int level = 6);
+  ~ZlibStream();
+  void write(const StringPiece& data, Buffer* out, bool flush = false);
+  void finish(Buffer* out);
+  bool finished() const { return finished_; }
+};
+} // namespace net
+} // namespace chtho
+
+
+#endif // !CHTHO_NET_HTTP_HTTPCOMPRESSOR_H
@@ -5,86 +5,379 @@
 
 #include "HTTPContext.h"
 #include "net/Buffer.h"
+#include "net/Simd.h"
+
+#include <string.h> // strlen
+#include <strings.h> // strncasecmp
 
 namespace chtho
 {
 namespace net
 {
+namespace
+{
+bool isKey(const StringPiece& a, const char* b)
+{
+  size_t n = ::strlen(b);
+  return static_cast<size_t>(a.size()) == n && ::strncasecmp(a.data(), b, n) == 0;
+}
+// the last coding of a Transfer-Encoding value, e.g. "chunked" of
+// "gzip, chunked", without the spaces around it
+StringPiece lastCoding(const StringPiece& val)
+{
+  const char* begin = val.data();
+  const char* end = val.end();
+  const char* p = end;
+  while(p > begin && *(p-1) != ',') --p;
+  while(p < end && (*p == ' ' || *p == '\t')) ++p;
+  return StringPiece(p, static_cast<int>(end-p));
+}
+} // namespace
+
 /* request structure
-GET /hello.txt HTTP/1.1
-User-Agent: curl/7.16.3 libcurl/7.16.3 OpenSSL/0.9.7l zlib/1.2.3
+POST /upload HTTP/1.1
 Host: www.example.com
-Accept-Language: en, mi
+Content-Length: 11
+
+hello world
 */
 bool HTTPContext::parse(Buffer* buf, Timestamp rcvTime)
 {
+  // the Buffer moves its readable bytes as a block when it grows or
+  // compacts, shift the slices taken during earlier calls accordingly
+  if(base_ && base_ != buf->peek())
+    request_.rebase(base_, pos_, buf->peek());
+  base_ = buf->peek();
   bool ok = true, more = true;
-  while(more)
+  while(ok && more)
   {
+    const char* cur = buf->peek() + pos_;
+    const char* end = buf->writePtr();
     if(state_ == ExpReq)
     {
-      const char* crlf = buf->findCRLF();
-      if(crlf)
+      // tolerate empty lines between requests
+      if(end - cur >= 2 && cur[0] == '\r' && cur[1] == '\n') pos_ += 2;
+      else
       {
-        ok = procReq(buf->peek(), crlf);
-        if(ok)
+        const char* next = procReq(cur, end);
+        if(next)
         {
           request_.setRcvTime(rcvTime);
-          buf->retrieveUntil(crlf+2);
+          pos_ = next - buf->peek();
           state_ = ExpHeader;
-        } else more = false;
-      } else more = false; 
+          if(pos_ > kMaxHeaderSz) ok = fail(BadRequest);
+        }
+        else if(err_ != NoError) ok = false;
+        else
+        {
+          if(static_cast<size_t>(end - buf->peek()) > kMaxHeaderSz)
+            ok = fail(BadRequest);
+          more = false;
+        }
+      }
     }
-    else if(state_ == ExpHeader) // retrieve headers 
+    else if(state_ == ExpHeader) // slice headers
     {
-      const char* crlf = buf->findCRLF();
-      if(crlf)
+      const char* next = procHeader(cur, end);
+      if(next)
       {
-        const char* colon = std::find(buf->peek(), crlf, ':');
-        if(colon != crlf) request_.addHeader(buf->peek(), colon, crlf);
-        else  // no more headers 
+        pos_ = next - buf->peek();
+        // checked line by line, the lines may come one at a time
+        if(pos_ > kMaxHeaderSz || request_.headers().size() > kMaxHeaders)
+          ok = fail(BadRequest);
+        else if(state_ != ExpHeader) // empty line, no more headers
         {
+          ok = procHeaderEnd();
+          if(ok && request_.bodyStreamed()) startStreaming(buf);
+        }
+      }
+      else if(err_ != NoError) ok = false;
+      else
+      {
+        if(static_cast<size_t>(end - buf->peek()) > kMaxHeaderSz)
+          ok = fail(BadRequest);
+        more = false;
+      }
+    }
+    else if(state_ == ExpBody) // body framed by Content-Length
+    {
+      size_t n = std::min(remaining_, static_cast<size_t>(end - cur));
+      if(!request_.bodyStreamed())
+      {
+        // a small body is delivered as a whole slice of the Buffer
+        if(n < remaining_) more = false;
+        else
+        {
+          request_.setBody(cur, n);
+          pos_ += n;
+          remaining_ = 0;
           state_ = Done;
-          more = false; 
         }
-        buf->retrieveUntil(crlf+2); 
       }
-      else more = false; 
+      else if(n == 0) more = false;
+      else
+      {
+        remaining_ -= n;
+        deliverBody(buf, cur, n);
+        if(remaining_ == 0) state_ = Done;
+      }
     }
-  } 
-  return ok; 
+    else if(state_ == ExpChunkSize)
+    {
+      const char* crlf = buf->findCRLF(cur);
+      if(static_cast<size_t>((crlf ? crlf : end) - cur) > kMaxLineSz)
+        ok = fail(BadRequest);
+      else if(crlf)
+      {
+        ok = procChunkSize(cur, crlf);
+        if(ok) pos_ = crlf + 2 - buf->peek();
+      }
+      else more = false;
+    }
+    else if(state_ == ExpChunkData)
+    {
+      size_t n = std::min(remaining_, static_cast<size_t>(end - cur));
+      if(n == 0) more = false;
+      else
+      {
+        remaining_ -= n;
+        if(remaining_ == 0) state_ = ExpChunkEnd;
+        deliverBody(buf, cur, n);
+      }
+    }
+    else if(state_ == ExpChunkEnd) // CRLF closing the chunk data
+    {
+      if(end - cur < 2) more = false;
+      else if(cur[0] != '\r' || cur[1] != '\n') ok = fail(BadRequest);
+      else
+      {
+        pos_ += 2;
+        state_ = ExpChunkSize;
+      }
+    }
+    else if(state_ == ExpTrailer) // trailer fields are skipped
+    {
+      const char* crlf = buf->findCRLF(cur);
+      size_t len = (crlf ? crlf : end) - cur;
+      if(len > kMaxLineSz || trailerSz_ + len > kMaxHeaderSz)
+        ok = fail(BadRequest);
+      else if(crlf)
+      {
+        if(crlf == cur) state_ = Done;
+        pos_ = crlf + 2 - buf->peek();
+        trailerSz_ += len + 2;
+      }
+      else more = false;
+    }
+    else more = false; // Done
+  }
+  base_ = buf->peek();
+  return ok;
+}
+
+void HTTPContext::retire(Buffer* buf)
+{
+  assert(state_ == Done);
+  buf->retrieve(pos_);
+  reset();
 }
 /* request line, something like
-GET /hello HTTP/1.1
-*/  
-bool HTTPContext::procReq(const char* begin, const char* end)
+GET /hello?name=chtho HTTP/1.1
+the line is tokenized in a single pass: each delimiter search starts
+where the previous token ended, so no byte is looked at twice.
+returns the start of the next line, or NULL when the line is
+incomplete (err_ untouched) or malformed (err_ set)
+*/
+const char* HTTPContext::procReq(const char* begin, const char* end)
 {
-  const char* space = std::find(begin, end, ' ');
-  if(space == end) return false; 
-  if(!request_.setMethod(begin, space)) return false;
-  begin = space + 1; // move to something like '/hello' 
-  space = std::find(begin, end, ' ');
-  if(space == end) return false; 
-  const char* question = std::find(begin, space, '?');
-  if(question != space)
+  const char* space = simd::findFirstOf(begin, end, " \r\n", 3);
+  if(!space) return NULL;
+  if(*space != ' ' || !request_.setMethod(begin, space))
+    return failAt(BadRequest);
+  begin = space + 1; // move to something like '/hello'
+  const char* delim = simd::findFirstOf(begin, end, " ?\r\n", 4);
+  if(!delim) return NULL;
+  if(*delim == '?')
   {
-    request_.setPath(begin, question);
-    request_.setQuery(question, space);
+    request_.setPath(begin, delim);
+    const char* query = delim;
+    delim = simd::findFirstOf(query, end, " \r\n", 3);
+    if(!delim) return NULL;
+    request_.setQuery(query, delim);
   }
-  else  
-  {
-    request_.setPath(begin, space);
-  }
-  begin = space + 1;
-  // should be either 'HTTP/1.0' or 'HTTP/1.1'
-  if(end - begin != 8) return false; 
-  if(!std::equal(begin, end-1, "HTTP/1.")) return false;
-  if(*(end-1) == '1')
+  else request_.setPath(begin, delim);
+  if(*delim != ' ') return failAt(BadRequest);
+  begin = delim + 1;
+  // should be either 'HTTP/1.0' or 'HTTP/1.1' followed by CRLF
+  static const char kVersion[] = "HTTP/1.";
+  size_t avail = std::min(static_cast<size_t>(end - begin), sizeof kVersion - 1);
+  if(!std::equal(begin, begin + avail, kVersion)) return failAt(BadRequest);
+  if(end - begin < 10) return NULL;
+  if(begin[8] != '\r' || begin[9] != '\n') return failAt(BadRequest);
+  if(begin[7] == '1')
     request_.setVersion(HTTPRequest::HTTP11);
-  else if(*(end-1) == '0')
+  else if(begin[7] == '0')
     request_.setVersion(HTTPRequest::HTTP10);
-  else return false;
-  return true; 
+  else return failAt(BadRequest);
+  return begin + 10;
+}
+/* header line, something like
+Content-Length: 11
+the field name ends at the first ':', the value at the CRLF. a line
+that starts with CRLF ends the header section (state_ becomes ExpBody
+as a marker, procHeaderEnd decides the real framing). same return
+convention as procReq
+*/
+const char* HTTPContext::procHeader(const char* begin, const char* end)
+{
+  const char* delim = simd::findFirstOf(begin, end, ":\r\n", 3);
+  if(!delim) return NULL;
+  if(*delim == ':')
+  {
+    if(delim == begin) return failAt(BadRequest);
+    const char* crlf = simd::findCRLF(delim + 1, end);
+    if(!crlf) return NULL;
+    request_.addHeader(begin, delim, crlf);
+    return crlf + 2;
+  }
+  // only an empty line may come without a colon
+  if(delim != begin || *delim != '\r') return failAt(BadRequest);
+  if(end - delim < 2) return NULL;
+  if(delim[1] != '\n') return failAt(BadRequest);
+  state_ = ExpBody;
+  return delim + 2;
+}
+// called on the empty line ending the header section,
+// decides how the body (if any) is framed
+bool HTTPContext::procHeaderEnd()
+{
+  expectContinue_ = request_.version() == HTTPRequest::HTTP11
+    && request_.getHeader("Expect") == "100-continue";
+  // the last Transfer-Encoding field has the final coding. a message
+  // with both framings, or with Content-Lengths that disagree, is read
+  // differently by different servers, a proxy in front of this one
+  // may see another request boundary. so it is refused
+  StringPiece te, cl;
+  bool hasTE = false;
+  for(const auto& f : request_.headers())
+  {
+    if(isKey(f.key, "Transfer-Encoding"))
+    {
+      hasTE = true;
+      te = f.val;
+    }
+    else if(isKey(f.key, "Content-Length"))
+    {
+      if(cl.data() && cl != f.val) return fail(BadRequest);
+      cl = f.val;
+    }
+  }
+  if(hasTE)
+  {
+    // chunked must be the final coding, anything else
+    // cannot be framed by the server
+    if(cl.data() || !isKey(lastCoding(te), "chunked"))
+      return fail(BadRequest);
+    state_ = ExpChunkSize;
+    return true;
+  }
+  if(cl.empty())
+  {
+    expectContinue_ = false;
+    state_ = Done;
+    return true;
+  }
+  size_t len = 0;
+  for(char c : cl)
+  {
+    if(c < '0' || c > '9') return fail(BadRequest);
+    if(len > maxBodySz_/10) return fail(TooLarge);
+    len = len*10 + (c-'0');
+  }
+  if(len > maxBodySz_) return fail(TooLarge);
+  remaining_ = len;
+  if(len == 0)
+  {
+    expectContinue_ = false;
+    state_ = Done;
+  }
+  else
+  {
+    if(bodyCB_ && len > streamThreshold_) request_.setBodyStreamed(true);
+    state_ = ExpBody;
+  }
+  return true;
+}
+/* chunk size line, hex digits optionally followed by extensions
+1a;name=value
+*/
+bool HTTPContext::procChunkSize(const char* begin, const char* end)
+{
+  size_t sz = 0;
+  const char* p = begin;
+  for(; p != end; ++p)
+  {
+    int d;
+    if(*p >= '0' && *p <= '9') d = *p - '0';
+    else if(*p >= 'a' && *p <= 'f') d = *p - 'a' + 10;
+    else if(*p >= 'A' && *p <= 'F') d = *p - 'A' + 10;
+    else break;
+    if(sz > (maxBodySz_ >> 4)) return fail(TooLarge);
+    sz = (sz << 4) | d;
+  }
+  if(p == begin || (p != end && *p != ';' && *p != ' ' && *p != '\t'))
+    return fail(BadRequest);
+  if(sz > maxBodySz_ - bodyRcvd_) return fail(TooLarge);
+  if(sz == 0) state_ = ExpTrailer;
+  else
+  {
+    remaining_ = sz;
+    state_ = ExpChunkData;
+  }
+  return true;
+}
+// from here on the body goes to the body callback: the request takes
+// a copy of its slices so the Buffer can be retrieved piece by piece
+void HTTPContext::startStreaming(Buffer* buf)
+{
+  request_.setBodyStreamed(true);
+  request_.own();
+  buf->retrieve(pos_);
+  pos_ = 0;
+  base_ = buf->peek();
+}
+// hands body bytes at the cursor either to the request or to the body
+// callback. a chunked body has no length up front, it switches to
+// streaming (flushing what was collected so far) once it outgrows
+// the threshold
+void HTTPContext::deliverBody(Buffer* buf, const char* data, size_t len)
+{
+  bodyRcvd_ += len;
+  if(!request_.bodyStreamed() && bodyCB_ && bodyRcvd_ > streamThreshold_)
+  {
+    assert(data == buf->peek() + pos_);
+    startStreaming(buf);
+    data = buf->peek(); // the cursor is at the front now
+    StringPiece body = request_.body();
+    if(!body.empty())
+    {
+      bodyCB_(request_, body.data(), body.size());
+      request_.clearBody();
+    }
+  }
+  if(request_.bodyStreamed())
+  {
+    bodyCB_(request_, data, len);
+    // everything up to the end of this piece has been consumed
+    buf->retrieve(data + len - buf->peek());
+    pos_ = 0;
+    base_ = buf->peek();
+  }
+  else
+  {
+    request_.appendBody(data, len);
+    pos_ += len;
+  }
 }
 } // namespace net
 } // namespace chtho
@@ -7,31 +7,140 @@
 #define CHTHO_NET_HTTP_HTTPCONTEXT_H
 
 #include "HTTPRequest.h"
+#include "HTTPResponse.h"
+
+#include <deque>
+#include <functional>
+#include <memory>
 
 namespace chtho
 {
 namespace net
 {
 class Buffer;
+class HTTP2Session;
+class HTTPResponder;
+class HTTPStream;
+class WebSocket;
 
+// HTTPContext lives as long as the connection (see HTTPServer::onConn)
+// so a request split over several reads is parsed incrementally.
+// nothing is copied out of the Buffer: the parser walks a cursor over
+// the readable bytes and HTTPRequest keeps slices into them. the bytes
+// of a request are retrieved by retire() after the handler has run.
+// request bodies are framed either by Content-Length or by the chunked
+// transfer coding. small bodies are delivered whole in
+// HTTPRequest::body(), bodies larger than the stream threshold are
+// handed to the body callback piece by piece and retrieved right away
 class HTTPContext
 {
 public:
-  enum ParseState { ExpReq, ExpHeader, ExpBody, Done };
+  enum ParseState { ExpReq, ExpHeader, ExpBody,
+    ExpChunkSize, ExpChunkData, ExpChunkEnd, ExpTrailer, Done };
+  enum Error { NoError, BadRequest, TooLarge };
+  using BodyCB = std::function<void(const HTTPRequest&, const char*, size_t)>;
+  // the request line and the header fields, also the trailer fields
+  static const size_t kMaxHeaderSz = 64*1024; // 64 KB
+  static const size_t kMaxHeaders = 100; // fields of a request
+  static const size_t kMaxLineSz = 8*1024; // a chunk size line or a trailer field
+  // reading stops while this many async responses are outstanding
+  static const size_t kMaxPending = 16;
 private:
   ParseState state_;
-  HTTPRequest request_; 
+  Error err_;
+  HTTPRequest request_;
+  // reused for every response on the connection
+  HTTPResponse response_;
+  // async responses in request order, see HTTPResponder
+  std::deque<std::shared_ptr<HTTPResponder>> pending_;
+  BodyCB bodyCB_;
+  size_t maxBodySz_;
+  size_t streamThreshold_;
+  size_t pos_; // parsed bytes of the request, counted from Buffer::peek()
+  const char* base_; // Buffer::peek() when the slices were taken
+  size_t remaining_; // bytes left of the current body or chunk
+  size_t bodyRcvd_; // total body bytes seen so far
+  size_t trailerSz_; // bytes of the trailer section so far
+  bool expectContinue_; // client waits for '100 Continue' before the body
+  bool continueDeferred_; // the '100 Continue' waits for earlier responses
+  // set once the connection has switched to the WebSocket protocol
+  std::shared_ptr<WebSocket> webSocket_;
+  // or to HTTP/2, with the preface or 'Upgrade: h2c'
+  std::shared_ptr<HTTP2Session> http2_;
+  // a streamed response in progress, the requests after it wait
+  std::shared_ptr<HTTPStream> stream_;
 
-  bool procReq(const char* begin, const char* end);
+  const char* procReq(const char* begin, const char* end);
+  const char* procHeader(const char* begin, const char* end);
+  bool procHeaderEnd();
+  bool procChunkSize(const char* begin, const char* end);
+  void deliverBody(Buffer* buf, const char* data, size_t len);
+  void startStreaming(Buffer* buf);
+  bool fail(Error err) { err_ = err; return false; }
+  const char* failAt(Error err) { err_ = err; return NULL; }
 public:
-  HTTPContext() : state_(ExpReq) {} 
+  HTTPContext()
+    : state_(ExpReq),
+      err_(NoError),
+      maxBodySz_(8*1024*1024), // 8 MB
+      streamThreshold_(64*1024), // 64 KB
+      pos_(0),
+      base_(nullptr),
+      remaining_(0),
+      bodyRcvd_(0),
+      trailerSz_(0),
+      expectContinue_(false),
+      continueDeferred_(false)
+  {}
   bool parse(Buffer* buf, Timestamp rcvTime);
   bool done() const { return state_ == Done; }
+  // between requests, nothing of the next one has been parsed
+  bool idle() const { return state_ == ExpReq && pos_ == 0; }
+  Error error() const { return err_; }
+  // true once per request whose body is expected after an interim
+  // '100 Continue' response
+  bool expectContinue()
+  {
+    bool res = expectContinue_;
+    expectContinue_ = false;
+    return res;
+  }
+  // the '100 Continue' is due once the async responses to earlier
+  // requests are out, HTTPResponder::flush sends it then
+  void deferContinue(bool deferred) { continueDeferred_ = deferred; }
+  bool continueDeferred() const { return continueDeferred_; }
+  // retrieves the bytes of the finished request from the Buffer and
+  // prepares for the next one. the request must not be used afterwards
+  void retire(Buffer* buf);
+  void reset()
+  {
+    state_ = ExpReq;
+    err_ = NoError;
+    pos_ = 0;
+    base_ = nullptr;
+    remaining_ = 0;
+    bodyRcvd_ = 0;
+    trailerSz_ = 0;
+    expectContinue_ = false;
+    continueDeferred_ = false;
+    request_.reset();
+  }
+  void setBodyCB(const BodyCB& cb) { bodyCB_ = cb; }
+  void setMaxBodySz(size_t sz) { maxBodySz_ = sz; }
+  void setStreamThreshold(size_t sz) { streamThreshold_ = sz; }
   const HTTPRequest& request() const { return request_; }
   HTTPRequest& request() { return request_; }
+  HTTPResponse& response() { return response_; }
+  std::deque<std::shared_ptr<HTTPResponder>>& pending() { return pending_; }
+  void setWebSocket(const std::shared_ptr<WebSocket>& ws) { webSocket_ = ws; }
+  const std::shared_ptr<WebSocket>& webSocket() const { return webSocket_; }
+  void setHTTP2(const std::shared_ptr<HTTP2Session>& s) { http2_ = s; }
+  const std::shared_ptr<HTTP2Session>& http2() const { return http2_; }
+  void setStream(const std::shared_ptr<HTTPStream>& s) { stream_ = s; }
+  const std::shared_ptr<HTTPStream>& stream() const { return stream_; }
 };
 } // namespace net
 } // namespace chtho
 
 
-#endif //! CHTHO_NET_HTTP_HTTPCONTEXT_H
\ No newline at end of file
+#endif //! CHTHO_NET_HTTP_HTTPCONTEXT_H
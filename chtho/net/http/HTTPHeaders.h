@@ -0,0 +1,94 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_NET_HTTP_HTTPHEADERS_H
+#define CHTHO_NET_HTTP_HTTPHEADERS_H
+
+#include "base/StringPiece.h"
+
+#include <vector>
+
+#include <strings.h> // strncasecmp
+
+namespace chtho
+{
+namespace net
+{
+// a flat array of header fields. keys and values are slices into
+// memory owned by someone else (usually the connection Buffer), so
+// adding a header never allocates once the array has warmed up.
+// lookups are linear and case-insensitive, which beats a map for
+// the couple dozen fields a message carries
+class HTTPHeaders
+{
+public:
+  struct Field
+  {
+    StringPiece key;
+    StringPiece val;
+  };
+  using const_iterator = std::vector<Field>::const_iterator;
+  static const size_t kInline = 32;
+private:
+  std::vector<Field> fields_;
+public:
+  HTTPHeaders() { fields_.reserve(kInline); }
+
+  void add(const StringPiece& key, const StringPiece& val)
+  {
+    Field f = { key, val };
+    fields_.push_back(f);
+  }
+  // returns an empty piece when the field is absent
+  StringPiece get(const StringPiece& key) const
+  {
+    for(const auto& f : fields_)
+    {
+      if(f.key.size() == key.size()
+        && ::strncasecmp(f.key.data(), key.data(), key.size()) == 0)
+        return f.val;
+    }
+    return StringPiece();
+  }
+  bool has(const StringPiece& key) const
+  {
+    for(const auto& f : fields_)
+    {
+      if(f.key.size() == key.size()
+        && ::strncasecmp(f.key.data(), key.data(), key.size()) == 0)
+        return true;
+    }
+    return false;
+  }
+  size_t size() const { return fields_.size(); }
+  bool empty() const { return fields_.empty(); }
+  const Field& operator[](size_t i) const { return fields_[i]; }
+  const_iterator begin() const { return fields_.begin(); }
+  const_iterator end() const { return fields_.end(); }
+  // keeps the capacity for the next message on the connection
+  void clear() { fields_.clear(); }
+
+  // the slices are plain pointers, when the memory they point to
+  // moves as a block (e.g. the Buffer grows) they are shifted by the
+  // same distance. only slices inside [from, from+len) are touched
+  void rebase(const char* from, size_t len, const char* to)
+  {
+    for(auto& f : fields_)
+    {
+      rebase(&f.key, from, len, to);
+      rebase(&f.val, from, len, to);
+    }
+  }
+  static void rebase(StringPiece* s, const char* from, size_t len, const char* to)
+  {
+    if(s->data() >= from && s->data() < from + len)
+      s->set(to + (s->data() - from), s->size());
+  }
+};
+} // namespace net
+} // namespace chtho
+
+
+#endif //! CHTHO_NET_HTTP_HTTPHEADERS_H
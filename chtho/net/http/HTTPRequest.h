@@ -7,32 +7,103 @@
 #define CHTHO_NET_HTTP_HTTPREQUEST_H
 
 #include "time/Timestamp.h"
+#include "HTTPHeaders.h"
 
-#include <map> 
+#include <string>
+
+#include <ctype.h> // isspace
 
 namespace chtho
 {
 namespace net
 {
+// HTTPRequest is a view: path, query, headers and (usually) the body
+// are slices into the connection Buffer the request was parsed from.
+// the Buffer is retired only after the handler returns, see
+// HTTPContext::retire. whoever needs the request beyond that (e.g. a
+// streamed upload spanning several reads) calls own() or copies it,
+// which moves every slice into a single string owned by the request
 class HTTPRequest
 {
 public:
   enum Method { Invalid, Get, Post, Head, Put, Delete };
-  enum Version { Unknown, HTTP10, HTTP11 };
+  enum Version { Unknown, HTTP10, HTTP11, HTTP2 };
 private:
   Method method_;
   Version version_;
-  std::string path_;
-  std::string query_;
+  StringPiece path_;
+  StringPiece query_;
   Timestamp rcvTime_;
-  std::map<std::string, std::string> headers_; 
+  HTTPHeaders headers_;
+  // path parameters filled in by HTTPRouter, e.g. id for '/users/:id'
+  HTTPHeaders params_;
+  StringPiece body_;
+  // a chunked body has to be decoded, it is collected here
+  std::string decodedBody_;
+  // backing store of the slices once the request owns its data
+  std::string storage_;
+  // set when the body was handed to the body stream callback
+  // piece by piece instead of being collected in body_
+  bool bodyStreamed_;
+
+  void copyFrom(const HTTPRequest& r)
+  {
+    method_ = r.method_;
+    version_ = r.version_;
+    rcvTime_ = r.rcvTime_;
+    bodyStreamed_ = r.bodyStreamed_;
+    path_ = r.path_;
+    query_ = r.query_;
+    headers_.clear();
+    for(const auto& f : r.headers_) headers_.add(f.key, f.val);
+    params_.clear();
+    for(const auto& f : r.params_) params_.add(f.key, f.val);
+    decodedBody_ = r.decodedBody_;
+    body_ = r.body_;
+    if(body_.data() == r.decodedBody_.data()) body_ = decodedBody_;
+    storage_.clear();
+    own();
+  }
+  void keep(StringPiece* s)
+  {
+    if(!s->empty())
+    {
+      size_t off = storage_.size();
+      storage_.append(s->data(), s->size());
+      // storage_ has been reserved, so off stays valid
+      s->set(storage_.data() + off, s->size());
+    }
+  }
 
 public:
-  HTTPRequest() : method_(Invalid), version_(Unknown) {} 
+  HTTPRequest() : method_(Invalid), version_(Unknown), bodyStreamed_(false) {}
+  HTTPRequest(const HTTPRequest& r) { copyFrom(r); }
+  HTTPRequest& operator=(const HTTPRequest& r)
+  {
+    if(this != &r) copyFrom(r);
+    return *this;
+  }
+  // prepares for the next request on the same connection,
+  // the header array keeps its capacity
+  void reset()
+  {
+    method_ = Invalid;
+    version_ = Unknown;
+    path_.clear();
+    query_.clear();
+    rcvTime_ = Timestamp();
+    headers_.clear();
+    params_.clear();
+    body_.clear();
+    decodedBody_.clear();
+    storage_.clear();
+    bodyStreamed_ = false;
+  }
   void setRcvTime(Timestamp t) { rcvTime_ = t; }
+  Timestamp rcvTime() const { return rcvTime_; }
   bool setMethod(const char* start, const char* end)
   {
-    std::string m(start, end);
+    StringPiece m(start, static_cast<int>(end-start));
     if(m == "GET") method_ = Get;
     else if(m == "POST") method_ = Post;
     else if(m == "HEAD") method_ = Head;
@@ -41,36 +112,102 @@ public:
     else method_ = Invalid;
     return method_ != Invalid;
   }
+  Method method() const { return method_; }
   // something like '/hello'
-  void setPath(const char* start, const char* end) { path_.assign(start, end); }
-  const std::string& path() const { return path_; }
+  void setPath(const char* start, const char* end)
+  { path_.set(start, static_cast<int>(end-start)); }
+  StringPiece path() const { return path_; }
   // 'hello?yourquery'
-  void setQuery(const char* start, const char* end) { query_.assign(start, end); }
-  // 'HTTP/1.0' or 'HTTP/1.1' 
+  void setQuery(const char* start, const char* end)
+  { query_.set(start, static_cast<int>(end-start)); }
+  StringPiece query() const { return query_; }
+  // 'HTTP/1.0' or 'HTTP/1.1', HTTP2 for requests of an HTTP2Session
   void setVersion(Version v) { version_ = v; }
   Version version() const { return version_; }
   void addHeader(const char* start, const char* colon, const char* end)
   {
-    std::string key(start, colon);
+    const char* key = start;
+    const char* keyEnd = colon;
     while(++colon < end && isspace(*colon)) /* empty */ ;
-    std::string val(colon, end);
-    while(!val.empty() && isspace(val[val.size()-1]))
-    {
-      val.resize(val.size()-1);
-    }
-    headers_[key] = val; 
+    while(end > colon && isspace(*(end-1))) --end;
+    headers_.add(StringPiece(key, static_cast<int>(keyEnd-key)),
+      StringPiece(colon, static_cast<int>(end-colon)));
   }
-  std::string getHeader(const std::string& key) const 
+  // a field that is already split, e.g. decoded by HPACK
+  void addHeader(const StringPiece& key, const StringPiece& val) { headers_.add(key, val); }
+  // empty when the header is absent, field names are case-insensitive
+  StringPiece getHeader(const StringPiece& key) const { return headers_.get(key); }
+  const HTTPHeaders& headers() const { return headers_; }
+  void addParam(const StringPiece& name, const StringPiece& val) { params_.add(name, val); }
+  void clearParams() { params_.clear(); }
+  // empty when the route has no such parameter
+  StringPiece param(const StringPiece& name) const { return params_.get(name); }
+  const HTTPHeaders& params() const { return params_; }
+
+  void setBody(const char* start, size_t len)
+  { body_.set(start, static_cast<int>(len)); }
+  void appendBody(const char* start, size_t len)
+  {
+    decodedBody_.append(start, len);
+    body_ = decodedBody_;
+  }
+  StringPiece body() const { return body_; }
+  void clearBody()
   {
-    std::string res;
-    auto it = headers_.find(key);
-    if(it != headers_.end()) res = it->second;
-    return res; 
+    decodedBody_.clear();
+    body_.clear();
+  }
+  void setBodyStreamed(bool on) { bodyStreamed_ = on; }
+  bool bodyStreamed() const { return bodyStreamed_; }
+
+  // shifts the slices pointing into [from, from+len) to 'to',
+  // called when the Buffer holding an incomplete request moves
+  void rebase(const char* from, size_t len, const char* to)
+  {
+    HTTPHeaders::rebase(&path_, from, len, to);
+    HTTPHeaders::rebase(&query_, from, len, to);
+    HTTPHeaders::rebase(&body_, from, len, to);
+    headers_.rebase(from, len, to);
+    params_.rebase(from, len, to);
+  }
+  // copies every slice that does not point into the request itself
+  // into storage_, after this the request is independent of the Buffer
+  // (and of the router the parameter names come from)
+  void own()
+  {
+    if(!storage_.empty()) return; // already owned
+    size_t total = path_.size() + query_.size();
+    for(const auto& f : headers_) total += f.key.size() + f.val.size();
+    for(const auto& f : params_) total += f.key.size() + f.val.size();
+    bool bodyOwned = body_.empty() || body_.data() == decodedBody_.data();
+    if(!bodyOwned) total += body_.size();
+    storage_.reserve(total);
+    keep(&path_);
+    keep(&query_);
+    HTTPHeaders fields;
+    for(const auto& f : headers_)
+    {
+      StringPiece key = f.key, val = f.val;
+      keep(&key);
+      keep(&val);
+      fields.add(key, val);
+    }
+    headers_ = fields;
+    fields.clear();
+    for(const auto& f : params_)
+    {
+      StringPiece key = f.key, val = f.val;
+      keep(&key);
+      keep(&val);
+      fields.add(key, val);
+    }
+    params_ = fields;
+    if(!bodyOwned) keep(&body_);
   }
 };
-  
+
 } // namespace net
 } // namespace chtho
 
 
-#endif //! CHTHO_NET_HTTP_HTTPREQUEST_H
\ No newline at end of file
+#endif //! CHTHO_NET_HTTP_HTTPREQUEST_H
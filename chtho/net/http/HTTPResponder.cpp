@@ -0,0 +1,87 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "HTTPResponder.h"
+#include "HTTP2Session.h"
+#include "HTTPCompressor.h"
+#include "HTTPContext.h"
+#include "HTTPStream.h"
+
+#include "net/EventLoop.h"
+#include "net/TcpConnection.h"
+
+namespace chtho
+{
+namespace net
+{
+HTTPResponder::HTTPResponder(const TcpConnPtr& conn, const HTTPRequest& req,
+  bool close, HTTPCompressor* compressor)
+  : conn_(conn),
+    loop_(conn->loop()),
+    request_(req), // a copy owns its data
+    response_(close),
+    compressor_(compressor),
+    done_(false),
+    ready_(false),
+    streamID_(0)
+{
+  response_.setHeadOnly(req.method() == HTTPRequest::Head);
+}
+
+void HTTPResponder::done()
+{
+  bool expected = false;
+  if(!done_.compare_exchange_strong(expected, true)) return;
+  // deflate on the worker, not on the IO loop
+  if(compressor_) compressor_->apply(request_, &response_);
+  // the loop may get the last reference after the worker lets go
+  HTTPResponderPtr self(shared_from_this());
+  loop_->runInLoop([self](){self->readyInLoop();});
+}
+
+void HTTPResponder::readyInLoop()
+{
+  loop_->assertInLoopThread();
+  ready_ = true;
+  TcpConnPtr conn = conn_.lock();
+  if(!conn || !conn->connected()) return;
+  HTTPContext* context = static_cast<HTTPContext*>(conn->context().get());
+  if(streamID_) context->http2()->respond(streamID_, &response_);
+  else flush(conn, context);
+}
+
+void HTTPResponder::flush(const TcpConnPtr& conn, HTTPContext* context)
+{
+  auto& pending = context->pending();
+  while(!pending.empty() && pending.front()->ready_)
+  {
+    HTTPResponderPtr r;
+    r.swap(pending.front());
+    pending.pop_front();
+    r->response_.writeTo(conn.get(), r->request_.rcvTime());
+    if(r->response_.close())
+    {
+      // whatever was pipelined after it will not be answered
+      pending.clear();
+      conn->flushOutputBuf();
+      conn->shutdown();
+      return;
+    }
+  }
+  // a stream behind them was held back until now
+  if(pending.empty() && context->stream()) context->stream()->release();
+  // and so was the interim response to the request being read
+  if(pending.empty() && context->continueDeferred())
+  {
+    context->deferContinue(false);
+    conn->outputBuf()->append("HTTP/1.1 100 Continue\r\n\r\n");
+  }
+  conn->flushOutputBuf();
+  // reading was paused while too many requests were in flight
+  if(pending.size() < HTTPContext::kMaxPending && !conn->isReading())
+    conn->startRead();
+}
+} // namespace net
+} // namespace chtho
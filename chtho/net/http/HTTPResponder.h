@@ -0,0 +1,71 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_NET_HTTP_HTTPRESPONDER_H
+#define CHTHO_NET_HTTP_HTTPRESPONDER_H
+
+#include "base/noncopyable.h"
+#include "net/Callbacks.h"
+#include "HTTPRequest.h"
+#include "HTTPResponse.h"
+
+#include <atomic>
+#include <memory>
+
+namespace chtho
+{
+namespace net
+{
+class EventLoop;
+class HTTPCompressor;
+class HTTPContext;
+
+// the handle given to an asynchronous HTTP handler (see
+// HTTPServer::setAsyncHTTPCB). it owns a copy of the request, so it
+// may be passed to a worker thread, filled in there and completed by
+// done() from any thread. completion hops back to the connection's
+// loop where the responses are written strictly in request order:
+// a response that is done early waits for the ones before it.
+// if the connection goes away in the meantime the response is dropped.
+// on an HTTP/2 connection the responder answers its stream instead,
+// streams complete in any order
+class HTTPResponder : noncopyable,
+  public std::enable_shared_from_this<HTTPResponder>
+{
+private:
+  std::weak_ptr<TcpConnection> conn_;
+  EventLoop* loop_;
+  HTTPRequest request_;
+  HTTPResponse response_;
+  HTTPCompressor* compressor_; // may be NULL
+  std::atomic<bool> done_; // done() has been called
+  bool ready_; // seen by the loop, only touched in the loop thread
+  uint32_t streamID_; // 0 for HTTP/1.x
+
+  void readyInLoop();
+public:
+  // the compressor, if any, runs in done() on the completing thread
+  HTTPResponder(const TcpConnPtr& conn, const HTTPRequest& req, bool close,
+    HTTPCompressor* compressor = NULL);
+  const HTTPRequest& request() const { return request_; }
+  HTTPResponse* response() { return &response_; }
+  // thread safe, the response must not be touched afterwards.
+  // calling it twice has no effect
+  void done();
+  bool isDone() const { return done_.load(std::memory_order_acquire); }
+  // set by HTTPServer before the handler sees the responder
+  void setStreamID(uint32_t id) { streamID_ = id; }
+  uint32_t streamID() const { return streamID_; }
+
+  // writes the ready responses at the head of the connection's
+  // queue, must be called in the loop thread
+  static void flush(const TcpConnPtr& conn, HTTPContext* context);
+};
+using HTTPResponderPtr = std::shared_ptr<HTTPResponder>;
+} // namespace net
+} // namespace chtho
+
+
+#endif // !CHTHO_NET_HTTP_HTTPRESPONDER_H
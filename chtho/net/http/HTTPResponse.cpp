@@ -6,35 +6,209 @@
 #include "HTTPResponse.h"
 
 #include "net/Buffer.h"
+#include "net/TcpConnection.h"
+
+#include <string.h> // memcpy
+#include <strings.h> // strncasecmp
+#include <time.h> // gmtime_r, strftime
 
 namespace chtho
 {
 namespace net
 {
+namespace
+{
+// the date line of the current second, per thread (i.e. per loop)
+struct DateCache
+{
+  time_t sec;
+  int len;
+  char buf[64];
+};
+__thread DateCache t_date = { -1, 0, { 0 } };
+
+// writes n in decimal at the end of [buf, end), returns the first digit
+char* formatSize(char* end, size_t n)
+{
+  char* p = end;
+  do
+  {
+    *--p = static_cast<char>('0' + n % 10);
+    n /= 10;
+  } while(n);
+  return p;
+}
+
+inline char* put(char* p, const char* s, size_t len)
+{
+  memcpy(p, s, len);
+  return p + len;
+}
+inline char* put(char* p, const StringPiece& s)
+{
+  return put(p, s.data(), s.size());
+}
+} // namespace
+
+#define CHTHO_STATUS_LINE(s) StringPiece("HTTP/1.1 " s "\r\n", sizeof("HTTP/1.1 " s "\r\n")-1)
+StringPiece HTTPResponse::statusLine(int code)
+{
+  switch (code)
+  {
+  case 100: return CHTHO_STATUS_LINE("100 Continue");
+  case 101: return CHTHO_STATUS_LINE("101 Switching Protocols");
+  case 200: return CHTHO_STATUS_LINE("200 OK");
+  case 201: return CHTHO_STATUS_LINE("201 Created");
+  case 204: return CHTHO_STATUS_LINE("204 No Content");
+  case 206: return CHTHO_STATUS_LINE("206 Partial Content");
+  case 301: return CHTHO_STATUS_LINE("301 Moved Permanently");
+  case 302: return CHTHO_STATUS_LINE("302 Found");
+  case 304: return CHTHO_STATUS_LINE("304 Not Modified");
+  case 400: return CHTHO_STATUS_LINE("400 Bad Request");
+  case 401: return CHTHO_STATUS_LINE("401 Unauthorized");
+  case 403: return CHTHO_STATUS_LINE("403 Forbidden");
+  case 404: return CHTHO_STATUS_LINE("404 Not Found");
+  case 405: return CHTHO_STATUS_LINE("405 Method Not Allowed");
+  case 413: return CHTHO_STATUS_LINE("413 Payload Too Large");
+  case 416: return CHTHO_STATUS_LINE("416 Range Not Satisfiable");
+  case 500: return CHTHO_STATUS_LINE("500 Internal Server Error");
+  case 503: return CHTHO_STATUS_LINE("503 Service Unavailable");
+  default: return StringPiece();
+  }
+}
+#undef CHTHO_STATUS_LINE
+
+StringPiece HTTPResponse::dateHeader(Timestamp t)
+{
+  time_t sec = t.valid() ? t.secsSinceE() : ::time(NULL);
+  if(sec != t_date.sec)
+  {
+    struct tm tm;
+    ::gmtime_r(&sec, &tm);
+    t_date.len = static_cast<int>(::strftime(t_date.buf, sizeof t_date.buf,
+      "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm));
+    t_date.sec = sec;
+  }
+  return StringPiece(t_date.buf, t_date.len);
+}
+
+void HTTPResponse::addHeader(const StringPiece& key, const StringPiece& val)
+{
+  Field f;
+  f.valOff = static_cast<uint32_t>(arena_.size());
+  f.valLen = static_cast<uint32_t>(val.size());
+  arena_.append(val.data(), val.size());
+  for(auto& old : fields_)
+  {
+    if(old.keyLen == static_cast<uint32_t>(key.size())
+      && ::strncasecmp(arena_.data() + old.keyOff, key.data(), key.size()) == 0)
+    {
+      // the old value stays in the arena until reset()
+      old.valOff = f.valOff;
+      old.valLen = f.valLen;
+      return;
+    }
+  }
+  f.keyOff = static_cast<uint32_t>(arena_.size());
+  f.keyLen = static_cast<uint32_t>(key.size());
+  arena_.append(key.data(), key.size());
+  fields_.push_back(f);
+}
+
+StringPiece HTTPResponse::getHeader(const StringPiece& key) const
+{
+  for(const auto& f : fields_)
+  {
+    if(f.keyLen == static_cast<uint32_t>(key.size())
+      && ::strncasecmp(arena_.data() + f.keyOff, key.data(), key.size()) == 0)
+      return slice(f.valOff, f.valLen);
+  }
+  return StringPiece();
+}
+
 void HTTPResponse::appendToBuf(Buffer* out) const
 {
-  char buf[32]; 
-  snprintf(buf, sizeof(buf), "HTTP/1.1 %d ", status_);
-  out->append(buf);
-  out->append(statusMsg_);
-  out->append("\r\n");
-  if(close_) out->append("Connection: close\r\n");
-  else
+  appendToBuf(out, Timestamp());
+}
+
+void HTTPResponse::appendToBuf(Buffer* out, Timestamp rcvTime) const
+{
+  static const char kCL[] = "Content-Length: ";
+  static const char kClose[] = "Connection: close\r\n";
+  static const char kKeepAlive[] = "Connection: Keep-Alive\r\n";
+  static const char kChunked[] = "Transfer-Encoding: chunked\r\n";
+  StringPiece line = statusLine(status_);
+  char custom[32];
+  bool customPhrase = false;
+  // the table line reads 'HTTP/1.1 200 OK\r\n', the phrase starts at 13
+  if(line.empty() || (!statusMsg_.empty()
+    && StringPiece(line.data() + 13, line.size() - 15) != statusMsg_))
   {
-    snprintf(buf, sizeof(buf), "Content-Length: %zd\r\n", body_.size());
-    out->append(buf);
-    out->append("Connection: Keep-Alive\r\n");
+    // unknown code or a non standard reason phrase, the number
+    // is formatted here and the phrase follows
+    char* end = custom + sizeof custom;
+    end[-1] = ' ';
+    char* p = formatSize(end - 1, static_cast<size_t>(status_));
+    p -= 9;
+    memcpy(p, "HTTP/1.1 ", 9);
+    line.set(p, static_cast<int>(end - p));
+    customPhrase = true;
   }
-  for(const auto& header : headers_)
+  StringPiece date = dateHeader(rcvTime);
+  // 1xx, 204 and 304 never carry a body
+  bool hasLength = status_ >= 200 && status_ != NoContent204
+    && status_ != NotModified304 && !streamed_;
+  bool chunked = streamed_ && !close_;
+  char len[24];
+  char* lenEnd = len + sizeof len;
+  char* lenBegin = formatSize(lenEnd, bodySize());
+  // the file body is not part of the buffer, see writeTo
+  StringPiece body;
+  if(!headOnly_ && !hasFile() && !streamed_)
+    body = bodyRef_.data() ? bodyRef_ : StringPiece(body_);
+
+  size_t total = line.size() + date.size() + 2 + body.size();
+  if(customPhrase) total += statusMsg_.size() + 2;
+  if(hasLength) total += sizeof kCL - 1 + (lenEnd - lenBegin) + 2;
+  if(chunked) total += sizeof kChunked - 1;
+  total += close_ ? sizeof kClose - 1 : sizeof kKeepAlive - 1;
+  for(const auto& f : fields_) total += f.keyLen + f.valLen + 4;
+
+  out->ensure(total);
+  char* start = out->writePtr();
+  char* p = put(start, line);
+  if(customPhrase)
   {
-    out->append(header.first);
-    out->append(": ");
-    out->append(header.second);
-    out->append("\r\n");
+    p = put(p, statusMsg_.data(), statusMsg_.size());
+    p = put(p, "\r\n", 2);
   }
-  out->append("\r\n");
-  out->append(body_);
+  p = put(p, date);
+  if(hasLength)
+  {
+    p = put(p, kCL, sizeof kCL - 1);
+    p = put(p, lenBegin, lenEnd - lenBegin);
+    p = put(p, "\r\n", 2);
+  }
+  if(chunked) p = put(p, kChunked, sizeof kChunked - 1);
+  if(close_) p = put(p, kClose, sizeof kClose - 1);
+  else p = put(p, kKeepAlive, sizeof kKeepAlive - 1);
+  for(const auto& f : fields_)
+  {
+    p = put(p, arena_.data() + f.keyOff, f.keyLen);
+    p = put(p, ": ", 2);
+    p = put(p, arena_.data() + f.valOff, f.valLen);
+    p = put(p, "\r\n", 2);
+  }
+  p = put(p, "\r\n", 2);
+  p = put(p, body);
+  assert(static_cast<size_t>(p - start) == total);
+  out->written(p - start);
+}
+void HTTPResponse::writeTo(TcpConnection* conn, Timestamp rcvTime) const
+{
+  appendToBuf(conn->outputBuf(), rcvTime);
+  if(hasFile() && !headOnly_)
+    conn->sendFile(fileFd_, fileOff_, fileLen_, owner_);
 }
-  
 } // namespace net
 } // namespace chtho
@@ -6,46 +6,176 @@
 #ifndef CHTHO_NET_HTTP_HTTPRESPONSE_H
 #define CHTHO_NET_HTTP_HTTPRESPONSE_H
 
+#include "base/StringPiece.h"
+#include "time/Timestamp.h"
 
-#include <map>
-#include <string> 
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+#include <sys/types.h> // off_t
 
 namespace chtho
 {
 namespace net
 {
 class Buffer;
+class TcpConnection;
+// HTTPResponse is reused for every request of a connection (see
+// HTTPContext::response), reset() keeps the capacity of the header
+// arena, the field array and the body, so once a connection has
+// warmed up building and serializing a response does not allocate.
+// header fields are stored as offsets into one arena string so the
+// keys and values stay addressable (e.g. for HPACK) without a map
 class HTTPResponse
 {
 public:
-  enum Status { Unknown, OK200 = 200, 
+  enum Status { Unknown,
+    Continue100 = 100,
+    SwitchingProtocols101 = 101,
+    OK200 = 200,
+    Created201 = 201,
+    NoContent204 = 204,
+    PartialContent206 = 206,
     MovedPermanently301 = 301,
+    Found302 = 302,
+    NotModified304 = 304,
     BadRequest400 = 400,
-    NotFound404 = 404, 
+    Unauthorized401 = 401,
+    Forbidden403 = 403,
+    NotFound404 = 404,
+    MethodNotAllowed405 = 405,
+    PayloadTooLarge413 = 413,
+    RangeNotSatisfiable416 = 416,
+    InternalServerError500 = 500,
+    ServiceUnavailable503 = 503,
   };
+  static const size_t kInlineFields = 16;
+  static const size_t kArenaSz = 512;
 private:
-  Status status_; 
-  bool close_; 
+  struct Field
+  {
+    uint32_t keyOff;
+    uint32_t keyLen;
+    uint32_t valOff;
+    uint32_t valLen;
+  };
+  Status status_;
+  bool close_;
   std::string statusMsg_;
-  std::map<std::string, std::string> headers_; 
+  std::vector<Field> fields_;
+  std::string arena_; // bytes of all header keys and values
   std::string body_;
+  // a body that lives elsewhere (e.g. an mmap'ed file), or a file
+  // region sent with sendfile(2). owner keeps either alive
+  StringPiece bodyRef_;
+  int fileFd_;
+  off_t fileOff_;
+  size_t fileLen_;
+  std::shared_ptr<void> owner_;
+  bool headOnly_; // answering a HEAD request: headers but no body
+  bool cacheable_; // the body is the same for many requests
+  bool streamed_; // the body follows the head piece by piece, see HTTPStream
 
+  StringPiece slice(uint32_t off, uint32_t len) const
+  { return StringPiece(arena_.data() + off, static_cast<int>(len)); }
 public:
-  explicit HTTPResponse(bool close)
+  explicit HTTPResponse(bool close = false)
     : status_(Unknown),
-      close_(close)
-  {}
+      close_(close),
+      fileFd_(-1),
+      fileOff_(0),
+      fileLen_(0),
+      headOnly_(false),
+      cacheable_(false),
+      streamed_(false)
+  {
+    fields_.reserve(kInlineFields);
+    arena_.reserve(kArenaSz);
+  }
+  // prepares for the next request on the same connection
+  void reset(bool close)
+  {
+    status_ = Unknown;
+    close_ = close;
+    statusMsg_.clear();
+    fields_.clear();
+    arena_.clear();
+    body_.clear();
+    bodyRef_.clear();
+    fileFd_ = -1;
+    fileOff_ = 0;
+    fileLen_ = 0;
+    owner_.reset();
+    headOnly_ = false;
+    cacheable_ = false;
+    streamed_ = false;
+  }
   void setStatus(Status s) { status_ = s; }
+  Status status() const { return status_; }
+  // only needed for a reason phrase other than the standard one
   void setStatusMsg(const std::string& msg) { statusMsg_ = msg; }
   void setClose(bool on) { close_ = on; }
   bool close() const { return close_; }
-  void setContentType(const std::string& type) { addHeader("Content-Type", type); }
-  void addHeader(const std::string& key, const std::string& val)
-  { headers_[key] = val; }
-  void setBody(const std::string& body) { body_ = body; }
+  void setContentType(const StringPiece& type) { addHeader("Content-Type", type); }
+  // a field that is already present is replaced
+  void addHeader(const StringPiece& key, const StringPiece& val);
+  StringPiece getHeader(const StringPiece& key) const;
+  size_t numHeaders() const { return fields_.size(); }
+  StringPiece headerKey(size_t i) const { return slice(fields_[i].keyOff, fields_[i].keyLen); }
+  StringPiece headerVal(size_t i) const { return slice(fields_[i].valOff, fields_[i].valLen); }
+
+  void setBody(const StringPiece& body) { body_.assign(body.data(), body.size()); }
+  void appendBody(const StringPiece& body) { body_.append(body.data(), body.size()); }
+  // to build the body in place
+  std::string* mutableBody() { return &body_; }
+  const std::string& body() const { return body_; }
+  // the body is data, which stays valid as long as owner lives.
+  // it is copied straight into the output buffer
+  void setBodyRef(const StringPiece& data, const std::shared_ptr<void>& owner)
+  { bodyRef_ = data; fileFd_ = -1; owner_ = owner; }
+  StringPiece bodyRef() const { return bodyRef_; }
+  // the body is [off, off+len) of fd, sent without copying it
+  // through user space. owner keeps fd open
+  void setFile(int fd, off_t off, size_t len, const std::shared_ptr<void>& owner)
+  { fileFd_ = fd; fileOff_ = off; fileLen_ = len; bodyRef_.clear(); owner_ = owner; }
+  bool hasFile() const { return fileFd_ >= 0; }
+  int fileFd() const { return fileFd_; }
+  off_t fileOff() const { return fileOff_; }
+  size_t fileLen() const { return fileLen_; }
+  const std::shared_ptr<void>& owner() const { return owner_; }
+  // Content-Length as usual but no body, set by HTTPServer for HEAD
+  void setHeadOnly(bool on) { headOnly_ = on; }
+  bool headOnly() const { return headOnly_; }
+  // the head announces 'Transfer-Encoding: chunked' instead of a
+  // Content-Length, or nothing at all when the connection closes
+  // after the body. the body itself is not part of the response
+  void setStreamed(bool on) { streamed_ = on; }
+  bool streamed() const { return streamed_; }
+  // marks a dynamic body as repeatable (e.g. a rendered page served
+  // to everyone), HTTPCompressor then caches its compressed form.
+  // bodies from setBodyRef/setFile are taken to be repeatable
+  void setCacheable(bool on) { cacheable_ = on; }
+  bool cacheable() const { return cacheable_ || bodyRef_.data() || hasFile(); }
+  size_t bodySize() const
+  { return hasFile() ? fileLen_ : bodyRef_.data() ? bodyRef_.size() : body_.size(); }
+
+  // serializes the whole response into buf with a single reservation,
+  // rcvTime (the request's receive time) drives the cached Date header
+  void appendToBuf(Buffer* buf, Timestamp rcvTime) const;
   void appendToBuf(Buffer* buf) const;
+  // appendToBuf into the connection's output buffer, followed by the
+  // file body if there is one. the caller flushes. loop thread only
+  void writeTo(TcpConnection* conn, Timestamp rcvTime) const;
+
+  // 'HTTP/1.1 200 OK\r\n' for the known codes, empty otherwise
+  static StringPiece statusLine(int code);
+  // 'Date: Sun, 14 Mar 2021 08:00:00 GMT\r\n' for the second of t,
+  // formatted at most once per second per thread
+  static StringPiece dateHeader(Timestamp t);
 };
 } // namespace net
 } // namespace chtho
 
-#endif //! CHTHO_NET_HTTP_HTTPRESPONSE_H
\ No newline at end of file
+#endif //! CHTHO_NET_HTTP_HTTPRESPONSE_H
@@ -0,0 +1,320 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "HTTPRouter.h"
+
+#include "logging/Logger.h"
+
+#include <memory>
+
+#include <assert.h>
+#include <string.h> // memchr, memcmp
+
+namespace chtho
+{
+namespace net
+{
+// the tree while routes are inserted, pointer based so nodes can
+// be split. compile() flattens it and throws it away
+struct HTTPRouter::BuildNode
+{
+  Kind kind;
+  std::string text;
+  std::vector<std::unique_ptr<BuildNode>> children;
+  std::unique_ptr<BuildNode> param;
+  std::unique_ptr<BuildNode> wildcard;
+  int handlers[kMethods];
+
+  explicit BuildNode(Kind k, const std::string& t = std::string())
+    : kind(k), text(t)
+  {
+    for(int i = 0; i < kMethods; ++i) handlers[i] = -1;
+  }
+};
+
+namespace
+{
+// ':' and '*' start a parameter only at the beginning of a segment
+const char* findSpecial(const char* p, const char* end)
+{
+  for(const char* q = p; q < end; ++q)
+  {
+    if((*q == ':' || *q == '*') && q != p && q[-1] == '/') return q;
+  }
+  return end;
+}
+} // namespace
+
+void HTTPRouter::add(HTTPRequest::Method method, const std::string& pattern,
+  const HTTPCB& cb)
+{
+  assert(!compiled_);
+  assert(method != HTTPRequest::Invalid);
+  Route r = { method, pattern, Handler() };
+  r.handler.sync = cb;
+  routes_.push_back(r);
+}
+
+void HTTPRouter::addAsync(HTTPRequest::Method method, const std::string& pattern,
+  const AsyncHTTPCB& cb)
+{
+  assert(!compiled_);
+  assert(method != HTTPRequest::Invalid);
+  Route r = { method, pattern, Handler() };
+  r.handler.async = cb;
+  routes_.push_back(r);
+}
+
+void HTTPRouter::addStream(HTTPRequest::Method method, const std::string& pattern,
+  const StreamCB& cb)
+{
+  assert(!compiled_);
+  assert(method != HTTPRequest::Invalid);
+  Route r = { method, pattern, Handler() };
+  r.handler.stream = cb;
+  routes_.push_back(r);
+}
+
+// p is at a segment start inside n's subtree
+void HTTPRouter::insert(BuildNode* n, const char* p, const char* end, int route)
+{
+  const Route& r = routes_[route];
+  if(p == end)
+  {
+    if(n->handlers[r.method] >= 0)
+      LOG_FATAL << "HTTPRouter: duplicate route " << r.pattern;
+    n->handlers[r.method] = route;
+    return;
+  }
+  if(*p == ':')
+  {
+    const char* q = static_cast<const char*>(memchr(p, '/', end - p));
+    if(!q) q = end;
+    std::string name(p + 1, q);
+    if(name.empty() || name.find_first_of(":*") != std::string::npos)
+      LOG_FATAL << "HTTPRouter: bad parameter in " << r.pattern;
+    if(!n->param) n->param.reset(new BuildNode(Param, name));
+    else if(n->param->text != name)
+      LOG_FATAL << "HTTPRouter: parameter :" << name << " in " << r.pattern
+        << " conflicts with :" << n->param->text;
+    insert(n->param.get(), q, end, route);
+  }
+  else if(*p == '*')
+  {
+    std::string name(p + 1, end);
+    if(name.empty() || name.find_first_of("/:*") != std::string::npos)
+      LOG_FATAL << "HTTPRouter: wildcard must be the last segment in " << r.pattern;
+    if(!n->wildcard) n->wildcard.reset(new BuildNode(Wildcard, name));
+    else if(n->wildcard->text != name)
+      LOG_FATAL << "HTTPRouter: wildcard *" << name << " in " << r.pattern
+        << " conflicts with *" << n->wildcard->text;
+    insert(n->wildcard.get(), end, end, route);
+  }
+  else
+  {
+    const char* q = findSpecial(p, end);
+    insertStatic(n, p, q, end, route);
+  }
+}
+
+// inserts the static text [p, q) below n, splitting the edge that
+// shares a prefix with it, then goes on with [q, end)
+void HTTPRouter::insertStatic(BuildNode* n, const char* p, const char* q,
+  const char* end, int route)
+{
+  for(auto& child : n->children)
+  {
+    if(child->text[0] != *p) continue;
+    size_t common = 0;
+    size_t len = std::min(child->text.size(), static_cast<size_t>(q - p));
+    while(common < len && child->text[common] == p[common]) ++common;
+    if(common < child->text.size())
+    {
+      std::unique_ptr<BuildNode> mid(new BuildNode(Static, child->text.substr(0, common)));
+      child->text.erase(0, common);
+      mid->children.push_back(std::move(child));
+      child = std::move(mid);
+    }
+    p += common;
+    if(p == q) insert(child.get(), q, end, route);
+    else insertStatic(child.get(), p, q, end, route);
+    return;
+  }
+  n->children.emplace_back(new BuildNode(Static, std::string(p, q)));
+  insert(n->children.back().get(), q, end, route);
+}
+
+// lays n and its subtree out in nodes_, the static children of a
+// node get consecutive slots in children_ and firsts_
+uint32_t HTTPRouter::flatten(const BuildNode* n)
+{
+  uint32_t idx = static_cast<uint32_t>(nodes_.size());
+  nodes_.push_back(Node());
+  Node node;
+  node.kind = n->kind;
+  node.textOff = static_cast<uint32_t>(text_.size());
+  node.textLen = static_cast<uint32_t>(n->text.size());
+  text_ += n->text;
+  for(int i = 0; i < kMethods; ++i) node.handlers[i] = n->handlers[i];
+  node.numChildren = static_cast<uint32_t>(n->children.size());
+  node.childBegin = static_cast<uint32_t>(children_.size());
+  children_.resize(children_.size() + node.numChildren);
+  firsts_.resize(children_.size());
+  for(uint32_t i = 0; i < node.numChildren; ++i)
+  {
+    firsts_[node.childBegin + i] = n->children[i]->text[0];
+    uint32_t c = flatten(n->children[i].get());
+    children_[node.childBegin + i] = c;
+  }
+  node.param = n->param ? static_cast<int32_t>(flatten(n->param.get())) : -1;
+  node.wildcard = n->wildcard ? static_cast<int32_t>(flatten(n->wildcard.get())) : -1;
+  nodes_[idx] = node;
+  return idx;
+}
+
+void HTTPRouter::compile()
+{
+  BuildNode root(Static);
+  for(size_t i = 0; i < routes_.size(); ++i)
+  {
+    const std::string& pattern = routes_[i].pattern;
+    if(pattern.empty() || pattern[0] != '/')
+      LOG_FATAL << "HTTPRouter: pattern must start with '/': " << pattern;
+    int params = 0;
+    for(size_t j = 1; j < pattern.size(); ++j)
+      if(pattern[j-1] == '/' && (pattern[j] == ':' || pattern[j] == '*')) ++params;
+    if(params > kMaxParams)
+      LOG_FATAL << "HTTPRouter: too many parameters in " << pattern;
+    insert(&root, pattern.data(), pattern.data() + pattern.size(), static_cast<int>(i));
+  }
+  nodes_.clear();
+  children_.clear();
+  firsts_.clear();
+  text_.clear();
+  flatten(&root);
+  compiled_ = true;
+}
+
+int HTTPRouter::handlerOf(const Node& n, int method) const
+{
+  int h = n.handlers[method];
+  if(h < 0 && method == HTTPRequest::Head) h = n.handlers[HTTPRequest::Get];
+  return h;
+}
+
+// [p, end) is what is left of the path after node idx matched.
+// returns the route or -1, vals collects the parameter values.
+// pathOnly remembers a node that matched the path but not the method
+int HTTPRouter::matchNode(uint32_t idx, const char* p, const char* end,
+  int method, StringPiece* vals, int nvals, int* pathOnly) const
+{
+  const Node& n = nodes_[idx];
+  if(p == end)
+  {
+    int h = handlerOf(n, method);
+    if(h >= 0) return h;
+    if(*pathOnly < 0)
+    {
+      for(int i = 0; i < kMethods; ++i)
+        if(n.handlers[i] >= 0) *pathOnly = static_cast<int>(idx);
+    }
+  }
+  else if(n.numChildren > 0)
+  {
+    const char* first = firsts_.data() + n.childBegin;
+    const void* hit = memchr(first, *p, n.numChildren);
+    if(hit)
+    {
+      uint32_t c = children_[n.childBegin + (static_cast<const char*>(hit) - first)];
+      const Node& child = nodes_[c];
+      if(static_cast<uint32_t>(end - p) >= child.textLen
+        && memcmp(p, text_.data() + child.textOff, child.textLen) == 0)
+      {
+        int h = matchNode(c, p + child.textLen, end, method, vals, nvals, pathOnly);
+        if(h >= 0) return h;
+      }
+    }
+  }
+  if(n.param >= 0 && p != end)
+  {
+    const char* q = static_cast<const char*>(memchr(p, '/', end - p));
+    if(!q) q = end;
+    if(q != p)
+    {
+      vals[nvals].set(p, static_cast<int>(q - p));
+      int h = matchNode(static_cast<uint32_t>(n.param), q, end, method,
+        vals, nvals + 1, pathOnly);
+      if(h >= 0) return h;
+    }
+  }
+  if(n.wildcard >= 0)
+  {
+    const Node& w = nodes_[n.wildcard];
+    int h = handlerOf(w, method);
+    if(h >= 0)
+    {
+      vals[nvals].set(p, static_cast<int>(end - p));
+      return h;
+    }
+    if(*pathOnly < 0) *pathOnly = n.wildcard;
+  }
+  return -1;
+}
+
+const HTTPRouter::Handler* HTTPRouter::match(HTTPRequest* req, Result* res) const
+{
+  assert(compiled_);
+  StringPiece path = req->path();
+  StringPiece vals[kMaxParams + 1];
+  int pathOnly = -1;
+  int h = nodes_.empty() ? -1 : matchNode(0, path.data(), path.data() + path.size(),
+    req->method(), vals, 0, &pathOnly);
+  if(h < 0)
+  {
+    *res = pathOnly >= 0 ? MethodNotAllowed : NotFound;
+    return NULL;
+  }
+  // walk the pattern again for the parameter names, only the
+  // matched route pays for it
+  const std::string& pattern = routes_[h].pattern;
+  int i = 0;
+  for(size_t j = 1; j < pattern.size(); ++j)
+  {
+    if(pattern[j-1] != '/' || (pattern[j] != ':' && pattern[j] != '*')) continue;
+    size_t k = pattern.find('/', j);
+    if(k == std::string::npos) k = pattern.size();
+    req->addParam(StringPiece(pattern.data() + j + 1, static_cast<int>(k - j - 1)), vals[i++]);
+  }
+  *res = Found;
+  return &routes_[h].handler;
+}
+
+std::string HTTPRouter::allowed(const StringPiece& path) const
+{
+  assert(compiled_);
+  static const struct { HTTPRequest::Method method; const char* name; } kNames[] = {
+    { HTTPRequest::Get, "GET" }, { HTTPRequest::Head, "HEAD" }, { HTTPRequest::Post, "POST" },
+    { HTTPRequest::Put, "PUT" }, { HTTPRequest::Delete, "DELETE" },
+  };
+  std::string allow;
+  if(nodes_.empty()) return allow;
+  // no route has Invalid, so the walk ends on the node match() found
+  // the path at
+  StringPiece vals[kMaxParams + 1];
+  int pathOnly = -1;
+  matchNode(0, path.data(), path.data() + path.size(), HTTPRequest::Invalid,
+    vals, 0, &pathOnly);
+  if(pathOnly < 0) return allow;
+  const Node& n = nodes_[pathOnly];
+  for(const auto& m : kNames)
+  {
+    if(handlerOf(n, m.method) < 0) continue;
+    if(!allow.empty()) allow += ", ";
+    allow += m.name;
+  }
+  return allow;
+}
+} // namespace net
+} // namespace chtho
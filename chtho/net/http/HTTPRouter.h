@@ -0,0 +1,118 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_NET_HTTP_HTTPROUTER_H
+#define CHTHO_NET_HTTP_HTTPROUTER_H
+
+#include "base/noncopyable.h"
+#include "HTTPRequest.h"
+#include "HTTPResponder.h"
+#include "HTTPStream.h"
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace chtho
+{
+namespace net
+{
+class HTTPResponse;
+
+// maps method + path patterns to handlers. a pattern is a path in
+// which whole segments may be
+//   :name   matches one non-empty segment
+//   *name   matches the rest of the path (possibly empty), must be last
+// e.g. '/users/:id/posts' or '/static/*file'. the matched values are
+// available as HTTPRequest::param("id").
+// routes are registered up front and compiled by compile() into a
+// radix tree laid out in flat arrays, matching walks it without
+// allocating. static segments win over parameters, parameters over
+// wildcards, with backtracking ('/users/new' and '/users/:id' coexist).
+// a HEAD request falls back to the GET handler
+class HTTPRouter : noncopyable
+{
+public:
+  using HTTPCB = std::function<void(const HTTPRequest&, HTTPResponse*)>;
+  using AsyncHTTPCB = std::function<void(const HTTPResponderPtr&)>;
+  using StreamCB = std::function<void(const HTTPRequest&, const HTTPStreamPtr&)>;
+  // exactly one of them is set
+  struct Handler
+  {
+    HTTPCB sync;
+    AsyncHTTPCB async;
+    StreamCB stream;
+  };
+  enum Result { Found, NotFound, MethodNotAllowed };
+  static const int kMaxParams = 16;
+private:
+  static const int kMethods = HTTPRequest::Delete + 1;
+  struct Route
+  {
+    HTTPRequest::Method method;
+    std::string pattern;
+    Handler handler;
+  };
+  enum Kind : uint8_t { Static, Param, Wildcard };
+  // the compiled tree: a node matches its text (static nodes) or a
+  // segment (param and wildcard nodes), its static children are
+  // children_[childBegin, childBegin+numChildren) and firsts_ holds
+  // their first bytes at the same positions
+  struct Node
+  {
+    uint32_t textOff; // static text, or the parameter name
+    uint32_t textLen;
+    uint32_t childBegin;
+    uint32_t numChildren;
+    int32_t param; // index of the ':name' child or -1
+    int32_t wildcard; // index of the '*name' child or -1
+    int32_t handlers[kMethods]; // index into routes_ or -1
+    Kind kind;
+  };
+  struct BuildNode;
+
+  std::vector<Route> routes_;
+  std::vector<Node> nodes_;
+  std::vector<uint32_t> children_;
+  std::string firsts_;
+  std::string text_;
+  bool compiled_;
+
+  void insert(BuildNode* n, const char* p, const char* end, int route);
+  void insertStatic(BuildNode* n, const char* p, const char* q,
+    const char* end, int route);
+  uint32_t flatten(const BuildNode* n);
+  int matchNode(uint32_t idx, const char* p, const char* end, int method,
+    StringPiece* vals, int nvals, int* pathOnly) const;
+  int handlerOf(const Node& n, int method) const;
+  StringPiece text(const Node& n) const
+  { return StringPiece(text_.data() + n.textOff, static_cast<int>(n.textLen)); }
+public:
+  HTTPRouter() : compiled_(false) {}
+  // registration must happen before compile(), an invalid or
+  // duplicate pattern is fatal
+  void add(HTTPRequest::Method method, const std::string& pattern, const HTTPCB& cb);
+  void addAsync(HTTPRequest::Method method, const std::string& pattern,
+    const AsyncHTTPCB& cb);
+  void addStream(HTTPRequest::Method method, const std::string& pattern,
+    const StreamCB& cb);
+  void compile();
+  bool empty() const { return routes_.empty(); }
+  size_t size() const { return routes_.size(); }
+  size_t numNodes() const { return nodes_.size(); }
+  // looks up the request's method and path, on success the path
+  // parameters are added to req
+  const Handler* match(HTTPRequest* req, Result* res) const;
+  // the methods path has handlers for, as the Allow header of a 405
+  // lists them, e.g. "GET, HEAD, POST". empty if there are none
+  std::string allowed(const StringPiece& path) const;
+};
+} // namespace net
+} // namespace chtho
+
+
+#endif // !CHTHO_NET_HTTP_HTTPROUTER_H
@@ -7,6 +7,9 @@
 
 #include "HTTPContext.h"
 #include "HTTPResponse.h"
+#include "WebSocket.h"
+
+#include <algorithm>
 
 namespace chtho
 {
@@ -23,48 +26,334 @@ void defaultHTTPCB(const HTTPRequest&, HTTPResponse* resp)
 HTTPServer::HTTPServer(EventLoop* loop, const InetAddr& listenAddr, 
                         const std::string& name, TcpServer::PortOpt opt)
   : server_(loop, listenAddr, name, opt),
-    httpCB_(defaultHTTPCB)
+    httpCB_(defaultHTTPCB),
+    maxBodySz_(8*1024*1024), // 8 MB
+    streamThreshold_(64*1024), // 64 KB
+    http2_(false)
 {
+  // the methods the path has go to the Allow header, RFC 9110 wants it
+  notAllowedCB_ = [this](const HTTPRequest& req, HTTPResponse* resp)
+  {
+    resp->setStatus(HTTPResponse::MethodNotAllowed405);
+    resp->addHeader("Allow", router_.allowed(req.path()));
+  };
   server_.setConnCB([this](const TcpConnPtr& conn){this->onConn(conn);});
   server_.setMsgCB([this](const TcpConnPtr& conn, Buffer* buf, Timestamp rcvTime){
     this->onMsg(conn, buf, rcvTime);
   });
+  server_.setCloseCB([this](const TcpConnPtr& conn){this->onClose(conn);});
 }  
 void HTTPServer::start()
 {
   LOG_WARN << "HTTP server " << server_.name() << " starts listening on "
     << server_.ipPort();
+  if(!router_.empty()) router_.compile();
   server_.start();
 }
+// the parsing context lives with the connection, so requests
+// (and their bodies) may span several reads
 void HTTPServer::onConn(const TcpConnPtr& conn)
 {
   LOG_INFO << "HTTPServer::onConn";
+  std::shared_ptr<HTTPContext> context(new HTTPContext);
+  context->setMaxBodySz(maxBodySz_);
+  if(bodyCB_)
+  {
+    context->setBodyCB(bodyCB_);
+    context->setStreamThreshold(streamThreshold_);
+  }
+  conn->setContext(context);
+}
+void HTTPServer::onClose(const TcpConnPtr& conn)
+{
+  HTTPContext* context = static_cast<HTTPContext*>(conn->context().get());
+  if(context && context->webSocket()) context->webSocket()->handleClose();
+  if(context && context->stream()) context->stream()->handleClose();
 }
 void HTTPServer::onMsg(const TcpConnPtr& conn, Buffer* buf, Timestamp rcvTime)
 {
-  HTTPContext context;
-  bool ok = context.parse(buf, rcvTime);
-  if(!ok)
+  HTTPContext* context = static_cast<HTTPContext*>(conn->context().get());
+  if(context->webSocket())
   {
-    conn->send("HTTP/1.1 400 Bad Request\r\n\r\n");
-    conn->shutdown();
+    context->webSocket()->handleMsg(buf);
+    return;
   }
-  if(context.done()) onReq(conn, context.request());
+  if(context->http2())
+  {
+    context->http2()->handleMsg(buf, rcvTime);
+    return;
+  }
+  // pipelined requests wait for the stream to end, but reading goes
+  // on (so a closing peer is noticed) until a header's worth piles up
+  if(context->stream())
+  {
+    if(buf->readableBytes() > HTTPContext::kMaxHeaderSz) conn->stopRead();
+    return;
+  }
+  // prior knowledge: the client starts right away with the preface
+  if(http2_ && context->idle() && context->pending().empty())
+  {
+    size_t n = std::min(buf->readableBytes(), HTTP2Session::kPrefaceLen);
+    if(HTTP2Session::maybePreface(buf->peek(), n))
+    {
+      if(n < HTTP2Session::kPrefaceLen) return; // wait for the rest
+      startHTTP2(conn, context)->start();
+      context->http2()->handleMsg(buf, rcvTime);
+      return;
+    }
+  }
+  // a request was malformed, the rest of the input is ignored while
+  // the responses before its error go out. reading goes on, so a
+  // closing peer is noticed
+  if(context->error() != HTTPContext::NoError)
+  {
+    buf->retrieveAll();
+    return;
+  }
+  // pipelined requests may arrive within a single read
+  while(conn->connected())
+  {
+    if(!context->parse(buf, rcvTime))
+    {
+      buf->retrieveAll();
+      bool tooLarge = context->error() == HTTPContext::TooLarge;
+      if(context->pending().empty())
+      {
+        if(tooLarge)
+          conn->send("HTTP/1.1 413 Payload Too Large\r\n"
+            "Connection: close\r\n\r\n");
+        else conn->send("HTTP/1.1 400 Bad Request\r\n\r\n");
+        conn->shutdown();
+        break;
+      }
+      // behind the responses owed to the requests before, it closes
+      // the connection once they are out
+      HTTPRequest req;
+      req.setRcvTime(rcvTime);
+      HTTPResponderPtr responder(new HTTPResponder(conn, req, true));
+      responder->response()->setStatus(tooLarge ? HTTPResponse::PayloadTooLarge413
+        : HTTPResponse::BadRequest400);
+      context->pending().push_back(responder);
+      responder->done();
+      break;
+    }
+    if(context->expectContinue())
+    {
+      // not before the responses to the requests before this one
+      if(context->pending().empty()) conn->send("HTTP/1.1 100 Continue\r\n\r\n");
+      else context->deferContinue(true);
+    }
+    if(!context->done()) break;
+    // the body came without waiting for it
+    context->deferContinue(false);
+    onReq(conn, context);
+    // the request was a view into buf, drop its bytes only now
+    context->retire(buf);
+    // the connection has switched protocols, what follows are frames
+    if(context->webSocket())
+    {
+      context->webSocket()->handleMsg(buf);
+      return;
+    }
+    if(context->http2())
+    {
+      context->http2()->handleMsg(buf, rcvTime);
+      return;
+    }
+    if(context->stream()) break;
+  }
+  // responses to pipelined requests leave in a single write
+  conn->flushOutputBuf();
 }
 // will be called by HTTPServer::onMsg
 // and will call user provided httpCB 
-void HTTPServer::onReq(const TcpConnPtr& conn, const HTTPRequest& req)
+// a synchronous response is serialized straight into the connection's
+// output buffer, onMsg flushes it after the last pipelined request.
+// an asynchronous one, or any response while asynchronous ones are
+// still in flight, is queued behind them
+void HTTPServer::onReq(const TcpConnPtr& conn, HTTPContext* context)
 {
-  const std::string& c = req.getHeader("Connection");
+  HTTPRequest& req = context->request();
+  if(webSocketCB_ && WebSocket::isUpgrade(req))
+  {
+    upgrade(conn, context);
+    return;
+  }
+  if(http2_ && upgradeHTTP2(conn, context)) return;
+  StringPiece c = req.getHeader("Connection");
   bool close = false;
   if(c == "close") close = true;
   if(req.version() == HTTPRequest::HTTP10 && c != "Keep-Alive") close = true;
-  HTTPResponse resp(close);
-  httpCB_(req, &resp);
-  Buffer buf;
-  resp.appendToBuf(&buf);
-  conn->send(&buf);
-  if(resp.close()) conn->shutdown();
+  const HTTPCB* sync;
+  const AsyncHTTPCB* async;
+  const StreamCB* stream;
+  findHandler(&req, &sync, &async, &stream);
+  if(stream)
+  {
+    startStream(conn, context, close, *stream);
+    return;
+  }
+  if(async || !context->pending().empty())
+  {
+    HTTPResponderPtr responder(new HTTPResponder(conn, req, close, compressor_.get()));
+    context->pending().push_back(responder);
+    if(context->pending().size() >= HTTPContext::kMaxPending)
+      conn->stopRead();
+    if(async) (*async)(responder);
+    else
+    {
+      (*sync)(responder->request(), responder->response());
+      responder->done();
+    }
+    return;
+  }
+  HTTPResponse* resp = &context->response();
+  resp->reset(close);
+  resp->setHeadOnly(req.method() == HTTPRequest::Head);
+  (*sync)(req, resp);
+  if(compressor_) compressor_->apply(req, resp);
+  resp->writeTo(conn.get(), req.rcvTime());
+  if(resp->close())
+  {
+    conn->flushOutputBuf();
+    conn->shutdown();
+  }
+}
+// routes first, then the catch-all handlers
+void HTTPServer::findHandler(HTTPRequest* req, const HTTPCB** sync,
+  const AsyncHTTPCB** async, const StreamCB** stream)
+{
+  *sync = &httpCB_;
+  *async = asyncHTTPCB_ ? &asyncHTTPCB_ : nullptr;
+  *stream = nullptr;
+  if(router_.empty()) return;
+  HTTPRouter::Result res;
+  const HTTPRouter::Handler* h = router_.match(req, &res);
+  if(h)
+  {
+    *sync = &h->sync;
+    *async = h->async ? &h->async : nullptr;
+    *stream = h->stream ? &h->stream : nullptr;
+  }
+  else if(res == HTTPRouter::MethodNotAllowed)
+  {
+    *sync = &notAllowedCB_;
+    *async = nullptr;
+  }
+}
+// a stream of an HTTP/2 connection. streams are independent, so a
+// synchronous response is sent at once even while asynchronous ones
+// on other streams are in flight
+void HTTPServer::onHTTP2Req(const TcpConnPtr& conn, uint32_t streamID, HTTPRequest& req)
+{
+  HTTPContext* context = static_cast<HTTPContext*>(conn->context().get());
+  const HTTPCB* sync;
+  const AsyncHTTPCB* async;
+  const StreamCB* stream;
+  findHandler(&req, &sync, &async, &stream);
+  if(stream)
+  {
+    context->http2()->reset(streamID, HTTP2Session::HTTP11Required);
+    return;
+  }
+  if(async)
+  {
+    HTTPResponderPtr responder(new HTTPResponder(conn, req, false, compressor_.get()));
+    responder->setStreamID(streamID);
+    (*async)(responder);
+    return;
+  }
+  HTTP2Session* session = context->http2().get();
+  HTTPResponse* resp = session->response();
+  resp->reset(false);
+  resp->setHeadOnly(req.method() == HTTPRequest::Head);
+  (*sync)(req, resp);
+  if(compressor_) compressor_->apply(req, resp);
+  session->respond(streamID, resp);
+}
+// the stream takes over the connection until it ends, then parsing
+// resumes with whatever was pipelined behind it
+void HTTPServer::startStream(const TcpConnPtr& conn, HTTPContext* context,
+  bool close, const StreamCB& cb)
+{
+  const HTTPRequest& req = context->request();
+  HTTPStreamPtr stream(new HTTPStream(conn, req, close, compressor_.get()));
+  context->setStream(stream);
+  if(!context->pending().empty()) stream->hold();
+  stream->setDoneCB([this](const TcpConnPtr& c){
+    HTTPContext* ctx = static_cast<HTTPContext*>(c->context().get());
+    ctx->setStream(HTTPStreamPtr());
+    if(!c->connected()) return;
+    if(!c->isReading()) c->startRead();
+    if(c->inputBuf()->readableBytes()) this->onMsg(c, c->inputBuf(), Timestamp::now());
+  });
+  cb(req, stream);
+  stream->start();
+}
+HTTP2SessionPtr HTTPServer::startHTTP2(const TcpConnPtr& conn, HTTPContext* context)
+{
+  HTTP2SessionPtr session(new HTTP2Session(conn,
+    [this](const TcpConnPtr& c, uint32_t id, HTTPRequest& req){
+      this->onHTTP2Req(c, id, req);
+    }));
+  session->setMaxBodySz(maxBodySz_);
+  context->setHTTP2(session);
+  return session;
+}
+// RFC 7540 section 3.2. false leaves the request to HTTP/1.1, which
+// is also the answer to an upgrade the server does not take
+bool HTTPServer::upgradeHTTP2(const TcpConnPtr& conn, HTTPContext* context)
+{
+  const HTTPRequest& req = context->request();
+  StringPiece up = req.getHeader("Upgrade");
+  if(up.empty() || req.version() != HTTPRequest::HTTP11
+    || !context->pending().empty()) return false;
+  bool h2c = false;
+  for(int i = 0; i + 3 <= up.size() && !h2c; ++i)
+    h2c = StringPiece(up.data() + i, 3) == "h2c"
+      && (i + 3 == up.size() || up[i+3] == ',' || up[i+3] == ' ');
+  std::string settings;
+  if(!h2c || !HTTP2Session::decodeSettingsHeader(req.getHeader("HTTP2-Settings"), &settings))
+    return false;
+  conn->outputBuf()->append("HTTP/1.1 101 Switching Protocols\r\n"
+    "Connection: Upgrade\r\nUpgrade: h2c\r\n\r\n");
+  startHTTP2(conn, context)->startUpgrade(req, settings);
+  return true;
+}
+// the handshake of RFC 6455 section 4.2. the 101 response goes into
+// the output buffer ahead of anything the open callback sends
+void HTTPServer::upgrade(const TcpConnPtr& conn, HTTPContext* context)
+{
+  const HTTPRequest& req = context->request();
+  StringPiece key = req.getHeader("Sec-WebSocket-Key");
+  // a protocol switch cannot wait for asynchronous responses
+  if(req.version() != HTTPRequest::HTTP11 || key.size() != 24
+    || !context->pending().empty())
+  {
+    conn->outputBuf()->append("HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n");
+    conn->flushOutputBuf();
+    conn->shutdown();
+    return;
+  }
+  if(req.getHeader("Sec-WebSocket-Version") != "13")
+  {
+    conn->send("HTTP/1.1 426 Upgrade Required\r\nSec-WebSocket-Version: 13\r\n"
+      "Content-Length: 0\r\n\r\n");
+    return;
+  }
+  WebSocketPtr ws(new WebSocket(conn));
+  if(!webSocketCB_(req, ws))
+  {
+    conn->send("HTTP/1.1 403 Forbidden\r\nContent-Length: 0\r\n\r\n");
+    return;
+  }
+  Buffer* out = conn->outputBuf();
+  out->append("HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+    "Connection: Upgrade\r\nSec-WebSocket-Accept: ");
+  out->append(WebSocket::acceptKey(key));
+  out->append("\r\n\r\n");
+  context->setWebSocket(ws);
+  ws->handleOpen();
 }
 } // namespace net
 } // namespace chtho
@@ -8,6 +8,13 @@
 
 #include "base/noncopyable.h"
 #include "net/TcpServer.h"
+#include "HTTPCompressor.h"
+#include "HTTP2Session.h"
+#include "HTTPContext.h"
+#include "HTTPResponder.h"
+#include "HTTPRouter.h"
+#include "HTTPStream.h"
+#include "WebSocket.h"
 
 namespace chtho
 {
@@ -20,19 +27,84 @@ class HTTPServer : noncopyable
 {
 public:
   using HTTPCB = std::function<void(const HTTPRequest&, HTTPResponse*)>;
+  // the handler fills responder->response() now or later (from any
+  // thread) and calls responder->done()
+  using AsyncHTTPCB = std::function<void(const HTTPResponderPtr&)>;
+  // the handler sets up the stream (response fields, mode, produce
+  // callback) and may write to it right away, see HTTPStream
+  using StreamCB = HTTPRouter::StreamCB;
+  // receives pieces of a large request body as they arrive,
+  // HTTPCB is still called once the whole body has been seen
+  using BodyCB = HTTPContext::BodyCB;
+  // decides on a WebSocket upgrade: sets the callbacks of ws and
+  // returns true to accept, false answers 403
+  using WebSocketCB = std::function<bool(const HTTPRequest&, const WebSocketPtr& ws)>;
 private:
   TcpServer server_; 
   HTTPCB httpCB_;   
+  AsyncHTTPCB asyncHTTPCB_;
+  HTTPRouter router_;
+  HTTPCB notAllowedCB_; // the 405 of router_
+  BodyCB bodyCB_;
+  size_t maxBodySz_;
+  size_t streamThreshold_;
+  std::shared_ptr<HTTPCompressor> compressor_;
+  WebSocketCB webSocketCB_;
+  bool http2_;
 
   void onConn(const TcpConnPtr& conn);
+  void onClose(const TcpConnPtr& conn);
   void onMsg(const TcpConnPtr& conn, Buffer* buf, Timestamp rcvTime);
-  void onReq(const TcpConnPtr& conn, const HTTPRequest& req);
+  void onReq(const TcpConnPtr& conn, HTTPContext* context);
+  void upgrade(const TcpConnPtr& conn, HTTPContext* context);
+  bool upgradeHTTP2(const TcpConnPtr& conn, HTTPContext* context);
+  HTTP2SessionPtr startHTTP2(const TcpConnPtr& conn, HTTPContext* context);
+  void onHTTP2Req(const TcpConnPtr& conn, uint32_t streamID, HTTPRequest& req);
+  void findHandler(HTTPRequest* req, const HTTPCB** sync, const AsyncHTTPCB** async,
+    const StreamCB** stream);
+  void startStream(const TcpConnPtr& conn, HTTPContext* context, bool close,
+    const StreamCB& cb);
 
 public:
   HTTPServer(EventLoop* loop, const InetAddr& listenAddr, const std::string& name,
     TcpServer::PortOpt opt = TcpServer::PortOpt::Noreuse);
   void setThreadNum(int threadNum) { server_.setThreadNum(threadNum); }
   void setHTTPCB(const HTTPCB& cb) { httpCB_ = cb; }
+  // takes precedence over HTTPCB, CPU heavy or blocking handlers
+  // hand the responder to a ThreadPool so the IO loop keeps going
+  void setAsyncHTTPCB(const AsyncHTTPCB& cb) { asyncHTTPCB_ = cb; }
+  // routes are tried first, requests matching none of them go to
+  // the HTTPCB/AsyncHTTPCB above. see HTTPRouter for the patterns.
+  // must be called before start()
+  void route(HTTPRequest::Method method, const std::string& pattern, const HTTPCB& cb)
+  { router_.add(method, pattern, cb); }
+  void routeAsync(HTTPRequest::Method method, const std::string& pattern,
+    const AsyncHTTPCB& cb)
+  { router_.addAsync(method, pattern, cb); }
+  // a response produced piece by piece, chunked or as server-sent
+  // events. HTTP/1.x only, an HTTP/2 client is told to retry with
+  // HTTP/1.1
+  void routeStream(HTTPRequest::Method method, const std::string& pattern,
+    const StreamCB& cb)
+  { router_.addStream(method, pattern, cb); }
+  // bodies larger than the threshold go to cb instead of
+  // HTTPRequest::body(), should be set before start()
+  void setBodyCB(const BodyCB& cb, size_t threshold = 64*1024)
+  { bodyCB_ = cb; streamThreshold_ = threshold; }
+  // requests with a larger body are answered with 413 
+  void setMaxBodySz(size_t sz) { maxBodySz_ = sz; }
+  // compresses the responses of clients accepting gzip/deflate,
+  // should be set before start()
+  void setCompressor(const std::shared_ptr<HTTPCompressor>& c) { compressor_ = c; }
+  // upgrade requests (RFC 6455) go to cb instead of the routes, the
+  // accepted connections speak WebSocket from then on.
+  // should be set before start()
+  void setWebSocketCB(const WebSocketCB& cb) { webSocketCB_ = cb; }
+  // also speaks HTTP/2 over cleartext (h2c), entered with the
+  // connection preface or an 'Upgrade: h2c' request. the handlers are
+  // the same, request bodies are always collected whole.
+  // should be set before start()
+  void setHTTP2(bool on) { http2_ = on; }
   void start(); 
 };
 
@@ -0,0 +1,450 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "HTTPStaticFiles.h"
+#include "HTTPResponse.h"
+
+#include "threads/MutexLockGuard.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h> // strncasecmp
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace chtho
+{
+namespace net
+{
+// one open file, shared by the cache and the responses in flight,
+// the fd goes away with the last of them
+struct HTTPStaticFiles::Entry : noncopyable
+{
+  int fd;
+  size_t size;
+  dev_t dev;
+  ino_t ino;
+  struct timespec mtime;
+  const char* mime;
+  std::string etag;
+  std::string lastModified;
+  std::string body; // whole file when it is small enough to inline
+  time_t checked; // last stat(2), guarded by the cache mutex
+
+  Entry() : fd(-1), size(0), dev(0), ino(0), mime(NULL), checked(0) {}
+  ~Entry()
+  {
+    if(fd >= 0) ::close(fd);
+  }
+  bool same(const struct stat& st) const
+  {
+    return st.st_dev == dev && st.st_ino == ino
+      && static_cast<size_t>(st.st_size) == size
+      && st.st_mtim.tv_sec == mtime.tv_sec && st.st_mtim.tv_nsec == mtime.tv_nsec;
+  }
+};
+
+namespace
+{
+struct Mime
+{
+  const char* ext;
+  const char* type;
+};
+const Mime kMimes[] = {
+  { "html", "text/html; charset=utf-8" },
+  { "htm", "text/html; charset=utf-8" },
+  { "css", "text/css" },
+  { "js", "application/javascript" },
+  { "json", "application/json" },
+  { "txt", "text/plain; charset=utf-8" },
+  { "xml", "application/xml" },
+  { "svg", "image/svg+xml" },
+  { "png", "image/png" },
+  { "jpg", "image/jpeg" },
+  { "jpeg", "image/jpeg" },
+  { "gif", "image/gif" },
+  { "webp", "image/webp" },
+  { "ico", "image/x-icon" },
+  { "woff", "font/woff" },
+  { "woff2", "font/woff2" },
+  { "wasm", "application/wasm" },
+  { "pdf", "application/pdf" },
+  { "mp4", "video/mp4" },
+};
+
+const char* mimeOf(const std::string& path)
+{
+  size_t dot = path.rfind('.');
+  if(dot != std::string::npos && path.find('/', dot) == std::string::npos)
+  {
+    const char* ext = path.c_str() + dot + 1;
+    for(const auto& m : kMimes)
+      if(::strcasecmp(ext, m.ext) == 0) return m.type;
+  }
+  return "application/octet-stream";
+}
+
+void formatHTTPDate(time_t t, std::string* out)
+{
+  struct tm tm;
+  ::gmtime_r(&t, &tm);
+  char buf[64];
+  size_t n = ::strftime(buf, sizeof buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  out->assign(buf, n);
+}
+
+// -1 when the date cannot be parsed
+time_t parseHTTPDate(const StringPiece& s)
+{
+  char buf[64];
+  if(s.size() >= static_cast<int>(sizeof buf)) return -1;
+  memcpy(buf, s.data(), s.size());
+  buf[s.size()] = '\0';
+  struct tm tm;
+  memset(&tm, 0, sizeof tm);
+  const char* end = ::strptime(buf, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+  if(!end || *end) return -1;
+  return ::timegm(&tm);
+}
+
+int hexVal(char c)
+{
+  if(c >= '0' && c <= '9') return c - '0';
+  if(c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if(c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+// percent-decodes path into out and rejects anything that could
+// leave the root: '..' segments, NUL bytes, backslashes
+bool cleanPath(const StringPiece& path, std::string* out)
+{
+  out->clear();
+  for(int i = 0; i < path.size(); ++i)
+  {
+    char c = path[i];
+    if(c == '%')
+    {
+      if(i + 2 >= path.size()) return false;
+      int hi = hexVal(path[i+1]), lo = hexVal(path[i+2]);
+      if(hi < 0 || lo < 0) return false;
+      c = static_cast<char>(hi * 16 + lo);
+      i += 2;
+    }
+    if(c == '\0' || c == '\\') return false;
+    out->push_back(c);
+  }
+  size_t begin = 0;
+  while(begin <= out->size())
+  {
+    size_t end = out->find('/', begin);
+    if(end == std::string::npos) end = out->size();
+    if(end - begin == 2 && (*out)[begin] == '.' && (*out)[begin+1] == '.') return false;
+    begin = end + 1;
+  }
+  // relative to the root
+  size_t slash = out->find_first_not_of('/');
+  out->erase(0, slash == std::string::npos ? out->size() : slash);
+  return true;
+}
+
+// true when the etag is in the If-None-Match list (or it is '*')
+bool etagMatches(const StringPiece& list, const std::string& etag)
+{
+  if(list == "*") return true;
+  const char* p = list.data();
+  const char* end = list.end();
+  while(p < end)
+  {
+    while(p < end && (*p == ' ' || *p == ',')) ++p;
+    const char* q = p;
+    while(q < end && *q != ',') ++q;
+    const char* e = q;
+    while(e > p && e[-1] == ' ') --e;
+    // weak comparison, W/ prefixes are ignored
+    if(e - p > 2 && p[0] == 'W' && p[1] == '/') p += 2;
+    if(static_cast<size_t>(e - p) == etag.size() && memcmp(p, etag.data(), etag.size()) == 0)
+      return true;
+    // the tag of a compressed representation, '"abc-gzip"' (see HTTPCompressor)
+    size_t n = etag.size() - 1;
+    if(static_cast<size_t>(e - p) > n && memcmp(p, etag.data(), n) == 0)
+    {
+      StringPiece suffix(p + n, static_cast<int>(e - p - n));
+      if(suffix == "-gzip\"" || suffix == "-deflate\"") return true;
+    }
+    p = q;
+  }
+  return false;
+}
+
+bool parseNum(const char* p, const char* end, size_t* n)
+{
+  if(p == end) return false;
+  size_t v = 0;
+  for(; p < end; ++p)
+  {
+    if(*p < '0' || *p > '9') return false;
+    if(v > (static_cast<size_t>(-1) - 9) / 10) return false;
+    v = v * 10 + (*p - '0');
+  }
+  *n = v;
+  return true;
+}
+
+enum RangeResult { NoRange, Satisfiable, Unsatisfiable };
+
+// a single 'bytes=first-last' range, anything fancier (several
+// ranges, other units, garbage) is ignored and the whole file sent
+RangeResult parseRange(const StringPiece& range, size_t size, size_t* first, size_t* last)
+{
+  if(range.size() < 6 || ::strncasecmp(range.data(), "bytes=", 6) != 0) return NoRange;
+  const char* p = range.data() + 6;
+  const char* end = range.end();
+  while(p < end && *p == ' ') ++p;
+  while(end > p && end[-1] == ' ') --end;
+  if(memchr(p, ',', end - p)) return NoRange;
+  const char* dash = static_cast<const char*>(memchr(p, '-', end - p));
+  if(!dash) return NoRange;
+  size_t a, b;
+  if(dash == p) // '-n', the last n bytes
+  {
+    if(!parseNum(dash + 1, end, &b)) return NoRange;
+    if(b == 0 || size == 0) return Unsatisfiable;
+    if(b > size) b = size;
+    *first = size - b;
+    *last = size - 1;
+    return Satisfiable;
+  }
+  if(!parseNum(p, dash, &a)) return NoRange;
+  if(dash + 1 == end) b = size - 1; // 'a-'
+  else if(!parseNum(dash + 1, end, &b) || b < a) return NoRange;
+  if(a >= size) return Unsatisfiable;
+  if(b >= size) b = size - 1;
+  *first = a;
+  *last = b;
+  return Satisfiable;
+}
+} // namespace
+
+HTTPStaticFiles::HTTPStaticFiles(const std::string& root)
+  : root_(root),
+    inlineThreshold_(16*1024), // 16 KB
+    maxCached_(1024),
+    maxAge_(-1)
+{
+}
+
+HTTPStaticFiles::~HTTPStaticFiles()
+{
+}
+
+size_t HTTPStaticFiles::cached()
+{
+  MutexLockGuard lock(mutex_);
+  return cache_.size();
+}
+
+HTTPStaticFiles::EntryPtr HTTPStaticFiles::open(const std::string& rel, int* err)
+{
+  std::string path = root_ + "/" + rel;
+  int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+  if(fd < 0)
+  {
+    *err = errno;
+    return EntryPtr();
+  }
+  struct stat st;
+  if(::fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+  {
+    bool dir = ::fstat(fd, &st) == 0 && S_ISDIR(st.st_mode);
+    ::close(fd);
+    if(dir) return open(rel + (rel.empty() || rel.back() == '/' ? "" : "/") + "index.html", err);
+    *err = ENOENT;
+    return EntryPtr();
+  }
+  EntryPtr e(new Entry);
+  e->fd = fd;
+  e->size = static_cast<size_t>(st.st_size);
+  e->dev = st.st_dev;
+  e->ino = st.st_ino;
+  e->mtime = st.st_mtim;
+  e->mime = mimeOf(path);
+  char buf[64];
+  snprintf(buf, sizeof buf, "\"%zx-%lx%05lx\"", e->size,
+    static_cast<long>(st.st_mtim.tv_sec), static_cast<long>(st.st_mtim.tv_nsec / 10000));
+  e->etag = buf;
+  formatHTTPDate(st.st_mtim.tv_sec, &e->lastModified);
+  // small files are copied, not mapped: the entry is only revalidated
+  // once a second and touching a mapping past the end of a file that
+  // shrank in the meantime raises SIGBUS. a short read means the file
+  // is changing under us, it is then sent with sendfile(2) like a big one
+  if(e->size > 0 && e->size <= inlineThreshold_)
+  {
+    e->body.resize(e->size);
+    size_t got = 0;
+    while(got < e->size)
+    {
+      ssize_t n = ::pread(fd, &e->body[got], e->size - got, static_cast<off_t>(got));
+      if(n < 0 && errno == EINTR) continue;
+      if(n <= 0) break;
+      got += static_cast<size_t>(n);
+    }
+    if(got != e->size) std::string().swap(e->body);
+  }
+  *err = 0;
+  return e;
+}
+
+// finds the file in the cache, revalidating it once per second,
+// or opens it and puts it there
+int HTTPStaticFiles::lookup(const std::string& rel, EntryPtr* entry)
+{
+  time_t now = ::time(NULL);
+  EntryPtr cached;
+  {
+    MutexLockGuard lock(mutex_);
+    auto it = cache_.find(rel);
+    if(it != cache_.end())
+    {
+      lru_.splice(lru_.begin(), lru_, it->second.pos);
+      cached = it->second.entry;
+      if(cached->checked == now)
+      {
+        *entry = cached;
+        return 0;
+      }
+    }
+  }
+  if(cached)
+  {
+    struct stat st;
+    std::string path = root_ + "/" + rel;
+    int ret = ::stat(path.c_str(), &st);
+    if(ret == 0 && S_ISDIR(st.st_mode))
+      ret = ::stat((path + (path.back() == '/' ? "" : "/") + "index.html").c_str(), &st);
+    if(ret == 0 && cached->same(st))
+    {
+      MutexLockGuard lock(mutex_);
+      cached->checked = now;
+      *entry = cached;
+      return 0;
+    }
+  }
+  int err = 0;
+  EntryPtr e = open(rel, &err);
+  MutexLockGuard lock(mutex_);
+  auto it = cache_.find(rel);
+  if(!e)
+  {
+    if(it != cache_.end())
+    {
+      lru_.erase(it->second.pos);
+      cache_.erase(it);
+    }
+    return err;
+  }
+  e->checked = now;
+  if(it != cache_.end()) it->second.entry = e;
+  else
+  {
+    lru_.push_front(rel);
+    Slot slot = { e, lru_.begin() };
+    cache_[rel] = slot;
+    while(cache_.size() > maxCached_)
+    {
+      // responses in flight keep their entry (and fd) alive
+      cache_.erase(lru_.back());
+      lru_.pop_back();
+    }
+  }
+  *entry = e;
+  return 0;
+}
+
+void HTTPStaticFiles::serve(const HTTPRequest& req, const StringPiece& relPath,
+  HTTPResponse* resp)
+{
+  if(req.method() != HTTPRequest::Get && req.method() != HTTPRequest::Head)
+  {
+    resp->setStatus(HTTPResponse::MethodNotAllowed405);
+    resp->addHeader("Allow", "GET, HEAD");
+    return;
+  }
+  std::string rel;
+  EntryPtr e;
+  int err = cleanPath(relPath, &rel) ? lookup(rel, &e) : EACCES;
+  if(err)
+  {
+    resp->setStatus(err == EACCES || err == EPERM
+      ? HTTPResponse::Forbidden403 : HTTPResponse::NotFound404);
+    return;
+  }
+  resp->addHeader("ETag", e->etag);
+  resp->addHeader("Last-Modified", e->lastModified);
+  if(maxAge_ >= 0)
+    resp->addHeader("Cache-Control", "max-age=" + std::to_string(maxAge_));
+
+  // If-None-Match wins over If-Modified-Since when both are present
+  StringPiece inm = req.getHeader("If-None-Match");
+  bool notModified = false;
+  if(!inm.empty()) notModified = etagMatches(inm, e->etag);
+  else
+  {
+    StringPiece ims = req.getHeader("If-Modified-Since");
+    if(!ims.empty())
+    {
+      time_t since = parseHTTPDate(ims);
+      notModified = since >= 0 && e->mtime.tv_sec <= since;
+    }
+  }
+  if(notModified)
+  {
+    resp->setStatus(HTTPResponse::NotModified304);
+    return;
+  }
+
+  resp->addHeader("Accept-Ranges", "bytes");
+  resp->setContentType(e->mime);
+  size_t first = 0, last = e->size == 0 ? 0 : e->size - 1;
+  size_t len = e->size;
+  resp->setStatus(HTTPResponse::OK200);
+  StringPiece range = req.getHeader("Range");
+  StringPiece ifRange = req.getHeader("If-Range");
+  if(!range.empty() && (ifRange.empty() || ifRange == e->etag || ifRange == e->lastModified))
+  {
+    RangeResult r = parseRange(range, e->size, &first, &last);
+    char buf[96];
+    if(r == Unsatisfiable)
+    {
+      snprintf(buf, sizeof buf, "bytes */%zu", e->size);
+      resp->setStatus(HTTPResponse::RangeNotSatisfiable416);
+      resp->addHeader("Content-Range", buf);
+      return;
+    }
+    if(r == Satisfiable)
+    {
+      snprintf(buf, sizeof buf, "bytes %zu-%zu/%zu", first, last, e->size);
+      resp->setStatus(HTTPResponse::PartialContent206);
+      resp->addHeader("Content-Range", buf);
+      len = last - first + 1;
+    }
+  }
+  if(len == 0) return;
+  if(!e->body.empty()) resp->setBodyRef(StringPiece(e->body.data() + first, static_cast<int>(len)), e);
+  else resp->setFile(e->fd, static_cast<off_t>(first), len, e);
+}
+
+HTTPRouter::HTTPCB HTTPStaticFiles::handler(const std::string& param)
+{
+  return [this, param](const HTTPRequest& req, HTTPResponse* resp){
+    this->serve(req, req.param(param), resp);
+  };
+}
+} // namespace net
+} // namespace chtho
@@ -0,0 +1,77 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_NET_HTTP_HTTPSTATICFILES_H
+#define CHTHO_NET_HTTP_HTTPSTATICFILES_H
+
+#include "base/noncopyable.h"
+#include "threads/MutexLock.h"
+#include "HTTPRouter.h"
+
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+#include <sys/types.h>
+
+namespace chtho
+{
+namespace net
+{
+// serves the files below a root directory, e.g.
+//   HTTPStaticFiles files("/var/www");
+//   server.route(HTTPRequest::Get, "/static/*file", files.handler());
+// open files are cached with their metadata. a cached file is
+// revalidated with stat(2) at most once per second and reopened
+// when it changed. large bodies go out with sendfile(2), files up to
+// the inline threshold are read into the cache once and copied
+// straight into the output buffer. GET and HEAD are supported, with ETag/Last-Modified
+// validation (304) and single byte ranges (206/416).
+// serve() may be called from any number of loop threads
+class HTTPStaticFiles : noncopyable
+{
+public:
+  struct Entry;
+  using EntryPtr = std::shared_ptr<Entry>;
+private:
+  using LRU = std::list<std::string>;
+  struct Slot
+  {
+    EntryPtr entry;
+    LRU::iterator pos;
+  };
+  const std::string root_;
+  size_t inlineThreshold_;
+  size_t maxCached_;
+  int maxAge_;
+  MutexLock mutex_;
+  std::unordered_map<std::string, Slot> cache_; // guarded by mutex_
+  LRU lru_; // most recently used first, guarded by mutex_
+
+  // 0 or an errno value
+  int lookup(const std::string& rel, EntryPtr* entry);
+  EntryPtr open(const std::string& rel, int* err);
+public:
+  explicit HTTPStaticFiles(const std::string& root);
+  ~HTTPStaticFiles();
+  // files up to sz bytes are served from memory, 16 KB by default
+  void setInlineThreshold(size_t sz) { inlineThreshold_ = sz; }
+  // open files kept in the cache, 1024 by default
+  void setMaxCached(size_t n) { maxCached_ = n; }
+  // adds 'Cache-Control: max-age=seconds', off by default
+  void setMaxAge(int seconds) { maxAge_ = seconds; }
+  // answers req with the file at relPath below the root,
+  // relPath may still be percent-encoded
+  void serve(const HTTPRequest& req, const StringPiece& relPath, HTTPResponse* resp);
+  // a route handler serving the path in the given route parameter
+  HTTPRouter::HTTPCB handler(const std::string& param = "file");
+  size_t cached();
+};
+} // namespace net
+} // namespace chtho
+
+
+#endif // !CHTHO_NET_HTTP_HTTPSTATICFILES_H
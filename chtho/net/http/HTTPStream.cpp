@@ -0,0 +1,310 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "HTTPStream.h"
+
+#include "net/EventLoop.h"
+#include "net/TcpConnection.h"
+
+#include <algorithm>
+
+#include <stdio.h> // snprintf
+
+namespace chtho
+{
+namespace net
+{
+HTTPStream::HTTPStream(const TcpConnPtr& conn, const HTTPRequest& req, bool close,
+  HTTPCompressor* compressor)
+  : conn_(conn),
+    loop_(conn->loop()),
+    response_(close),
+    rcvTime_(req.rcvTime()),
+    mode_(Chunked),
+    chunked_(!close),
+    compressor_(compressor),
+    accepted_(compressor ? HTTPCompressor::negotiate(req.getHeader("Accept-Encoding"))
+      : HTTPCompressor::Identity),
+    holding_(false),
+    started_(false),
+    ended_(false),
+    closed_(false),
+    producing_(false),
+    highWaterMark_(256*1024), // 256 KB
+    written_(0)
+{
+  response_.setHeadOnly(req.method() == HTTPRequest::Head);
+}
+
+HTTPStream::~HTTPStream() = default;
+
+Buffer* HTTPStream::out(const TcpConnPtr& conn)
+{
+  return holding_ ? &held_ : conn->outputBuf();
+}
+
+bool HTTPStream::writable() const
+{
+  if(ended_ || closed_ || holding_) return false;
+  TcpConnPtr conn = conn_.lock();
+  return conn && conn->outputBuf()->readableBytes() < highWaterMark_;
+}
+
+void HTTPStream::writeHead(Buffer* out)
+{
+  if(response_.status() == HTTPResponse::Unknown)
+    response_.setStatus(HTTPResponse::OK200);
+  if(mode_ == EventStream)
+  {
+    if(response_.getHeader("Content-Type").empty())
+      response_.setContentType("text/event-stream");
+    if(response_.getHeader("Cache-Control").empty())
+      response_.addHeader("Cache-Control", "no-cache");
+  }
+  if(compressor_ && !response_.headOnly())
+  {
+    HTTPCompressor::Encoding enc = compressor_->applyStream(accepted_, &response_);
+    if(enc != HTTPCompressor::Identity)
+      zlib_.reset(new ZlibStream(enc, compressor_->level()));
+  }
+  response_.setStreamed(true);
+  response_.appendToBuf(out, rcvTime_);
+  started_ = true;
+}
+
+// a chunk is its size in hex, the data and CRLF
+void HTTPStream::appendPiece(Buffer* out, const StringPiece& piece)
+{
+  if(chunked_)
+  {
+    char size[24];
+    int n = snprintf(size, sizeof size, "%zx\r\n", static_cast<size_t>(piece.size()));
+    out->ensure(n + piece.size() + 2);
+    out->append(size, n);
+    out->append(piece);
+    out->append("\r\n", 2);
+  }
+  else out->append(piece);
+}
+
+void HTTPStream::write(const StringPiece& data)
+{
+  if(loop_->isInLoopThread()) writeInLoop(data.data(), data.size());
+  else
+  {
+    HTTPStreamPtr self(shared_from_this());
+    std::string copy(data.data(), data.size());
+    loop_->queueInLoop([self, copy](){ self->writeInLoop(copy.data(), copy.size()); });
+  }
+}
+
+void HTTPStream::writeInLoop(const char* data, size_t len)
+{
+  loop_->assertInLoopThread();
+  if(ended_ || closed_) return;
+  TcpConnPtr conn = conn_.lock();
+  if(!conn) return;
+  Buffer* o = out(conn);
+  if(!started_) writeHead(o);
+  if(len == 0 || response_.headOnly()) return;
+  written_ += len;
+  StringPiece piece(data, static_cast<int>(len));
+  if(zlib_)
+  {
+    // every piece is flushed through zlib, an event has to be
+    // readable by the client as soon as it arrives
+    zbuf_.retrieveAll();
+    zlib_->write(piece, &zbuf_, true);
+    piece.set(zbuf_.peek(), static_cast<int>(zbuf_.readableBytes()));
+    if(piece.empty()) return;
+  }
+  appendPiece(o, piece);
+  // pieces written by the producer leave together after it returns
+  if(!producing_) flush(conn);
+}
+
+void HTTPStream::formatEvent(std::string* out, const StringPiece& data,
+  const StringPiece& event, const StringPiece& id)
+{
+  out->clear();
+  if(!event.empty())
+  {
+    out->append("event: ");
+    out->append(event.data(), event.size());
+    out->append("\n");
+  }
+  if(!id.empty())
+  {
+    out->append("id: ");
+    out->append(id.data(), id.size());
+    out->append("\n");
+  }
+  const char* p = data.data();
+  const char* end = p + data.size();
+  do
+  {
+    const char* eol = std::find(p, end, '\n');
+    const char* lineEnd = eol;
+    if(lineEnd > p && lineEnd[-1] == '\r') --lineEnd;
+    out->append("data: ");
+    out->append(p, lineEnd - p);
+    out->append("\n");
+    p = eol + 1;
+  } while(p < end);
+  // the blank line dispatches the event
+  out->append("\n");
+}
+
+void HTTPStream::sendEvent(const StringPiece& data, const StringPiece& event,
+  const StringPiece& id)
+{
+  if(loop_->isInLoopThread())
+  {
+    formatEvent(&event_, data, event, id);
+    writeInLoop(event_.data(), event_.size());
+  }
+  else
+  {
+    std::string e;
+    formatEvent(&e, data, event, id);
+    write(e);
+  }
+}
+
+void HTTPStream::sendComment(const StringPiece& text)
+{
+  write(": " + text.as_string() + "\n\n");
+}
+
+void HTTPStream::end()
+{
+  if(loop_->isInLoopThread()) endInLoop();
+  else
+  {
+    HTTPStreamPtr self(shared_from_this());
+    loop_->queueInLoop([self](){ self->endInLoop(); });
+  }
+}
+
+// the zlib trailer, then the last chunk
+void HTTPStream::endInLoop()
+{
+  loop_->assertInLoopThread();
+  if(ended_ || closed_) return;
+  TcpConnPtr conn = conn_.lock();
+  if(!conn) return;
+  Buffer* o = out(conn);
+  if(!started_) writeHead(o);
+  if(!response_.headOnly())
+  {
+    if(zlib_)
+    {
+      zbuf_.retrieveAll();
+      zlib_->finish(&zbuf_);
+      if(zbuf_.readableBytes())
+        appendPiece(o, StringPiece(zbuf_.peek(), static_cast<int>(zbuf_.readableBytes())));
+    }
+    if(chunked_) o->append("0\r\n\r\n");
+  }
+  ended_ = true;
+  // release() finishes once the responses before it are out
+  if(!holding_) finish(conn);
+}
+
+// the connection either closes (HTTP/1.0, 'Connection: close') or
+// goes on with the next request. the callbacks are dropped later,
+// end() may have been called from one of them
+void HTTPStream::finish(const TcpConnPtr& conn)
+{
+  conn->flushOutputBuf();
+  if(response_.close()) conn->shutdown();
+  HTTPStreamPtr self(shared_from_this());
+  loop_->queueInLoop([self, conn](){
+    self->produceCB_ = ProduceCB();
+    self->closeCB_ = CloseCB();
+    if(!self->response_.close() && self->doneCB_) self->doneCB_(conn);
+    self->doneCB_ = DoneCB();
+  });
+}
+
+void HTTPStream::flush(const TcpConnPtr& conn)
+{
+  if(!holding_) conn->flushOutputBuf();
+}
+
+void HTTPStream::start()
+{
+  loop_->assertInLoopThread();
+  TcpConnPtr conn = conn_.lock();
+  if(!conn || ended_ || closed_) return;
+  // pulls the next pieces once the socket has taken the last ones
+  std::weak_ptr<HTTPStream> weak(shared_from_this());
+  conn->setWriteCompleteCB([weak](const TcpConnPtr&){
+    HTTPStreamPtr s = weak.lock();
+    if(s) s->resume();
+  });
+  if(response_.headOnly())
+  {
+    endInLoop();
+    return;
+  }
+  if(!started_) writeHead(out(conn));
+  flush(conn);
+  resume();
+}
+
+void HTTPStream::release()
+{
+  loop_->assertInLoopThread();
+  if(!holding_) return;
+  holding_ = false;
+  TcpConnPtr conn = conn_.lock();
+  if(!conn) return;
+  if(held_.readableBytes())
+  {
+    conn->outputBuf()->append(held_.peek(), held_.readableBytes());
+    held_.retrieveAll();
+  }
+  if(ended_) finish(conn);
+  else
+  {
+    flush(conn);
+    resume();
+  }
+}
+
+// the producer is called until the output reaches the high-water mark
+// or it has nothing more for now
+void HTTPStream::resume()
+{
+  loop_->assertInLoopThread();
+  if(producing_ || !produceCB_) return;
+  TcpConnPtr conn = conn_.lock();
+  if(!conn) return;
+  producing_ = true;
+  HTTPStreamPtr self(shared_from_this());
+  while(writable())
+  {
+    size_t before = written_;
+    produceCB_(self);
+    if(written_ == before) break;
+  }
+  producing_ = false;
+  if(!ended_) flush(conn);
+}
+
+void HTTPStream::handleClose()
+{
+  loop_->assertInLoopThread();
+  if(closed_) return;
+  closed_ = true;
+  if(!ended_ && closeCB_) closeCB_(shared_from_this());
+  // the user's callbacks may hold the stream
+  produceCB_ = ProduceCB();
+  closeCB_ = CloseCB();
+  doneCB_ = DoneCB();
+}
+} // namespace net
+} // namespace chtho
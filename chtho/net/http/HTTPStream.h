@@ -0,0 +1,131 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_NET_HTTP_HTTPSTREAM_H
+#define CHTHO_NET_HTTP_HTTPSTREAM_H
+
+#include "base/noncopyable.h"
+#include "net/Buffer.h"
+#include "net/Callbacks.h"
+#include "HTTPCompressor.h"
+#include "HTTPRequest.h"
+#include "HTTPResponse.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace chtho
+{
+namespace net
+{
+class EventLoop;
+class HTTPStream;
+using HTTPStreamPtr = std::shared_ptr<HTTPStream>;
+
+// a response whose body is produced piece by piece (see
+// HTTPServer::routeStream), e.g. a large export or an endless feed of
+// server-sent events. on HTTP/1.1 the pieces go out as chunks, an
+// HTTP/1.0 body ends with the connection. the head is sent with the
+// first piece, or when the handler returns.
+// memory stays bounded by pull: the produce callback is called while
+// the connection's output buffer is below the high-water mark and
+// again from the write complete callback once the socket has taken
+// it all. a producer that has nothing to say right now just returns
+// and calls write() (or sendEvent()) later, e.g. from a timer.
+// write(), sendEvent() and end() may be called from any thread (the
+// data is copied then), the callbacks run in the loop thread.
+// while earlier pipelined responses are outstanding the stream is
+// held: its pieces wait in a Buffer of their own and writable() is false
+class HTTPStream : noncopyable,
+  public std::enable_shared_from_this<HTTPStream>
+{
+public:
+  enum Mode { Chunked, EventStream };
+  using ProduceCB = std::function<void(const HTTPStreamPtr&)>;
+  // the connection went away before end()
+  using CloseCB = std::function<void(const HTTPStreamPtr&)>;
+  using DoneCB = std::function<void(const TcpConnPtr&)>;
+private:
+  std::weak_ptr<TcpConnection> conn_;
+  EventLoop* loop_;
+  HTTPResponse response_;
+  Timestamp rcvTime_;
+  Mode mode_;
+  bool chunked_; // else the body ends with the connection
+  HTTPCompressor* compressor_; // may be NULL
+  HTTPCompressor::Encoding accepted_;
+  std::unique_ptr<ZlibStream> zlib_;
+  Buffer zbuf_; // deflated output of one piece
+  Buffer held_; // pieces waiting for earlier responses
+  bool holding_;
+  bool started_; // the head has been written
+  bool ended_;
+  bool closed_; // the connection is gone
+  bool producing_; // inside resume()
+  size_t highWaterMark_;
+  size_t written_; // payload bytes accepted so far
+  std::string event_; // scratch for sendEvent()
+  ProduceCB produceCB_;
+  CloseCB closeCB_;
+  DoneCB doneCB_;
+
+  Buffer* out(const TcpConnPtr& conn);
+  void writeHead(Buffer* out);
+  void writeInLoop(const char* data, size_t len);
+  void endInLoop();
+  void appendPiece(Buffer* out, const StringPiece& piece);
+  void flush(const TcpConnPtr& conn);
+  void finish(const TcpConnPtr& conn);
+  void formatEvent(std::string* out, const StringPiece& data,
+    const StringPiece& event, const StringPiece& id);
+public:
+  // close: the connection goes down after the body, as it must for
+  // HTTP/1.0. the compressor, if any, deflates the body when the
+  // request accepts it
+  HTTPStream(const TcpConnPtr& conn, const HTTPRequest& req, bool close,
+    HTTPCompressor* compressor = NULL);
+  ~HTTPStream();
+  // status and fields, to be set before the first piece. 200 if unset
+  HTTPResponse* response() { return &response_; }
+  // EventStream defaults the Content-Type to text/event-stream and
+  // turns off caching. before the first piece
+  void setMode(Mode mode) { mode_ = mode; }
+  void setProduceCB(const ProduceCB& cb) { produceCB_ = cb; }
+  void setCloseCB(const CloseCB& cb) { closeCB_ = cb; }
+  // 256 KB by default
+  void setHighWaterMark(size_t sz) { highWaterMark_ = sz; }
+  EventLoop* loop() const { return loop_; }
+
+  // whether the producer should go on, loop thread only
+  bool writable() const;
+  bool ended() const { return ended_; }
+  bool closed() const { return closed_; }
+  // empty pieces are ignored
+  void write(const StringPiece& data);
+  // one event: 'event:' and 'id:' lines if given, a 'data:' line for
+  // every line of data
+  void sendEvent(const StringPiece& data, const StringPiece& event = StringPiece(),
+    const StringPiece& id = StringPiece());
+  // ': text', ignored by clients, keeps idle proxies from timing out
+  void sendComment(const StringPiece& text);
+  void end();
+
+  // called by HTTPServer in the loop thread: done runs once the
+  // stream has ended on a connection that stays open, start() after
+  // the handler returned, release() when the responses before it
+  // have been written, handleClose() when the connection is gone
+  void setDoneCB(const DoneCB& cb) { doneCB_ = cb; }
+  void hold() { holding_ = true; }
+  void start();
+  void release();
+  void resume();
+  void handleClose();
+};
+} // namespace net
+} // namespace chtho
+
+
+#endif // !CHTHO_NET_HTTP_HTTPSTREAM_H
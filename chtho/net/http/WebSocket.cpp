@@ -0,0 +1,476 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "WebSocket.h"
+
+#include "logging/Logger.h"
+#include "net/Buffer.h"
+#include "net/EventLoop.h"
+#include "net/Simd.h"
+#include "net/TcpConnection.h"
+#include "HTTPRequest.h"
+
+#include <algorithm>
+
+#include <string.h> // memcpy
+#include <strings.h> // strncasecmp
+
+namespace chtho
+{
+namespace net
+{
+namespace
+{
+// the handshake only needs SHA-1 of a 60 byte string, a plain
+// implementation of FIPS 180-1 is enough
+class SHA1
+{
+private:
+  uint32_t h_[5];
+  unsigned char block_[64];
+  size_t blockLen_;
+  uint64_t total_;
+
+  static uint32_t rol(uint32_t x, int n) { return (x << n) | (x >> (32-n)); }
+  void compress()
+  {
+    uint32_t w[80];
+    for(int i = 0; i < 16; ++i)
+      w[i] = (static_cast<uint32_t>(block_[4*i]) << 24) | (block_[4*i+1] << 16)
+        | (block_[4*i+2] << 8) | block_[4*i+3];
+    for(int i = 16; i < 80; ++i) w[i] = rol(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+    uint32_t a = h_[0], b = h_[1], c = h_[2], d = h_[3], e = h_[4];
+    for(int i = 0; i < 80; ++i)
+    {
+      uint32_t f, k;
+      if(i < 20) { f = (b & c) | (~b & d); k = 0x5a827999; }
+      else if(i < 40) { f = b ^ c ^ d; k = 0x6ed9eba1; }
+      else if(i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8f1bbcdc; }
+      else { f = b ^ c ^ d; k = 0xca62c1d6; }
+      uint32_t t = rol(a, 5) + f + e + k + w[i];
+      e = d; d = c; c = rol(b, 30); b = a; a = t;
+    }
+    h_[0] += a; h_[1] += b; h_[2] += c; h_[3] += d; h_[4] += e;
+    blockLen_ = 0;
+  }
+public:
+  SHA1() : blockLen_(0), total_(0)
+  {
+    h_[0] = 0x67452301; h_[1] = 0xefcdab89; h_[2] = 0x98badcfe;
+    h_[3] = 0x10325476; h_[4] = 0xc3d2e1f0;
+  }
+  void update(const char* data, size_t len)
+  {
+    total_ += len;
+    for(size_t i = 0; i < len; ++i)
+    {
+      block_[blockLen_++] = static_cast<unsigned char>(data[i]);
+      if(blockLen_ == 64) compress();
+    }
+  }
+  void final(unsigned char digest[20])
+  {
+    uint64_t bits = total_ * 8;
+    block_[blockLen_++] = 0x80;
+    if(blockLen_ > 56)
+    {
+      while(blockLen_ < 64) block_[blockLen_++] = 0;
+      compress();
+    }
+    while(blockLen_ < 56) block_[blockLen_++] = 0;
+    for(int i = 7; i >= 0; --i) block_[blockLen_++] = static_cast<unsigned char>(bits >> (8*i));
+    compress();
+    for(int i = 0; i < 20; ++i) digest[i] = static_cast<unsigned char>(h_[i/4] >> (24 - 8*(i%4)));
+  }
+};
+
+std::string base64(const unsigned char* data, size_t len)
+{
+  static const char kTable[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string res;
+  res.reserve((len+2) / 3 * 4);
+  size_t i = 0;
+  for(; i + 3 <= len; i += 3)
+  {
+    uint32_t v = (data[i] << 16) | (data[i+1] << 8) | data[i+2];
+    res += kTable[v >> 18];
+    res += kTable[(v >> 12) & 63];
+    res += kTable[(v >> 6) & 63];
+    res += kTable[v & 63];
+  }
+  if(i < len)
+  {
+    uint32_t v = data[i] << 16;
+    if(i+1 < len) v |= data[i+1] << 8;
+    res += kTable[v >> 18];
+    res += kTable[(v >> 12) & 63];
+    res += i+1 < len ? kTable[(v >> 6) & 63] : '=';
+    res += '=';
+  }
+  return res;
+}
+
+// whether the comma separated list contains token, case-insensitive
+bool hasToken(StringPiece list, const char* token)
+{
+  size_t n = strlen(token);
+  const char* p = list.data();
+  const char* end = p + list.size();
+  while(p < end)
+  {
+    while(p < end && (*p == ' ' || *p == '\t' || *p == ',')) ++p;
+    const char* start = p;
+    while(p < end && *p != ',') ++p;
+    const char* stop = p;
+    while(stop > start && (stop[-1] == ' ' || stop[-1] == '\t')) --stop;
+    if(static_cast<size_t>(stop-start) == n && ::strncasecmp(start, token, n) == 0)
+      return true;
+  }
+  return false;
+}
+
+// the frame header for a payload of len bytes, at most 10 bytes
+size_t encodeHeader(char* out, WebSocket::Opcode op, size_t len, bool fin)
+{
+  out[0] = static_cast<char>((fin ? 0x80 : 0) | op);
+  if(len < 126)
+  {
+    out[1] = static_cast<char>(len);
+    return 2;
+  }
+  if(len <= 0xffff)
+  {
+    out[1] = 126;
+    out[2] = static_cast<char>(len >> 8);
+    out[3] = static_cast<char>(len);
+    return 4;
+  }
+  out[1] = 127;
+  for(int i = 0; i < 8; ++i)
+    out[2+i] = static_cast<char>(static_cast<uint64_t>(len) >> (56 - 8*i));
+  return 10;
+}
+} // namespace
+
+const double WebSocket::kCloseTimeout = 5.0;
+
+WebSocket::WebSocket(const TcpConnPtr& conn)
+  : conn_(conn),
+    loop_(conn->loop()),
+    state_(State::Connecting),
+    maxMsgSz_(16*1024*1024), // 16 MB
+    pingInterval_(0),
+    awaitingPong_(false),
+    fragOp_(Continuation),
+    closeCode_(0),
+    inRead_(false)
+{
+}
+
+WebSocket::~WebSocket() = default;
+
+std::string WebSocket::acceptKey(const StringPiece& key)
+{
+  static const char kGUID[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+  SHA1 sha;
+  sha.update(key.data(), key.size());
+  sha.update(kGUID, sizeof(kGUID)-1);
+  unsigned char digest[20];
+  sha.final(digest);
+  return base64(digest, sizeof(digest));
+}
+
+bool WebSocket::isUpgrade(const HTTPRequest& req)
+{
+  StringPiece upgrade = req.getHeader("Upgrade");
+  return req.method() == HTTPRequest::Get
+    && upgrade.size() == 9 && ::strncasecmp(upgrade.data(), "websocket", 9) == 0
+    && hasToken(req.getHeader("Connection"), "upgrade");
+}
+
+WebSocketFrame WebSocket::encodeFrame(Opcode op, const StringPiece& data, bool fin)
+{
+  std::shared_ptr<std::string> frame(new std::string);
+  size_t len = static_cast<size_t>(data.size());
+  frame->resize(10 + len);
+  size_t hdr = encodeHeader(&(*frame)[0], op, len, fin);
+  memcpy(&(*frame)[hdr], data.data(), len);
+  frame->resize(hdr + len);
+  return frame;
+}
+
+void WebSocket::broadcast(const std::vector<WebSocketPtr>& conns, Opcode op,
+  const StringPiece& data)
+{
+  if(conns.empty()) return;
+  WebSocketFrame frame = encodeFrame(op, data);
+  for(const WebSocketPtr& ws : conns) ws->sendFrame(frame);
+}
+
+void WebSocket::handleOpen()
+{
+  loop_->assertInLoopThread();
+  state_ = State::Open;
+  if(pingInterval_ > 0)
+  {
+    std::weak_ptr<WebSocket> weak(shared_from_this());
+    pingTimer_ = loop_->runEvery(pingInterval_, [weak](){
+      WebSocketPtr ws = weak.lock();
+      if(ws) ws->onPingTimer();
+    });
+  }
+  if(openCB_) openCB_(shared_from_this());
+}
+
+// a frame is handled once all of it is in the buffer, its payload is
+// unmasked in place and retrieved after the callbacks have seen it
+void WebSocket::handleMsg(Buffer* buf)
+{
+  loop_->assertInLoopThread();
+  TcpConnPtr conn = conn_.lock();
+  if(!conn) return;
+  inRead_ = true;
+  while(state_ == State::Open || state_ == State::Closing)
+  {
+    size_t avail = buf->readableBytes();
+    if(avail < 2) break;
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(buf->peek());
+    bool fin = (p[0] & 0x80) != 0;
+    Opcode op = static_cast<Opcode>(p[0] & 0x0f);
+    uint64_t len = p[1] & 0x7f;
+    size_t hdr = 2;
+    if(len == 126)
+    {
+      if(avail < 4) break;
+      len = (p[2] << 8) | p[3];
+      hdr = 4;
+    }
+    else if(len == 127)
+    {
+      if(avail < 10) break;
+      len = 0;
+      for(int i = 2; i < 10; ++i) len = (len << 8) | p[i];
+      hdr = 10;
+    }
+    // no extension was negotiated so the rsv bits must be clear,
+    // and every frame from a client must be masked
+    if((p[0] & 0x70) || !(p[1] & 0x80))
+    {
+      fail(ProtocolError);
+      break;
+    }
+    if(op & 0x8)
+    {
+      if(!fin || len > 125 || op > Pong)
+      {
+        fail(ProtocolError);
+        break;
+      }
+    }
+    else if(op > Binary || (op == Continuation) != (fragOp_ != Continuation))
+    {
+      fail(ProtocolError);
+      break;
+    }
+    else if(len > maxMsgSz_ - fragments_.size())
+    {
+      fail(TooBig);
+      break;
+    }
+    hdr += 4; // the masking key
+    if(avail < hdr || avail - hdr < len) break;
+    // the payload is consumed right here, so it is unmasked in the
+    // buffer rather than copied out
+    char* payload = const_cast<char*>(buf->peek()) + hdr;
+    uint32_t key;
+    memcpy(&key, payload - 4, 4);
+    simd::xorMask(payload, static_cast<size_t>(len), key);
+    awaitingPong_ = false;
+    bool more = handleFrame(fin, op, payload, static_cast<size_t>(len));
+    buf->retrieve(hdr + static_cast<size_t>(len));
+    if(!more) break;
+  }
+  // the rest is of no interest once the close handshake is over
+  if(state_ != State::Open && state_ != State::Closing) buf->retrieveAll();
+  inRead_ = false;
+  // everything the callbacks sent leaves in one write
+  conn->flushOutputBuf();
+}
+
+// returns false when no more frames are to be read
+bool WebSocket::handleFrame(bool fin, Opcode op, char* payload, size_t len)
+{
+  switch (op)
+  {
+  case Continuation:
+  case Text:
+  case Binary:
+    if(op != Continuation && fin)
+    {
+      if(state_ == State::Open && msgCB_)
+        msgCB_(shared_from_this(), StringPiece(payload, static_cast<int>(len)), op);
+      return true;
+    }
+    if(op != Continuation) fragOp_ = op;
+    fragments_.append(payload, len);
+    if(fin)
+    {
+      Opcode msgOp = fragOp_;
+      fragOp_ = Continuation;
+      if(state_ == State::Open && msgCB_) msgCB_(shared_from_this(), fragments_, msgOp);
+      fragments_.clear();
+    }
+    return true;
+  case Ping:
+    if(state_ == State::Open) sendInLoop(Pong, payload, len);
+    return true;
+  case Pong:
+    return true;
+  case Close:
+  {
+    if(len == 1)
+    {
+      fail(ProtocolError);
+      return false;
+    }
+    closeCode_ = len >= 2
+      ? (static_cast<unsigned char>(payload[0]) << 8) | static_cast<unsigned char>(payload[1])
+      : static_cast<int>(NoStatus);
+    // echo the status, then the server closes the TCP connection
+    if(state_ == State::Open) closeInLoop(len >= 2 ? closeCode_ : 0, std::string());
+    state_ = State::Closed;
+    shutdown();
+    return false;
+  }
+  default:
+    fail(ProtocolError);
+    return false;
+  }
+}
+
+void WebSocket::handleClose()
+{
+  loop_->assertInLoopThread();
+  state_ = State::Closed;
+  loop_->cancel(pingTimer_);
+  loop_->cancel(closeTimer_);
+  if(closeCode_ == 0) closeCode_ = Abnormal;
+  fragments_.clear();
+  if(closeCB_) closeCB_(shared_from_this(), closeCode_);
+}
+
+void WebSocket::send(Opcode op, const StringPiece& data)
+{
+  if(loop_->isInLoopThread()) sendInLoop(op, data.data(), data.size());
+  // the payload has to be copied anyway, it is copied framed
+  else sendFrame(encodeFrame(op, data));
+}
+
+void WebSocket::sendInLoop(Opcode op, const char* data, size_t len)
+{
+  loop_->assertInLoopThread();
+  if(state_ != State::Open) return;
+  TcpConnPtr conn = conn_.lock();
+  if(!conn) return;
+  Buffer* out = conn->outputBuf();
+  out->ensure(10 + len);
+  size_t hdr = encodeHeader(out->writePtr(), op, len, true);
+  out->written(hdr);
+  out->append(data, len);
+  if(!inRead_) conn->flushOutputBuf();
+}
+
+void WebSocket::sendFrame(const WebSocketFrame& frame)
+{
+  if(loop_->isInLoopThread()) sendFrameInLoop(frame);
+  else
+  {
+    WebSocketPtr self(shared_from_this());
+    loop_->queueInLoop([self, frame](){ self->sendFrameInLoop(frame); });
+  }
+}
+
+void WebSocket::sendFrameInLoop(const WebSocketFrame& frame)
+{
+  loop_->assertInLoopThread();
+  if(state_ != State::Open) return;
+  TcpConnPtr conn = conn_.lock();
+  if(!conn) return;
+  if(inRead_) conn->outputBuf()->append(frame->data(), frame->size());
+  // written straight from the shared frame when the socket takes it
+  else conn->sendInLoop(frame->data(), frame->size());
+}
+
+void WebSocket::close(int code, const std::string& reason)
+{
+  if(loop_->isInLoopThread()) closeInLoop(code, reason);
+  else
+  {
+    WebSocketPtr self(shared_from_this());
+    loop_->queueInLoop([self, code, reason](){ self->closeInLoop(code, reason); });
+  }
+}
+
+// sends the close frame (without a status for code 0) and waits for
+// the peer's, the connection is dropped if it takes too long
+void WebSocket::closeInLoop(int code, const std::string& reason)
+{
+  loop_->assertInLoopThread();
+  if(state_ != State::Open) return;
+  char payload[125];
+  size_t len = 0;
+  if(code)
+  {
+    payload[0] = static_cast<char>(code >> 8);
+    payload[1] = static_cast<char>(code);
+    len = 2 + std::min(reason.size(), sizeof(payload) - 2);
+    memcpy(payload + 2, reason.data(), len - 2);
+  }
+  sendInLoop(Close, payload, len);
+  state_ = State::Closing;
+  loop_->cancel(pingTimer_);
+  std::weak_ptr<TcpConnection> weak(conn_);
+  closeTimer_ = loop_->runAfter(kCloseTimeout, [weak](){
+    TcpConnPtr conn = weak.lock();
+    if(conn) conn->forceClose();
+  });
+}
+
+// a protocol violation by the peer: close with code and stop reading
+void WebSocket::fail(int code)
+{
+  LOG_WARN << "WebSocket::fail " << code;
+  closeInLoop(code, std::string());
+  state_ = State::Closed;
+  shutdown();
+}
+
+// the close frame may still sit in the output buffer, it has to be
+// handed to the socket before the write side is shut down
+void WebSocket::shutdown()
+{
+  TcpConnPtr conn = conn_.lock();
+  if(!conn) return;
+  conn->flushOutputBuf();
+  conn->shutdown();
+}
+
+// a ping goes out every interval, any frame counts as an answer
+void WebSocket::onPingTimer()
+{
+  if(state_ != State::Open) return;
+  if(awaitingPong_)
+  {
+    LOG_INFO << "WebSocket::onPingTimer peer timed out";
+    TcpConnPtr conn = conn_.lock();
+    if(conn) conn->forceClose();
+    return;
+  }
+  awaitingPong_ = true;
+  sendInLoop(Ping, NULL, 0);
+}
+} // namespace net
+} // namespace chtho
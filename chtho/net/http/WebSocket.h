@@ -0,0 +1,140 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_NET_HTTP_WEBSOCKET_H
+#define CHTHO_NET_HTTP_WEBSOCKET_H
+
+#include "base/noncopyable.h"
+#include "base/StringPiece.h"
+#include "net/Callbacks.h"
+#include "net/TimerID.h"
+
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+namespace chtho
+{
+namespace net
+{
+class Buffer;
+class EventLoop;
+class HTTPRequest;
+
+class WebSocket;
+using WebSocketPtr = std::shared_ptr<WebSocket>;
+// a frame encoded once, e.g. by broadcast(), shared by every
+// connection it is sent on
+using WebSocketFrame = std::shared_ptr<const std::string>;
+
+// the server side of a WebSocket (RFC 6455) connection. HTTPServer
+// creates one when a request asks to upgrade (see
+// HTTPServer::setWebSocketCB) and from then on feeds the connection's
+// input to it. frames are parsed straight out of the input Buffer
+// and unmasked in place with simd::xorMask, an unfragmented message is
+// handed to the message callback as a slice of that Buffer, fragments
+// are collected until the final one arrives. pings and pongs are
+// answered and the peer is pinged on the loop's timer queue, a peer
+// that stays silent for a whole ping interval is dropped.
+// no extensions are negotiated and text is not validated as UTF-8.
+// the callbacks run in the connection's loop thread, send() and
+// close() may be called from any thread
+class WebSocket : noncopyable,
+  public std::enable_shared_from_this<WebSocket>
+{
+public:
+  enum Opcode { Continuation = 0x0, Text = 0x1, Binary = 0x2,
+    Close = 0x8, Ping = 0x9, Pong = 0xa };
+  // status codes of the close frame
+  enum CloseCode { Normal = 1000, GoingAway = 1001, ProtocolError = 1002,
+    NoStatus = 1005, Abnormal = 1006, TooBig = 1009 };
+  using OpenCB = std::function<void(const WebSocketPtr&)>;
+  // msg is only valid during the call, op is Text or Binary
+  using MsgCB = std::function<void(const WebSocketPtr&, const StringPiece& msg, Opcode op)>;
+  // the TCP connection is gone, code is the peer's close status or
+  // Abnormal when it went away without a close frame
+  using CloseCB = std::function<void(const WebSocketPtr&, int code)>;
+  static const double kCloseTimeout; // seconds the close handshake may take
+private:
+  enum class State { Connecting, Open, Closing, Closed };
+  std::weak_ptr<TcpConnection> conn_;
+  EventLoop* loop_;
+  State state_;
+  OpenCB openCB_;
+  MsgCB msgCB_;
+  CloseCB closeCB_;
+  size_t maxMsgSz_;
+  double pingInterval_;
+  TimerID pingTimer_;
+  TimerID closeTimer_;
+  bool awaitingPong_; // nothing heard from the peer since the last ping
+  Opcode fragOp_; // opcode of the fragmented message, Continuation if none
+  std::string fragments_;
+  int closeCode_;
+  // frames sent while a read is handled are flushed together after it
+  bool inRead_;
+  std::shared_ptr<void> context_;
+
+  bool handleFrame(bool fin, Opcode op, char* payload, size_t len);
+  void sendInLoop(Opcode op, const char* data, size_t len);
+  void sendFrameInLoop(const WebSocketFrame& frame);
+  void closeInLoop(int code, const std::string& reason);
+  void fail(int code);
+  void shutdown();
+  void onPingTimer();
+public:
+  explicit WebSocket(const TcpConnPtr& conn);
+  ~WebSocket();
+
+  void setOpenCB(const OpenCB& cb) { openCB_ = cb; }
+  void setMsgCB(const MsgCB& cb) { msgCB_ = cb; }
+  void setCloseCB(const CloseCB& cb) { closeCB_ = cb; }
+  // larger messages close the connection with TooBig, 16 MB by default
+  void setMaxMsgSz(size_t sz) { maxMsgSz_ = sz; }
+  // seconds between pings, 0 (the default) disables them.
+  // must be set before the connection opens
+  void setPingInterval(double sec) { pingInterval_ = sec; }
+
+  void send(Opcode op, const StringPiece& data);
+  void sendText(const StringPiece& text) { send(Text, text); }
+  void sendBinary(const StringPiece& data) { send(Binary, data); }
+  // sends a frame made by encodeFrame()
+  void sendFrame(const WebSocketFrame& frame);
+  // starts the close handshake, the connection goes down once the
+  // peer has answered or after kCloseTimeout
+  void close(int code = Normal, const std::string& reason = std::string());
+
+  EventLoop* loop() const { return loop_; }
+  TcpConnPtr conn() const { return conn_.lock(); }
+  // loop thread only
+  bool open() const { return state_ == State::Open; }
+  // free for the user, e.g. the room a chat client has joined
+  void setContext(const std::shared_ptr<void>& ctx) { context_ = ctx; }
+  const std::shared_ptr<void>& context() const { return context_; }
+
+  // called by HTTPServer in the loop thread: after the 101 response
+  // has been queued, for every read, and when the connection is gone
+  void handleOpen();
+  void handleMsg(Buffer* buf);
+  void handleClose();
+
+  // Sec-WebSocket-Accept for a Sec-WebSocket-Key
+  static std::string acceptKey(const StringPiece& key);
+  // whether req asks for a WebSocket upgrade
+  static bool isUpgrade(const HTTPRequest& req);
+  // an unmasked (server to client) frame
+  static WebSocketFrame encodeFrame(Opcode op, const StringPiece& data, bool fin = true);
+  // encodes the message once and sends it on every open connection
+  static void broadcast(const std::vector<WebSocketPtr>& conns, Opcode op,
+    const StringPiece& data);
+};
+} // namespace net
+} // namespace chtho
+
+
+#endif // !CHTHO_NET_HTTP_WEBSOCKET_H
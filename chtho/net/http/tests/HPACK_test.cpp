@@ -0,0 +1,178 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/net/http/HPACK.h"
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace chtho;
+using namespace chtho::net;
+
+using Fields = std::vector<std::pair<std::string, std::string>>;
+
+std::string unhex(const char* s)
+{
+  std::string res;
+  for(; *s; )
+  {
+    if(*s == ' ') { ++s; continue; }
+    res += static_cast<char>(strtol(std::string(s, 2).c_str(), NULL, 16));
+    s += 2;
+  }
+  return res;
+}
+
+std::string encode(HPACKEncoder* enc, const Fields& fields)
+{
+  std::string out;
+  enc->beginBlock(&out);
+  for(const auto& f : fields) enc->encode(f.first, f.second, &out);
+  return out;
+}
+
+bool decode(HPACKDecoder* dec, const std::string& block, Fields* fields)
+{
+  fields->clear();
+  return dec->decode(block.data(), block.size(),
+    [fields](const StringPiece& name, const StringPiece& value){
+      fields->push_back(std::make_pair(name.as_string(), value.as_string()));
+    });
+}
+
+std::string huffman(const std::string& s)
+{
+  std::string out;
+  hpack::huffmanEncode(s, &out);
+  assert(out.size() == hpack::huffmanLen(s));
+  return out;
+}
+
+// appendix C.1 and the Huffman strings of C.4
+void testPrimitives()
+{
+  std::string out;
+  hpack::encodeInt(10, 5, 0, &out);
+  assert(out == unhex("0a"));
+  out.clear();
+  hpack::encodeInt(1337, 5, 0, &out);
+  assert(out == unhex("1f 9a 0a"));
+  out.clear();
+  hpack::encodeInt(42, 8, 0, &out);
+  assert(out == unhex("2a"));
+  uint64_t v;
+  const uint8_t* p = reinterpret_cast<const uint8_t*>("\x1f\x9a\x0a");
+  assert(hpack::decodeInt(p, p + 3, 5, &v) == p + 3 && v == 1337);
+  assert(hpack::decodeInt(p, p + 2, 5, &v) == NULL);
+
+  assert(huffman("www.example.com") == unhex("f1e3 c2e5 f23a 6ba0 ab90 f4ff"));
+  assert(huffman("no-cache") == unhex("a8eb 1064 9cbf"));
+  assert(huffman("custom-key") == unhex("25a8 49e9 5ba9 7d7f"));
+  assert(huffman("custom-value") == unhex("25a8 49e9 5bb8 e8b4 bf"));
+
+  // every byte value survives the round trip, in every position
+  std::string all;
+  for(int i = 0; i < 256; ++i) all += static_cast<char>(i);
+  for(int shift = 0; shift < 8; ++shift)
+  {
+    std::string s = std::string(shift, 'a') + all;
+    std::string h = huffman(s), back;
+    assert(hpack::huffmanDecode(reinterpret_cast<const uint8_t*>(h.data()), h.size(), &back));
+    assert(back == s);
+  }
+  std::string back;
+  // padding longer than 7 bits, and padding that is not all ones
+  std::string bad = huffman("a") + "\xff";
+  assert(!hpack::huffmanDecode(reinterpret_cast<const uint8_t*>(bad.data()), bad.size(), &back));
+  bad = unhex("00");
+  back.clear();
+  assert(!hpack::huffmanDecode(reinterpret_cast<const uint8_t*>(bad.data()), bad.size(), &back));
+}
+
+// the three requests of appendix C.4 on one connection
+void testRequests()
+{
+  Fields r1 = { { ":method", "GET" }, { ":scheme", "http" }, { ":path", "/" },
+    { ":authority", "www.example.com" } };
+  Fields r2 = r1;
+  r2.push_back(std::make_pair("cache-control", "no-cache"));
+  Fields r3 = { { ":method", "GET" }, { ":scheme", "https" }, { ":path", "/index.html" },
+    { ":authority", "www.example.com" }, { "custom-key", "custom-value" } };
+  const char* wire[] = {
+    "8286 8441 8cf1 e3c2 e5f2 3a6b a0ab 90f4 ff",
+    "8286 84be 5886 a8eb 1064 9cbf",
+    "8287 85bf 4088 25a8 49e9 5ba9 7d7f 8925 a849 e95b b8e8 b4bf",
+  };
+  Fields* reqs[] = { &r1, &r2, &r3 };
+  HPACKEncoder enc;
+  HPACKDecoder dec;
+  for(int i = 0; i < 3; ++i)
+  {
+    std::string block = encode(&enc, *reqs[i]);
+    assert(block == unhex(wire[i]));
+    Fields got;
+    assert(decode(&dec, block, &got));
+    assert(got == *reqs[i]);
+  }
+  assert(dec.table().size() == 164);
+  assert(enc.table().size() == 164);
+}
+
+// random fields through a small table that keeps evicting, with
+// table size changes in between
+void testRoundTrip()
+{
+  HPACKEncoder enc;
+  HPACKDecoder dec;
+  srand(7);
+  const char* names[] = { "content-type", "x-request-id", "cache-control", "date",
+    "set-cookie", "server", "x-custom", "vary" };
+  for(int iter = 0; iter < 2000; ++iter)
+  {
+    if(iter % 300 == 0) enc.setMaxTableSize(iter % 600 == 0 ? 256 : 0);
+    if(iter % 300 == 150) enc.setMaxTableSize(4096);
+    Fields fields;
+    int n = rand() % 10;
+    for(int i = 0; i < n; ++i)
+    {
+      std::string value(rand() % 40, 'v');
+      for(auto& c : value) c = static_cast<char>(rand() % 256);
+      fields.push_back(std::make_pair(names[rand() % 8],
+        rand() % 3 ? value : std::string("text/html")));
+    }
+    Fields got;
+    assert(decode(&dec, encode(&enc, fields), &got));
+    assert(got == fields);
+    assert(dec.table().size() == enc.table().size());
+  }
+}
+
+void testErrors()
+{
+  HPACKDecoder dec;
+  Fields got;
+  assert(!decode(&dec, unhex("be"), &got)); // nothing at index 62
+  assert(!decode(&dec, unhex("80"), &got)); // index 0
+  assert(!decode(&dec, unhex("3fe21f"), &got)); // size update above 4096
+  assert(!decode(&dec, unhex("8220"), &got)); // size update after a field
+  assert(!decode(&dec, unhex("4088"), &got)); // truncated literal
+  dec.setMaxHeaderListSz(100);
+  std::string big = unhex("40 05") + "x-big" + unhex("7f 21") + std::string(160, 'x');
+  assert(!decode(&dec, big, &got));
+}
+
+int main()
+{
+  testPrimitives();
+  testRequests();
+  testRoundTrip();
+  testErrors();
+  printf("HPACK tests passed\n");
+}
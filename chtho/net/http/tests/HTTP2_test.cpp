@@ -0,0 +1,394 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/net/EventLoop.h"
+#include "chtho/net/EventLoopThread.h"
+#include "chtho/net/http/HPACK.h"
+#include "chtho/net/http/HTTP2Session.h"
+#include "chtho/net/http/HTTPServer.h"
+
+#include <algorithm>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace chtho;
+using namespace chtho::net;
+
+const uint16_t kPort = 8093;
+const size_t kBigSz = 200*1000;
+
+struct Frame
+{
+  int type;
+  int flags;
+  uint32_t id;
+  std::string payload;
+};
+
+struct Response
+{
+  std::map<std::string, std::string> headers;
+  std::string body;
+  bool done;
+  Response() : done(false) {}
+};
+
+// a blocking test client speaking just enough HTTP/2
+class Client
+{
+private:
+  int fd_;
+  std::string in_;
+  HPACKEncoder encoder_;
+  HPACKDecoder decoder_;
+
+  bool fill(int timeoutMs)
+  {
+    struct pollfd pfd = { fd_, POLLIN, 0 };
+    if(::poll(&pfd, 1, timeoutMs) <= 0) return false;
+    char buf[65536];
+    ssize_t n = ::read(fd_, buf, sizeof(buf));
+    if(n <= 0) return false;
+    in_.append(buf, n);
+    return true;
+  }
+public:
+  std::map<uint32_t, Response> responses;
+  uint32_t goaway; // the error code, or ~0
+
+  Client() : fd_(::socket(AF_INET, SOCK_STREAM, 0)), goaway(~0u)
+  {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int ret = ::connect(fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    assert(ret == 0);
+    (void)ret;
+  }
+  ~Client() { ::close(fd_); }
+  void write(const std::string& data)
+  {
+    ssize_t n = ::write(fd_, data.data(), data.size());
+    assert(n == static_cast<ssize_t>(data.size()));
+    (void)n;
+  }
+  // the response head of an HTTP/1.1 request, what follows stays buffered
+  std::string readHead()
+  {
+    size_t end;
+    while((end = in_.find("\r\n\r\n")) == std::string::npos)
+      if(!fill(2000)) return std::string();
+    std::string head = in_.substr(0, end + 4);
+    in_.erase(0, end + 4);
+    return head;
+  }
+  void sendFrame(int type, int flags, uint32_t id, const std::string& payload)
+  {
+    std::string f;
+    f += static_cast<char>(payload.size() >> 16);
+    f += static_cast<char>(payload.size() >> 8);
+    f += static_cast<char>(payload.size());
+    f += static_cast<char>(type);
+    f += static_cast<char>(flags);
+    for(int i = 3; i >= 0; --i) f += static_cast<char>(id >> (8*i));
+    write(f + payload);
+  }
+  static std::string u32(uint32_t v)
+  {
+    std::string s;
+    for(int i = 3; i >= 0; --i) s += static_cast<char>(v >> (8*i));
+    return s;
+  }
+  static std::string setting(uint16_t id, uint32_t v)
+  { return std::string(1, static_cast<char>(id >> 8)) + static_cast<char>(id) + u32(v); }
+  void preface(const std::string& settings = std::string())
+  {
+    write(std::string(HTTP2Session::kPreface, HTTP2Session::kPrefaceLen));
+    sendFrame(0x4, 0, 0, settings);
+  }
+  void request(uint32_t id, const std::string& method, const std::string& path,
+    const std::string& body = std::string())
+  {
+    std::string block;
+    encoder_.beginBlock(&block);
+    encoder_.encode(":method", method, &block);
+    encoder_.encode(":scheme", "http", &block);
+    encoder_.encode(":path", path, &block);
+    encoder_.encode(":authority", "localhost", &block);
+    encoder_.encode("accept", "*/*", &block);
+    sendFrame(0x1, 0x4 | (body.empty() ? 0x1 : 0), id, block);
+    if(!body.empty()) sendFrame(0x0, 0x1, id, body);
+  }
+  // false on EOF or timeout
+  bool recv(Frame* f, int timeoutMs = 2000)
+  {
+    for(;;)
+    {
+      if(in_.size() >= 9)
+      {
+        const uint8_t* p = reinterpret_cast<const uint8_t*>(in_.data());
+        size_t len = (p[0] << 16) | (p[1] << 8) | p[2];
+        if(in_.size() >= 9 + len)
+        {
+          f->type = p[3];
+          f->flags = p[4];
+          f->id = ((p[5] & 0x7f) << 24) | (p[6] << 16) | (p[7] << 8) | p[8];
+          f->payload = in_.substr(9, len);
+          in_.erase(0, 9 + len);
+          return true;
+        }
+      }
+      if(!fill(timeoutMs)) return false;
+    }
+  }
+  // collects responses until n streams are done or nothing arrives
+  // for timeoutMs. returns the frames of other types
+  std::vector<Frame> run(size_t n, int timeoutMs = 2000)
+  {
+    std::vector<Frame> others;
+    Frame f;
+    size_t done = 0;
+    for(const auto& r : responses) done += r.second.done;
+    while(done < n && recv(&f, timeoutMs))
+    {
+      Response& r = responses[f.id];
+      if(f.type == 0x1)
+      {
+        assert(f.flags & 0x4); // our responses fit into one frame
+        bool ok = decoder_.decode(f.payload.data(), f.payload.size(),
+          [&r](const StringPiece& name, const StringPiece& value){
+            r.headers[name.as_string()] = value.as_string();
+          });
+        assert(ok);
+        (void)ok;
+      }
+      else if(f.type == 0x0) r.body += f.payload;
+      else
+      {
+        responses.erase(f.id);
+        if(f.type == 0x7) goaway = static_cast<uint8_t>(f.payload[7]);
+        others.push_back(f);
+        continue;
+      }
+      if(f.flags & 0x1)
+      {
+        r.done = true;
+        ++done;
+      }
+    }
+    return others;
+  }
+};
+
+// the server preface is a SETTINGS frame and a connection WINDOW_UPDATE
+void expectServerPreface(Client* c)
+{
+  Frame f;
+  assert(c->recv(&f) && f.type == 0x4 && f.id == 0 && !(f.flags & 0x1));
+  assert(c->recv(&f) && f.type == 0x8 && f.id == 0);
+}
+
+void testPriorKnowledge()
+{
+  Client c;
+  c.preface();
+  expectServerPreface(&c);
+  c.request(1, "GET", "/hello");
+  c.request(3, "POST", "/echo?x=1", "posted body");
+  c.request(5, "GET", "/missing");
+  c.request(7, "HEAD", "/hello");
+  // many streams at once, their responses interleave freely
+  for(uint32_t id = 9; id < 9 + 2*50; id += 2)
+    c.request(id, "POST", "/echo", std::string(id, 'e'));
+  std::vector<Frame> others = c.run(4 + 50);
+  // the ACK of our SETTINGS
+  assert(others.size() == 1 && others[0].type == 0x4 && others[0].flags == 0x1);
+  assert(c.responses[1].headers[":status"] == "200");
+  assert(c.responses[1].body == "hello");
+  assert(c.responses[1].headers["content-length"] == "5");
+  assert(c.responses[1].headers.count("date"));
+  assert(c.responses[3].body == "POST /echo ?x=1 localhost posted body");
+  assert(c.responses[5].headers[":status"] == "404");
+  // no connection specific fields make it into HTTP/2
+  assert(!c.responses[5].headers.count("connection"));
+  assert(c.responses[7].headers[":status"] == "200");
+  assert(c.responses[7].headers["content-length"] == "5");
+  assert(c.responses[7].body.empty());
+  for(uint32_t id = 9; id < 9 + 2*50; id += 2)
+    assert(c.responses[id].body == "POST /echo  localhost " + std::string(id, 'e'));
+
+  c.sendFrame(0x6, 0, 0, "pingpong");
+  Frame f;
+  assert(c.recv(&f) && f.type == 0x6 && f.flags == 0x1 && f.payload == "pingpong");
+}
+
+// a stream window of 1000 bytes: the body only moves on with our
+// WINDOW_UPDATEs, exactly as far as they allow
+void testFlowControl()
+{
+  Client c;
+  c.preface(Client::setting(0x4, 1000) + Client::setting(0x5, 16384));
+  expectServerPreface(&c);
+  c.request(1, "GET", "/big");
+  c.run(1, 200);
+  Response& r = c.responses[1];
+  assert(r.headers["content-length"] == std::to_string(kBigSz));
+  assert(r.body.size() == 1000);
+  // the connection window (65535) is the limit now
+  c.sendFrame(0x8, 0, 1, Client::u32(1000000));
+  c.run(1, 200);
+  assert(r.body.size() == 65535);
+  while(!r.done)
+  {
+    c.sendFrame(0x8, 0, 0, Client::u32(50000));
+    size_t before = r.body.size();
+    c.run(1, 200);
+    assert(r.body.size() == std::min(before + 50000, kBigSz));
+  }
+  for(size_t i = 0; i < kBigSz; ++i) assert(r.body[i] == static_cast<char>('a' + i % 26));
+}
+
+// a slow asynchronous stream does not hold up the ones after it
+void testAsync()
+{
+  Client c;
+  c.preface();
+  expectServerPreface(&c);
+  c.request(1, "GET", "/slow");
+  c.request(3, "GET", "/hello");
+  c.run(1);
+  assert(c.responses[3].done && !c.responses[1].done);
+  c.run(2);
+  assert(c.responses[1].body == "slow");
+}
+
+// 'Upgrade: h2c', the request becomes stream 1
+void testUpgrade()
+{
+  Client c;
+  // SETTINGS_MAX_CONCURRENT_STREAMS = 100, INITIAL_WINDOW_SIZE = 1 GB - 1
+  c.write("GET /hello HTTP/1.1\r\nHost: localhost\r\nConnection: Upgrade, HTTP2-Settings\r\n"
+    "Upgrade: h2c\r\nHTTP2-Settings: AAMAAABkAAQ_____\r\n\r\n");
+  std::string head = c.readHead();
+  assert(head.find("HTTP/1.1 101") == 0);
+  assert(head.find("Upgrade: h2c") != std::string::npos);
+  c.preface();
+  expectServerPreface(&c);
+  c.request(3, "GET", "/hello");
+  c.run(2);
+  assert(c.responses[1].body == "hello");
+  assert(c.responses[3].body == "hello");
+
+  // a malformed HTTP2-Settings leaves the request to HTTP/1.1
+  Client h1;
+  h1.write("GET /hello HTTP/1.1\r\nHost: localhost\r\nUpgrade: h2c\r\n"
+    "HTTP2-Settings: AAM\r\n\r\n");
+  assert(h1.readHead().find("HTTP/1.1 200") == 0);
+}
+
+void testErrors()
+{
+  {
+    // DATA on stream 0
+    Client c;
+    c.preface();
+    expectServerPreface(&c);
+    c.sendFrame(0x0, 0, 0, "x");
+    c.run(1);
+    assert(c.goaway == 0x1);
+  }
+  {
+    // a header block that is not HPACK
+    Client c;
+    c.preface();
+    expectServerPreface(&c);
+    c.sendFrame(0x1, 0x5, 1, "\xbf\xff\xff");
+    c.run(1);
+    assert(c.goaway == 0x9);
+  }
+  {
+    // a stream without :path is reset, the connection lives on
+    Client c;
+    c.preface();
+    expectServerPreface(&c);
+    HPACKEncoder enc;
+    std::string block;
+    enc.encode(":method", "GET", &block);
+    c.sendFrame(0x1, 0x5, 1, block);
+    std::vector<Frame> others = c.run(1, 200);
+    bool reset = false;
+    for(const auto& f : others) reset |= f.type == 0x3 && f.id == 1;
+    assert(reset);
+  }
+  {
+    // plain HTTP/1.1 is unaffected
+    Client c;
+    c.write("GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    assert(c.readHead().find("HTTP/1.1 200") == 0);
+  }
+}
+
+int main()
+{
+  ::signal(SIGPIPE, SIG_IGN);
+  EventLoopThread serverThread;
+  EventLoop* serverLoop = serverThread.startLoop();
+  std::unique_ptr<HTTPServer> server;
+  std::string big(kBigSz, ' ');
+  for(size_t i = 0; i < kBigSz; ++i) big[i] = static_cast<char>('a' + i % 26);
+  serverLoop->runInLoop([&](){
+    server.reset(new HTTPServer(serverLoop, InetAddr(kPort), "server",
+      TcpServer::PortOpt::Reuse));
+    server->setHTTP2(true);
+    server->route(HTTPRequest::Get, "/hello", [](const HTTPRequest&, HTTPResponse* resp){
+      resp->setStatus(HTTPResponse::OK200);
+      resp->setBody("hello");
+    });
+    server->route(HTTPRequest::Get, "/big", [&big](const HTTPRequest&, HTTPResponse* resp){
+      resp->setStatus(HTTPResponse::OK200);
+      resp->setBody(big);
+    });
+    server->route(HTTPRequest::Post, "/echo", [](const HTTPRequest& req, HTTPResponse* resp){
+      resp->setStatus(HTTPResponse::OK200);
+      resp->setBody("POST " + req.path().as_string() + " " + req.query().as_string() + " "
+        + req.getHeader("Host").as_string() + " " + req.body().as_string());
+    });
+    server->routeAsync(HTTPRequest::Get, "/slow", [](const HTTPResponderPtr& r){
+      std::thread([r](){
+        ::usleep(200 * 1000);
+        r->response()->setStatus(HTTPResponse::OK200);
+        r->response()->setBody("slow");
+        r->done();
+      }).detach();
+    });
+    server->start();
+  });
+  ::usleep(100 * 1000);
+
+  testPriorKnowledge();
+  testFlowControl();
+  testAsync();
+  testUpgrade();
+  testErrors();
+
+  serverLoop->runInLoop([&](){ server.reset(); });
+  ::usleep(100 * 1000);
+  printf("HTTP2 tests passed\n");
+}
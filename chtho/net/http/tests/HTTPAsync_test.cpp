@@ -0,0 +1,203 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/net/EventLoop.h"
+#include "chtho/net/EventLoopThread.h"
+#include "chtho/net/http/HTTPServer.h"
+#include "chtho/threads/ThreadPool.h"
+
+#include <string>
+#include <vector>
+
+#include <assert.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace chtho;
+using namespace chtho::net;
+
+const uint16_t kPort = 8089;
+ThreadPool pool("worker");
+
+// '/slow?N' is answered by a worker after N ms,
+// '/fast' right away in the loop thread
+void onRequest(const HTTPResponderPtr& r)
+{
+  if(r->request().path() == "/slow")
+  {
+    pool.run([r](){
+      int ms = atoi(r->request().query().data() + 1);
+      ::usleep(ms * 1000);
+      r->response()->setStatus(HTTPResponse::OK200);
+      r->response()->setBody("slow " + std::to_string(ms));
+      r->done();
+    });
+  }
+  else
+  {
+    r->response()->setStatus(HTTPResponse::OK200);
+    r->response()->setBody("fast");
+    r->done();
+  }
+}
+
+int connectServer()
+{
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(kPort);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int ret = ::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr);
+  assert(ret == 0);
+  (void)ret;
+  return fd;
+}
+
+void sendAll(int fd, const std::string& s)
+{
+  ssize_t n = ::write(fd, s.data(), s.size());
+  assert(n == static_cast<ssize_t>(s.size()));
+  (void)n;
+}
+
+// reads n responses and returns their bodies
+std::vector<std::string> readBodies(int fd, size_t n)
+{
+  std::vector<std::string> bodies;
+  std::string in;
+  char buf[4096];
+  while(bodies.size() < n)
+  {
+    size_t hdrEnd = in.find("\r\n\r\n");
+    size_t cl = in.find("Content-Length: ");
+    if(hdrEnd != std::string::npos && cl < hdrEnd)
+    {
+      size_t len = strtoul(in.c_str() + cl + 16, NULL, 10);
+      if(in.size() >= hdrEnd + 4 + len)
+      {
+        bodies.push_back(in.substr(hdrEnd + 4, len));
+        in.erase(0, hdrEnd + 4 + len);
+        continue;
+      }
+    }
+    ssize_t r = ::read(fd, buf, sizeof buf);
+    if(r <= 0) break;
+    in.append(buf, r);
+  }
+  return bodies;
+}
+
+// a response that is done early waits for the ones before it
+void testPipelineOrder()
+{
+  int fd = connectServer();
+  sendAll(fd, "GET /slow?200 HTTP/1.1\r\n\r\n"
+    "GET /fast HTTP/1.1\r\n\r\n"
+    "GET /slow?50 HTTP/1.1\r\n\r\n");
+  std::vector<std::string> bodies = readBodies(fd, 3);
+  assert(bodies.size() == 3);
+  assert(bodies[0] == "slow 200");
+  assert(bodies[1] == "fast");
+  assert(bodies[2] == "slow 50");
+  ::close(fd);
+}
+
+// the loop serves other connections while a worker is busy
+void testResponsive()
+{
+  int slow = connectServer();
+  sendAll(slow, "GET /slow?500 HTTP/1.1\r\n\r\n");
+  int fast = connectServer();
+  Timestamp start = Timestamp::now();
+  sendAll(fast, "GET /fast HTTP/1.1\r\n\r\n");
+  std::vector<std::string> bodies = readBodies(fast, 1);
+  double sec = Timestamp::diffInSec(Timestamp::now(), start);
+  assert(bodies.size() == 1 && bodies[0] == "fast");
+  assert(sec < 0.25);
+  bodies = readBodies(slow, 1);
+  assert(bodies.size() == 1 && bodies[0] == "slow 500");
+  ::close(slow);
+  ::close(fast);
+  printf("fast response in %.1f ms while a slow one was pending\n", sec * 1000);
+}
+
+// responses after a 'Connection: close' one are not sent
+void testClose()
+{
+  int fd = connectServer();
+  sendAll(fd, "GET /slow?50 HTTP/1.1\r\nConnection: close\r\n\r\n"
+    "GET /fast HTTP/1.1\r\n\r\n");
+  std::vector<std::string> bodies = readBodies(fd, 2);
+  assert(bodies.size() == 1 && bodies[0] == "slow 50");
+  ::close(fd);
+}
+
+// reads until the text has needle in it, or the peer closes
+std::string readUntil(int fd, const char* needle)
+{
+  std::string in;
+  char buf[4096];
+  while(in.find(needle) == std::string::npos)
+  {
+    ssize_t r = ::read(fd, buf, sizeof buf);
+    if(r <= 0) break;
+    in.append(buf, r);
+  }
+  return in;
+}
+
+// the interim and the error responses also wait for the ones before
+void testPipelineInterim()
+{
+  int fd = connectServer();
+  sendAll(fd, "GET /slow?100 HTTP/1.1\r\n\r\n"
+    "POST /fast HTTP/1.1\r\nContent-Length: 4\r\nExpect: 100-continue\r\n\r\n");
+  std::string in = readUntil(fd, "100 Continue");
+  size_t cont = in.find("HTTP/1.1 100 Continue\r\n\r\n");
+  assert(cont != std::string::npos);
+  assert(in.find("slow 100") < cont);
+  sendAll(fd, "body");
+  in = readUntil(fd, "fast");
+  assert(in.find("fast") != std::string::npos);
+  ::close(fd);
+
+  fd = connectServer();
+  sendAll(fd, "GET /slow?100 HTTP/1.1\r\n\r\nNOT HTTP\r\n\r\nGET /fast HTTP/1.1\r\n\r\n");
+  in = readUntil(fd, "no such text"); // up to the close
+  size_t bad = in.find("HTTP/1.1 400 Bad Request\r\n");
+  assert(bad != std::string::npos);
+  assert(in.find("slow 100") < bad);
+  assert(in.find("fast") == std::string::npos);
+  ::close(fd);
+}
+
+int main()
+{
+  pool.start(2);
+  EventLoopThread loopThread;
+  EventLoop* loop = loopThread.startLoop();
+  std::unique_ptr<HTTPServer> server;
+  loop->runInLoop([&](){
+    server.reset(new HTTPServer(loop, InetAddr(kPort), "async",
+      TcpServer::PortOpt::Reuse));
+    server->setAsyncHTTPCB(onRequest);
+    server->start();
+  });
+  ::usleep(100 * 1000);
+  testPipelineOrder();
+  testResponsive();
+  testClose();
+  testPipelineInterim();
+  loop->runInLoop([&](){ server.reset(); });
+  ::usleep(100 * 1000);
+  pool.stop();
+  printf("HTTPAsync tests passed\n");
+}
@@ -0,0 +1,275 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/net/Buffer.h"
+#include "chtho/net/EventLoop.h"
+#include "chtho/net/EventLoopThread.h"
+#include "chtho/net/http/HTTPClient.h"
+#include "chtho/net/http/HTTPClientContext.h"
+#include "chtho/net/http/HTTPServer.h"
+#include "chtho/threads/CountDownLatch.h"
+#include "chtho/threads/ThreadPool.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace chtho;
+using namespace chtho::net;
+
+const uint16_t kPort = 8091;
+ThreadPool pool("worker");
+HTTPClient* client = NULL;
+EventLoop* clientLoop = NULL;
+
+// feeds raw to a parser one byte at a time, the response must come out
+// the same as when it arrives in one piece
+void parseBytewise(const std::string& raw, bool head, int status, const std::string& body,
+  bool untilClose = false)
+{
+  for(int bytewise = 0; bytewise < 2; ++bytewise)
+  {
+    HTTPClientContext ctx;
+    Buffer buf;
+    size_t step = bytewise ? 1 : raw.size();
+    for(size_t i = 0; i < raw.size(); i += step)
+    {
+      assert(!ctx.done());
+      buf.append(raw.data() + i, std::min(step, raw.size() - i));
+      bool ok = ctx.parse(&buf, head);
+      assert(ok);
+      (void)ok;
+    }
+    if(untilClose)
+    {
+      assert(!ctx.done());
+      assert(ctx.finishOnClose(&buf));
+    }
+    assert(ctx.done());
+    assert(ctx.response().status() == status);
+    assert(ctx.response().body() == body);
+    ctx.retire(&buf);
+    assert(buf.readableBytes() == 0);
+  }
+}
+
+void testParse()
+{
+  parseBytewise("HTTP/1.1 200 OK\r\nContent-Length: 5\r\nX-A:  b \r\n\r\nhello",
+    false, 200, "hello");
+  parseBytewise("HTTP/1.1 200 OK\r\nTransfer-Encoding: chunked\r\n\r\n"
+    "5\r\nhello\r\n7;ext=1\r\n, world\r\n0\r\nX-Trailer: t\r\n\r\n",
+    false, 200, "hello, world");
+  // interim responses are skipped
+  parseBytewise("HTTP/1.1 100 Continue\r\n\r\nHTTP/1.1 201 Created\r\n"
+    "Content-Length: 2\r\n\r\nok", false, 201, "ok");
+  // no body for HEAD, 204 and 304, whatever the headers say
+  parseBytewise("HTTP/1.1 200 OK\r\nContent-Length: 100\r\n\r\n", true, 200, "");
+  parseBytewise("HTTP/1.1 304 Not Modified\r\nContent-Length: 100\r\n\r\n", false, 304, "");
+  parseBytewise("HTTP/1.0 200\r\n\r\nuntil the end", false, 200, "until the end", true);
+
+  HTTPClientContext ctx;
+  Buffer buf;
+  buf.append("HTTP/1.1 200 OK\r\nX-A: b\r\nConnection: close\r\nContent-Length: 0\r\n\r\n");
+  assert(ctx.parse(&buf, false) && ctx.done());
+  assert(ctx.response().reason() == "OK");
+  assert(ctx.response().getHeader("x-a") == "b");
+  assert(!ctx.response().keepAlive());
+  ctx.retire(&buf);
+  buf.append("HTTP/1.0 200 OK\r\nConnection: Keep-Alive\r\nContent-Length: 0\r\n\r\n");
+  assert(ctx.parse(&buf, false) && ctx.done());
+  assert(ctx.response().keepAlive());
+  ctx.retire(&buf);
+  buf.append("HTTP/2 200\r\n\r\n");
+  assert(!ctx.parse(&buf, false));
+  ctx.reset();
+  buf.retrieveAll();
+  buf.append("HTTP/1.1 200 OK\r\nContent-Length: x\r\n\r\n");
+  assert(!ctx.parse(&buf, false));
+}
+
+struct Result
+{
+  HTTPClient::Error err;
+  int status;
+  std::string body;
+};
+
+// issues reqs at once from this thread and waits for all of them
+std::vector<Result> fetchAll(const InetAddr& addr, const std::vector<HTTPClientRequest>& reqs)
+{
+  std::vector<Result> res(reqs.size());
+  CountDownLatch latch(static_cast<int>(reqs.size()));
+  for(size_t i = 0; i < reqs.size(); ++i)
+  {
+    Result* r = &res[i];
+    client->request(addr, reqs[i], [r, &latch](HTTPClient::Error err,
+      const HTTPClientResponse& resp){
+      r->err = err;
+      r->status = resp.status();
+      r->body = resp.body().as_string();
+      latch.countDown();
+    });
+  }
+  latch.wait();
+  return res;
+}
+
+Result fetch(const HTTPClientRequest& req, const InetAddr& addr = InetAddr(kPort, true))
+{
+  return fetchAll(addr, std::vector<HTTPClientRequest>(1, req))[0];
+}
+
+size_t numConns()
+{
+  size_t n = 0;
+  CountDownLatch latch(1);
+  clientLoop->runInLoop([&](){ n = client->numConns(); latch.countDown(); });
+  latch.wait();
+  return n;
+}
+
+void testKeepAlive()
+{
+  for(int i = 0; i < 10; ++i)
+  {
+    Result r = fetch(HTTPClientRequest(HTTPRequest::Get, "/hello"));
+    assert(r.err == HTTPClient::Ok && r.status == 200 && r.body == "hello");
+  }
+  // one connection served them all
+  assert(numConns() == 1);
+  Result r = fetch(HTTPClientRequest(HTTPRequest::Get, "/nowhere"));
+  assert(r.err == HTTPClient::Ok && r.status == 404);
+  r = fetch(HTTPClientRequest(HTTPRequest::Head, "/hello"));
+  assert(r.err == HTTPClient::Ok && r.status == 200 && r.body.empty());
+}
+
+void testPost()
+{
+  HTTPClientRequest req(HTTPRequest::Post, "/echo");
+  req.body = std::string(100*1000, 'x') + "end";
+  req.addHeader("Content-Type", "text/plain");
+  Result r = fetch(req);
+  assert(r.err == HTTPClient::Ok && r.body == req.body);
+}
+
+// more requests than connections: the pool grows to its limit and
+// then pipelines
+void testPipeline()
+{
+  std::vector<HTTPClientRequest> reqs;
+  for(int i = 0; i < 16; ++i)
+    reqs.push_back(HTTPClientRequest(HTTPRequest::Get, "/slow?" + std::to_string(20 + i)));
+  Timestamp start = Timestamp::now();
+  std::vector<Result> res = fetchAll(InetAddr(kPort, true), reqs);
+  double sec = Timestamp::diffInSec(Timestamp::now(), start);
+  for(size_t i = 0; i < res.size(); ++i)
+  {
+    assert(res[i].err == HTTPClient::Ok);
+    assert(res[i].body == "slow " + std::to_string(20 + i));
+  }
+  assert(numConns() <= 2);
+  printf("16 requests over %zu connections in %.1f ms\n", numConns(), sec * 1000);
+}
+
+void testServerClose()
+{
+  size_t before = numConns();
+  Result r = fetch(HTTPClientRequest(HTTPRequest::Get, "/close"));
+  assert(r.err == HTTPClient::Ok && r.body == "bye");
+  ::usleep(50 * 1000);
+  assert(numConns() == before - 1);
+  r = fetch(HTTPClientRequest(HTTPRequest::Get, "/hello"));
+  assert(r.err == HTTPClient::Ok && r.body == "hello");
+}
+
+void testTimeout()
+{
+  HTTPClientRequest req(HTTPRequest::Get, "/slow?500");
+  req.timeout = 0.1;
+  Timestamp start = Timestamp::now();
+  Result r = fetch(req);
+  assert(r.err == HTTPClient::Timeout);
+  assert(Timestamp::diffInSec(Timestamp::now(), start) < 0.4);
+  r = fetch(HTTPClientRequest(HTTPRequest::Get, "/hello"));
+  assert(r.err == HTTPClient::Ok && r.body == "hello");
+
+  // nobody listens there
+  Result refused = fetch(HTTPClientRequest(), InetAddr(1, true));
+  assert(refused.err == HTTPClient::ConnectFailed);
+}
+
+int main()
+{
+  testParse();
+
+  pool.start(4);
+  EventLoopThread serverThread;
+  EventLoop* serverLoop = serverThread.startLoop();
+  std::unique_ptr<HTTPServer> server;
+  serverLoop->runInLoop([&](){
+    server.reset(new HTTPServer(serverLoop, InetAddr(kPort), "server",
+      TcpServer::PortOpt::Reuse));
+    server->route(HTTPRequest::Get, "/hello", [](const HTTPRequest&, HTTPResponse* resp){
+      resp->setStatus(HTTPResponse::OK200);
+      resp->setBody("hello");
+    });
+    server->route(HTTPRequest::Post, "/echo", [](const HTTPRequest& req, HTTPResponse* resp){
+      resp->setStatus(HTTPResponse::OK200);
+      resp->setBody(req.body());
+    });
+    server->route(HTTPRequest::Get, "/close", [](const HTTPRequest&, HTTPResponse* resp){
+      resp->setStatus(HTTPResponse::OK200);
+      resp->setClose(true);
+      resp->setBody("bye");
+    });
+    server->routeAsync(HTTPRequest::Get, "/slow", [](const HTTPResponderPtr& r){
+      pool.run([r](){
+        int ms = atoi(r->request().query().data() + 1);
+        ::usleep(ms * 1000);
+        r->response()->setStatus(HTTPResponse::OK200);
+        r->response()->setBody("slow " + std::to_string(ms));
+        r->done();
+      });
+    });
+    server->setHTTPCB([](const HTTPRequest&, HTTPResponse* resp){
+      resp->setStatus(HTTPResponse::NotFound404);
+    });
+    server->start();
+  });
+
+  EventLoopThread clientThread;
+  clientLoop = clientThread.startLoop();
+  std::unique_ptr<HTTPClient> c;
+  CountDownLatch created(1);
+  clientLoop->runInLoop([&](){
+    c.reset(new HTTPClient(clientLoop, "client"));
+    c->setMaxConnsPerHost(2);
+    c->setConnectTimeout(0.2);
+    created.countDown();
+  });
+  created.wait();
+  client = c.get();
+  ::usleep(100 * 1000);
+
+  testKeepAlive();
+  testPost();
+  testPipeline();
+  testServerClose();
+  testTimeout();
+
+  CountDownLatch destroyed(1);
+  clientLoop->runInLoop([&](){ c.reset(); destroyed.countDown(); });
+  destroyed.wait();
+  serverLoop->runInLoop([&](){ server.reset(); });
+  ::usleep(100 * 1000);
+  pool.stop();
+  printf("HTTPClient tests passed\n");
+}
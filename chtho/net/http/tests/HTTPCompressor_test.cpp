@@ -0,0 +1,264 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/net/http/HTTPCompressor.h"
+#include "chtho/net/http/HTTPRequest.h"
+#include "chtho/net/http/HTTPResponse.h"
+#include "chtho/net/Buffer.h"
+
+#include <memory>
+#include <string>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h> // mkstemp
+#include <string.h>
+#include <sys/stat.h> // futimens
+#include <time.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using namespace chtho;
+using namespace chtho::net;
+
+// inflates gzip or zlib data (windowBits 15+32 detects the wrapper)
+std::string inflateAll(const StringPiece& in)
+{
+  z_stream zs;
+  memset(&zs, 0, sizeof(zs));
+  int err = inflateInit2(&zs, 15 + 32);
+  assert(err == Z_OK);
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(in.data()));
+  zs.avail_in = static_cast<uInt>(in.size());
+  std::string out;
+  char chunk[4096];
+  do
+  {
+    zs.next_out = reinterpret_cast<Bytef*>(chunk);
+    zs.avail_out = sizeof(chunk);
+    err = inflate(&zs, Z_NO_FLUSH);
+    assert(err == Z_OK || err == Z_STREAM_END);
+    out.append(chunk, sizeof(chunk) - zs.avail_out);
+  } while(err != Z_STREAM_END);
+  inflateEnd(&zs);
+  return out;
+}
+
+std::string page()
+{
+  std::string s;
+  for(int i = 0; i < 200; ++i)
+    s += "<li>item " + std::to_string(i) + " of a rather repetitive page</li>\n";
+  return s;
+}
+
+// the header line must outlive req, HTTPRequest only keeps slices
+void setAccept(HTTPRequest* req, const std::string& line)
+{
+  const char* colon = strchr(line.c_str(), ':');
+  req->addHeader(line.c_str(), colon, line.c_str() + line.size());
+}
+
+void testNegotiate()
+{
+  assert(HTTPCompressor::negotiate("") == HTTPCompressor::Identity);
+  assert(HTTPCompressor::negotiate("gzip") == HTTPCompressor::Gzip);
+  assert(HTTPCompressor::negotiate("deflate") == HTTPCompressor::Deflate);
+  assert(HTTPCompressor::negotiate("gzip, deflate, br") == HTTPCompressor::Gzip);
+  assert(HTTPCompressor::negotiate("deflate, GZIP") == HTTPCompressor::Gzip);
+  assert(HTTPCompressor::negotiate("gzip;q=0.5, deflate") == HTTPCompressor::Deflate);
+  assert(HTTPCompressor::negotiate("gzip; q=0, deflate;q=0") == HTTPCompressor::Identity);
+  assert(HTTPCompressor::negotiate("br, identity") == HTTPCompressor::Identity);
+  assert(HTTPCompressor::negotiate("*") == HTTPCompressor::Gzip);
+  assert(HTTPCompressor::negotiate("gzip;q=0, *") == HTTPCompressor::Deflate);
+  assert(HTTPCompressor::negotiate("gzipx") == HTTPCompressor::Identity);
+}
+
+void testCompress()
+{
+  std::string body = page();
+  std::string z;
+  assert(HTTPCompressor::compress(HTTPCompressor::Gzip, body, &z));
+  assert(z.size() < body.size() / 4);
+  assert(static_cast<unsigned char>(z[0]) == 0x1f); // gzip magic
+  assert(inflateAll(z) == body);
+  // the per-thread deflate state is reused across encodings
+  assert(HTTPCompressor::compress(HTTPCompressor::Deflate, body, &z, 9));
+  assert(z[0] == 0x78); // zlib header
+  assert(inflateAll(z) == body);
+  assert(HTTPCompressor::compress(HTTPCompressor::Gzip, "", &z));
+  assert(inflateAll(z).empty());
+}
+
+void testStream()
+{
+  std::string body = page();
+  Buffer out;
+  ZlibStream zs(HTTPCompressor::Gzip);
+  zs.write(StringPiece(body.data(), 100), &out, true);
+  // a sync flush makes the first part decodable on its own
+  size_t flushed = out.readableBytes();
+  assert(flushed > 0);
+  zs.write(StringPiece(body.data() + 100, static_cast<int>(body.size() - 100)), &out);
+  zs.finish(&out);
+  assert(zs.finished());
+  assert(inflateAll(out.toStringPiece()) == body);
+}
+
+void testApply()
+{
+  HTTPCompressor c;
+  std::string body = page();
+  std::string accept = "Accept-Encoding: gzip, deflate";
+  HTTPRequest req;
+  setAccept(&req, accept);
+
+  // a dynamic body is compressed in place
+  HTTPResponse resp;
+  resp.setStatus(HTTPResponse::OK200);
+  resp.setContentType("text/html; charset=utf-8");
+  resp.addHeader("ETag", "\"abc\"");
+  resp.setBody(body);
+  assert(c.apply(req, &resp));
+  assert(resp.getHeader("Content-Encoding") == "gzip");
+  assert(resp.getHeader("Vary") == "Accept-Encoding");
+  assert(resp.getHeader("ETag") == "\"abc-gzip\"");
+  assert(resp.bodySize() == resp.body().size());
+  assert(inflateAll(resp.body()) == body);
+  assert(c.hits() == 0 && c.misses() == 0);
+
+  // not compressed: small, binary, not 200, already encoded, not accepted
+  resp.reset(false);
+  resp.setStatus(HTTPResponse::OK200);
+  resp.setContentType("text/plain");
+  resp.setBody("short");
+  assert(!c.apply(req, &resp));
+  resp.setBody(body);
+  resp.setContentType("image/png");
+  assert(!c.apply(req, &resp));
+  assert(resp.getHeader("Vary").empty());
+  resp.setContentType("application/json");
+  resp.setStatus(HTTPResponse::NotFound404);
+  assert(!c.apply(req, &resp));
+  resp.setStatus(HTTPResponse::OK200);
+  resp.addHeader("Content-Encoding", "br");
+  assert(!c.apply(req, &resp));
+  HTTPRequest plain;
+  resp.reset(false);
+  resp.setStatus(HTTPResponse::OK200);
+  resp.setContentType("application/json");
+  resp.addHeader("Vary", "Origin");
+  resp.setBody(body);
+  assert(!c.apply(plain, &resp));
+  assert(resp.getHeader("Vary") == "Origin, Accept-Encoding");
+  assert(resp.body() == body);
+}
+
+void testCache()
+{
+  HTTPCompressor c;
+  std::string body = page();
+  std::string accept = "Accept-Encoding: gzip";
+  HTTPRequest req;
+  setAccept(&req, accept);
+  std::shared_ptr<std::string> owner(new std::string(body));
+  StringPiece first;
+  for(int i = 0; i < 3; ++i)
+  {
+    HTTPResponse resp;
+    resp.setStatus(HTTPResponse::OK200);
+    resp.setContentType("text/css");
+    resp.setBodyRef(*owner, owner);
+    assert(c.apply(req, &resp));
+    StringPiece z = resp.bodyRef();
+    assert(inflateAll(z) == body);
+    // served from the cache, the very same bytes
+    if(i == 0) first = z;
+    else assert(z.data() == first.data());
+  }
+  assert(c.misses() == 1 && c.hits() == 2);
+  // the body is kept to be compared on a hit
+  assert(c.cacheBytes() == static_cast<size_t>(first.size()) + body.size());
+
+  // a dynamic body marked cacheable with the same content hits too
+  HTTPResponse resp;
+  resp.setStatus(HTTPResponse::OK200);
+  resp.setContentType("text/css");
+  resp.setBody(body);
+  resp.setCacheable(true);
+  assert(c.apply(req, &resp));
+  assert(resp.bodyRef().data() == first.data());
+  assert(c.hits() == 3);
+
+  // other content is another entry, the LRU keeps the byte bound
+  size_t bound = static_cast<size_t>(first.size()) + body.size() + 10;
+  c.setMaxCacheBytes(bound);
+  resp.reset(false);
+  resp.setStatus(HTTPResponse::OK200);
+  resp.setContentType("text/css");
+  resp.setBody(body + "<p>more</p>");
+  resp.setCacheable(true);
+  assert(c.apply(req, &resp));
+  assert(c.misses() == 2);
+  assert(c.cacheBytes() <= bound);
+}
+
+HTTPResponse* fileResponse(HTTPResponse* resp, int fd, size_t len)
+{
+  resp->reset(false);
+  resp->setStatus(HTTPResponse::OK200);
+  resp->setContentType("text/html");
+  resp->setFile(fd, 0, len, std::shared_ptr<void>());
+  return resp;
+}
+
+// a file is found by its identity, a new mtime is a new entry
+void testFileCache()
+{
+  HTTPCompressor c;
+  std::string accept = "Accept-Encoding: gzip";
+  HTTPRequest req;
+  setAccept(&req, accept);
+  char path[] = "/tmp/httpcompressor_test.XXXXXX";
+  int fd = ::mkstemp(path);
+  assert(fd >= 0);
+  std::string body = page();
+  ssize_t n = ::pwrite(fd, body.data(), body.size(), 0);
+  assert(n == static_cast<ssize_t>(body.size()));
+  HTTPResponse resp;
+  for(int i = 0; i < 2; ++i)
+  {
+    assert(c.apply(req, fileResponse(&resp, fd, body.size())));
+    assert(inflateAll(resp.bodyRef()) == body);
+  }
+  assert(c.misses() == 1 && c.hits() == 1);
+  // nothing but the compressed form is kept for a file
+  assert(c.cacheBytes() == static_cast<size_t>(resp.bodyRef().size()));
+
+  std::string other = body;
+  other[10] = other[10] == 'x' ? 'y' : 'x';
+  n = ::pwrite(fd, other.data(), other.size(), 0);
+  assert(n == static_cast<ssize_t>(other.size()));
+  (void)n;
+  struct timespec later[2] = { { 0, UTIME_OMIT }, { time(NULL) + 10, 0 } };
+  ::futimens(fd, later);
+  assert(c.apply(req, fileResponse(&resp, fd, other.size())));
+  assert(inflateAll(resp.bodyRef()) == other);
+  assert(c.misses() == 2);
+  ::close(fd);
+  ::unlink(path);
+}
+
+int main()
+{
+  testNegotiate();
+  testCompress();
+  testStream();
+  testApply();
+  testCache();
+  testFileCache();
+  printf("all passed\n");
+  return 0;
+}
@@ -0,0 +1,238 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/net/Buffer.h"
+#include "chtho/net/http/HTTPContext.h"
+
+#include <string>
+
+using namespace chtho;
+using namespace chtho::net;
+
+void testContentLength()
+{
+  HTTPContext context;
+  Buffer buf;
+  buf.append("POST /echo HTTP/1.1\r\nContent-Length: 10\r\n\r\nhello");
+  assert(context.parse(&buf, Timestamp::now()));
+  assert(!context.done());
+  buf.append(" body");
+  assert(context.parse(&buf, Timestamp::now()));
+  assert(context.done());
+  assert(context.request().method() == HTTPRequest::Post);
+  assert(context.request().body() == "hello body");
+  // the request is a view, its bytes stay until it is retired
+  assert(context.request().body().data() > buf.peek());
+  context.retire(&buf);
+  assert(buf.readableBytes() == 0);
+}
+
+void testZeroCopy()
+{
+  HTTPContext context;
+  Buffer buf(64);
+  buf.append("GET /index.html?x=1 HTTP/1.1\r\nHost: example.com\r\n");
+  assert(context.parse(&buf, Timestamp::now()));
+  assert(!context.done());
+  // the readable bytes move elsewhere (as when the Buffer grows),
+  // the slices taken so far must follow them
+  Buffer moved(8);
+  moved.append(buf.toStringPiece());
+  buf.retrieveAll();
+  moved.append("user-agent:  curl \r\n\r\n");
+  assert(context.parse(&moved, Timestamp::now()));
+  assert(context.done());
+  const HTTPRequest& req = context.request();
+  assert(req.path() == "/index.html");
+  assert(req.query() == "?x=1");
+  assert(req.getHeader("host") == "example.com");
+  assert(req.getHeader("User-Agent") == "curl");
+  assert(req.getHeader("Accept").empty());
+  assert(req.path().data() >= moved.peek());
+  assert(req.path().data() < moved.writePtr());
+
+  // a copy owns its data
+  HTTPRequest copy(req);
+  context.retire(&moved);
+  assert(copy.path() == "/index.html");
+  assert(copy.getHeader("Host") == "example.com");
+}
+
+void testChunked()
+{
+  HTTPContext context;
+  Buffer buf;
+  buf.append("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+    "5\r\nhello\r\n5;ext=1\r\n body\r\n0\r\nX-Trailer: 1\r\n\r\n"
+    "GET / HTTP/1.1\r\n\r\n");
+  assert(context.parse(&buf, Timestamp::now()));
+  assert(context.done());
+  assert(context.request().body() == "hello body");
+  context.retire(&buf);
+  assert(context.parse(&buf, Timestamp::now()));
+  assert(context.done());
+  assert(context.request().method() == HTTPRequest::Get);
+  assert(context.request().body().empty());
+}
+
+void testStreaming()
+{
+  std::string streamed;
+  HTTPContext context;
+  context.setStreamThreshold(4);
+  context.setBodyCB([&streamed](const HTTPRequest&, const char* data, size_t len){
+    streamed.append(data, len);
+  });
+  Buffer buf;
+  buf.append("POST /upload HTTP/1.1\r\nContent-Length: 10\r\n\r\nhel");
+  assert(context.parse(&buf, Timestamp::now()));
+  assert(streamed == "hel");
+  buf.append("lo body");
+  assert(context.parse(&buf, Timestamp::now()));
+  assert(context.done());
+  assert(context.request().bodyStreamed());
+  assert(context.request().body().empty());
+  assert(streamed == "hello body");
+
+  streamed.clear();
+  context.retire(&buf);
+  buf.append("POST /upload HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+    "3\r\nhel\r\n7\r\nlo body\r\n0\r\n\r\n");
+  assert(context.parse(&buf, Timestamp::now()));
+  assert(context.done());
+  assert(streamed == "hello body");
+}
+
+void testErrors()
+{
+  HTTPContext context;
+  context.setMaxBodySz(8);
+  Buffer buf;
+  buf.append("POST /echo HTTP/1.1\r\nContent-Length: 10\r\n\r\n");
+  assert(!context.parse(&buf, Timestamp::now()));
+  assert(context.error() == HTTPContext::TooLarge);
+
+  context.reset();
+  buf.retrieveAll();
+  buf.append("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n"
+    "5\r\nhello\r\n5\r\nworld\r\n");
+  assert(!context.parse(&buf, Timestamp::now()));
+  assert(context.error() == HTTPContext::TooLarge);
+
+  context.reset();
+  buf.retrieveAll();
+  buf.append("POST /echo HTTP/1.1\r\nContent-Length: 1x\r\n\r\n");
+  assert(!context.parse(&buf, Timestamp::now()));
+  assert(context.error() == HTTPContext::BadRequest);
+}
+
+bool badRequest(const char* req)
+{
+  HTTPContext context;
+  Buffer buf;
+  buf.append(req);
+  return !context.parse(&buf, Timestamp::now()) && context.error() == HTTPContext::BadRequest;
+}
+
+// requests another server could frame differently are refused
+void testSmuggling()
+{
+  assert(badRequest("POST /echo HTTP/1.1\r\nContent-Length: 5\r\n"
+    "Transfer-Encoding: chunked\r\n\r\n0\r\n\r\n"));
+  assert(badRequest("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+    "Content-Length: 5\r\n\r\n0\r\n\r\n"));
+  assert(badRequest("POST /echo HTTP/1.1\r\nContent-Length: 5\r\n"
+    "Content-Length: 6\r\n\r\nhello!"));
+  assert(badRequest("POST /echo HTTP/1.1\r\nTransfer-Encoding: xchunked\r\n\r\n"));
+  assert(badRequest("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked, gzip\r\n\r\n"));
+  assert(badRequest("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n"
+    "Transfer-Encoding: gzip\r\n\r\n"));
+
+  // the same length twice is one length
+  HTTPContext context;
+  Buffer buf;
+  buf.append("POST /echo HTTP/1.1\r\nContent-Length: 5\r\nContent-Length: 5\r\n\r\nhello");
+  assert(context.parse(&buf, Timestamp::now()));
+  assert(context.done() && context.request().body() == "hello");
+
+  context.reset();
+  buf.retrieveAll();
+  buf.append("POST /echo HTTP/1.1\r\nTransfer-Encoding: gzip ,  Chunked\r\n\r\n0\r\n\r\n");
+  assert(context.parse(&buf, Timestamp::now()));
+  assert(context.done());
+}
+
+// feeds line after line (each a read of its own) until the context
+// fails, returns how many lines it took or -1 if it never failed
+int feedUntilFail(HTTPContext* context, Buffer* buf, const std::string& line, int max)
+{
+  for(int i = 0; i < max; ++i)
+  {
+    buf->append(line);
+    if(!context->parse(buf, Timestamp::now()))
+      return context->error() == HTTPContext::BadRequest ? i + 1 : -1;
+  }
+  return -1;
+}
+void testLimits()
+{
+  const std::string head = "POST /echo HTTP/1.1\r\n";
+  // header lines of 1 KB one at a time: stops at kMaxHeaderSz, not
+  // when the buffer happens to end inside a line
+  HTTPContext context;
+  Buffer buf;
+  buf.append(head);
+  std::string big = "X-Big: " + std::string(1024 - 9, 'x') + "\r\n";
+  int n = feedUntilFail(&context, &buf, big, 1000);
+  assert(n > 0 && static_cast<size_t>(n) <= HTTPContext::kMaxHeaderSz / 1024 + 1);
+
+  // many small fields
+  context.reset();
+  buf.retrieveAll();
+  buf.append(head);
+  n = feedUntilFail(&context, &buf, "X-A: 1\r\n", 1000);
+  assert(n == static_cast<int>(HTTPContext::kMaxHeaders) + 1);
+
+  // as many as allowed are fine
+  context.reset();
+  buf.retrieveAll();
+  buf.append(head);
+  for(size_t i = 0; i < HTTPContext::kMaxHeaders - 1; ++i) buf.append("X-A: 1\r\n");
+  buf.append("Content-Length: 0\r\n\r\n");
+  assert(context.parse(&buf, Timestamp::now()) && context.done());
+
+  // a chunk size line that never ends
+  const std::string chunked = head + "Transfer-Encoding: chunked\r\n\r\n";
+  context.reset();
+  buf.retrieveAll();
+  buf.append(chunked);
+  buf.append("5");
+  n = feedUntilFail(&context, &buf, ";ext=" + std::string(1019, 'e'), 1000);
+  assert(n > 0 && static_cast<size_t>(n) <= HTTPContext::kMaxLineSz / 1024 + 1);
+
+  // a trailer field that never ends
+  context.reset();
+  buf.retrieveAll();
+  buf.append(chunked + "0\r\nX-Trailer: ");
+  n = feedUntilFail(&context, &buf, std::string(1024, 't'), 1000);
+  assert(n > 0 && static_cast<size_t>(n) <= HTTPContext::kMaxLineSz / 1024 + 1);
+
+  // trailer fields that never end
+  context.reset();
+  buf.retrieveAll();
+  buf.append(chunked + "0\r\n");
+  n = feedUntilFail(&context, &buf, big, 1000);
+  assert(n > 0 && static_cast<size_t>(n) <= HTTPContext::kMaxHeaderSz / 1024 + 1);
+}
+int main()
+{
+  testContentLength();
+  testZeroCopy();
+  testChunked();
+  testStreaming();
+  testErrors();
+  testSmuggling();
+  testLimits();
+}
@@ -0,0 +1,103 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/net/http/HTTPResponse.h"
+#include "chtho/net/Buffer.h"
+
+#include <string>
+
+#include <assert.h>
+#include <stdio.h>
+
+using namespace chtho;
+using namespace chtho::net;
+
+// 2021-03-14 08:00:00 UTC
+const Timestamp kTime(static_cast<int64_t>(1615708800) * 1000 * 1000);
+
+void testSerialize()
+{
+  HTTPResponse resp(false);
+  resp.setStatus(HTTPResponse::OK200);
+  resp.setStatusMsg("OK");
+  resp.setContentType("text/plain");
+  resp.addHeader("Server", "chtho");
+  resp.setBody("hello, world!\n");
+  Buffer buf;
+  resp.appendToBuf(&buf, kTime);
+  std::string s = buf.retrieveAllAsString();
+  assert(s == "HTTP/1.1 200 OK\r\n"
+    "Date: Sun, 14 Mar 2021 08:00:00 GMT\r\n"
+    "Content-Length: 14\r\n"
+    "Connection: Keep-Alive\r\n"
+    "Content-Type: text/plain\r\n"
+    "Server: chtho\r\n"
+    "\r\n"
+    "hello, world!\n");
+}
+
+void testStatus()
+{
+  HTTPResponse resp(true);
+  resp.setStatus(HTTPResponse::NotFound404);
+  Buffer buf;
+  resp.appendToBuf(&buf, kTime);
+  std::string s = buf.retrieveAllAsString();
+  assert(s.find("HTTP/1.1 404 Not Found\r\n") == 0);
+  assert(s.find("Content-Length: 0\r\n") != std::string::npos);
+  assert(s.find("Connection: close\r\n") != std::string::npos);
+
+  // non standard phrase and unknown code
+  resp.setStatusMsg("Nope");
+  resp.appendToBuf(&buf, kTime);
+  assert(buf.retrieveAllAsString().find("HTTP/1.1 404 Nope\r\n") == 0);
+  resp.setStatus(static_cast<HTTPResponse::Status>(418));
+  resp.setStatusMsg("I'm a teapot");
+  resp.appendToBuf(&buf, kTime);
+  assert(buf.retrieveAllAsString().find("HTTP/1.1 418 I'm a teapot\r\n") == 0);
+
+  // no body, no length
+  resp.reset(false);
+  resp.setStatus(HTTPResponse::NotModified304);
+  resp.appendToBuf(&buf, kTime);
+  assert(buf.retrieveAllAsString().find("Content-Length") == std::string::npos);
+}
+
+void testHeaders()
+{
+  HTTPResponse resp;
+  resp.addHeader("Content-Type", "text/plain");
+  resp.addHeader("X-A", "1");
+  resp.addHeader("content-type", "text/html");
+  assert(resp.numHeaders() == 2);
+  assert(resp.getHeader("Content-Type") == "text/html");
+  assert(resp.headerKey(0) == "Content-Type");
+  assert(resp.headerVal(1) == "1");
+  assert(resp.getHeader("X-B").empty());
+  resp.reset(false);
+  assert(resp.numHeaders() == 0);
+  assert(resp.body().empty());
+}
+
+void testDate()
+{
+  StringPiece d = HTTPResponse::dateHeader(kTime);
+  assert(d == "Date: Sun, 14 Mar 2021 08:00:00 GMT\r\n");
+  // cached for the whole second
+  Timestamp later(kTime.usSinceE() + 999999);
+  assert(HTTPResponse::dateHeader(later).data() == d.data());
+  assert(HTTPResponse::dateHeader(later) == "Date: Sun, 14 Mar 2021 08:00:00 GMT\r\n");
+  Timestamp next(kTime.usSinceE() + 1000000);
+  assert(HTTPResponse::dateHeader(next) == "Date: Sun, 14 Mar 2021 08:00:01 GMT\r\n");
+}
+
+int main()
+{
+  testSerialize();
+  testStatus();
+  testHeaders();
+  testDate();
+  printf("HTTPResponse tests passed\n");
+}
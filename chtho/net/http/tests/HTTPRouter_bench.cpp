@@ -0,0 +1,114 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/net/http/HTTPRouter.h"
+
+#include <string>
+#include <vector>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace chtho;
+using namespace chtho::net;
+
+// an API gateway style route table: services x resources x shapes
+// like '/api/v2/billing/invoices/:id/refund'
+void makeRoutes(size_t n, std::vector<std::string>* patterns,
+  std::vector<std::string>* paths)
+{
+  static const char* shapes[] = { "", "/:id", "/:id/history", "/:id/refund",
+    "/:id/items/:item", "/search" };
+  const size_t kShapes = sizeof shapes / sizeof shapes[0];
+  for(size_t i = 0; patterns->size() < n; ++i)
+  {
+    size_t svc = i / (20 * kShapes), res = (i / kShapes) % 20, shape = i % kShapes;
+    std::string base = "/api/v" + std::to_string(1 + svc % 3) + "/service"
+      + std::to_string(svc) + "/resource" + std::to_string(res);
+    patterns->push_back(base + shapes[shape]);
+    std::string path = patterns->back();
+    size_t pos;
+    while((pos = path.find(":id")) != std::string::npos) path.replace(pos, 3, "1029384756");
+    while((pos = path.find(":item")) != std::string::npos) path.replace(pos, 5, "sku-42");
+    paths->push_back(path);
+  }
+}
+
+// what a hand written if/else chain over the patterns amounts to
+bool linearMatch(const std::string& pattern, const StringPiece& path)
+{
+  const char* p = pattern.data(), *pe = p + pattern.size();
+  const char* s = path.data(), *se = s + path.size();
+  while(p < pe && s < se)
+  {
+    if(*p == ':')
+    {
+      while(p < pe && *p != '/') ++p;
+      while(s < se && *s != '/') ++s;
+    }
+    else if(*p++ != *s++) return false;
+  }
+  return p == pe && s == se;
+}
+
+void bench(size_t n, int iters)
+{
+  std::vector<std::string> patterns, paths;
+  makeRoutes(n, &patterns, &paths);
+  HTTPRouter router;
+  for(const auto& p : patterns)
+    router.add(HTTPRequest::Get, p, [](const HTTPRequest&, HTTPResponse*){});
+  router.compile();
+
+  std::vector<int> order(paths.size() * 4);
+  srand(7);
+  for(auto& o : order) o = rand() % static_cast<int>(paths.size());
+  HTTPRequest req;
+  const char* get = "GET";
+  Timestamp start = Timestamp::now();
+  size_t found = 0;
+  for(int it = 0; it < iters; ++it)
+  {
+    for(int o : order)
+    {
+      const std::string& path = paths[o];
+      req.reset();
+      req.setMethod(get, get + 3);
+      req.setPath(path.data(), path.data() + path.size());
+      HTTPRouter::Result res;
+      if(router.match(&req, &res)) ++found;
+    }
+  }
+  double radix = Timestamp::diffInSec(Timestamp::now(), start) * 1e9
+    / (static_cast<double>(iters) * order.size());
+  assert(found == iters * order.size());
+
+  int linearIters = std::max(1, iters / 20);
+  start = Timestamp::now();
+  found = 0;
+  for(int it = 0; it < linearIters; ++it)
+  {
+    for(int o : order)
+    {
+      StringPiece path(paths[o]);
+      for(const auto& p : patterns)
+        if(linearMatch(p, path)) { ++found; break; }
+    }
+  }
+  double linear = Timestamp::diffInSec(Timestamp::now(), start) * 1e9
+    / (static_cast<double>(linearIters) * order.size());
+  if(found != linearIters * order.size()) printf("linear scan missed routes\n");
+  printf("%6zu routes %6zu nodes   radix %8.1f ns/match   linear %10.1f ns/match\n",
+    n, router.numNodes(), radix, linear);
+}
+
+int main(int argc, char* argv[])
+{
+  int iters = argc > 1 ? atoi(argv[1]) : 200;
+  bench(100, iters);
+  bench(1200, iters);
+  bench(5000, iters / 4 + 1);
+}
@@ -0,0 +1,109 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/net/http/HTTPRouter.h"
+#include "chtho/net/http/HTTPResponse.h"
+
+#include <string>
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+using namespace chtho;
+using namespace chtho::net;
+
+std::string hit; // name of the handler that ran
+std::string target; // the request is a view, keep the path alive
+
+HTTPRouter::HTTPCB named(const std::string& name)
+{
+  return [name](const HTTPRequest&, HTTPResponse*){ hit = name; };
+}
+
+// returns the handler name, '404' or '405'
+std::string route(const HTTPRouter& router, HTTPRequest* req,
+  HTTPRequest::Method m, const std::string& path)
+{
+  target = path;
+  req->reset();
+  const char* name = m == HTTPRequest::Get ? "GET" : m == HTTPRequest::Post ? "POST"
+    : m == HTTPRequest::Head ? "HEAD" : "DELETE";
+  req->setMethod(name, name + strlen(name));
+  req->setPath(target.data(), target.data() + target.size());
+  HTTPRouter::Result res;
+  const HTTPRouter::Handler* h = router.match(req, &res);
+  if(!h) return res == HTTPRouter::NotFound ? "404" : "405";
+  HTTPResponse resp;
+  h->sync(*req, &resp);
+  return hit;
+}
+
+int main()
+{
+  HTTPRouter router;
+  router.add(HTTPRequest::Get, "/", named("root"));
+  router.add(HTTPRequest::Get, "/users", named("users"));
+  router.add(HTTPRequest::Post, "/users", named("createUser"));
+  router.add(HTTPRequest::Get, "/users/new", named("newUser"));
+  router.add(HTTPRequest::Get, "/users/:id", named("user"));
+  router.add(HTTPRequest::Delete, "/users/:id", named("deleteUser"));
+  router.add(HTTPRequest::Get, "/users/:id/posts/:post", named("post"));
+  router.add(HTTPRequest::Get, "/user", named("user1"));
+  router.add(HTTPRequest::Get, "/usage", named("usage"));
+  router.add(HTTPRequest::Get, "/static/*file", named("static"));
+  router.add(HTTPRequest::Get, "/static/index.html", named("index"));
+  router.add(HTTPRequest::Get, "/a:b", named("colon"));
+  router.compile();
+
+  HTTPRequest req;
+  assert(route(router, &req, HTTPRequest::Get, "/") == "root");
+  assert(route(router, &req, HTTPRequest::Get, "/users") == "users");
+  assert(route(router, &req, HTTPRequest::Post, "/users") == "createUser");
+  assert(route(router, &req, HTTPRequest::Get, "/user") == "user1");
+  assert(route(router, &req, HTTPRequest::Get, "/usage") == "usage");
+  assert(route(router, &req, HTTPRequest::Get, "/use") == "404");
+  assert(route(router, &req, HTTPRequest::Get, "/users/new") == "newUser");
+  assert(req.params().empty());
+
+  assert(route(router, &req, HTTPRequest::Get, "/users/42") == "user");
+  assert(req.param("id") == "42");
+  // a static route for one method does not shadow a parameter
+  assert(route(router, &req, HTTPRequest::Delete, "/users/new") == "deleteUser");
+  assert(req.param("id") == "new");
+  assert(route(router, &req, HTTPRequest::Get, "/users/42/posts/7") == "post");
+  assert(req.param("id") == "42" && req.param("post") == "7");
+  assert(req.params().size() == 2);
+  assert(route(router, &req, HTTPRequest::Get, "/users/42/posts") == "404");
+  assert(route(router, &req, HTTPRequest::Get, "/users//posts/7") == "404");
+
+  assert(route(router, &req, HTTPRequest::Get, "/static/css/site.css") == "static");
+  assert(req.param("file") == "css/site.css");
+  assert(route(router, &req, HTTPRequest::Get, "/static/") == "static");
+  assert(req.param("file") == "");
+  assert(route(router, &req, HTTPRequest::Get, "/static/index.html") == "index");
+  assert(route(router, &req, HTTPRequest::Get, "/a:b") == "colon");
+
+  // the path exists, the method does not
+  assert(route(router, &req, HTTPRequest::Post, "/users/42") == "405");
+  assert(route(router, &req, HTTPRequest::Delete, "/static/x") == "405");
+  // what a 405 lists in Allow, HEAD with GET
+  assert(router.allowed("/users/42") == "GET, HEAD, DELETE");
+  assert(router.allowed("/users") == "GET, HEAD, POST");
+  assert(router.allowed("/static/x") == "GET, HEAD");
+  assert(router.allowed("/nowhere/at/all").empty());
+  // HEAD is served by GET
+  assert(route(router, &req, HTTPRequest::Head, "/users/42") == "user");
+
+  // parameters survive a copy of the request
+  route(router, &req, HTTPRequest::Get, "/users/42/posts/7");
+  HTTPRequest copy(req);
+  req.reset();
+  target.assign(target.size(), 'x');
+  assert(copy.param("id") == "42" && copy.param("post") == "7");
+  assert(copy.path() == "/users/42/posts/7");
+  printf("HTTPRouter tests passed, %zu routes in %zu nodes\n",
+    router.size(), router.numNodes());
+}
@@ -6,6 +6,7 @@
 #include "chtho/logging/Logger.h"
 #include "chtho/net/EventLoop.h"
 #include "chtho/net/http/HTTPServer.h"
+#include "chtho/net/http/HTTPCompressor.h"
 #include "chtho/net/http/HTTPRequest.h"
 #include "chtho/net/http/HTTPResponse.h"
 
@@ -16,6 +17,15 @@ using namespace chtho::net;
 
 extern char favicon[555];
 
+// bytes of the streamed upload currently being received
+// (the example runs each connection on one loop thread)
+__thread size_t uploaded = 0;
+
+void onBody(const HTTPRequest& req, const char* data, size_t len)
+{
+  uploaded += len;
+}
+
 void onRequest(const HTTPRequest& req, HTTPResponse* resp)
 {
   if(req.path() == "/")
@@ -43,6 +53,22 @@ void onRequest(const HTTPRequest& req, HTTPResponse* resp)
     resp->addHeader("Server", "chtho");
     resp->setBody("hello, world!\n");
   }
+  else if(req.path() == "/echo" && req.method() == HTTPRequest::Post)
+  {
+    resp->setStatus(HTTPResponse::OK200);
+    resp->setStatusMsg("OK");
+    resp->setContentType("application/octet-stream");
+    resp->setBody(req.body().as_string());
+  }
+  else if(req.path() == "/upload" && req.method() == HTTPRequest::Post)
+  {
+    size_t n = req.bodyStreamed() ? uploaded : req.body().size();
+    uploaded = 0;
+    resp->setStatus(HTTPResponse::OK200);
+    resp->setStatusMsg("OK");
+    resp->setContentType("text/plain");
+    resp->setBody("received " + std::to_string(n) + " bytes\n");
+  }
   else  
   {
     resp->setStatus(HTTPResponse::NotFound404);
@@ -51,6 +77,17 @@ void onRequest(const HTTPRequest& req, HTTPResponse* resp)
   }
 }
 
+// routed, e.g. '/hello/chtho'
+void onHello(const HTTPRequest& req, HTTPResponse* resp)
+{
+  resp->setStatus(HTTPResponse::OK200);
+  resp->setContentType("text/plain");
+  std::string* body = resp->mutableBody();
+  body->append("hello, ");
+  body->append(req.param("name").data(), req.param("name").size());
+  body->append("!\n");
+}
+
 int main(int argc, char const *argv[])
 {
   int numThreads = 0, port = 8080;
@@ -62,6 +99,10 @@ int main(int argc, char const *argv[])
   EventLoop loop;
   HTTPServer server(&loop, InetAddr(port), "hello server");
   server.setHTTPCB(onRequest);
+  server.route(HTTPRequest::Get, "/hello/:name", onHello);
+  server.setBodyCB(onBody);
+  server.setMaxBodySz(64*1024*1024);
+  server.setCompressor(std::make_shared<HTTPCompressor>());
   server.setThreadNum(numThreads);
   server.start();
   loop.loop();
@@ -0,0 +1,245 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/net/EventLoop.h"
+#include "chtho/net/EventLoopThread.h"
+#include "chtho/net/http/HTTPServer.h"
+#include "chtho/net/http/HTTPStaticFiles.h"
+
+#include <string>
+
+#include <assert.h>
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace chtho;
+using namespace chtho::net;
+
+const uint16_t kPort = 8090;
+std::string root;
+
+struct Reply
+{
+  int status;
+  std::string headers;
+  std::string body;
+  std::string header(const std::string& key) const
+  {
+    size_t p = headers.find("\r\n" + key + ": ");
+    if(p == std::string::npos) return std::string();
+    p += key.size() + 4;
+    return headers.substr(p, headers.find("\r\n", p) - p);
+  }
+};
+
+int connectServer()
+{
+  int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in addr;
+  memset(&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(kPort);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  int ret = ::connect(fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof addr);
+  assert(ret == 0);
+  (void)ret;
+  return fd;
+}
+
+// one request on a kept-alive connection, the reply is read
+// according to its Content-Length (none for HEAD)
+Reply request(int fd, const std::string& req, bool head = false)
+{
+  ssize_t n = ::write(fd, req.data(), req.size());
+  assert(n == static_cast<ssize_t>(req.size()));
+  std::string in;
+  char buf[65536];
+  Reply r;
+  size_t hdrEnd;
+  while((hdrEnd = in.find("\r\n\r\n")) == std::string::npos)
+  {
+    n = ::read(fd, buf, sizeof buf);
+    assert(n > 0);
+    in.append(buf, n);
+  }
+  r.headers = in.substr(0, hdrEnd + 2);
+  r.status = atoi(in.c_str() + 9);
+  size_t len = head ? 0 : strtoul(r.header("Content-Length").c_str(), NULL, 10);
+  in.erase(0, hdrEnd + 4);
+  while(in.size() < len)
+  {
+    n = ::read(fd, buf, sizeof buf);
+    assert(n > 0);
+    in.append(buf, n);
+  }
+  assert(in.size() == len);
+  r.body = in;
+  return r;
+}
+
+void writeFile(const std::string& name, const std::string& content)
+{
+  FILE* fp = ::fopen((root + "/" + name).c_str(), "w");
+  assert(fp);
+  ::fwrite(content.data(), 1, content.size(), fp);
+  ::fclose(fp);
+}
+
+std::string get(const std::string& path, const std::string& extra = std::string())
+{
+  return "GET " + path + " HTTP/1.1\r\nHost: x\r\n" + extra + "\r\n";
+}
+
+void testGet(int fd)
+{
+  Reply r = request(fd, get("/static/small.txt"));
+  assert(r.status == 200);
+  assert(r.body == "hello, static\n");
+  assert(r.header("Content-Type") == "text/plain; charset=utf-8");
+  assert(!r.header("ETag").empty());
+  assert(!r.header("Last-Modified").empty());
+  assert(r.header("Accept-Ranges") == "bytes");
+
+  // large enough for sendfile, followed by a pipelined small one
+  std::string big(3 * 1024 * 1024 + 17, 'x');
+  for(size_t i = 0; i < big.size(); i += 4096) big[i] = static_cast<char>('a' + i / 4096 % 26);
+  writeFile("big.bin", big);
+  r = request(fd, get("/static/big.bin"));
+  assert(r.status == 200 && r.body == big);
+  assert(r.header("Content-Type") == "application/octet-stream");
+  r = request(fd, get("/static/dir/"));
+  assert(r.status == 200 && r.body == "<h1>index</h1>");
+  assert(r.header("Content-Type") == "text/html; charset=utf-8");
+  r = request(fd, get("/static/sm%61ll.txt"));
+  assert(r.status == 200 && r.body == "hello, static\n");
+
+  r = request(fd, "HEAD /static/big.bin HTTP/1.1\r\n\r\n", true);
+  assert(r.status == 200 && r.body.empty());
+  assert(r.header("Content-Length") == std::to_string(big.size()));
+}
+
+void testErrors(int fd)
+{
+  assert(request(fd, get("/static/nothere.txt")).status == 404);
+  assert(request(fd, get("/static/../secret.txt")).status == 403);
+  assert(request(fd, get("/static/dir/%2e%2e/%2e%2e/secret.txt")).status == 403);
+  assert(request(fd, get("/static/%zz")).status == 403);
+  assert(request(fd, "POST /static/small.txt HTTP/1.1\r\nContent-Length: 0\r\n\r\n").status == 405);
+}
+
+void testConditional(int fd)
+{
+  Reply r = request(fd, get("/static/small.txt"));
+  std::string etag = r.header("ETag");
+  std::string lm = r.header("Last-Modified");
+  r = request(fd, get("/static/small.txt", "If-None-Match: " + etag + "\r\n"), true);
+  assert(r.status == 304);
+  assert(r.header("ETag") == etag);
+  assert(r.header("Content-Length").empty());
+  r = request(fd, get("/static/small.txt", "If-None-Match: \"other\", W/" + etag + "\r\n"), true);
+  assert(r.status == 304);
+  r = request(fd, get("/static/small.txt", "If-None-Match: \"other\"\r\n"));
+  assert(r.status == 200);
+  r = request(fd, get("/static/small.txt", "If-Modified-Since: " + lm + "\r\n"), true);
+  assert(r.status == 304);
+  r = request(fd, get("/static/small.txt", "If-Modified-Since: Sat, 01 Jan 2000 00:00:00 GMT\r\n"));
+  assert(r.status == 200);
+}
+
+void testRange(int fd)
+{
+  // 'hello, static\n'
+  Reply r = request(fd, get("/static/small.txt", "Range: bytes=0-4\r\n"));
+  assert(r.status == 206 && r.body == "hello");
+  assert(r.header("Content-Range") == "bytes 0-4/14");
+  r = request(fd, get("/static/small.txt", "Range: bytes=7-\r\n"));
+  assert(r.status == 206 && r.body == "static\n");
+  r = request(fd, get("/static/small.txt", "Range: bytes=-7\r\n"));
+  assert(r.status == 206 && r.body == "static\n");
+  r = request(fd, get("/static/small.txt", "Range: bytes=7-100\r\n"));
+  assert(r.status == 206 && r.body == "static\n");
+  r = request(fd, get("/static/small.txt", "Range: bytes=14-\r\n"));
+  assert(r.status == 416 && r.header("Content-Range") == "bytes */14");
+  // several ranges are not supported, the whole file is sent
+  r = request(fd, get("/static/small.txt", "Range: bytes=0-1,3-4\r\n"));
+  assert(r.status == 200 && r.body == "hello, static\n");
+  r = request(fd, get("/static/small.txt", "Range: bytes=0-4\r\nIf-Range: \"stale\"\r\n"));
+  assert(r.status == 200);
+  r = request(fd, get("/static/big.bin", "Range: bytes=1048576-1048580\r\n"));
+  assert(r.status == 206 && r.body.size() == 5);
+}
+
+void testRevalidate(int fd)
+{
+  Reply r = request(fd, get("/static/small.txt"));
+  std::string etag = r.header("ETag");
+  writeFile("small.txt", "changed\n");
+  // the cached entry is trusted for up to a second
+  ::usleep(1100 * 1000);
+  r = request(fd, get("/static/small.txt"));
+  assert(r.status == 200 && r.body == "changed\n");
+  assert(r.header("ETag") != etag);
+  ::unlink((root + "/small.txt").c_str());
+  ::usleep(1100 * 1000);
+  assert(request(fd, get("/static/small.txt")).status == 404);
+}
+
+// a small file shrinking under a cached entry is served from the copy
+// made when it was opened (a mapping of it would raise SIGBUS)
+void testTruncate(int fd)
+{
+  std::string content(8192, 't');
+  writeFile("trunc.txt", content);
+  Reply r = request(fd, get("/static/trunc.txt"));
+  assert(r.status == 200 && r.body == content);
+  int ret = ::truncate((root + "/trunc.txt").c_str(), 0);
+  assert(ret == 0);
+  (void)ret;
+  r = request(fd, get("/static/trunc.txt"));
+  assert(r.status == 200 && r.body == content);
+  ::usleep(1100 * 1000);
+  r = request(fd, get("/static/trunc.txt"));
+  assert(r.status == 200 && r.body.empty());
+}
+
+int main()
+{
+  char tmpl[] = "/tmp/chtho_static_XXXXXX";
+  root = ::mkdtemp(tmpl);
+  ::mkdir((root + "/dir").c_str(), 0755);
+  writeFile("small.txt", "hello, static\n");
+  writeFile("dir/index.html", "<h1>index</h1>");
+  writeFile("../secret.txt", "secret");
+
+  HTTPStaticFiles files(root);
+  EventLoopThread loopThread;
+  EventLoop* loop = loopThread.startLoop();
+  std::unique_ptr<HTTPServer> server;
+  loop->runInLoop([&](){
+    server.reset(new HTTPServer(loop, InetAddr(kPort), "static",
+      TcpServer::PortOpt::Reuse));
+    server->route(HTTPRequest::Get, "/static/*file", files.handler());
+    server->route(HTTPRequest::Post, "/static/*file", files.handler());
+    server->start();
+  });
+  ::usleep(100 * 1000);
+  int fd = connectServer();
+  testGet(fd);
+  testErrors(fd);
+  testConditional(fd);
+  testRange(fd);
+  testRevalidate(fd);
+  testTruncate(fd);
+  ::close(fd);
+  loop->runInLoop([&](){ server.reset(); });
+  ::usleep(100 * 1000);
+  printf("HTTPStaticFiles tests passed, %zu files cached\n", files.cached());
+  ::system(("rm -rf " + root + " /tmp/secret.txt").c_str());
+}
@@ -0,0 +1,374 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/net/EventLoop.h"
+#include "chtho/net/EventLoopThread.h"
+#include "chtho/net/http/HTTPServer.h"
+#include "chtho/net/http/HTTPStream.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <zlib.h>
+
+using namespace chtho;
+using namespace chtho::net;
+
+const uint16_t kPort = 8094;
+const size_t kLine = 100; // bytes per produced line
+
+std::atomic<size_t> produced(0);
+std::atomic<int> closedStreams(0);
+
+// line i of a /count body
+std::string line(size_t i)
+{
+  char buf[kLine + 1];
+  snprintf(buf, sizeof buf, "%010zu", i);
+  std::string s(buf);
+  s.append(kLine - 11, static_cast<char>('a' + i % 26));
+  s += '\n';
+  return s;
+}
+
+// a blocking test client
+class Client
+{
+private:
+  int fd_;
+  std::string in_;
+public:
+  Client() : fd_(::socket(AF_INET, SOCK_STREAM, 0))
+  {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int ret = ::connect(fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    assert(ret == 0);
+    (void)ret;
+  }
+  ~Client() { close(); }
+  void close()
+  {
+    if(fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+  }
+  void write(const std::string& data)
+  {
+    ssize_t n = ::write(fd_, data.data(), data.size());
+    assert(n == static_cast<ssize_t>(data.size()));
+    (void)n;
+  }
+  // false on EOF or timeout
+  bool fill(int timeoutMs = 2000)
+  {
+    struct pollfd pfd = { fd_, POLLIN, 0 };
+    if(::poll(&pfd, 1, timeoutMs) <= 0) return false;
+    char buf[65536];
+    ssize_t n = ::read(fd_, buf, sizeof(buf));
+    if(n <= 0) return false;
+    in_.append(buf, n);
+    return true;
+  }
+  std::string head()
+  {
+    size_t end;
+    while((end = in_.find("\r\n\r\n")) == std::string::npos)
+      if(!fill()) return std::string();
+    std::string h = in_.substr(0, end + 4);
+    in_.erase(0, end + 4);
+    return h;
+  }
+  // a whole chunked body, empty on a framing error
+  std::string chunked()
+  {
+    std::string body;
+    for(;;)
+    {
+      size_t eol;
+      while((eol = in_.find("\r\n")) == std::string::npos)
+        if(!fill()) return std::string();
+      size_t len = strtoul(in_.c_str(), NULL, 16);
+      while(in_.size() < eol + 2 + len + 2)
+        if(!fill()) return std::string();
+      assert(in_.compare(eol + 2 + len, 2, "\r\n") == 0);
+      body.append(in_, eol + 2, len);
+      in_.erase(0, eol + 2 + len + 2);
+      if(len == 0) return body;
+    }
+  }
+  std::string take(size_t n)
+  {
+    while(in_.size() < n)
+      if(!fill()) return std::string();
+    std::string s = in_.substr(0, n);
+    in_.erase(0, n);
+    return s;
+  }
+  // everything up to EOF
+  std::string rest()
+  {
+    while(fill()) ;
+    std::string s;
+    s.swap(in_);
+    return s;
+  }
+  // a single chunk as it arrives
+  std::string chunk()
+  {
+    size_t eol;
+    while((eol = in_.find("\r\n")) == std::string::npos)
+      if(!fill()) return std::string();
+    size_t len = strtoul(in_.c_str(), NULL, 16);
+    while(in_.size() < eol + 2 + len + 2)
+      if(!fill()) return std::string();
+    std::string c = in_.substr(eol + 2, len);
+    in_.erase(0, eol + 2 + len + 2);
+    return c;
+  }
+};
+
+std::string gunzip(const std::string& z)
+{
+  z_stream zs;
+  memset(&zs, 0, sizeof zs);
+  int ret = inflateInit2(&zs, 15 + 16);
+  assert(ret == Z_OK);
+  std::string out;
+  char buf[65536];
+  zs.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(z.data()));
+  zs.avail_in = static_cast<uInt>(z.size());
+  do
+  {
+    zs.next_out = reinterpret_cast<Bytef*>(buf);
+    zs.avail_out = sizeof buf;
+    ret = inflate(&zs, Z_NO_FLUSH);
+    assert(ret == Z_OK || ret == Z_STREAM_END);
+    out.append(buf, sizeof buf - zs.avail_out);
+  } while(ret != Z_STREAM_END);
+  inflateEnd(&zs);
+  return out;
+}
+
+void testChunked()
+{
+  Client c;
+  c.write("GET /count?n=1000 HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  std::string h = c.head();
+  assert(h.find("HTTP/1.1 200") == 0);
+  assert(h.find("Transfer-Encoding: chunked\r\n") != std::string::npos);
+  assert(h.find("Content-Length") == std::string::npos);
+  std::string body = c.chunked();
+  assert(body.size() == 1000 * kLine);
+  for(size_t i = 0; i < 1000; ++i) assert(body.compare(i * kLine, kLine, line(i)) == 0);
+
+  // the connection goes on with the next request
+  c.write("GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  assert(c.head().find("HTTP/1.1 200") == 0);
+}
+
+// a client that does not read stops the producer, the server holds
+// no more than the high-water mark plus what the socket takes
+void testBackpressure()
+{
+  const size_t n = 1000*1000; // 100 MB
+  Client c;
+  produced = 0;
+  c.write("GET /count?n=" + std::to_string(n) + " HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  ::usleep(300 * 1000);
+  size_t stalled = produced;
+  ::usleep(200 * 1000);
+  assert(produced == stalled);
+  assert(stalled < n * kLine / 4);
+  assert(c.head().find("HTTP/1.1 200") == 0);
+  size_t total = 0;
+  for(;;)
+  {
+    std::string piece = c.chunk();
+    if(piece.empty()) break;
+    total += piece.size();
+  }
+  assert(total == n * kLine);
+  printf("backpressure: %zu bytes produced while the client did not read\n", stalled);
+}
+
+// events from a timer, then the end
+void testEvents()
+{
+  Client c;
+  c.write("GET /events HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  std::string h = c.head();
+  assert(h.find("Content-Type: text/event-stream\r\n") != std::string::npos);
+  assert(h.find("Cache-Control: no-cache\r\n") != std::string::npos);
+  // every event arrives in a chunk of its own
+  assert(c.chunk() == "event: tick\nid: 0\ndata: tick 0\ndata: second line\n\n");
+  assert(c.chunk() == "event: tick\nid: 1\ndata: tick 1\ndata: second line\n\n");
+  assert(c.chunk() == "event: tick\nid: 2\ndata: tick 2\ndata: second line\n\n");
+  assert(c.chunk() == ": bye\n\n");
+  assert(c.chunk().empty());
+}
+
+// the peer goes away in the middle of an endless stream
+void testClose()
+{
+  int before = closedStreams;
+  {
+    Client c;
+    c.write("GET /forever HTTP/1.1\r\nHost: localhost\r\n\r\n");
+    assert(c.head().find("HTTP/1.1 200") == 0);
+    assert(!c.chunk().empty());
+  }
+  for(int i = 0; i < 100 && closedStreams == before; ++i) ::usleep(10 * 1000);
+  assert(closedStreams == before + 1);
+}
+
+// HTTP/1.0 has no chunks, the body ends with the connection
+void testHTTP10()
+{
+  Client c;
+  c.write("GET /count?n=10 HTTP/1.0\r\n\r\n");
+  std::string h = c.head();
+  assert(h.find("Connection: close\r\n") != std::string::npos);
+  assert(h.find("Transfer-Encoding") == std::string::npos);
+  std::string body = c.rest();
+  assert(body.size() == 10 * kLine && body.compare(0, kLine, line(0)) == 0);
+
+  Client head;
+  head.write("HEAD /count?n=10 HTTP/1.1\r\nHost: localhost\r\n\r\n"
+    "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  assert(head.head().find("Transfer-Encoding: chunked") != std::string::npos);
+  // no body, not even the last chunk
+  assert(head.head().find("HTTP/1.1 200") == 0);
+}
+
+void testGzip()
+{
+  Client c;
+  c.write("GET /count?n=2000 HTTP/1.1\r\nHost: localhost\r\nAccept-Encoding: gzip\r\n\r\n");
+  std::string h = c.head();
+  assert(h.find("Content-Encoding: gzip\r\n") != std::string::npos);
+  assert(h.find("Vary: Accept-Encoding\r\n") != std::string::npos);
+  std::string z = c.chunked();
+  assert(z.size() < 2000 * kLine / 4);
+  std::string body = gunzip(z);
+  assert(body.size() == 2000 * kLine);
+  for(size_t i = 0; i < 2000; ++i) assert(body.compare(i * kLine, kLine, line(i)) == 0);
+}
+
+// a stream pipelined behind a slow asynchronous response waits for it,
+// the request after the stream waits for the stream
+void testPipelined()
+{
+  Client c;
+  c.write("GET /slow HTTP/1.1\r\nHost: localhost\r\n\r\n"
+    "GET /count?n=500 HTTP/1.1\r\nHost: localhost\r\n\r\n"
+    "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n");
+  std::string h = c.head();
+  assert(h.find("Content-Length: 4\r\n") != std::string::npos);
+  assert(c.take(4) == "slow");
+  assert(c.head().find("Transfer-Encoding: chunked") != std::string::npos);
+  assert(c.chunked().size() == 500 * kLine);
+  assert(c.head().find("Content-Length: 5\r\n") != std::string::npos);
+  assert(c.take(5) == "hello");
+}
+
+int main()
+{
+  ::signal(SIGPIPE, SIG_IGN);
+  EventLoopThread serverThread;
+  EventLoop* serverLoop = serverThread.startLoop();
+  std::unique_ptr<HTTPServer> server;
+  serverLoop->runInLoop([&](){
+    server.reset(new HTTPServer(serverLoop, InetAddr(kPort), "server",
+      TcpServer::PortOpt::Reuse));
+    server->setCompressor(std::make_shared<HTTPCompressor>());
+    server->route(HTTPRequest::Get, "/hello", [](const HTTPRequest&, HTTPResponse* resp){
+      resp->setStatus(HTTPResponse::OK200);
+      resp->setBody("hello");
+    });
+    server->routeAsync(HTTPRequest::Get, "/slow", [](const HTTPResponderPtr& r){
+      std::thread([r](){
+        ::usleep(100 * 1000);
+        r->response()->setStatus(HTTPResponse::OK200);
+        r->response()->setBody("slow");
+        r->done();
+      }).detach();
+    });
+    // n lines, pulled as the connection drains
+    server->routeStream(HTTPRequest::Get, "/count",
+      [](const HTTPRequest& req, const HTTPStreamPtr& s){
+        size_t n = strtoul(req.query().data() + 3, NULL, 10);
+        std::shared_ptr<size_t> next(new size_t(0));
+        s->response()->setContentType("text/plain");
+        s->setHighWaterMark(64*1024);
+        s->setProduceCB([n, next](const HTTPStreamPtr& st){
+          if(*next == n)
+          {
+            st->end();
+            return;
+          }
+          st->write(line((*next)++));
+          produced += kLine;
+        });
+      });
+    server->routeStream(HTTPRequest::Get, "/events",
+      [serverLoop](const HTTPRequest&, const HTTPStreamPtr& s){
+        s->setMode(HTTPStream::EventStream);
+        std::shared_ptr<int> n(new int(0));
+        std::shared_ptr<TimerID> timer(new TimerID);
+        *timer = serverLoop->runEvery(0.02, [serverLoop, s, n, timer](){
+          std::string i = std::to_string(*n);
+          s->sendEvent("tick " + i + "\r\nsecond line", "tick", i);
+          if(++*n == 3)
+          {
+            s->sendComment("bye");
+            s->end();
+            serverLoop->cancel(*timer);
+          }
+        });
+      });
+    server->routeStream(HTTPRequest::Get, "/forever",
+      [serverLoop](const HTTPRequest&, const HTTPStreamPtr& s){
+        s->setMode(HTTPStream::EventStream);
+        std::weak_ptr<HTTPStream> weak(s);
+        TimerID timer = serverLoop->runEvery(0.01, [weak](){
+          HTTPStreamPtr st = weak.lock();
+          if(st) st->sendEvent("still here");
+        });
+        s->setCloseCB([serverLoop, timer](const HTTPStreamPtr&){
+          serverLoop->cancel(timer);
+          ++closedStreams;
+        });
+      });
+    server->start();
+  });
+  ::usleep(100 * 1000);
+
+  testChunked();
+  testBackpressure();
+  testEvents();
+  testClose();
+  testHTTP10();
+  testGzip();
+  testPipelined();
+
+  serverLoop->runInLoop([&](){ server.reset(); });
+  ::usleep(100 * 1000);
+  printf("HTTPStream tests passed\n");
+}
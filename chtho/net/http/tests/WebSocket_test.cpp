@@ -0,0 +1,396 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/net/EventLoop.h"
+#include "chtho/net/EventLoopThread.h"
+#include "chtho/net/Simd.h"
+#include "chtho/net/http/HTTPServer.h"
+#include "chtho/net/http/WebSocket.h"
+#include "chtho/threads/CountDownLatch.h"
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <assert.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace chtho;
+using namespace chtho::net;
+
+const uint16_t kPort = 8092;
+
+// connections that joined /chat, only touched in the server loop
+std::vector<WebSocketPtr> room;
+std::atomic<int> lastCloseCode(0);
+
+// a blocking test client speaking just enough of the protocol
+class Client
+{
+private:
+  int fd_;
+  std::string in_;
+
+  // false on EOF or after timeoutMs without data
+  bool fill(int timeoutMs = 2000)
+  {
+    struct pollfd pfd = { fd_, POLLIN, 0 };
+    if(::poll(&pfd, 1, timeoutMs) <= 0) return false;
+    char buf[65536];
+    ssize_t n = ::read(fd_, buf, sizeof(buf));
+    if(n <= 0) return false;
+    in_.append(buf, n);
+    return true;
+  }
+public:
+  Client() : fd_(::socket(AF_INET, SOCK_STREAM, 0))
+  {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(kPort);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int ret = ::connect(fd_, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr));
+    assert(ret == 0);
+    (void)ret;
+  }
+  ~Client() { close(); }
+  void close()
+  {
+    if(fd_ >= 0) ::close(fd_);
+    fd_ = -1;
+  }
+  void write(const std::string& data)
+  {
+    ssize_t n = ::write(fd_, data.data(), data.size());
+    assert(n == static_cast<ssize_t>(data.size()));
+    (void)n;
+  }
+  // the response head, frames sent right behind it stay buffered
+  std::string handshake(const std::string& path, const std::string& version = "13")
+  {
+    write("GET " + path + " HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\n"
+      "Connection: keep-alive, Upgrade\r\nSec-WebSocket-Key: dGhlIHNhbXBsZSBub25jZQ==\r\n"
+      "Sec-WebSocket-Version: " + version + "\r\n\r\n");
+    size_t end;
+    while((end = in_.find("\r\n\r\n")) == std::string::npos)
+      if(!fill()) return std::string();
+    std::string head = in_.substr(0, end + 4);
+    in_.erase(0, end + 4);
+    return head;
+  }
+  // a masked frame as a client has to send it
+  static std::string frame(int op, const std::string& payload, bool fin = true, bool mask = true)
+  {
+    std::string f(1, static_cast<char>((fin ? 0x80 : 0) | op));
+    size_t len = payload.size();
+    char m = mask ? static_cast<char>(0x80) : 0;
+    if(len < 126) f += static_cast<char>(m | len);
+    else if(len <= 0xffff)
+    {
+      f += static_cast<char>(m | 126);
+      f += static_cast<char>(len >> 8);
+      f += static_cast<char>(len);
+    }
+    else
+    {
+      f += static_cast<char>(m | 127);
+      for(int i = 7; i >= 0; --i) f += static_cast<char>(static_cast<uint64_t>(len) >> (8*i));
+    }
+    std::string body(payload);
+    if(mask)
+    {
+      const char key[4] = { 0x12, 0x34, 0x56, 0x78 };
+      uint32_t k;
+      memcpy(&k, key, 4);
+      f.append(key, 4);
+      if(!body.empty()) simd::xorMask(&body[0], body.size(), k);
+    }
+    return f + body;
+  }
+  void send(int op, const std::string& payload, bool fin = true)
+  { write(frame(op, payload, fin)); }
+  // reads one frame from the server, op is -1 on EOF or timeout
+  int recv(std::string* payload, int timeoutMs = 2000)
+  {
+    for(;;)
+    {
+      if(in_.size() >= 2)
+      {
+        const unsigned char* p = reinterpret_cast<const unsigned char*>(in_.data());
+        assert(!(p[1] & 0x80)); // server frames are never masked
+        size_t len = p[1] & 0x7f;
+        size_t hdr = 2;
+        if(len == 126 && in_.size() >= 4) { len = (p[2] << 8) | p[3]; hdr = 4; }
+        else if(len == 127 && in_.size() >= 10)
+        {
+          len = 0;
+          for(int i = 2; i < 10; ++i) len = (len << 8) | p[i];
+          hdr = 10;
+        }
+        if(len < 126 || hdr > 2)
+        {
+          if(in_.size() >= hdr + len)
+          {
+            int op = p[0] & 0x0f;
+            payload->assign(in_, hdr, len);
+            in_.erase(0, hdr + len);
+            return op;
+          }
+        }
+      }
+      if(!fill(timeoutMs)) return -1;
+    }
+  }
+  // the connection has been closed by the server
+  bool eof(int timeoutMs = 2000)
+  {
+    struct pollfd pfd = { fd_, POLLIN, 0 };
+    if(::poll(&pfd, 1, timeoutMs) <= 0) return false;
+    char buf[1024];
+    return ::read(fd_, buf, sizeof(buf)) == 0;
+  }
+};
+
+std::string closePayload(int code)
+{
+  std::string s;
+  s += static_cast<char>(code >> 8);
+  s += static_cast<char>(code);
+  return s;
+}
+
+void testCodec()
+{
+  // the example of RFC 6455 section 1.3
+  assert(WebSocket::acceptKey("dGhlIHNhbXBsZSBub25jZQ==") == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=");
+  assert(*WebSocket::encodeFrame(WebSocket::Text, "Hello") == std::string("\x81\x05Hello"));
+  WebSocketFrame f = WebSocket::encodeFrame(WebSocket::Binary, std::string(300, 'x'), false);
+  assert(f->size() == 304 && (*f)[0] == 0x02 && (*f)[1] == 126);
+  f = WebSocket::encodeFrame(WebSocket::Binary, std::string(70000, 'x'));
+  assert(f->size() == 70010 && static_cast<unsigned char>((*f)[1]) == 127);
+}
+
+void testHandshake()
+{
+  {
+    Client c;
+    std::string head = c.handshake("/echo");
+    assert(head.find("HTTP/1.1 101") == 0);
+    assert(head.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != std::string::npos);
+    // the open callback greets right after the handshake
+    std::string msg;
+    assert(c.recv(&msg) == WebSocket::Text && msg == "welcome");
+  }
+  {
+    Client c;
+    assert(c.handshake("/deny").find("HTTP/1.1 403") == 0);
+  }
+  {
+    Client c;
+    assert(c.handshake("/echo", "8").find("HTTP/1.1 426") == 0);
+  }
+}
+
+void testEcho()
+{
+  Client c;
+  c.handshake("/echo");
+  std::string msg;
+  assert(c.recv(&msg) == WebSocket::Text && msg == "welcome");
+
+  c.send(WebSocket::Text, "hello");
+  assert(c.recv(&msg) == WebSocket::Text && msg == "hello");
+  // every length encoding, unmasked at every alignment
+  for(size_t len : { 0, 1, 125, 126, 1000, 65535, 65536, 300000 })
+  {
+    std::string data(len, 0);
+    for(size_t i = 0; i < len; ++i) data[i] = static_cast<char>(i * 7);
+    c.send(WebSocket::Binary, data);
+    assert(c.recv(&msg) == WebSocket::Binary && msg == data);
+  }
+  // several frames within one write
+  c.write(Client::frame(WebSocket::Text, "a") + Client::frame(WebSocket::Text, "b"));
+  assert(c.recv(&msg) == WebSocket::Text && msg == "a");
+  assert(c.recv(&msg) == WebSocket::Text && msg == "b");
+  // a frame split in two writes
+  std::string f = Client::frame(WebSocket::Text, "split");
+  c.write(f.substr(0, 3));
+  ::usleep(20 * 1000);
+  c.write(f.substr(3));
+  assert(c.recv(&msg) == WebSocket::Text && msg == "split");
+
+  // a fragmented message with a ping between the fragments
+  c.send(WebSocket::Text, "frag", false);
+  c.send(WebSocket::Ping, "are you there");
+  c.send(WebSocket::Continuation, "men", false);
+  c.send(WebSocket::Continuation, "ted");
+  assert(c.recv(&msg) == WebSocket::Pong && msg == "are you there");
+  assert(c.recv(&msg) == WebSocket::Text && msg == "fragmented");
+
+  // the close handshake, the status is echoed
+  c.send(WebSocket::Close, closePayload(WebSocket::Normal));
+  assert(c.recv(&msg) == WebSocket::Close && msg == closePayload(WebSocket::Normal));
+  assert(c.eof());
+  // the server learns about the close once the TCP connection is gone
+  c.close();
+  ::usleep(50 * 1000);
+  assert(lastCloseCode == WebSocket::Normal);
+}
+
+void testProtocolErrors()
+{
+  std::string msg;
+  {
+    Client c;
+    c.handshake("/echo");
+    c.recv(&msg);
+    // clients must mask
+    c.write(Client::frame(WebSocket::Text, "x", true, false));
+    assert(c.recv(&msg) == WebSocket::Close && msg == closePayload(WebSocket::ProtocolError));
+    assert(c.eof());
+  }
+  {
+    Client c;
+    c.handshake("/echo");
+    c.recv(&msg);
+    // a continuation without a start
+    c.send(WebSocket::Continuation, "x");
+    assert(c.recv(&msg) == WebSocket::Close && msg == closePayload(WebSocket::ProtocolError));
+  }
+  {
+    Client c;
+    c.handshake("/echo");
+    c.recv(&msg);
+    // over the 1 MB limit set for /echo, refused from the header alone
+    std::string f = Client::frame(WebSocket::Binary, std::string(2*1024*1024, 'x'));
+    c.write(f.substr(0, 14));
+    assert(c.recv(&msg) == WebSocket::Close && msg == closePayload(WebSocket::TooBig));
+  }
+}
+
+void testBroadcast(EventLoop* serverLoop)
+{
+  std::vector<std::unique_ptr<Client>> clients;
+  std::string msg;
+  for(int i = 0; i < 5; ++i)
+  {
+    clients.emplace_back(new Client);
+    assert(clients.back()->handshake("/chat").find("HTTP/1.1 101") == 0);
+  }
+  ::usleep(50 * 1000);
+  clients[2]->send(WebSocket::Text, "hi all");
+  for(auto& c : clients)
+    assert(c->recv(&msg) == WebSocket::Text && msg == "hi all");
+
+  // from a foreign thread, the frame hops to the server loop
+  std::vector<WebSocketPtr> copy;
+  CountDownLatch latch(1);
+  serverLoop->runInLoop([&](){ copy = room; latch.countDown(); });
+  latch.wait();
+  assert(copy.size() == 5);
+  WebSocket::broadcast(copy, WebSocket::Binary, "news");
+  for(auto& c : clients)
+    assert(c->recv(&msg) == WebSocket::Binary && msg == "news");
+
+  // close() from the server side waits for the client's close frame
+  copy[0]->close(WebSocket::GoingAway, "bye");
+  assert(clients[0]->recv(&msg) == WebSocket::Close
+    && msg == closePayload(WebSocket::GoingAway) + "bye");
+  clients[0]->send(WebSocket::Close, closePayload(WebSocket::GoingAway));
+  assert(clients[0]->eof());
+  clients.clear();
+  ::usleep(100 * 1000);
+  copy.clear();
+  CountDownLatch left(1);
+  serverLoop->runInLoop([&](){ assert(room.empty()); left.countDown(); });
+  left.wait();
+}
+
+void testPing()
+{
+  Client c;
+  c.handshake("/ping");
+  std::string msg;
+  Timestamp start = Timestamp::now();
+  assert(c.recv(&msg) == WebSocket::Ping);
+  c.send(WebSocket::Pong, msg);
+  assert(c.recv(&msg) == WebSocket::Ping);
+  // stay silent, the next tick drops the connection
+  assert(c.eof());
+  double sec = Timestamp::diffInSec(Timestamp::now(), start);
+  assert(sec > 0.25 && sec < 1.0);
+  ::usleep(50 * 1000);
+  assert(lastCloseCode == WebSocket::Abnormal);
+}
+
+int main()
+{
+  // the protocol error tests leave frames unread behind a close
+  ::signal(SIGPIPE, SIG_IGN);
+  testCodec();
+
+  EventLoopThread serverThread;
+  EventLoop* serverLoop = serverThread.startLoop();
+  std::unique_ptr<HTTPServer> server;
+  serverLoop->runInLoop([&](){
+    server.reset(new HTTPServer(serverLoop, InetAddr(kPort), "server",
+      TcpServer::PortOpt::Reuse));
+    server->route(HTTPRequest::Get, "/hello", [](const HTTPRequest&, HTTPResponse* resp){
+      resp->setStatus(HTTPResponse::OK200);
+      resp->setBody("hello");
+    });
+    server->setWebSocketCB([](const HTTPRequest& req, const WebSocketPtr& ws){
+      ws->setCloseCB([](const WebSocketPtr& w, int code){
+        for(size_t i = 0; i < room.size(); ++i)
+          if(room[i] == w) room.erase(room.begin() + i);
+        lastCloseCode = code;
+      });
+      if(req.path() == "/echo")
+      {
+        ws->setMaxMsgSz(1024*1024);
+        ws->setOpenCB([](const WebSocketPtr& w){ w->sendText("welcome"); });
+        ws->setMsgCB([](const WebSocketPtr& w, const StringPiece& msg, WebSocket::Opcode op){
+          w->send(op, msg);
+        });
+        return true;
+      }
+      if(req.path() == "/chat")
+      {
+        ws->setOpenCB([](const WebSocketPtr& w){ room.push_back(w); });
+        ws->setMsgCB([](const WebSocketPtr&, const StringPiece& msg, WebSocket::Opcode op){
+          WebSocket::broadcast(room, op, msg);
+        });
+        return true;
+      }
+      if(req.path() == "/ping")
+      {
+        ws->setPingInterval(0.15);
+        return true;
+      }
+      return false;
+    });
+    server->start();
+  });
+  ::usleep(100 * 1000);
+
+  testHandshake();
+  testEcho();
+  testProtocolErrors();
+  testBroadcast(serverLoop);
+  testPing();
+
+  serverLoop->runInLoop([&](){ server.reset(); });
+  ::usleep(100 * 1000);
+  printf("WebSocket tests passed\n");
+}
@@ -0,0 +1,273 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/logging/AsyncLogging.h"
+#include "chtho/net/Buffer.h"
+#include "chtho/net/EventLoop.h"
+#include "chtho/net/EventLoopThread.h"
+#include "chtho/net/LogShipper.h"
+#include "chtho/net/TcpConnection.h"
+#include "chtho/net/TcpServer.h"
+#include "chtho/threads/CountDownLatch.h"
+#include "chtho/threads/Thread.h"
+
+#include <assert.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace chtho;
+using namespace chtho::net;
+
+// runs f in the loop and waits for it
+template<typename Func>
+void inLoop(EventLoop* loop, Func f)
+{
+  CountDownLatch latch(1);
+  loop->runInLoop([&]()
+  {
+    f();
+    latch.countDown();
+  });
+  latch.wait();
+}
+
+// takes the batches of one shipper at a time, answers each with the
+// count so far. with dropAt it drops the connection on that batch,
+// as if it had crashed before taking it
+class Collector : noncopyable
+{
+private:
+  EventLoop* loop_;
+  std::unique_ptr<TcpServer> server_;
+  MutexLock mutex_;
+  std::string data_;
+  uint32_t taken_; // on the connection
+  int batches_;
+  int dropAt_;
+
+  void onMsg(const TcpConnPtr& conn, Buffer* buf)
+  {
+    while(buf->readableBytes() >= sizeof(uint32_t))
+    {
+      uint32_t len = static_cast<uint32_t>(buf->peekInt32());
+      if(buf->readableBytes() < sizeof(uint32_t) + len) break;
+      if(++batches_ == dropAt_)
+      {
+        buf->retrieveAll();
+        conn->forceClose();
+        return;
+      }
+      buf->retrieve(sizeof(uint32_t));
+      {
+        MutexLockGuard lock(mutex_);
+        data_ += buf->retrieveAsString(len);
+      }
+      Buffer ack;
+      ack.appendInt32(static_cast<int32_t>(++taken_));
+      conn->send(&ack);
+    }
+  }
+
+public:
+  Collector(EventLoop* loop, uint16_t port, int dropAt = 0)
+    : loop_(loop), taken_(0), batches_(0), dropAt_(dropAt)
+  {
+    inLoop(loop_, [this, port]()
+    {
+      server_.reset(new TcpServer(loop_, InetAddr(port, true), "Collector", TcpServer::Reuse));
+      server_->setConnCB([this](const TcpConnPtr& conn){ if(conn->connected()) taken_ = 0; });
+      server_->setMsgCB([this](const TcpConnPtr& conn, Buffer* buf, Timestamp)
+        { onMsg(conn, buf); });
+      server_->start();
+    });
+  }
+  ~Collector() { inLoop(loop_, [this](){ server_.reset(); }); }
+  std::string data()
+  {
+    MutexLockGuard lock(mutex_);
+    return data_;
+  }
+};
+
+std::atomic<AsyncLogging*> g_log(NULL);
+
+void output(const char* msg, int len)
+{
+  AsyncLogging* log = g_log.load();
+  if(log) log->append(msg, len);
+}
+
+// the loggers stay until the end, a loop thread may still be in one
+std::vector<std::unique_ptr<AsyncLogging>> g_logs;
+
+AsyncLogging* startLog(LogSink* sink, AsyncLogging::Overflow policy = AsyncLogging::Overflow::Block)
+{
+  g_logs.emplace_back(new AsyncLogging("shipper_test", 1024*1024, 1));
+  AsyncLogging* log = g_logs.back().get();
+  log->setSink(sink);
+  log->setRingSize(64*1024);
+  log->setOverflow(policy);
+  log->start();
+  g_log = log;
+  return log;
+}
+
+void stopLog(AsyncLogging* log)
+{
+  g_log = NULL;
+  log->stop();
+}
+
+// threads * lines lines "msg t<thread> <i>", from threads of their own
+void logLines(int threads, int lines, int first = 0)
+{
+  std::vector<std::unique_ptr<Thread>> ts;
+  for(int t = 0; t < threads; ++t)
+  {
+    ts.emplace_back(new Thread([=]()
+    {
+      for(int i = first; i < first + lines; ++i) LOG_INFO << "msg t" << t << " " << i;
+    }, "logger"));
+    ts.back()->start();
+  }
+  for(auto& t : ts) t->join();
+}
+
+// every thread's lines arrived in order, each once
+void check(const std::string& data, int threads, int lines)
+{
+  std::vector<int> next(threads, 0);
+  size_t pos = 0;
+  int n = 0;
+  while((pos = data.find("msg t", pos)) != std::string::npos)
+  {
+    char* end;
+    int t = static_cast<int>(strtol(data.c_str() + pos + 5, &end, 10));
+    int i = static_cast<int>(strtol(end, NULL, 10));
+    assert(t < threads);
+    assert(i == next[t]);
+    ++next[t];
+    ++n;
+    ++pos;
+  }
+  assert(n == threads * lines);
+  for(int t = 0; t < threads; ++t) assert(next[t] == lines);
+}
+
+bool waitFor(LogShipper& shipper, double secs)
+{
+  for(int i = 0; i < secs * 100; ++i)
+  {
+    LogShipper::Stats st = shipper.stats();
+    if(st.memory == 0 && st.spooled == 0) return true;
+    usleep(10000);
+  }
+  return false;
+}
+
+// the collector drops the connection once, the batches it hadn't
+// answered are sent again
+void testShip(EventLoop* shipLoop, EventLoop* collectLoop)
+{
+  Collector collector(collectLoop, 19781, 3);
+  LogShipper shipper(shipLoop, InetAddr(19781, true));
+  shipper.start();
+  AsyncLogging* log = startLog(&shipper);
+  logLines(4, 20000);
+  stopLog(log);
+  bool done = waitFor(shipper, 10);
+  assert(done);
+  (void)done;
+  LogShipper::Stats st = shipper.stats();
+  assert(st.connects == 2);
+  check(collector.data(), 4, 20000);
+  printf("shipped %zu batches, %zu bytes\n", st.batches, st.bytes);
+}
+
+off_t fileSize(const char* name)
+{
+  struct stat st;
+  return ::stat(name, &st) == 0 ? st.st_size : -1;
+}
+
+// batches wait in the spool while there is no collector, also for the
+// next shipper
+void testSpool(EventLoop* shipLoop, EventLoop* collectLoop)
+{
+  char dir[] = "/tmp/chtho_shipper_XXXXXX";
+  if(!mkdtemp(dir)) abort();
+  std::string spool = std::string(dir) + "/shipper.spool";
+  LogShipper::Options opts;
+  opts.maxMemory = 64*1024;
+  opts.spool = spool;
+  {
+    LogShipper shipper(shipLoop, InetAddr(19782, true), opts);
+    shipper.start();
+    AsyncLogging* log = startLog(&shipper);
+    logLines(2, 10000);
+    stopLog(log);
+    LogShipper::Stats st = shipper.stats();
+    assert(st.spooled > 0 && st.memory <= opts.maxMemory);
+    assert(st.connects == 0);
+  }
+  off_t spooled = fileSize(spool.c_str());
+  assert(spooled > 0);
+  printf("%lld bytes spooled\n", static_cast<long long>(spooled));
+  {
+    Collector collector(collectLoop, 19782);
+    LogShipper shipper(shipLoop, InetAddr(19782, true), opts);
+    shipper.start();
+    AsyncLogging* log = startLog(&shipper);
+    logLines(2, 10000, 10000);
+    stopLog(log);
+    bool done = waitFor(shipper, 10);
+    assert(done);
+    (void)done;
+    check(collector.data(), 2, 20000);
+    assert(fileSize(spool.c_str()) == 0);
+  }
+  // the spool is the only file in the directory
+  int removed = ::unlink(spool.c_str()) + ::rmdir(dir);
+  assert(removed == 0);
+  (void)removed;
+}
+
+// with nowhere to put the lines, the overflow policy drops them
+void testBackpressure(EventLoop* shipLoop)
+{
+  LogShipper::Options opts;
+  opts.maxMemory = 256*1024;
+  LogShipper shipper(shipLoop, InetAddr(19783, true), opts);
+  shipper.start();
+  AsyncLogging* log = startLog(&shipper, AsyncLogging::Overflow::DropNewest);
+  logLines(1, 100000);
+  AsyncLogging::Stats ast = log->stats();
+  LogShipper::Stats st = shipper.stats();
+  stopLog(log);
+  assert(ast.droppedLines > 0);
+  assert(st.memory <= opts.maxMemory);
+  printf("%zu lines dropped, %zu bytes held\n", ast.droppedLines, st.memory);
+}
+
+int main()
+{
+  ::signal(SIGPIPE, SIG_IGN);
+  Logger::setOutput(output);
+  EventLoopThread shipThread(ThreadInitCB(), "shipper");
+  EventLoopThread collectThread(ThreadInitCB(), "collector");
+  EventLoop* shipLoop = shipThread.startLoop();
+  EventLoop* collectLoop = collectThread.startLoop();
+  testShip(shipLoop, collectLoop);
+  testSpool(shipLoop, collectLoop);
+  testBackpressure(shipLoop);
+  printf("all passed\n");
+  return 0;
+}
@@ -0,0 +1,103 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/net/Simd.h"
+
+#include <string>
+#include <vector>
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+using namespace chtho;
+using namespace chtho::net;
+
+const char* refCRLF(const char* begin, const char* end)
+{
+  for(const char* p = begin; p+1 < end; ++p)
+    if(p[0] == '\r' && p[1] == '\n') return p;
+  return NULL;
+}
+
+const char* refFirstOf(const char* begin, const char* end, const char* set, int n)
+{
+  for(const char* p = begin; p < end; ++p)
+    if(memchr(set, *p, n)) return p;
+  return NULL;
+}
+
+// the kernels are compared against the obvious loops on random data
+// from a tiny alphabet (so delimiters are dense), every length and
+// alignment up to 100 bytes, at every level the cpu supports
+void testLevel(simd::Level l)
+{
+  simd::setLevel(l);
+  assert(simd::level() == l);
+  const char alphabet[] = "ab \r\n:?";
+  std::vector<char> mem(256);
+  srand(42);
+  for(int iter = 0; iter < 20000; ++iter)
+  {
+    int off = rand() % 32;
+    int len = rand() % 100;
+    char* begin = mem.data() + off;
+    char* end = begin + len;
+    for(char* p = begin; p < end; ++p) *p = alphabet[rand() % 7];
+    // bytes just outside the range must never be matched
+    if(off > 0) begin[-1] = '\r';
+    *end = '\n';
+
+    assert(simd::findCRLF(begin, end) == refCRLF(begin, end));
+    assert(simd::findChar(begin, end, '\n') == refFirstOf(begin, end, "\n", 1));
+    assert(simd::findFirstOf(begin, end, ":\r\n", 3) == refFirstOf(begin, end, ":\r\n", 3));
+    assert(simd::findFirstOf(begin, end, " ?\r\n", 4) == refFirstOf(begin, end, " ?\r\n", 4));
+    assert(simd::findFirstOf(begin, end, "?:b \r\n", 6) == refFirstOf(begin, end, "?:b \r\n", 6));
+  }
+
+  // long runs without a match, '\r' right at the end of a block
+  std::string s(1000, 'x');
+  assert(simd::findCRLF(s.data(), s.data()+s.size()) == NULL);
+  for(size_t i = 0; i+1 < s.size(); ++i)
+  {
+    s[i] = '\r';
+    assert(simd::findCRLF(s.data(), s.data()+s.size()) == NULL);
+    s[i+1] = '\n';
+    assert(simd::findCRLF(s.data(), s.data()+s.size()) == s.data()+i);
+    assert(simd::findFirstOf(s.data(), s.data()+s.size(), ":\n", 2) == s.data()+i+1);
+    s[i] = s[i+1] = 'x';
+  }
+  assert(simd::findCRLF(s.data(), s.data()) == NULL);
+
+  // unmasking: every length and alignment, neighbours untouched
+  const unsigned char key[4] = { 0x37, 0xfa, 0x21, 0x3d };
+  uint32_t k;
+  memcpy(&k, key, 4);
+  for(int iter = 0; iter < 5000; ++iter)
+  {
+    int off = rand() % 32;
+    int len = rand() % 200;
+    std::vector<char> in(len + 64);
+    for(size_t i = 0; i < in.size(); ++i) in[i] = static_cast<char>(rand());
+    std::vector<char> out(in);
+    simd::xorMask(out.data() + off, len, k);
+    for(size_t i = 0; i < in.size(); ++i)
+    {
+      bool inside = static_cast<int>(i) >= off && static_cast<int>(i) < off + len;
+      char want = inside ? static_cast<char>(in[i] ^ key[(i-off) & 3]) : in[i];
+      assert(out[i] == want);
+    }
+  }
+  printf("%s ok\n", simd::levelName(l));
+}
+
+int main()
+{
+  simd::Level best = simd::detect();
+  testLevel(simd::Level::Scalar);
+  if(best >= simd::Level::SSE42) testLevel(simd::Level::SSE42);
+  if(best >= simd::Level::AVX2) testLevel(simd::Level::AVX2);
+}
@@ -5,6 +5,8 @@
 
 #include "CurrentThread.h"
 
+#include <unistd.h>
+
 #include <cstdio>
 
 #if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
@@ -0,0 +1,31 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_THREADS_FUTEX_H
+#define CHTHO_THREADS_FUTEX_H
+// Sleep on a word until another thread changes it
+
+#include <atomic>
+#include <climits> // INT_MAX
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace chtho
+{
+// sleeps while *word is val, it may also come back early. a waker
+// changes the word first, then calls futexWake()
+inline void futexWait(std::atomic<int>* word, int val)
+{
+  ::syscall(SYS_futex, reinterpret_cast<int*>(word), FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+// wakes up to n of the threads sleeping on word
+inline void futexWake(std::atomic<int>* word, int n = INT_MAX)
+{
+  ::syscall(SYS_futex, reinterpret_cast<int*>(word), FUTEX_WAKE_PRIVATE, n, NULL, NULL, 0);
+}
+} // namespace chtho
+#endif // !CHTHO_THREADS_FUTEX_H
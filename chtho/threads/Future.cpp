@@ -0,0 +1,94 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "Future.h"
+
+#include <pthread.h>
+
+namespace chtho
+{
+namespace detail
+{
+namespace
+{
+// blocks of up to kClasses * kGrain bytes are cached, the larger ones
+// go to operator new and back
+const size_t kGrain = 64;
+const size_t kClasses = 8;
+const int kMaxCached = 256; // of a class, per thread
+
+// the free blocks of a class are a list through their first word
+struct Cache
+{
+  void* free[kClasses];
+  int count[kClasses];
+};
+
+__thread Cache* t_cache = NULL;
+pthread_key_t cacheKey;
+pthread_once_t cacheOnce = PTHREAD_ONCE_INIT;
+
+// at the exit of the thread
+void freeCache(void* p)
+{
+  Cache* cache = static_cast<Cache*>(p);
+  for(size_t c = 0; c < kClasses; ++c)
+  {
+    while(void* block = cache->free[c])
+    {
+      cache->free[c] = *static_cast<void**>(block);
+      ::operator delete(block);
+    }
+  }
+  delete cache;
+  t_cache = NULL;
+}
+
+Cache* cache()
+{
+  if(!t_cache)
+  {
+    ::pthread_once(&cacheOnce, [](){ ::pthread_key_create(&cacheKey, freeCache); });
+    t_cache = new Cache();
+    ::pthread_setspecific(cacheKey, t_cache);
+  }
+  return t_cache;
+}
+} // namespace
+
+void* allocState(size_t size)
+{
+  size_t c = (size - 1) / kGrain;
+  if(c >= kClasses) return ::operator new(size);
+  Cache* cache = detail::cache();
+  if(void* block = cache->free[c])
+  {
+    cache->free[c] = *static_cast<void**>(block);
+    --cache->count[c];
+    return block;
+  }
+  return ::operator new((c + 1) * kGrain);
+}
+
+void freeState(void* p, size_t size)
+{
+  size_t c = (size - 1) / kGrain;
+  if(c >= kClasses)
+  {
+    ::operator delete(p);
+    return;
+  }
+  Cache* cache = detail::cache();
+  if(cache->count[c] >= kMaxCached)
+  {
+    ::operator delete(p);
+    return;
+  }
+  *static_cast<void**>(p) = cache->free[c];
+  cache->free[c] = p;
+  ++cache->count[c];
+}
+} // namespace detail
+} // namespace chtho
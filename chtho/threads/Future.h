@@ -0,0 +1,542 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_THREADS_FUTURE_H
+#define CHTHO_THREADS_FUTURE_H
+// The result of a task, and what runs once it is there
+
+#include "base/noncopyable.h"
+#include "threads/Futex.h"
+
+#include <atomic>
+#include <exception>
+#include <functional>
+#include <future> // std::future_error
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <stddef.h>
+
+namespace chtho
+{
+template<typename T> class Future;
+
+// how then() hands a continuation to where it should run. by default
+// it goes to e->runInLoop(), which is what EventLoop has, ThreadPool.h
+// adds ThreadPool. a specialization adds any other executor
+template<typename E>
+struct Executor
+{
+  static void post(E* e, std::function<void()> f) { e->runInLoop(std::move(f)); }
+};
+
+namespace detail
+{
+// the blocks of the states. a block freed goes to a small cache of
+// the freeing thread, the next state of about the size it has takes
+// it from there, so a chain of stages doesn't go to malloc once it
+// runs. see Future.cpp
+void* allocState(size_t size);
+void freeState(void* p, size_t size);
+
+// the value of a stage, until it is taken
+template<typename T>
+class Storage : noncopyable
+{
+private:
+  typename std::aligned_storage<sizeof(T), std::alignment_of<T>::value>::type buf_;
+  bool has_;
+  T* ptr() { return reinterpret_cast<T*>(&buf_); }
+public:
+  Storage() : has_(false) {}
+  ~Storage() { if(has_) ptr()->~T(); }
+  template<typename... Args>
+  void set(Args&&... args)
+  {
+    new (&buf_) T(std::forward<Args>(args)...);
+    has_ = true;
+  }
+  T take() { return std::move(*ptr()); }
+};
+template<>
+class Storage<void> : noncopyable
+{
+public:
+  void set() {}
+  void take() {}
+};
+
+template<typename T> class State;
+
+inline std::exception_ptr brokenPromise()
+{
+  return std::make_exception_ptr(std::future_error(std::future_errc::broken_promise));
+}
+
+// a stage that waits for an executor to run it
+class Runnable
+{
+public:
+  virtual void run() = 0;
+  // the executor drops it, the future fails with broken_promise
+  virtual void abandon() = 0;
+protected:
+  ~Runnable() {}
+};
+
+// what an executor is given for a stage. a plain pointer, so
+// std::function keeps it without allocating, of a type of its own, so
+// an executor that drops tasks can find it among them, see
+// ThreadPool::drop()
+struct Job
+{
+  Runnable* stage;
+  void operator()() const { stage->run(); }
+};
+
+// what a state runs once it is done
+template<typename T>
+class Callback
+{
+public:
+  // src is done. the callback has the reference the future had
+  virtual void fire(State<T>* src) = 0;
+protected:
+  ~Callback() {}
+};
+
+// one stage: the value or the exception, who waits for it, and what
+// runs after it. one reference for the future, one for whoever sets it
+template<typename T>
+class State : noncopyable
+{
+private:
+  // the futex word
+  enum { kEmpty, kDone, kCont, kWaiting };
+  std::atomic<int> word_;
+  std::atomic<int> refs_;
+  Callback<T>* cont_;
+  std::exception_ptr error_;
+  Storage<T> value_;
+
+  void done()
+  {
+    int old = word_.exchange(kDone, std::memory_order_acq_rel);
+    if(old == kCont) cont_->fire(this);
+    else if(old == kWaiting) futexWake(&word_);
+  }
+
+public:
+  State() : word_(kEmpty), refs_(2), cont_(NULL) {}
+  virtual ~State() {}
+  static void* operator new(size_t size) { return allocState(size); }
+  static void operator delete(void* p, size_t size) { freeState(p, size); }
+
+  void release()
+  {
+    if(refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+  }
+  bool ready() const { return word_.load(std::memory_order_acquire) == kDone; }
+
+  // once, by whoever sets it
+  template<typename... Args>
+  void setValue(Args&&... args)
+  {
+    value_.set(std::forward<Args>(args)...);
+    done();
+  }
+  void setError(std::exception_ptr e)
+  {
+    error_ = e;
+    done();
+  }
+
+  // the future's, either wait() or attach(), once
+  void wait()
+  {
+    int s = kEmpty;
+    if(word_.compare_exchange_strong(s, kWaiting, std::memory_order_acq_rel,
+        std::memory_order_acquire))
+    {
+      while(word_.load(std::memory_order_acquire) == kWaiting)
+        futexWait(&word_, kWaiting);
+    }
+  }
+  // cb fires here and now if the state is done already
+  void attach(Callback<T>* cb)
+  {
+    cont_ = cb;
+    int s = kEmpty;
+    if(!word_.compare_exchange_strong(s, kCont, std::memory_order_acq_rel,
+        std::memory_order_acquire))
+      cb->fire(this);
+  }
+
+  // when it is done
+  std::exception_ptr error() const { return error_; }
+  T take() { return value_.take(); }
+};
+
+// the value of f(value of src), or what they throw
+template<typename F, typename T>
+struct ResultOf { using type = typename std::result_of<F(T)>::type; };
+template<typename F>
+struct ResultOf<F, void> { using type = typename std::result_of<F()>::type; };
+
+template<typename R>
+struct Invoke
+{
+  template<typename F, typename... Args>
+  static void run(State<R>* dst, F& f, Args&&... args)
+  {
+    dst->setValue(f(std::forward<Args>(args)...));
+  }
+};
+template<>
+struct Invoke<void>
+{
+  template<typename F, typename... Args>
+  static void run(State<void>* dst, F& f, Args&&... args)
+  {
+    f(std::forward<Args>(args)...);
+    dst->setValue();
+  }
+};
+
+template<typename T>
+struct Apply
+{
+  template<typename R, typename F>
+  static void run(State<R>* dst, F& f, State<T>* src) { Invoke<R>::run(dst, f, src->take()); }
+};
+template<>
+struct Apply<void>
+{
+  template<typename R, typename F>
+  static void run(State<R>* dst, F& f, State<void>*) { Invoke<R>::run(dst, f); }
+};
+
+template<typename R, typename F, typename T>
+void settle(State<R>* dst, F& f, State<T>* src)
+{
+  if(src->error())
+  {
+    dst->setError(src->error());
+    return;
+  }
+  try
+  {
+    Apply<T>::run(dst, f, src);
+  }
+  catch(...)
+  {
+    dst->setError(std::current_exception());
+  }
+}
+
+// a task of submit(), its value is what f returns
+template<typename R, typename F>
+class TaskState : public State<R>, public Runnable
+{
+private:
+  F f_;
+public:
+  explicit TaskState(F&& f) : f_(std::move(f)) {}
+  void abandon() override
+  {
+    this->setError(brokenPromise());
+    this->release();
+  }
+  void run() override
+  {
+    try
+    {
+      Invoke<R>::run(this, f_);
+    }
+    catch(...)
+    {
+      this->setError(std::current_exception());
+    }
+    this->release();
+  }
+};
+
+// then() without an executor, never called
+struct Inline
+{
+  void runInLoop(std::function<void()> f) { f(); }
+};
+
+// a stage of then(). the continuation lives in the state it sets, so
+// a stage is one block, and what goes to the executor is a Job
+template<typename T, typename R, typename F, typename E>
+class ThenState : public State<R>, public Callback<T>, public Runnable
+{
+private:
+  F f_;
+  E* exec_; // NULL runs it where src is done
+  State<T>* src_;
+public:
+  ThenState(F&& f, E* exec, State<T>* src) : f_(std::move(f)), exec_(exec), src_(src) {}
+  void fire(State<T>*) override
+  {
+    if(exec_) Executor<E>::post(exec_, Job{ this });
+    else run();
+  }
+  void abandon() override
+  {
+    src_->release();
+    src_ = NULL;
+    this->setError(brokenPromise());
+    this->release();
+  }
+  void run() override
+  {
+    State<T>* src = src_;
+    src_ = NULL;
+    settle(static_cast<State<R>*>(this), f_, src);
+    src->release();
+    this->release();
+  }
+};
+
+struct Access;
+} // namespace detail
+
+// the result of a task of ThreadPool::submit(), of a Promise, or of
+// another future and a function, with then(). get() waits for it,
+// then() runs the function with it once it is there: at once where it
+// is set, or on the executor given, an EventLoop or a ThreadPool. a
+// future is moved around and used once, by get() or then(). a stage
+// is one block from a cache of the thread, and no lock is taken.
+// an exception of a task or a function goes down the chain, the
+// functions after it are skipped and get() throws it.
+//
+//   pool.submit([=](){ return parse(req); })
+//       .then([](Doc doc){ return render(doc); })
+//       .then(conn->getLoop(), [conn](std::string page){ conn->send(page); });
+//
+// a task that a ThreadPool drops, submitted after stop() or left
+// when stop() returns, fails its future with broken_promise. a
+// continuation posted to an EventLoop that quits first never runs,
+// a get() on it waits for good
+template<typename T>
+class Future
+{
+private:
+  detail::State<T>* s_;
+  explicit Future(detail::State<T>* s) : s_(s) {}
+  template<typename U> friend class Future;
+  friend struct detail::Access;
+
+public:
+  Future() : s_(NULL) {}
+  Future(Future&& f) : s_(f.s_) { f.s_ = NULL; }
+  Future& operator=(Future&& f)
+  {
+    if(this != &f)
+    {
+      if(s_) s_->release();
+      s_ = f.s_;
+      f.s_ = NULL;
+    }
+    return *this;
+  }
+  Future(const Future&) = delete;
+  Future& operator=(const Future&) = delete;
+  ~Future() { if(s_) s_->release(); }
+
+  // until get() or then()
+  bool valid() const { return s_ != NULL; }
+  bool ready() const { return s_->ready(); }
+
+  // waits for the value and takes it, or throws what the task threw
+  T get()
+  {
+    struct Unref
+    {
+      detail::State<T>* s;
+      ~Unref() { s->release(); }
+    } unref = { s_ };
+    s_ = NULL;
+    unref.s->wait();
+    if(unref.s->error()) std::rethrow_exception(unref.s->error());
+    return unref.s->take();
+  }
+
+  // f(value), or f() for a Future<void>, where the value is set
+  template<typename F>
+  Future<typename detail::ResultOf<typename std::decay<F>::type, T>::type> then(F&& f)
+  {
+    return then(static_cast<detail::Inline*>(NULL), std::forward<F>(f));
+  }
+  // the same on exec
+  template<typename E, typename F>
+  Future<typename detail::ResultOf<typename std::decay<F>::type, T>::type> then(E* exec, F&& f)
+  {
+    using Func = typename std::decay<F>::type;
+    using R = typename detail::ResultOf<Func, T>::type;
+    detail::State<T>* src = s_;
+    s_ = NULL;
+    auto* s = new detail::ThenState<T, R, Func, E>(Func(std::forward<F>(f)), exec, src);
+    Future<R> next(s);
+    src->attach(s);
+    return next;
+  }
+};
+
+namespace detail
+{
+struct Access
+{
+  template<typename T>
+  static Future<T> make(State<T>* s) { return Future<T>(s); }
+  template<typename T>
+  static State<T>* take(Future<T>& f)
+  {
+    State<T>* s = f.s_;
+    f.s_ = NULL;
+    return s;
+  }
+};
+} // namespace detail
+
+// sets a future from code that isn't a task, e.g. a callback of a
+// connection. a promise that goes unset fails the future with
+// std::future_errc::broken_promise
+template<typename T>
+class Promise : noncopyable
+{
+private:
+  detail::State<T>* s_;
+  bool retrieved_;
+  bool set_;
+public:
+  Promise() : s_(new detail::State<T>), retrieved_(false), set_(false) {}
+  ~Promise()
+  {
+    if(!set_)
+      s_->setError(detail::brokenPromise());
+    if(!retrieved_) s_->release();
+    s_->release();
+  }
+  // once
+  Future<T> future()
+  {
+    retrieved_ = true;
+    return detail::Access::make(s_);
+  }
+  // once, either of them
+  template<typename... Args>
+  void setValue(Args&&... args)
+  {
+    set_ = true;
+    s_->setValue(std::forward<Args>(args)...);
+  }
+  void setError(std::exception_ptr e)
+  {
+    set_ = true;
+    s_->setError(e);
+  }
+};
+
+namespace detail
+{
+template<typename T>
+struct AllResult { using type = std::vector<T>; };
+template<>
+struct AllResult<void> { using type = void; };
+
+// the state of whenAll(), the values arrive in a slot each
+template<typename T>
+class AllState : public State<typename AllResult<T>::type>
+{
+private:
+  struct Slot : public Callback<T>
+  {
+    AllState* all;
+    size_t i;
+    void fire(State<T>* src) override { all->arrive(i, src); }
+  };
+  std::vector<Slot> slots_;
+  std::vector<Storage<T>> values_;
+  std::atomic<size_t> left_;
+  std::atomic_bool failed_;
+  std::exception_ptr error_; // the first one
+
+  template<typename U>
+  static void store(Storage<U>& v, State<U>* src) { v.set(src->take()); }
+  static void store(Storage<void>&, State<void>*) {}
+
+  template<typename U>
+  void finish(std::vector<U>*)
+  {
+    std::vector<T> values;
+    values.reserve(values_.size());
+    for(auto& v : values_) values.push_back(v.take());
+    this->setValue(std::move(values));
+  }
+  void finish(void*) { this->setValue(); }
+
+  void arrive(size_t i, State<T>* src)
+  {
+    if(src->error())
+    {
+      if(!failed_.exchange(true)) error_ = src->error();
+    }
+    else store(values_[i], src);
+    src->release();
+    if(left_.fetch_sub(1, std::memory_order_acq_rel) == 1) finish();
+  }
+  void finish()
+  {
+    if(failed_) this->setError(error_);
+    else finish(static_cast<typename AllResult<T>::type*>(NULL));
+    this->release();
+  }
+
+public:
+  explicit AllState(std::vector<Future<T>>& futures)
+    : slots_(futures.size()),
+      values_(futures.size()),
+      left_(futures.size()),
+      failed_(false)
+  {
+    for(size_t i = 0; i < slots_.size(); ++i)
+    {
+      slots_[i].all = this;
+      slots_[i].i = i;
+    }
+  }
+  void start(std::vector<Future<T>>& futures)
+  {
+    if(futures.empty())
+    {
+      finish();
+      return;
+    }
+    for(size_t i = 0; i < futures.size(); ++i)
+      Access::take(futures[i])->attach(&slots_[i]);
+  }
+};
+} // namespace detail
+
+// the values of all the futures, in their order, once they are all
+// there. a Future<void> for Future<void>s. if any of them fails, the
+// result fails with the first exception that arrives. the futures are
+// used up
+template<typename T>
+Future<typename detail::AllResult<T>::type> whenAll(std::vector<Future<T>>& futures)
+{
+  auto* s = new detail::AllState<T>(futures);
+  Future<typename detail::AllResult<T>::type> all = detail::Access::make(
+    static_cast<detail::State<typename detail::AllResult<T>::type>*>(s));
+  s->start(futures);
+  return all;
+}
+} // namespace chtho
+#endif // !CHTHO_THREADS_FUTURE_H
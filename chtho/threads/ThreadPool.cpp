@@ -4,10 +4,46 @@
 // https://opensource.org/licenses/MIT
 
 #include "ThreadPool.h"
+#include "threads/Futex.h"
 #include "threads/MutexLockGuard.h"
+#include "threads/WorkDeque.h"
+
+#include <algorithm>
 
 namespace chtho
 {
+namespace
+{
+// the most a worker takes from the shared queue at once
+const size_t kBatch = 32;
+
+// Worker::state, the futex word
+const int kAwake = 0;
+const int kSleeping = 1;
+const int kNotified = 2;
+} // namespace
+
+// a thread of a WorkStealing pool
+struct ThreadPool::Worker
+{
+  ThreadPool* pool;
+  WorkDeque<Task> deque;
+  std::atomic<int> state;
+  uint32_t seed; // where it starts looking for something to steal
+
+  Worker(ThreadPool* p, uint32_t i) : pool(p), state(kAwake), seed(i * 2654435761u + 1) {}
+  uint32_t rand()
+  {
+    // xorshift32
+    seed ^= seed << 13;
+    seed ^= seed >> 17;
+    seed ^= seed << 5;
+    return seed;
+  }
+};
+
+__thread ThreadPool::Worker* ThreadPool::current_ = NULL;
+
 // the ctor of ThreadPool only initializes its 
 // members 
 ThreadPool::ThreadPool(const std::string& name)
@@ -16,7 +52,10 @@ ThreadPool::ThreadPool(const std::string& name)
     notFull_(mutex_), 
     name_(name),
     maxQueueSz_(0),
-    running_(false)
+    running_(false),
+    mode_(Mode::Shared),
+    queued_(0),
+    idleCount_(0)
 {
 }
 
@@ -30,12 +69,20 @@ void ThreadPool::start(int numThreads)
   assert(threads_.empty());
   running_ = true;
   threads_.reserve(numThreads);
+  // all the workers are there before any thread looks at the others
+  if(mode_ == Mode::WorkStealing)
+  {
+    workers_.clear();
+    for(int i = 0; i < numThreads; i++)
+      workers_.emplace_back(new Worker(this, i));
+  }
   for(int i = 0; i < numThreads; i++)
   {
     char id[32]; // store thread index 
     snprintf(id, sizeof(id), "%d", i+1);
     // threads_ is of type vector<unique_ptr<Thread>>
-    auto f = [this](){this->runInThread();};
+    Worker* w = mode_ == Mode::WorkStealing ? workers_[i].get() : NULL;
+    auto f = [this, w](){ if(w) current_ = w; this->runInThread();};
     threads_.emplace_back(new Thread(f, name_+id));
     // threads_.emplace_back(new Thread(
       // std::bind(&ThreadPool::runInThread, this), name_+id));
@@ -60,8 +107,41 @@ void ThreadPool::stop()
     notEmpty_.notifyAll();
     notFull_.notifyAll();
   }
+  // a worker going to sleep looks at running_ after it is in idle_
+  {
+    MutexLockGuard lock(idleMutex_);
+    for(Worker* w : idle_)
+    {
+      w->state.store(kNotified, std::memory_order_release);
+      futexWake(&w->state, 1);
+    }
+    idle_.clear();
+    idleCount_ = 0;
+  }
   for(auto& t : threads_)
     t->join();
+  // the tasks left don't run
+  std::deque<Task> left;
+  {
+    MutexLockGuard lock(mutex_);
+    left.swap(queue_);
+    queued_ = 0;
+  }
+  for(Task& task : left) drop(task);
+  for(auto& w : workers_)
+  {
+    while(Task* task = w->deque.pop())
+    {
+      drop(*task);
+      delete task;
+    }
+  }
+}
+
+// a task of a future fails it, its get() would wait for good
+void ThreadPool::drop(Task& task)
+{
+  if(detail::Job* job = task.target<detail::Job>()) job->stage->abandon();
 }
 
 // get the thread running
@@ -73,6 +153,11 @@ void ThreadPool::runInThread()
   try
   {
     if(threadInitCB) threadInitCB();
+    if(current_ && current_->pool == this)
+    {
+      runWorker(current_);
+      return;
+    }
     while(running_)
     {
       Task task(take());
@@ -123,37 +208,235 @@ ThreadPool::Task ThreadPool::take()
   return task;
 }
 
+void ThreadPool::runWorker(Worker* w)
+{
+  while(running_)
+  {
+    std::unique_ptr<Task> task(findTask(w));
+    if(task) (*task)();
+    else sleep(w);
+  }
+}
+
+// its own deque first, the newest task there. then a batch from the
+// shared queue, then the oldest task of another worker
+ThreadPool::Task* ThreadPool::findTask(Worker* w)
+{
+  Task* task = w->deque.pop();
+  if(task) return task;
+  if(queued_.load(std::memory_order_relaxed) > 0 && (task = takeBatch(w))) return task;
+  // steal() gives up when another thief is faster, so twice around
+  size_t n = workers_.size();
+  for(int round = 0; round < 2; ++round)
+  {
+    size_t start = w->rand() % n;
+    for(size_t i = 0; i < n; ++i)
+    {
+      Worker* victim = workers_[(start + i) % n].get();
+      if(victim != w && (task = victim->deque.steal())) return task;
+    }
+  }
+  return NULL;
+}
+
+// a fair share of the shared queue, kBatch at most. the first one is
+// run right away, the rest go to the deque for this worker to pop and
+// the others to steal, one lock for all of them
+ThreadPool::Task* ThreadPool::takeBatch(Worker* w)
+{
+  Task batch[kBatch];
+  size_t n;
+  {
+    MutexLockGuard lock(mutex_);
+    n = std::min(kBatch, queue_.size() / workers_.size() + 1);
+    n = std::min(n, queue_.size());
+    for(size_t i = 0; i < n; ++i)
+    {
+      batch[i] = std::move(queue_.front());
+      queue_.pop_front();
+    }
+    queued_.store(queue_.size(), std::memory_order_relaxed);
+    if(n > 0 && maxQueueSz_ > 0) notFull_.notifyAll();
+  }
+  if(n == 0) return NULL;
+  // the oldest is popped first
+  for(size_t i = n - 1; i > 0; --i)
+    w->deque.push(new Task(std::move(batch[i])));
+  if(n > 1 && idleCount_.load(std::memory_order_relaxed) > 0) wakeOne();
+  return new Task(std::move(batch[0]));
+}
+
+// in idle_ before it looks for work the last time, so whoever adds
+// work after that sees it there and wakes it
+void ThreadPool::sleep(Worker* w)
+{
+  w->state.store(kSleeping, std::memory_order_relaxed);
+  {
+    MutexLockGuard lock(idleMutex_);
+    idle_.push_back(w);
+    idleCount_.fetch_add(1);
+  }
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  if(!running_ || hasWork())
+  {
+    // unless a wakeOne() has taken it out already
+    MutexLockGuard lock(idleMutex_);
+    auto it = std::find(idle_.begin(), idle_.end(), w);
+    if(it != idle_.end())
+    {
+      idle_.erase(it);
+      idleCount_.fetch_sub(1);
+    }
+    w->state.store(kAwake, std::memory_order_relaxed);
+    return;
+  }
+  while(w->state.load(std::memory_order_acquire) == kSleeping)
+    futexWait(&w->state, kSleeping);
+}
+
+void ThreadPool::wakeOne()
+{
+  Worker* w = NULL;
+  {
+    MutexLockGuard lock(idleMutex_);
+    if(idle_.empty()) return;
+    w = idle_.back();
+    idle_.pop_back();
+    idleCount_.fetch_sub(1);
+    w->state.store(kNotified, std::memory_order_release);
+  }
+  futexWake(&w->state, 1);
+}
+
+bool ThreadPool::hasWork() const
+{
+  if(queued_.load(std::memory_order_relaxed) > 0) return true;
+  for(auto& w : workers_)
+    if(!w->deque.empty()) return true;
+  return false;
+}
+
 void ThreadPool::run(Task task)
 {
   if(threads_.empty()) // no other threads available
     task(); // current thread itself will handle the task
+  else if(mode_ == Mode::WorkStealing)
+  {
+    if(current_ && current_->pool == this)
+    {
+      // the deque has no bound, maxQueueSz_ is for the shared queue
+      current_->deque.push(new Task(std::move(task)));
+    }
+    else
+    {
+      bool dropped = false;
+      {
+        MutexLockGuard lock(mutex_);
+        while(isFull() && running_)
+          notFull_.wait();
+        if(running_)
+        {
+          queue_.push_back(std::move(task));
+          queued_.store(queue_.size(), std::memory_order_relaxed);
+        }
+        else dropped = true;
+      }
+      if(dropped)
+      {
+        drop(task); // after stop()
+        return;
+      }
+    }
+    // pairs with the fence in sleep(): either the sleeper sees the
+    // task or this sees the sleeper
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(idleCount_.load(std::memory_order_relaxed) > 0) wakeOne();
+  }
   else 
+  {
+    bool dropped = false;
+    {
+      MutexLockGuard lock(mutex_);
+      // if task queue is full, it will need to sleep
+      // on notFull_. it can be woken up at two places:
+      // 1. inside ThreadPool::take, obviously if a task
+      // is taken out of the task queue, then new task
+      // can be push to the task queue. this is the normal
+      // case.
+      // 2. inside ThreadPool::stop, upon woken up, it will
+      // immediately check the running_ flag. if it is false,
+      // the notify is sent in function stop. so function run
+      // will return.
+      while(isFull() && running_)
+        notFull_.wait();
+      if(running_)
+      {
+        assert(!isFull()); 
+        queue_.push_back(std::move(task));
+        notEmpty_.notify(); // notify that the task queue is available again
+        // it will wake up one of the threads blocking inside 
+        // ThreadPool::take
+      }
+      else dropped = true; // indicating that stop() sends the notify
+    }
+    if(dropped) drop(task);
+  }
+}
+
+void ThreadPool::runAll(std::vector<Task> tasks)
+{
+  if(tasks.empty()) return;
+  if(threads_.empty())
+  {
+    for(Task& task : tasks) task();
+    return;
+  }
+  size_t pushed = 0;
+  if(mode_ == Mode::WorkStealing && current_ && current_->pool == this)
+  {
+    for(; pushed < tasks.size(); ++pushed)
+      current_->deque.push(new Task(std::move(tasks[pushed])));
+  }
+  else
   {
     MutexLockGuard lock(mutex_);
-    // if task queue is full, it will need to sleep
-    // on notFull_. it can be woken up at two places:
-    // 1. inside ThreadPool::take, obviously if a task
-    // is taken out of the task queue, then new task
-    // can be push to the task queue. this is the normal
-    // case.
-    // 2. inside ThreadPool::stop, upon woken up, it will
-    // immediately check the running_ flag. if it is false,
-    // the notify is sent in function stop. so function run
-    // will return.
-    while(isFull() && running_)
-      notFull_.wait();
-    if(!running_) return; // indicating that stop() sends the notify
-    assert(!isFull()); 
-    queue_.push_back(std::move(task));
-    notEmpty_.notify(); // notify that the task queue is available again
-    // it will wake up one of the threads blocking inside 
-    // ThreadPool::take
+    for(; pushed < tasks.size(); ++pushed)
+    {
+      while(isFull() && running_)
+      {
+        // the threads take what is in already
+        if(mode_ == Mode::Shared) notEmpty_.notifyAll();
+        else
+        {
+          queued_.store(queue_.size(), std::memory_order_relaxed);
+          std::atomic_thread_fence(std::memory_order_seq_cst);
+          if(idleCount_.load(std::memory_order_relaxed) > 0) wakeOne();
+        }
+        notFull_.wait();
+      }
+      if(!running_) break;
+      queue_.push_back(std::move(tasks[pushed]));
+    }
+    queued_.store(queue_.size(), std::memory_order_relaxed);
+    if(mode_ == Mode::Shared) notEmpty_.notifyAll();
+  }
+  // the rest after stop()
+  for(size_t i = pushed; i < tasks.size(); ++i) drop(tasks[i]);
+  if(mode_ == Mode::WorkStealing)
+  {
+    // see run()
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    for(size_t i = 0; i < tasks.size() && idleCount_.load(std::memory_order_relaxed) > 0; ++i)
+      wakeOne();
   }
 }
 
 size_t ThreadPool::queueSz() const
 {
+  size_t n = 0;
+  for(auto& w : workers_)
+    n += w->deque.size();
   MutexLockGuard lock(mutex_);
-  return queue_.size();
+  return n + queue_.size();
 }
 } // namespace chtho
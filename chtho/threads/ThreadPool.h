@@ -9,8 +9,10 @@
 #include "base/noncopyable.h"
 #include "threads/MutexLock.h"
 #include "threads/Condition.h"
+#include "threads/Future.h"
 #include "threads/Thread.h"
 
+#include <atomic>
 #include <string>
 #include <functional> // std::function
 #include <vector>
@@ -26,11 +28,29 @@ namespace chtho
 // pool.start(5);
 // 3. give your task(a function) to pool
 // pool.run(yourTask);
+// or, for its result, see Future
+// Future<int> f = pool.submit(yourFunction);
 class ThreadPool : noncopyable
 {
 public:
   using Task = std::function<void()>; 
+  // how the tasks get to the threads
+  enum class Mode
+  {
+    // one queue and one lock for all, a thread takes one task at a
+    // time. the default
+    Shared,
+    // every thread has a deque of its own (see WorkDeque). what a
+    // task of the pool runs goes there, the thread takes it back LIFO
+    // while it is still hot in its cache, idle threads steal from the
+    // other end. tasks from outside go to the shared queue, a thread
+    // takes a batch of them at a time into its deque. idle threads
+    // sleep on a futex each, a new task wakes one of them and only
+    // if there is one
+    WorkStealing,
+  };
 private:
+  struct Worker; // see ThreadPool.cpp
   mutable MutexLock mutex_; 
   Condition notEmpty_;
   Condition notFull_;
@@ -39,9 +59,24 @@ private:
   std::vector<std::unique_ptr<Thread>> threads_;
   std::deque<Task> queue_; 
   size_t maxQueueSz_; // maximum queue size
-  bool running_;
+  std::atomic_bool running_;
+  Mode mode_;
+  // WorkStealing only
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::atomic<size_t> queued_; // queue_.size(), to look at without the lock
+  MutexLock idleMutex_;
+  std::vector<Worker*> idle_; // the sleeping workers
+  std::atomic<int> idleCount_;
+  static __thread Worker* current_; // the calling thread's
 
   void runInThread();
+  void runWorker(Worker* w);
+  Task* findTask(Worker* w);
+  Task* takeBatch(Worker* w);
+  void sleep(Worker* w);
+  void wakeOne();
+  bool hasWork() const;
+  static void drop(Task& task);
   // draw a task from task queue
   Task take();
   bool isFull() const 
@@ -53,13 +88,57 @@ public:
   explicit ThreadPool(const std::string& name = std::string("ThreadPool"));
   ~ThreadPool();
   void start(int numThreads);
+  // the tasks still queued don't run. the future of one from
+  // submit() fails with std::future_errc::broken_promise
   void stop();
+  // after stop() the task is dropped as well
   void run(Task task);
+  // the tasks in one go, with one lock for the lot
+  void runAll(std::vector<Task> tasks);
+
+  // f() on the pool, its value or exception goes to the future
+  template<typename F>
+  Future<typename std::result_of<F()>::type> submit(F f)
+  {
+    using R = typename std::result_of<F()>::type;
+    auto* s = new detail::TaskState<R, F>(std::move(f));
+    Future<R> future = detail::Access::make<R>(s);
+    run(detail::Job{ s });
+    return future;
+  }
+  // submit() for every function, with runAll()
+  template<typename F>
+  std::vector<Future<typename std::result_of<F()>::type>> submitAll(std::vector<F> fs)
+  {
+    using R = typename std::result_of<F()>::type;
+    std::vector<Future<R>> futures;
+    std::vector<Task> tasks;
+    futures.reserve(fs.size());
+    tasks.reserve(fs.size());
+    for(F& f : fs)
+    {
+      auto* s = new detail::TaskState<R, F>(std::move(f));
+      futures.push_back(detail::Access::make<R>(s));
+      tasks.push_back(detail::Job{ s });
+    }
+    runAll(std::move(tasks));
+    return futures;
+  }
   void setMaxQueueSz(int maxSize) { maxQueueSz_ = maxSize; }
+  // before start()
+  void setMode(Mode mode) { mode_ = mode; }
+  Mode mode() const { return mode_; }
   void setThreadInitCB(const Task& cb) { threadInitCB = cb; }
   const std::string& name() const { return name_; }
   size_t queueSz() const;
 };
+
+// then(pool, f) runs f on the pool
+template<>
+struct Executor<ThreadPool>
+{
+  static void post(ThreadPool* pool, std::function<void()> f) { pool->run(std::move(f)); }
+};
 } // namespace chtho
 
 
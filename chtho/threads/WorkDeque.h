@@ -0,0 +1,137 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#ifndef CHTHO_THREADS_WORKDEQUE_H
+#define CHTHO_THREADS_WORKDEQUE_H
+// The Chase-Lev work stealing deque
+
+#include "base/noncopyable.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+#include <stdint.h>
+
+namespace chtho
+{
+// a deque of T* with a single owner, who pushes and pops at the
+// bottom, LIFO, while any number of thieves steal from the top, FIFO.
+// the owner's operations are a few plain loads and stores, only
+// taking the last element races with the thieves and costs a CAS.
+// the array grows when it is full, the arrays it has outgrown are kept
+// until the deque goes, a thief may still be reading one.
+// after Le, Pop, Cohen, Zappa Nardelli, "Correct and Efficient
+// Work-Stealing for Weak Memory Models", PPoPP 2013
+template<typename T>
+class WorkDeque : noncopyable
+{
+private:
+  class Array
+  {
+  private:
+    const int64_t mask_;
+    std::unique_ptr<std::atomic<T*>[]> buf_;
+  public:
+    explicit Array(int64_t size) : mask_(size - 1), buf_(new std::atomic<T*>[size]) {}
+    int64_t size() const { return mask_ + 1; }
+    T* get(int64_t i) const { return buf_[i & mask_].load(std::memory_order_relaxed); }
+    void put(int64_t i, T* x) { buf_[i & mask_].store(x, std::memory_order_relaxed); }
+    Array* grow(int64_t bottom, int64_t top) const
+    {
+      Array* a = new Array(size() * 2);
+      for(int64_t i = top; i < bottom; ++i) a->put(i, get(i));
+      return a;
+    }
+  };
+
+  char pad0_[64];
+  std::atomic<int64_t> top_; // the thieves'
+  char pad1_[64];
+  std::atomic<int64_t> bottom_; // the owner's
+  std::atomic<Array*> array_;
+  std::vector<std::unique_ptr<Array>> arrays_; // the current one last
+  char pad2_[64];
+
+public:
+  // size is rounded up to a power of two
+  explicit WorkDeque(int64_t size = 256)
+    : top_(0), bottom_(0)
+  {
+    int64_t n = 2;
+    while(n < size) n <<= 1;
+    arrays_.emplace_back(new Array(n));
+    array_.store(arrays_.back().get(), std::memory_order_relaxed);
+  }
+
+  // owner
+  void push(T* x)
+  {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_acquire);
+    Array* a = array_.load(std::memory_order_relaxed);
+    if(b - t > a->size() - 1)
+    {
+      a = a->grow(b, t);
+      arrays_.emplace_back(a);
+      array_.store(a, std::memory_order_release);
+    }
+    a->put(b, x);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom_.store(b + 1, std::memory_order_relaxed);
+  }
+
+  // owner, the one pushed last, NULL if there is none
+  T* pop()
+  {
+    int64_t b = bottom_.load(std::memory_order_relaxed) - 1;
+    Array* a = array_.load(std::memory_order_relaxed);
+    bottom_.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    if(t > b)
+    {
+      bottom_.store(b + 1, std::memory_order_relaxed);
+      return NULL;
+    }
+    T* x = a->get(b);
+    if(t == b)
+    {
+      // the last one, a thief may be taking it as well
+      if(!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+          std::memory_order_relaxed))
+        x = NULL;
+      bottom_.store(b + 1, std::memory_order_relaxed);
+    }
+    return x;
+  }
+
+  // any thread, the one pushed first. NULL if there is none or
+  // another thread got it first
+  T* steal()
+  {
+    int64_t t = top_.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom_.load(std::memory_order_acquire);
+    if(t >= b) return NULL;
+    Array* a = array_.load(std::memory_order_acquire);
+    T* x = a->get(t);
+    if(!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+        std::memory_order_relaxed))
+      return NULL;
+    return x;
+  }
+
+  // any thread, a snapshot
+  int64_t size() const
+  {
+    int64_t b = bottom_.load(std::memory_order_relaxed);
+    int64_t t = top_.load(std::memory_order_relaxed);
+    return b > t ? b - t : 0;
+  }
+  bool empty() const { return size() == 0; }
+};
+} // namespace chtho
+#endif // !CHTHO_THREADS_WORKDEQUE_H
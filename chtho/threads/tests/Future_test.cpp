@@ -0,0 +1,266 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/threads/ThreadPool.h"
+#include "chtho/threads/CountDownLatch.h"
+#include "chtho/threads/CurrentThread.h"
+#include "chtho/threads/Thread.h"
+
+#include <assert.h>
+#include <atomic>
+#include <stdexcept>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+#include <unistd.h> // usleep
+
+using namespace chtho;
+
+// every operator new of the test counts. out of line, otherwise gcc
+// sees free() on what it takes for operator new's block
+std::atomic<int> g_news(0);
+
+__attribute__((noinline)) void* operator new(size_t size)
+{
+  ++g_news;
+  void* p = malloc(size);
+  if(!p) throw std::bad_alloc();
+  return p;
+}
+__attribute__((noinline)) void operator delete(void* p) noexcept { free(p); }
+__attribute__((noinline)) void operator delete(void* p, size_t) noexcept { free(p); }
+
+// anything with runInLoop() is an executor, as EventLoop is
+class Loop : noncopyable
+{
+private:
+  ThreadPool pool_;
+  std::atomic<int> tid_;
+public:
+  Loop() : pool_("loop"), tid_(0)
+  {
+    pool_.start(1);
+    CountDownLatch latch(1);
+    pool_.run([this, &latch](){ tid_ = CurrentThread::tid(); latch.countDown(); });
+    latch.wait();
+  }
+  void runInLoop(std::function<void()> f) { pool_.run(std::move(f)); }
+  int tid() const { return tid_; }
+};
+
+void testSubmit(ThreadPool& pool)
+{
+  Future<int> f = pool.submit([](){ return 6 * 7; });
+  assert(f.valid());
+  assert(f.get() == 42);
+  assert(!f.valid());
+
+  Future<void> v = pool.submit([](){});
+  v.get();
+
+  Future<std::string> s = pool.submit([](){ return std::string(100, 'x'); });
+  assert(s.get().size() == 100);
+}
+
+// the stages run one after the other, the last on the loop
+void testThen(ThreadPool& pool, Loop& loop)
+{
+  std::atomic<int> tid(0);
+  Future<std::string> f = pool.submit([](){ return 20; })
+    .then([](int x){ return x + 1; })
+    .then(&pool, [](int x){ return x * 2; })
+    .then(&loop, [&tid](int x)
+    {
+      tid = CurrentThread::tid();
+      return std::to_string(x);
+    });
+  assert(f.get() == "42");
+  assert(tid == loop.tid());
+
+  // on a future that is done already it runs at once, here
+  Promise<int> p;
+  p.setValue(1);
+  int tidHere = CurrentThread::tid();
+  Future<int> g = p.future().then([&tid](int x)
+  {
+    tid = CurrentThread::tid();
+    return x + 1;
+  });
+  assert(g.ready());
+  assert(tid == tidHere);
+  assert(g.get() == 2);
+
+  Future<void> v = pool.submit([](){}).then([](){ return 3; }).then([](int){});
+  v.get();
+}
+
+// an exception skips the stages after it and comes out of get()
+void testError(ThreadPool& pool)
+{
+  std::atomic<int> ran(0);
+  Future<int> f = pool.submit([]() -> int { throw std::runtime_error("oops"); })
+    .then([&ran](int x){ ++ran; return x; });
+  bool caught = false;
+  try
+  {
+    f.get();
+  }
+  catch(const std::runtime_error& e)
+  {
+    caught = std::string(e.what()) == "oops";
+  }
+  assert(caught);
+  assert(ran == 0);
+
+  Future<int> g;
+  {
+    Promise<int> p;
+    g = p.future();
+  }
+  caught = false;
+  try
+  {
+    g.get();
+  }
+  catch(const std::future_error& e)
+  {
+    caught = e.code() == std::future_errc::broken_promise;
+  }
+  assert(caught);
+}
+
+void testAll(ThreadPool& pool, Loop& loop)
+{
+  std::vector<std::function<int()>> fs;
+  for(int i = 0; i < 1000; ++i) fs.push_back([i](){ return i * i; });
+  std::vector<Future<int>> futures = pool.submitAll(std::move(fs));
+  assert(futures.size() == 1000);
+  std::vector<int> values = whenAll(futures).get();
+  assert(values.size() == 1000);
+  for(int i = 0; i < 1000; ++i) assert(values[i] == i * i);
+
+  std::atomic<int> count(0);
+  std::vector<Future<void>> voids;
+  for(int i = 0; i < 100; ++i) voids.push_back(pool.submit([&count](){ ++count; }));
+  CountDownLatch latch(1);
+  whenAll(voids).then(&loop, [&](){ latch.countDown(); });
+  latch.wait();
+  assert(count == 100);
+
+  std::vector<Future<int>> none;
+  assert(whenAll(none).get().empty());
+
+  std::vector<Future<int>> some;
+  some.push_back(pool.submit([](){ return 1; }));
+  some.push_back(pool.submit([]() -> int { throw std::logic_error("bad"); }));
+  bool caught = false;
+  try
+  {
+    whenAll(some).get();
+  }
+  catch(const std::logic_error&)
+  {
+    caught = true;
+  }
+  assert(caught);
+}
+
+bool broken(Future<int>& f)
+{
+  try
+  {
+    f.get();
+  }
+  catch(const std::future_error& e)
+  {
+    return e.code() == std::future_errc::broken_promise;
+  }
+  return false;
+}
+
+// the futures of the tasks a pool drops fail instead of hanging
+void testDropped(ThreadPool::Mode mode)
+{
+  ThreadPool pool("dropping");
+  pool.setMode(mode);
+  pool.start(1);
+  CountDownLatch started(1), release(1);
+  Future<int> busy = pool.submit([&](){ started.countDown(); release.wait(); return 1; });
+  started.wait();
+  // queued behind the busy one when stop() comes, and one of them a
+  // continuation on the pool
+  std::vector<Future<int>> queued;
+  for(int i = 0; i < 10; ++i) queued.push_back(pool.submit([i](){ return i; }));
+  Future<int> next = pool.submit([](){ return 1; }).then(&pool, [](int x){ return x + 1; });
+  Thread stopper([&pool](){ pool.stop(); }, "stopper");
+  stopper.start();
+  // once stop() has begun a new task is dropped at once
+  for(;;)
+  {
+    Future<int> probe = pool.submit([](){ return 0; });
+    if(probe.ready()) break;
+    usleep(1000);
+  }
+  release.countDown();
+  stopper.join();
+  assert(busy.get() == 1);
+  for(auto& f : queued) assert(broken(f));
+  assert(broken(next));
+
+  // submitted after stop()
+  Future<int> late = pool.submit([](){ return 1; });
+  assert(broken(late));
+  std::vector<std::function<int()>> fs(3, [](){ return 1; });
+  std::vector<Future<int>> lates = pool.submitAll(std::move(fs));
+  for(auto& f : lates) assert(broken(f));
+}
+
+// once the cache of the thread is warm, a chain of stages doesn't
+// allocate
+void testNoAlloc()
+{
+  for(int round = 0; round < 3; ++round)
+  {
+    int news = g_news;
+    Promise<int> p;
+    Future<int> f = p.future()
+      .then([](int x){ return x + 1; })
+      .then([](int x){ return x * 2; })
+      .then([](int x){ return x - 1; });
+    p.setValue(1);
+    assert(f.get() == 3);
+    if(round > 0) assert(g_news == news);
+  }
+}
+
+int main()
+{
+  Loop loop;
+  {
+    ThreadPool pool("shared");
+    pool.start(4);
+    testSubmit(pool);
+    testThen(pool, loop);
+    testError(pool);
+    testAll(pool, loop);
+    pool.stop();
+  }
+  {
+    ThreadPool pool("stealing");
+    pool.setMode(ThreadPool::Mode::WorkStealing);
+    pool.start(4);
+    testSubmit(pool);
+    testThen(pool, loop);
+    testError(pool);
+    testAll(pool, loop);
+    pool.stop();
+  }
+  testDropped(ThreadPool::Mode::Shared);
+  testDropped(ThreadPool::Mode::WorkStealing);
+  testNoAlloc();
+  printf("all passed\n");
+}
@@ -0,0 +1,90 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/threads/ThreadPool.h"
+#include "chtho/threads/CountDownLatch.h"
+#include "chtho/time/Timestamp.h"
+
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+
+using namespace chtho;
+
+// a few hundred ns of work, so the scheduling is what is measured
+int work(int seed)
+{
+  volatile int x = seed;
+  for(int i = 0; i < 200; ++i) x = x * 31 + i;
+  return x;
+}
+
+// tasks submitted from outside, one at a time
+double external(ThreadPool::Mode mode, int threads, int tasks)
+{
+  ThreadPool pool("bench");
+  pool.setMode(mode);
+  pool.start(threads);
+  std::atomic<int> left(tasks);
+  CountDownLatch latch(1);
+  Timestamp start = Timestamp::now();
+  for(int i = 0; i < tasks; ++i)
+    pool.run([&, i]()
+    {
+      work(i);
+      if(--left == 0) latch.countDown();
+    });
+  latch.wait();
+  double secs = Timestamp::diffInSec(Timestamp::now(), start);
+  pool.stop();
+  return secs;
+}
+
+// fork style: every task below the leaves runs two more
+void forkTree(ThreadPool* pool, int depth, std::atomic<int>* left, CountDownLatch* latch)
+{
+  work(depth);
+  if(depth == 0)
+  {
+    if(--*left == 0) latch->countDown();
+    return;
+  }
+  pool->run([=](){ forkTree(pool, depth - 1, left, latch); });
+  pool->run([=](){ forkTree(pool, depth - 1, left, latch); });
+}
+
+double spawned(ThreadPool::Mode mode, int threads, int depth)
+{
+  ThreadPool pool("bench");
+  pool.setMode(mode);
+  pool.start(threads);
+  std::atomic<int> left(1 << depth);
+  CountDownLatch latch(1);
+  Timestamp start = Timestamp::now();
+  pool.run([&](){ forkTree(&pool, depth, &left, &latch); });
+  latch.wait();
+  double secs = Timestamp::diffInSec(Timestamp::now(), start);
+  pool.stop();
+  return secs;
+}
+
+// usage: threadpool_bench [max threads]
+int main(int argc, char* argv[])
+{
+  int maxThreads = argc > 1 ? atoi(argv[1]) : 64;
+  const int kTasks = 1 << 18, kDepth = 17; // about as many tasks both ways
+  printf("%7s %12s %12s %12s %12s\n", "threads", "ext shared", "ext steal",
+    "fork shared", "fork steal");
+  for(int threads = 1; threads <= maxThreads; threads *= 2)
+  {
+    double es = external(ThreadPool::Mode::Shared, threads, kTasks);
+    double ew = external(ThreadPool::Mode::WorkStealing, threads, kTasks);
+    double fs = spawned(ThreadPool::Mode::Shared, threads, kDepth);
+    double fw = spawned(ThreadPool::Mode::WorkStealing, threads, kDepth);
+    // million tasks per second
+    printf("%7d %12.2f %12.2f %12.2f %12.2f\n", threads,
+      kTasks / es / 1e6, kTasks / ew / 1e6, (2 << kDepth) / fs / 1e6, (2 << kDepth) / fw / 1e6);
+  }
+}
@@ -0,0 +1,188 @@
+// Copyright (c) 2021 Qizhou Guo
+// 
+// This software is released under the MIT License.
+// https://opensource.org/licenses/MIT
+
+#include "chtho/threads/ThreadPool.h"
+#include "chtho/threads/WorkDeque.h"
+#include "chtho/threads/CountDownLatch.h"
+#include "chtho/threads/Thread.h"
+
+#include <assert.h>
+#include <atomic>
+#include <stdio.h>
+#include <unistd.h> // usleep
+#include <vector>
+
+using namespace chtho;
+
+// the owner pushes and pops, the thieves steal, every element is
+// taken exactly once
+void testDeque()
+{
+  const int kItems = 200000, kThieves = 3;
+  std::vector<int> items(kItems);
+  std::vector<std::atomic<int>> taken(kItems);
+  for(int i = 0; i < kItems; ++i) { items[i] = i; taken[i] = 0; }
+  WorkDeque<int> deque(4); // grows a few times
+  std::atomic_bool done(false);
+  std::atomic<int> stolen(0);
+  std::vector<std::unique_ptr<Thread>> thieves;
+  for(int t = 0; t < kThieves; ++t)
+  {
+    thieves.emplace_back(new Thread([&]()
+    {
+      while(!done || !deque.empty())
+      {
+        if(int* x = deque.steal())
+        {
+          ++taken[*x];
+          ++stolen;
+        }
+      }
+    }, "thief"));
+    thieves.back()->start();
+  }
+  int popped = 0;
+  for(int i = 0; i < kItems; ++i)
+  {
+    deque.push(&items[i]);
+    // take some back, newest first
+    if(i % 3 == 0)
+    {
+      if(int* x = deque.pop())
+      {
+        assert(*x <= i);
+        ++taken[*x];
+        ++popped;
+      }
+    }
+  }
+  while(int* x = deque.pop())
+  {
+    ++taken[*x];
+    ++popped;
+  }
+  done = true;
+  for(auto& t : thieves) t->join();
+  for(int i = 0; i < kItems; ++i) assert(taken[i] == 1);
+  assert(popped + stolen == kItems);
+  assert(deque.empty());
+  printf("deque: %d popped, %d stolen\n", popped, stolen.load());
+}
+
+// the tasks from outside all run, then the pool sleeps and wakes up
+// for more
+void testExternal()
+{
+  ThreadPool pool("stealing");
+  pool.setMode(ThreadPool::Mode::WorkStealing);
+  pool.start(4);
+  for(int round = 0; round < 3; ++round)
+  {
+    const int kTasks = 100000;
+    std::atomic<int> count(0);
+    CountDownLatch latch(1);
+    for(int i = 0; i < kTasks; ++i)
+      pool.run([&]()
+      {
+        if(++count == kTasks) latch.countDown();
+      });
+    latch.wait();
+    assert(count == kTasks);
+    usleep(20*1000); // all asleep again
+  }
+  pool.stop();
+}
+
+// a task of the pool spawns more, they go to its own deque and are
+// stolen by the others
+std::atomic<int> g_leaves(0);
+void spawn(ThreadPool* pool, int depth, CountDownLatch* latch)
+{
+  if(depth == 0)
+  {
+    g_leaves++;
+    latch->countDown();
+    return;
+  }
+  pool->run([=](){ spawn(pool, depth - 1, latch); });
+  pool->run([=](){ spawn(pool, depth - 1, latch); });
+}
+
+void testSpawn()
+{
+  ThreadPool pool("stealing");
+  pool.setMode(ThreadPool::Mode::WorkStealing);
+  pool.start(4);
+  const int kDepth = 16;
+  CountDownLatch latch(1 << kDepth);
+  g_leaves = 0;
+  pool.run([&](){ spawn(&pool, kDepth, &latch); });
+  latch.wait();
+  assert(g_leaves == 1 << kDepth);
+  pool.stop();
+}
+
+// a full shared queue makes run() wait until the workers take from it
+void testMaxQueue()
+{
+  ThreadPool pool("stealing");
+  pool.setMode(ThreadPool::Mode::WorkStealing);
+  pool.setMaxQueueSz(4);
+  pool.start(2);
+  const int kTasks = 10000;
+  std::atomic<int> count(0);
+  CountDownLatch latch(kTasks);
+  for(int i = 0; i < kTasks; ++i)
+  {
+    pool.run([&](){ ++count; latch.countDown(); });
+    assert(pool.queueSz() <= 4 + 2 * 32);
+  }
+  latch.wait();
+  assert(count == kTasks);
+  pool.stop();
+}
+
+// stop() returns with tasks left, they don't run and don't leak
+void testStop()
+{
+  ThreadPool pool("stealing");
+  pool.setMode(ThreadPool::Mode::WorkStealing);
+  pool.start(2);
+  std::atomic<int> count(0);
+  CountDownLatch started(1);
+  pool.run([&]()
+  {
+    for(int i = 0; i < 1000; ++i) pool.run([&](){ usleep(100); ++count; });
+    started.countDown();
+  });
+  started.wait();
+  pool.stop();
+  assert(count < 1000);
+  pool.run([](){}); // after stop(), nothing happens
+  printf("stop: %d of 1000 ran\n", count.load());
+}
+
+// with no threads run() runs the task itself, as in Shared mode
+void testNoThreads()
+{
+  ThreadPool pool("stealing");
+  pool.setMode(ThreadPool::Mode::WorkStealing);
+  pool.start(0);
+  int n = 0;
+  pool.run([&](){ ++n; });
+  assert(n == 1);
+  pool.stop();
+}
+
+int main()
+{
+  testDeque();
+  testExternal();
+  testSpawn();
+  testMaxQueue();
+  testStop();
+  testNoThreads();
+  printf("all passed\n");
+}
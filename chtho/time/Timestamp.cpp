@@ -5,8 +5,7 @@
 
 #include "Timestamp.h"
 
-#include <time.h> // struct timeval
-#include <sys/time.h> // gettimeofday
+#include <time.h> // clock_gettime
 
 namespace chtho
 {
@@ -14,14 +13,19 @@ namespace chtho
 
 Timestamp Timestamp::now()
 {
-  // contains seconds and micro seconds 
-  struct timeval tv;
-  // Get the current time of day and timezone information,
-  // putting it into *TV and *TZ. If TZ is NULL, *TZ is not filled.
-  // Returns 0 on success, -1 on errors.
-  gettimeofday(&tv, NULL);
-  int64_t secs = tv.tv_sec;
-  return Timestamp(secs * usPerSec + tv.tv_usec);
+  // seconds and nanoseconds, served by the vDSO without a syscall
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  int64_t secs = ts.tv_sec;
+  return Timestamp(secs * usPerSec + ts.tv_nsec / 1000);
+}
+
+Timestamp Timestamp::nowCoarse()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_REALTIME_COARSE, &ts);
+  int64_t secs = ts.tv_sec;
+  return Timestamp(secs * usPerSec + ts.tv_nsec / 1000);
 }
 
 std::string Timestamp::toString() const 
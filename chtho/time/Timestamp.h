@@ -23,6 +23,10 @@ public:
   explicit Timestamp(int64_t usSinceE)
     : usSinceE_(usSinceE) {}
   static Timestamp now(); // get current time 
+  // CLOCK_REALTIME_COARSE, the time of the last tick (1 to 4 ms old)
+  // read without touching the clock source, for callers that don't
+  // need better
+  static Timestamp nowCoarse();
 
   int64_t usSinceE() const { return usSinceE_; }
   time_t secsSinceE() const 